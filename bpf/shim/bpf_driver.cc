@@ -0,0 +1,323 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "bpf/shim/bpf_driver.h"
+
+#include "absl/random/distributions.h"
+#include "absl/strings/str_format.h"
+#include "lib/base.h"
+
+namespace ghost {
+
+namespace {
+
+// The driver that the shim's bpf_ghost_*() hooks report to.
+BpfSchedDriver* driver;
+// Cpus that bpf asked to reschedule during the current call into bpf.
+std::vector<bool>* resched;
+
+long ReschedCpu(u32 cpu, u64 cpu_seqnum) {
+  if (cpu >= resched->size()) return -ERANGE;
+  (*resched)[cpu] = true;
+  return 0;
+}
+
+}  // namespace
+
+BpfSchedDriver::BpfSchedDriver(const BpfSchedProgram& program,
+                               const BpfDriverOptions& options)
+    : program_(program),
+      options_(options),
+      gen_(options.seed),
+      cpus_(options.nr_cpus) {
+  CHECK_EQ(driver, nullptr);
+  CHECK_GT(options_.nr_cpus, 0);
+  driver = this;
+  resched = new std::vector<bool>(options_.nr_cpus);
+
+  bpf_shim_reset();
+  bpf_shim_set_run_gtid_hook(RunGtid);
+  bpf_shim_set_resched_cpu_hook(ReschedCpu);
+
+  // gtid 0 means "no task" to bpf, so start at 1.
+  tasks_.reserve(options_.nr_tasks);
+  for (int i = 0; i < options_.nr_tasks; i++) {
+    tasks_.push_back({.gtid = static_cast<uint64_t>(i) + 1});
+  }
+
+  // Like Discovery: every task is announced before bpf may schedule.
+  for (int i = 0; i < options_.nr_tasks; i++) {
+    Task* task = &tasks_[i];
+    struct bpf_ghost_msg msg = {};
+    msg.type = MSG_TASK_NEW;
+    msg.newt.gtid = task->gtid;
+    msg.newt.runnable = 1;
+    msg.newt.sw_info.index = i;
+    task->state = TaskState::kRunnable;
+    SendTaskMsg(i % options_.nr_cpus, task, msg);
+  }
+  if (program_.initialized) *program_.initialized = true;
+}
+
+BpfSchedDriver::~BpfSchedDriver() {
+  if (program_.initialized) *program_.initialized = false;
+  bpf_shim_reset();
+  delete resched;
+  resched = nullptr;
+  driver = nullptr;
+}
+
+BpfSchedDriver::Task* BpfSchedDriver::FindTask(uint64_t gtid) {
+  if (gtid == 0 || gtid > tasks_.size()) return nullptr;
+  return &tasks_[gtid - 1];
+}
+
+BpfSchedDriver::Task* BpfSchedDriver::NextRunnable() {
+  for (size_t i = 0; i < tasks_.size(); i++) {
+    Task* task = &tasks_[next_runnable_];
+    next_runnable_ = (next_runnable_ + 1) % tasks_.size();
+    if (task->state == TaskState::kRunnable) return task;
+  }
+  return nullptr;
+}
+
+// Plays the kernel's part of bpf_ghost_run_gtid().
+long BpfSchedDriver::RunGtid(u32 cpu, s64 gtid, u32 task_barrier,
+                             s32 run_flags) {
+  Task* task = driver->FindTask(gtid);
+  long err = 0;
+
+  if (!task) {
+    err = -ENOENT;
+  } else if (task->barrier != task_barrier) {
+    err = -ESTALE;
+  } else if (task->state == TaskState::kRunning) {
+    err = -EBUSY;
+  } else if (task->state != TaskState::kRunnable || driver->picked_) {
+    err = -EINVAL;
+  }
+  if (err) {
+    driver->stats_.rejected++;
+    return err;
+  }
+  driver->picked_ = task;
+  return 0;
+}
+
+void BpfSchedDriver::Send(int cpu, struct bpf_ghost_msg& msg) {
+  bpf_shim_set_cpu(cpu);
+
+  absl::Time start = MonotonicNow();
+  program_.msg_send(&msg);
+  HandlerStats& hs = stats_.msg[msg.type];
+  hs.ns += absl::ToInt64Nanoseconds(MonotonicNow() - start);
+  hs.calls++;
+}
+
+void BpfSchedDriver::SendTaskMsg(int cpu, Task* task,
+                                 struct bpf_ghost_msg& msg) {
+  msg.seqnum = ++task->barrier;
+  Send(cpu, msg);
+}
+
+void BpfSchedDriver::Pnt(int cpu) {
+  struct bpf_ghost_sched ctx = {};
+
+  if (program_.publish_next) {
+    if (Task* next = NextRunnable()) {
+      program_.publish_next(cpu, next->gtid, next->barrier);
+    }
+  }
+
+  bpf_shim_set_cpu(cpu);
+  picked_ = nullptr;
+
+  absl::Time start = MonotonicNow();
+  program_.pnt(&ctx);
+  stats_.pnt.ns += absl::ToInt64Nanoseconds(MonotonicNow() - start);
+  stats_.pnt.calls++;
+
+  if (picked_) {
+    stats_.decisions++;
+    Latch(cpu, picked_);
+    picked_ = nullptr;
+  }
+}
+
+void BpfSchedDriver::Latch(int cpu, Task* task) {
+  CpuState& cs = cpus_[cpu];
+  struct bpf_ghost_msg msg = {};
+
+  task->state = TaskState::kRunning;
+  task->cpu = cpu;
+  cs.current = task;
+  cs.seqnum++;
+
+  msg.type = MSG_TASK_LATCHED;
+  msg.latched.gtid = task->gtid;
+  msg.latched.commit_time = now_ns_;
+  msg.latched.cpu_seqnum = cs.seqnum;
+  msg.latched.cpu = cpu;
+  SendTaskMsg(cpu, task, msg);
+}
+
+void BpfSchedDriver::Stop(int cpu, Task* task, uint16_t type,
+                          TaskState state) {
+  CpuState& cs = cpus_[cpu];
+  struct bpf_ghost_msg msg = {};
+
+  task->state = state;
+  task->cpu = -1;
+  task->last_cpu = cpu;
+  cs.current = nullptr;
+
+  msg.type = type;
+  switch (type) {
+    case MSG_TASK_BLOCKED:
+      msg.blocked.gtid = task->gtid;
+      msg.blocked.cpu_seqnum = cs.seqnum;
+      msg.blocked.cpu = cpu;
+      break;
+    case MSG_TASK_YIELD:
+      msg.yield.gtid = task->gtid;
+      msg.yield.cpu_seqnum = cs.seqnum;
+      msg.yield.cpu = cpu;
+      break;
+    case MSG_TASK_PREEMPT:
+      msg.preempt.gtid = task->gtid;
+      msg.preempt.cpu_seqnum = cs.seqnum;
+      msg.preempt.cpu = cpu;
+      break;
+    default:
+      CHECK(false);
+  }
+  SendTaskMsg(cpu, task, msg);
+}
+
+void BpfSchedDriver::Wakeup(Task* task) {
+  struct bpf_ghost_msg msg = {};
+  const int waker_cpu = absl::Uniform(gen_, 0, options_.nr_cpus);
+
+  task->state = TaskState::kRunnable;
+
+  msg.type = MSG_TASK_WAKEUP;
+  msg.wakeup.gtid = task->gtid;
+  msg.wakeup.last_ran_cpu = task->last_cpu;
+  msg.wakeup.wake_up_cpu = task->last_cpu >= 0 ? task->last_cpu : waker_cpu;
+  msg.wakeup.waker_cpu = waker_cpu;
+  SendTaskMsg(waker_cpu, task, msg);
+}
+
+void BpfSchedDriver::Round() {
+  now_ns_ += options_.round_ns;
+  bpf_shim_set_time_ns(now_ns_);
+  stats_.rounds++;
+
+  for (int cpu = 0; cpu < options_.nr_cpus; cpu++) {
+    Task* task = cpus_[cpu].current;
+    if (!task) continue;
+
+    const double r = absl::Uniform(gen_, 0.0, 1.0);
+    if (r < options_.p_block) {
+      Stop(cpu, task, MSG_TASK_BLOCKED, TaskState::kBlocked);
+    } else if (r < options_.p_block + options_.p_yield) {
+      Stop(cpu, task, MSG_TASK_YIELD, TaskState::kRunnable);
+    } else if (r < options_.p_block + options_.p_yield + options_.p_preempt) {
+      Stop(cpu, task, MSG_TASK_PREEMPT, TaskState::kRunnable);
+    } else {
+      struct bpf_ghost_msg msg = {};
+      msg.type = MSG_CPU_TICK;
+      msg.cpu_tick.cpu = cpu;
+      (*resched)[cpu] = false;
+      Send(cpu, msg);
+      // bpf kicked the task off cpu.
+      if ((*resched)[cpu]) {
+        Stop(cpu, task, MSG_TASK_PREEMPT, TaskState::kRunnable);
+      }
+    }
+  }
+
+  for (int cpu = 0; cpu < options_.nr_cpus; cpu++) {
+    if (!cpus_[cpu].current) Pnt(cpu);
+  }
+
+  for (Task& task : tasks_) {
+    if (task.state == TaskState::kBlocked &&
+        absl::Bernoulli(gen_, options_.p_wakeup)) {
+      Wakeup(&task);
+    }
+  }
+}
+
+// static
+const char* BpfSchedDriver::MsgName(int type) {
+  switch (type) {
+    case MSG_TASK_DEAD:
+      return "TASK_DEAD";
+    case MSG_TASK_BLOCKED:
+      return "TASK_BLOCKED";
+    case MSG_TASK_WAKEUP:
+      return "TASK_WAKEUP";
+    case MSG_TASK_NEW:
+      return "TASK_NEW";
+    case MSG_TASK_PREEMPT:
+      return "TASK_PREEMPT";
+    case MSG_TASK_YIELD:
+      return "TASK_YIELD";
+    case MSG_TASK_DEPARTED:
+      return "TASK_DEPARTED";
+    case MSG_TASK_SWITCHTO:
+      return "TASK_SWITCHTO";
+    case MSG_TASK_AFFINITY_CHANGED:
+      return "TASK_AFFINITY_CHANGED";
+    case MSG_TASK_LATCHED:
+      return "TASK_LATCHED";
+    case MSG_CPU_TICK:
+      return "CPU_TICK";
+    case MSG_CPU_TIMER_EXPIRED:
+      return "CPU_TIMER_EXPIRED";
+    case MSG_CPU_NOT_IDLE:
+      return "CPU_NOT_IDLE";
+    default:
+      return "UNKNOWN";
+  }
+}
+
+std::string BpfSchedDriver::Report() const {
+  std::string s = absl::StrFormat("%s: %d cpus, %d tasks, %d rounds\n",
+                                  program_.name, options_.nr_cpus,
+                                  options_.nr_tasks, stats_.rounds);
+
+  auto line = [&s](const char* name, const HandlerStats& hs) {
+    absl::StrAppendFormat(&s, "  %-24s %10d calls %8.1f ns/call\n", name,
+                          hs.calls, hs.calls ? 1.0 * hs.ns / hs.calls : 0.0);
+  };
+  for (int type = 0; type <= _MSG_CPU_LAST; type++) {
+    if (stats_.msg[type].calls) line(MsgName(type), stats_.msg[type]);
+  }
+  line("pnt", stats_.pnt);
+
+  absl::StrAppendFormat(
+      &s, "  decisions: %d (%.1f%% of pnt calls), %d rejected by the kernel\n",
+      stats_.decisions,
+      stats_.pnt.calls ? 100.0 * stats_.decisions / stats_.pnt.calls : 0.0,
+      stats_.rejected);
+  if (stats_.pnt.ns) {
+    absl::StrAppendFormat(&s, "  %.0f decisions per second of pnt time\n",
+                          1e9 * stats_.decisions / stats_.pnt.ns);
+  }
+  return s;
+}
+
+}  // namespace ghost
@@ -0,0 +1,151 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GHOST_BPF_SHIM_BPF_DRIVER_H_
+#define GHOST_BPF_SHIM_BPF_DRIVER_H_
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bpf/shim/bpf_shim.h"
+
+namespace ghost {
+
+// The entry points of a ghost bpf scheduler compiled against the bpf shim.
+struct BpfSchedProgram {
+  const char* name;
+  int (*pnt)(struct bpf_ghost_sched* ctx);
+  int (*msg_send)(struct bpf_ghost_msg* msg);
+  // The program's "don't schedule yet" global, if it has one.  The driver sets
+  // it once its tasks exist, like an agent does after Discovery.
+  bool* initialized = nullptr;
+  // Plays the agent, for programs whose bpf-pnt only latches what an agent
+  // chose (e.g. EDF's next-up slots): publishes `gtid` at `barrier` as the next
+  // task for `cpu`.  If set, the driver calls it before bpf-pnt on every idle
+  // cpu that has a runnable task to offer.  It is not timed.
+  void (*publish_next)(int cpu, uint64_t gtid, uint32_t barrier) = nullptr;
+};
+
+struct BpfDriverOptions {
+  int nr_cpus = 8;
+  int nr_tasks = 64;
+  uint64_t seed = 1;
+  // Simulated time between rounds, seen through bpf_ktime_get_ns().
+  uint64_t round_ns = 10'000;
+  // Each round, what a running task does (else it gets a cpu tick) ...
+  double p_block = 0.2;
+  double p_yield = 0.1;
+  double p_preempt = 0.1;
+  // ... and the chance that a blocked task wakes up.
+  double p_wakeup = 0.5;
+};
+
+// Drives a bpf scheduler with a synthetic workload, the way the kernel would:
+// it sends task and cpu messages to bpf-msg, runs bpf-pnt on idle cpus, and
+// "latches" whatever bpf-pnt picks with bpf_ghost_run_gtid().  The driver
+// checks bpf's decisions against its own model of the tasks, rejecting them
+// the way the kernel does, and times every call into bpf.
+//
+// Uses the shim's global state, so only one driver may exist at a time.
+//
+// Example:
+//   BpfSchedDriver driver(program, BpfDriverOptions());
+//   for (int i = 0; i < 1000; i++) driver.Round();
+//   std::cout << driver.Report();
+class BpfSchedDriver {
+ public:
+  struct HandlerStats {
+    uint64_t calls = 0;
+    uint64_t ns = 0;
+  };
+
+  struct Stats {
+    // Indexed by message type.
+    HandlerStats msg[_MSG_CPU_LAST + 1];
+    HandlerStats pnt;
+    // bpf-pnt calls that latched a task ...
+    uint64_t decisions = 0;
+    // ... and calls to bpf_ghost_run_gtid() that the kernel would fail.
+    uint64_t rejected = 0;
+    uint64_t rounds = 0;
+  };
+
+  BpfSchedDriver(const BpfSchedProgram& program,
+                 const BpfDriverOptions& options);
+  ~BpfSchedDriver();
+
+  BpfSchedDriver(const BpfSchedDriver&) = delete;
+  BpfSchedDriver& operator=(const BpfSchedDriver&) = delete;
+
+  // Advances time by one round: every running task blocks, yields, is
+  // preempted or ticks, every idle cpu runs bpf-pnt, then blocked tasks may
+  // wake up.
+  void Round();
+
+  const Stats& stats() const { return stats_; }
+  void ResetStats() { stats_ = Stats(); }
+
+  // Per-handler call counts and average cost, and the decision rate.
+  std::string Report() const;
+
+  // e.g. "TASK_WAKEUP" for MSG_TASK_WAKEUP.
+  static const char* MsgName(int type);
+
+ private:
+  enum class TaskState { kBlocked, kRunnable, kRunning };
+
+  struct Task {
+    uint64_t gtid;
+    TaskState state = TaskState::kBlocked;
+    uint32_t barrier = 0;
+    int cpu = -1;
+    int last_cpu = -1;
+  };
+
+  struct CpuState {
+    Task* current = nullptr;
+    uint64_t seqnum = 0;
+  };
+
+  static long RunGtid(u32 cpu, s64 gtid, u32 task_barrier, s32 run_flags);
+
+  Task* FindTask(uint64_t gtid);
+  // The next runnable task after the last one offered, round robin, if any.
+  Task* NextRunnable();
+  void Send(int cpu, struct bpf_ghost_msg& msg);
+  // Sends a task message, setting its seqnum to the task's new barrier.
+  void SendTaskMsg(int cpu, Task* task, struct bpf_ghost_msg& msg);
+  void Pnt(int cpu);
+  void Latch(int cpu, Task* task);
+  void Stop(int cpu, Task* task, uint16_t type, TaskState state);
+  void Wakeup(Task* task);
+
+  const BpfSchedProgram program_;
+  const BpfDriverOptions options_;
+  std::mt19937_64 gen_;
+  std::vector<Task> tasks_;
+  std::vector<CpuState> cpus_;
+  uint64_t now_ns_ = 0;
+  // The task bpf-pnt picked on the cpu being scheduled, if any.
+  Task* picked_ = nullptr;
+  // Where NextRunnable() resumes its search.
+  size_t next_runnable_ = 0;
+  Stats stats_;
+};
+
+}  // namespace ghost
+
+#endif  // GHOST_BPF_SHIM_BPF_DRIVER_H_
@@ -0,0 +1,413 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bpf/shim/bpf_shim.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_SHIM_MAPS 64
+
+/*
+ * Hash maps use open addressing with linear probing over twice as many slots
+ * as max_entries.  Values live in their slot, so pointers returned by lookup
+ * stay valid until the element is deleted, like with a real (preallocated) bpf
+ * hash map.
+ */
+enum slot_state {
+	SLOT_EMPTY = 0,
+	SLOT_USED,
+	SLOT_DELETED,
+};
+
+struct shim_map {
+	void *def;		/* the map's definition, identifying it */
+	int type;
+	u32 max_entries;
+	size_t key_size;
+	size_t value_size;
+
+	/* Array: max_entries values.  Hash: slots.  Queue: a ring. */
+	char *data;
+	/* Hash only. */
+	u32 nr_slots;
+	u32 nr_used;
+	/* Queue only. */
+	u32 head;
+	u32 len;
+};
+
+static pthread_mutex_t shim_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct shim_map shim_maps[MAX_SHIM_MAPS];
+static int nr_shim_maps;
+
+static __thread u32 shim_cpu;
+static u64 shim_time_ns;
+static bpf_shim_run_gtid_fn shim_run_gtid;
+static bpf_shim_resched_cpu_fn shim_resched_cpu;
+
+/* Map values are cache line aligned, so tests see the kernel's false sharing. */
+static void *xcalloc(size_t n, size_t size)
+{
+	void *p;
+
+	if (posix_memalign(&p, 64, n * size)) {
+		fprintf(stderr, "bpf_shim: out of memory\n");
+		abort();
+	}
+	memset(p, 0, n * size);
+	return p;
+}
+
+static size_t hash_slot_size(const struct shim_map *m)
+{
+	return sizeof(u64) + m->key_size + m->value_size;
+}
+
+/* Finds (or creates) the backing storage of `def`.  Called with shim_lock. */
+static struct shim_map *get_map(void *def, int type, u32 max_entries,
+				size_t key_size, size_t value_size)
+{
+	struct shim_map *m;
+	int i;
+
+	for (i = 0; i < nr_shim_maps; i++) {
+		if (shim_maps[i].def == def)
+			return &shim_maps[i];
+	}
+	if (nr_shim_maps == MAX_SHIM_MAPS) {
+		fprintf(stderr, "bpf_shim: too many maps\n");
+		abort();
+	}
+
+	m = &shim_maps[nr_shim_maps];
+	m->def = def;
+	m->type = type;
+	m->max_entries = max_entries;
+	m->key_size = key_size;
+	m->value_size = value_size;
+	switch (type) {
+	case BPF_MAP_TYPE_ARRAY:
+	case BPF_MAP_TYPE_QUEUE:
+		m->data = xcalloc(max_entries, value_size);
+		break;
+	case BPF_MAP_TYPE_HASH:
+		m->nr_slots = 2 * max_entries;
+		m->data = xcalloc(m->nr_slots, hash_slot_size(m));
+		break;
+	default:
+		fprintf(stderr, "bpf_shim: unsupported map type %d\n", type);
+		abort();
+	}
+	/* Publish the map to find_array(). */
+	__atomic_store_n(&nr_shim_maps, nr_shim_maps + 1, __ATOMIC_RELEASE);
+	return m;
+}
+
+/*
+ * Returns the array map `def` if it exists, without shim_lock.  Array storage
+ * never moves, so like in the kernel, concurrent lookups don't serialize.
+ */
+static struct shim_map *find_array(void *def)
+{
+	int nr = __atomic_load_n(&nr_shim_maps, __ATOMIC_ACQUIRE);
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (shim_maps[i].def == def)
+			return &shim_maps[i];
+	}
+	return NULL;
+}
+
+static u64 *hash_slot(const struct shim_map *m, u32 i)
+{
+	return (u64 *)(m->data + (size_t)i * hash_slot_size(m));
+}
+
+static void *slot_key(u64 *slot)
+{
+	return slot + 1;
+}
+
+static void *slot_value(const struct shim_map *m, u64 *slot)
+{
+	return (char *)(slot + 1) + m->key_size;
+}
+
+/* FNV-1a */
+static u32 hash_key(const void *key, size_t size)
+{
+	const unsigned char *p = key;
+	u32 h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		h ^= p[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/*
+ * Returns the slot holding `key`, or NULL.  If `free_slot` is set, it gets the
+ * first reusable slot on the probe sequence.
+ */
+static u64 *hash_find(const struct shim_map *m, const void *key,
+		      u64 **free_slot)
+{
+	u32 i = hash_key(key, m->key_size) % m->nr_slots;
+	u32 n;
+
+	if (free_slot)
+		*free_slot = NULL;
+	for (n = 0; n < m->nr_slots; n++, i = (i + 1) % m->nr_slots) {
+		u64 *slot = hash_slot(m, i);
+
+		switch (*slot) {
+		case SLOT_EMPTY:
+			if (free_slot && !*free_slot)
+				*free_slot = slot;
+			return NULL;
+		case SLOT_DELETED:
+			if (free_slot && !*free_slot)
+				*free_slot = slot;
+			break;
+		case SLOT_USED:
+			if (!memcmp(slot_key(slot), key, m->key_size))
+				return slot;
+			break;
+		}
+	}
+	return NULL;
+}
+
+void *bpf_shim_map_lookup(void *map, int type, u32 max_entries,
+			  size_t key_size, size_t value_size, const void *key)
+{
+	struct shim_map *m;
+	void *ret = NULL;
+
+	if (type == BPF_MAP_TYPE_ARRAY) {
+		u32 idx = *(const u32 *)key;
+
+		m = find_array(map);
+		if (m) {
+			if (idx < max_entries)
+				ret = m->data + (size_t)idx * value_size;
+			return ret;
+		}
+	}
+
+	pthread_mutex_lock(&shim_lock);
+	m = get_map(map, type, max_entries, key_size, value_size);
+	if (type == BPF_MAP_TYPE_ARRAY) {
+		u32 idx = *(const u32 *)key;
+
+		if (idx < max_entries)
+			ret = m->data + (size_t)idx * value_size;
+	} else {
+		u64 *slot = hash_find(m, key, NULL);
+
+		if (slot)
+			ret = slot_value(m, slot);
+	}
+	pthread_mutex_unlock(&shim_lock);
+	return ret;
+}
+
+long bpf_shim_map_update(void *map, int type, u32 max_entries,
+			 size_t key_size, size_t value_size, const void *key,
+			 const void *value, u64 flags)
+{
+	struct shim_map *m;
+	long ret = 0;
+
+	pthread_mutex_lock(&shim_lock);
+	m = get_map(map, type, max_entries, key_size, value_size);
+	if (type == BPF_MAP_TYPE_ARRAY) {
+		u32 idx = *(const u32 *)key;
+
+		if (idx >= max_entries)
+			ret = -E2BIG;
+		else if (flags == BPF_NOEXIST)
+			ret = -EEXIST;
+		else
+			memcpy(m->data + (size_t)idx * value_size, value,
+			       value_size);
+	} else {
+		u64 *free_slot;
+		u64 *slot = hash_find(m, key, &free_slot);
+
+		if (slot && flags == BPF_NOEXIST) {
+			ret = -EEXIST;
+		} else if (!slot && flags == BPF_EXIST) {
+			ret = -ENOENT;
+		} else if (!slot && (m->nr_used == max_entries || !free_slot)) {
+			ret = -E2BIG;
+		} else {
+			if (!slot) {
+				slot = free_slot;
+				*slot = SLOT_USED;
+				memcpy(slot_key(slot), key, key_size);
+				m->nr_used++;
+			}
+			memcpy(slot_value(m, slot), value, value_size);
+		}
+	}
+	pthread_mutex_unlock(&shim_lock);
+	return ret;
+}
+
+long bpf_shim_map_delete(void *map, int type, u32 max_entries,
+			 size_t key_size, size_t value_size, const void *key)
+{
+	struct shim_map *m;
+	long ret = 0;
+
+	pthread_mutex_lock(&shim_lock);
+	m = get_map(map, type, max_entries, key_size, value_size);
+	if (type == BPF_MAP_TYPE_ARRAY) {
+		/* Like the kernel, array elements can't be deleted. */
+		ret = -EINVAL;
+	} else {
+		u64 *slot = hash_find(m, key, NULL);
+
+		if (slot) {
+			*slot = SLOT_DELETED;
+			m->nr_used--;
+		} else {
+			ret = -ENOENT;
+		}
+	}
+	pthread_mutex_unlock(&shim_lock);
+	return ret;
+}
+
+long bpf_shim_map_push(void *map, u32 max_entries, size_t value_size,
+		       const void *value, u64 flags)
+{
+	struct shim_map *m;
+	long ret = 0;
+
+	pthread_mutex_lock(&shim_lock);
+	m = get_map(map, BPF_MAP_TYPE_QUEUE, max_entries, 0, value_size);
+	if (m->len == max_entries) {
+		if (flags == BPF_EXIST) {
+			/* Make room by dropping the oldest element. */
+			m->head = (m->head + 1) % max_entries;
+			m->len--;
+		} else {
+			ret = -E2BIG;
+		}
+	}
+	if (!ret) {
+		u32 tail = (m->head + m->len) % max_entries;
+
+		memcpy(m->data + (size_t)tail * value_size, value, value_size);
+		m->len++;
+	}
+	pthread_mutex_unlock(&shim_lock);
+	return ret;
+}
+
+long bpf_shim_map_pop(void *map, u32 max_entries, size_t value_size,
+		      void *value)
+{
+	struct shim_map *m;
+	long ret = 0;
+
+	pthread_mutex_lock(&shim_lock);
+	m = get_map(map, BPF_MAP_TYPE_QUEUE, max_entries, 0, value_size);
+	if (!m->len) {
+		ret = -ENOENT;
+	} else {
+		memcpy(value, m->data + (size_t)m->head * value_size,
+		       value_size);
+		m->head = (m->head + 1) % max_entries;
+		m->len--;
+	}
+	pthread_mutex_unlock(&shim_lock);
+	return ret;
+}
+
+u64 bpf_ktime_get_ns(void)
+{
+	return __atomic_load_n(&shim_time_ns, __ATOMIC_RELAXED);
+}
+
+u32 bpf_get_smp_processor_id(void)
+{
+	return shim_cpu;
+}
+
+long bpf_ghost_wake_agent(u32 cpu)
+{
+	return 0;
+}
+
+long bpf_ghost_run_gtid(s64 gtid, u32 task_barrier, s32 run_flags)
+{
+	if (!shim_run_gtid)
+		return 0;
+	return shim_run_gtid(shim_cpu, gtid, task_barrier, run_flags);
+}
+
+long bpf_ghost_resched_cpu(u32 cpu, u64 cpu_seqnum)
+{
+	if (!shim_resched_cpu)
+		return 0;
+	return shim_resched_cpu(cpu, cpu_seqnum);
+}
+
+void bpf_shim_set_cpu(u32 cpu)
+{
+	shim_cpu = cpu;
+}
+
+void bpf_shim_set_time_ns(u64 ns)
+{
+	__atomic_store_n(&shim_time_ns, ns, __ATOMIC_RELAXED);
+}
+
+void bpf_shim_set_run_gtid_hook(bpf_shim_run_gtid_fn fn)
+{
+	shim_run_gtid = fn;
+}
+
+void bpf_shim_set_resched_cpu_hook(bpf_shim_resched_cpu_fn fn)
+{
+	shim_resched_cpu = fn;
+}
+
+void bpf_shim_reset(void)
+{
+	int i;
+
+	pthread_mutex_lock(&shim_lock);
+	for (i = 0; i < nr_shim_maps; i++)
+		free(shim_maps[i].data);
+	memset(shim_maps, 0, sizeof(shim_maps));
+	nr_shim_maps = 0;
+	pthread_mutex_unlock(&shim_lock);
+
+	shim_cpu = 0;
+	bpf_shim_set_time_ns(0);
+	shim_run_gtid = NULL;
+	shim_resched_cpu = NULL;
+}
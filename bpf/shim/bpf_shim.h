@@ -0,0 +1,174 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A userspace stand-in for the kernel environment of our ghost bpf programs,
+ * so that their policy can be compiled as plain C and unit tested without a
+ * ghost kernel.
+ *
+ * A bpf program opts in by including this header instead of vmlinux.h and the
+ * libbpf headers when GHOST_BPF_SHIM is defined:
+ *
+ *   #ifdef GHOST_BPF_SHIM
+ *   #include "bpf/shim/bpf_shim.h"
+ *   #else
+ *   #include "kernel/vmlinux_ghost_5_11.h"
+ *   ...
+ *   #endif
+ *
+ * Maps keep their BTF-style definitions (SEC(".maps"), __uint(), __type()).
+ * The bpf_map_*() helpers are macros that read the map's type, max_entries and
+ * key/value sizes from its definition and hand them to the shim, which backs
+ * each map with plain memory the first time the map is used. Array, hash and
+ * queue maps are supported; they are protected by a single mutex, so tests may
+ * run a program's entry points from several threads to emulate several cpus.
+ * Array lookups skip the mutex once the map exists, as they are lock-free in
+ * the kernel.
+ *
+ * Tests control the environment (current cpu, time) and observe the ghost
+ * helpers (e.g., bpf_ghost_run_gtid()) through the bpf_shim_*() functions.
+ */
+
+#ifndef GHOST_BPF_SHIM_BPF_SHIM_H_
+#define GHOST_BPF_SHIM_BPF_SHIM_H_
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/types.h>
+
+#include "kernel/ghost_uapi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The kernel-internal names, as in vmlinux.h. */
+typedef __u8 u8;
+typedef __u16 u16;
+typedef __u32 u32;
+typedef __u64 u64;
+typedef __s32 s32;
+typedef __s64 s64;
+
+enum {
+	BPF_MAP_TYPE_HASH = 1,
+	BPF_MAP_TYPE_ARRAY = 2,
+	BPF_MAP_TYPE_QUEUE = 22,
+};
+
+enum {
+	BPF_ANY = 0,
+	BPF_NOEXIST = 1,
+	BPF_EXIST = 2,
+};
+
+#define BPF_F_MMAPABLE (1U << 10)
+
+struct bpf_ghost_sched {
+	__u8 agent_on_rq;
+	__u8 agent_runnable;
+	__u8 might_yield;
+	__u8 dont_idle;
+	__u64 next_gtid;
+};
+
+/* Backends of the bpf_map_*() macros below. */
+void *bpf_shim_map_lookup(void *map, int type, u32 max_entries,
+			  size_t key_size, size_t value_size, const void *key);
+long bpf_shim_map_update(void *map, int type, u32 max_entries,
+			 size_t key_size, size_t value_size, const void *key,
+			 const void *value, u64 flags);
+long bpf_shim_map_delete(void *map, int type, u32 max_entries,
+			 size_t key_size, size_t value_size, const void *key);
+long bpf_shim_map_push(void *map, u32 max_entries, size_t value_size,
+		       const void *value, u64 flags);
+long bpf_shim_map_pop(void *map, u32 max_entries, size_t value_size,
+		      void *value);
+
+/*
+ * The rest of the bpf program environment.  Only bpf programs define
+ * GHOST_BPF_SHIM: macros like __type() would break other (C++) code.
+ */
+#ifdef GHOST_BPF_SHIM
+
+/* The ghost helpers are provided below rather than by common.bpf.h. */
+#define GHOST_BPF 1
+
+#define SEC(name)
+#define __uint(name, val) int (*name)[val]
+#define __type(name, val) __typeof__(val) *name
+
+/*
+ * Read a map's parameters from its definition.  The macro arguments are named
+ * _m, _k, ... so they don't clash with the definition's member names.
+ */
+#define __bpf_shim_type(_m) ((int)(sizeof(*(_m)->type) / sizeof(int)))
+#define __bpf_shim_max(_m) ((u32)(sizeof(*(_m)->max_entries) / sizeof(int)))
+
+#define bpf_map_lookup_elem(_m, _k)					\
+	bpf_shim_map_lookup((_m), __bpf_shim_type(_m), __bpf_shim_max(_m), \
+			    sizeof(*(_m)->key), sizeof(*(_m)->value), (_k))
+#define bpf_map_update_elem(_m, _k, _v, _f)				\
+	bpf_shim_map_update((_m), __bpf_shim_type(_m), __bpf_shim_max(_m), \
+			    sizeof(*(_m)->key), sizeof(*(_m)->value), (_k), \
+			    (_v), (_f))
+#define bpf_map_delete_elem(_m, _k)					\
+	bpf_shim_map_delete((_m), __bpf_shim_type(_m), __bpf_shim_max(_m), \
+			    sizeof(*(_m)->key), sizeof(*(_m)->value), (_k))
+#define bpf_map_push_elem(_m, _v, _f)					\
+	bpf_shim_map_push((_m), __bpf_shim_max(_m), sizeof(*(_m)->value), \
+			  (_v), (_f))
+#define bpf_map_pop_elem(_m, _v)					\
+	bpf_shim_map_pop((_m), __bpf_shim_max(_m), sizeof(*(_m)->value), (_v))
+
+/* Messages are only interesting when debugging a test, so drop them. */
+#define bpf_printk(fmt, ...) do { } while (0)
+
+#endif  /* GHOST_BPF_SHIM */
+
+u64 bpf_ktime_get_ns(void);
+u32 bpf_get_smp_processor_id(void);
+long bpf_ghost_wake_agent(u32 cpu);
+long bpf_ghost_run_gtid(s64 gtid, u32 task_barrier, s32 run_flags);
+long bpf_ghost_resched_cpu(u32 cpu, u64 cpu_seqnum);
+
+/* Test controls. */
+
+/* Sets the cpu that the calling thread runs bpf programs on. */
+void bpf_shim_set_cpu(u32 cpu);
+/* Sets the time returned by bpf_ktime_get_ns(). */
+void bpf_shim_set_time_ns(u64 ns);
+
+/*
+ * Called by the ghost helpers with the calling thread's cpu. A NULL hook (the
+ * default) makes the helper succeed without doing anything.
+ */
+typedef long (*bpf_shim_run_gtid_fn)(u32 cpu, s64 gtid, u32 task_barrier,
+				      s32 run_flags);
+typedef long (*bpf_shim_resched_cpu_fn)(u32 cpu, u64 cpu_seqnum);
+void bpf_shim_set_run_gtid_hook(bpf_shim_run_gtid_fn fn);
+void bpf_shim_set_resched_cpu_hook(bpf_shim_resched_cpu_fn fn);
+
+/* Empties every map and restores the defaults above. */
+void bpf_shim_reset(void);
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* GHOST_BPF_SHIM_BPF_SHIM_H_ */
@@ -21,8 +21,10 @@
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/param.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "third_party/bpf/schedclasstop.h"
 #include "bpf/user/schedclasstop_bpf.skel.h"
 #include "third_party/iovisor_bcc/trace_helpers.h"
 #include "libbpf/bpf.h"
@@ -31,10 +33,6 @@
 #define handle_error(msg) \
         do { perror(msg); exit(-1); } while (0)
 
-#define SCHED_GHOST 18
-#define SCHED_AGENT 19  /* Not a real sched class */
-#define MAX_SCHED_CLASS (SCHED_AGENT + 1)
-
 static struct sched_class {
 	char *name;
 	char symbol;
@@ -72,6 +70,20 @@ static unsigned int get_nr_columns(void)
 	return w.ws_col;
 }
 
+/* Reads a per-cpu array of MAX_SCHED_CLASS times into matrix[class][cpu]. */
+static void read_class_cpu_times(int fd, unsigned int nr_cpus,
+				 uint64_t *class_cpu_times)
+{
+	for (int i = 0; i < MAX_SCHED_CLASS; i++) {
+		/*
+		 * Each lookup returns a uint64_t[nr_cpus] of the times for a given
+		 * class for all cpus.
+		 */
+		if (bpf_map_lookup_elem(fd, &i, &class_cpu_times[i * nr_cpus]))
+			handle_error("lookup");
+	}
+}
+
 static void print_class_times(int fd)
 {
 	unsigned int nr_cpus = libbpf_num_possible_cpus();
@@ -86,14 +98,7 @@ static void print_class_times(int fd)
 	if (!class_cpu_times)
 		handle_error("calloc");
 
-	for (int i = 0; i < MAX_SCHED_CLASS; i++) {
-		/*
-		 * Each lookup returns a uint64_t[nr_cpus] of the times for a given
-		 * class for all cpus.
-		 */
-		if (bpf_map_lookup_elem(fd, &i, &class_cpu_times[i * nr_cpus]))
-			handle_error("lookup");
-	}
+	read_class_cpu_times(fd, nr_cpus, class_cpu_times);
 
 	for (int c = 0; c < nr_cpus; c++) {
 		uint64_t cpu_total = 0;
@@ -145,8 +150,305 @@ static void print_class_times(int fd)
 	printf("\n");
 }
 
+static void print_rq_times(int fd)
+{
+	unsigned int nr_cpus = libbpf_num_possible_cpus();
+	uint64_t *class_cpu_times;	/* matrix[class][cpu] */
+
+	class_cpu_times = calloc(nr_cpus, sizeof(uint64_t) * MAX_SCHED_CLASS);
+	if (!class_cpu_times)
+		handle_error("calloc");
+
+	read_class_cpu_times(fd, nr_cpus, class_cpu_times);
+
+	printf("Time runnable, waiting for a cpu\n");
+	printf("------------------------------------------------\n");
+	for (int i = 0; i < MAX_SCHED_CLASS; i++) {
+		uint64_t total = 0;
+
+		for (int c = 0; c < nr_cpus; c++)
+			total += class_cpu_times[i * nr_cpus + c];
+		if (total) {
+			printf("%-10s (%c): %20f cpu-seconds\n",
+			       sched_class[i].name, sched_class[i].symbol,
+			       1.0 * total / NSEC_PER_SEC);
+		}
+	}
+	printf("\n");
+
+	free(class_cpu_times);
+}
+
+/*
+ * Daemon mode (-i) samples the maps every interval and writes a time series.
+ * A sample costs O(classes * cpus) map reads, whatever the number of tasks.
+ *
+ * Sampled times are cumulative since schedclasstop started.  class_times only
+ * has a cpu's time up to its last context switch, so we add the time since
+ * then, from cpu_currs, to the class that the cpu is running.
+ */
+struct sample {
+	uint64_t ktime_ns;	/* CLOCK_MONOTONIC, like bpf_ktime_get_ns() */
+	uint64_t realtime_ns;
+	uint64_t *class_ns;	/* matrix[class][cpu] */
+	uint64_t *rq_ns;	/* matrix[class][cpu], if tracking rq time */
+};
+
+/*
+ * The binary format (-b) is a header followed by one record per interval, all
+ * in host byte order.  Each record is followed by the interval's deltas:
+ *
+ *   uint64_t class_ns[nr_classes][nr_cpus];
+ *   uint64_t rq_ns[nr_classes][nr_cpus];	if flags & BIN_FLAG_RQ
+ */
+#define BIN_MAGIC "GHSTCLS1"
+#define BIN_VERSION 1
+#define BIN_FLAG_RQ 1
+
+struct bin_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t nr_cpus;
+	uint32_t nr_classes;
+	uint32_t flags;
+};
+
+struct bin_record {
+	uint64_t realtime_ns;
+	uint64_t interval_ns;
+};
+
+static uint64_t get_realtime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void take_sample(struct schedclasstop_bpf *obj, unsigned int nr_cpus,
+			struct cpu_curr *currs, const struct sample *prev,
+			struct sample *cur)
+{
+	size_t n = nr_cpus * MAX_SCHED_CLASS;
+	uint32_t zero = 0;
+
+	read_class_cpu_times(bpf_map__fd(obj->maps.class_times), nr_cpus,
+			     cur->class_ns);
+	if (bpf_map_lookup_elem(bpf_map__fd(obj->maps.cpu_currs), &zero,
+				currs))
+		handle_error("lookup");
+	if (cur->rq_ns) {
+		read_class_cpu_times(bpf_map__fd(obj->maps.rq_times), nr_cpus,
+				     cur->rq_ns);
+	}
+	/* After reading cpu_currs, so that no cpu started after `now`. */
+	cur->ktime_ns = get_ktime_ns();
+	cur->realtime_ns = get_realtime_ns();
+
+	for (int c = 0; c < nr_cpus; c++) {
+		if (!currs[c].start || currs[c].start > cur->ktime_ns ||
+		    currs[c].policy >= MAX_SCHED_CLASS)
+			continue;
+		cur->class_ns[currs[c].policy * nr_cpus + c] +=
+			cur->ktime_ns - currs[c].start;
+	}
+
+	/*
+	 * A context switch between our reads can make the estimate overshoot,
+	 * so keep the counters monotonic.
+	 */
+	for (size_t i = 0; i < n; i++) {
+		cur->class_ns[i] = MAX(cur->class_ns[i], prev->class_ns[i]);
+		if (cur->rq_ns)
+			cur->rq_ns[i] = MAX(cur->rq_ns[i], prev->rq_ns[i]);
+	}
+}
+
+static void write_prom_seconds(FILE *f, const char *name, const char *help,
+			       unsigned int nr_cpus, const uint64_t *ns)
+{
+	fprintf(f, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+	for (int c = 0; c < nr_cpus; c++) {
+		for (int i = 0; i < MAX_SCHED_CLASS; i++) {
+			uint64_t v = ns[i * nr_cpus + c];
+
+			if (!v)
+				continue;
+			fprintf(f, "%s{cpu=\"%d\",class=\"%s\"} %.9f\n", name, c,
+				sched_class[i].name, 1.0 * v / NSEC_PER_SEC);
+		}
+	}
+}
+
+/*
+ * Writes the Prometheus text exposition format, e.g. for node_exporter's
+ * textfile collector.  The file is replaced atomically.
+ */
+static void write_prom(const char *path, unsigned int nr_cpus,
+		       const struct sample *prev, const struct sample *cur)
+{
+	char tmp_path[PATH_MAX];
+	uint64_t interval_ns = cur->ktime_ns - prev->ktime_ns;
+	const char *name = "ghost_sched_class_utilization";
+	FILE *f;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	f = fopen(tmp_path, "w");
+	if (!f)
+		handle_error("fopen");
+
+	write_prom_seconds(f, "ghost_sched_class_cpu_seconds_total",
+			   "CPU time spent running each scheduling class.",
+			   nr_cpus, cur->class_ns);
+
+	fprintf(f, "# HELP %s Fraction of the last interval that each cpu "
+		"spent running each scheduling class.\n# TYPE %s gauge\n",
+		name, name);
+	for (int c = 0; c < nr_cpus; c++) {
+		for (int i = 0; i < MAX_SCHED_CLASS; i++) {
+			size_t idx = i * nr_cpus + c;
+
+			if (!cur->class_ns[idx])
+				continue;
+			fprintf(f, "%s{cpu=\"%d\",class=\"%s\"} %.6f\n", name, c,
+				sched_class[i].name,
+				1.0 * (cur->class_ns[idx] - prev->class_ns[idx]) /
+				MAX(interval_ns, 1));
+		}
+	}
+
+	if (cur->rq_ns) {
+		write_prom_seconds(f, "ghost_sched_class_runqueue_seconds_total",
+				   "Time that tasks of each scheduling class "
+				   "waited runnable for the cpu they ran on.",
+				   nr_cpus, cur->rq_ns);
+	}
+
+	name = "ghost_sched_class_interval_seconds";
+	fprintf(f, "# HELP %s Length of the last interval.\n"
+		"# TYPE %s gauge\n%s %.6f\n", name, name, name,
+		1.0 * interval_ns / NSEC_PER_SEC);
+
+	if (fclose(f))
+		handle_error("fclose");
+	if (rename(tmp_path, path))
+		handle_error("rename");
+}
+
+/*
+ * Opens `path` for appending records, writing the header if it is a new file.
+ * An existing file must have been written with the same parameters.
+ */
+static FILE *open_bin(const char *path, unsigned int nr_cpus, bool rq)
+{
+	struct bin_header hdr = {
+		.magic = BIN_MAGIC,
+		.version = BIN_VERSION,
+		.nr_cpus = nr_cpus,
+		.nr_classes = MAX_SCHED_CLASS,
+		.flags = rq ? BIN_FLAG_RQ : 0,
+	};
+	struct bin_header old;
+	FILE *f;
+
+	f = fopen(path, "a+");
+	if (!f)
+		handle_error("fopen");
+	if (fseek(f, 0, SEEK_END))
+		handle_error("fseek");
+	if (!ftell(f)) {
+		if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+			handle_error("fwrite");
+		return f;
+	}
+
+	rewind(f);
+	if (fread(&old, sizeof(old), 1, f) != 1 ||
+	    memcmp(&old, &hdr, sizeof(hdr))) {
+		fprintf(stderr, "%s has a different format, not appending\n",
+			path);
+		exit(-1);
+	}
+	return f;
+}
+
+static void write_bin(FILE *f, unsigned int nr_cpus, uint64_t *delta,
+		      const struct sample *prev, const struct sample *cur)
+{
+	size_t n = nr_cpus * MAX_SCHED_CLASS;
+	struct bin_record rec = {
+		.realtime_ns = cur->realtime_ns,
+		.interval_ns = cur->ktime_ns - prev->ktime_ns,
+	};
+
+	if (fwrite(&rec, sizeof(rec), 1, f) != 1)
+		handle_error("fwrite");
+	for (size_t i = 0; i < n; i++)
+		delta[i] = cur->class_ns[i] - prev->class_ns[i];
+	if (fwrite(delta, sizeof(uint64_t), n, f) != n)
+		handle_error("fwrite");
+	if (cur->rq_ns) {
+		for (size_t i = 0; i < n; i++)
+			delta[i] = cur->rq_ns[i] - prev->rq_ns[i];
+		if (fwrite(delta, sizeof(uint64_t), n, f) != n)
+			handle_error("fwrite");
+	}
+	if (fflush(f))
+		handle_error("fflush");
+}
+
+static void init_sample(struct sample *sample, unsigned int nr_cpus, bool rq)
+{
+	sample->ktime_ns = start_time_ns;
+	sample->realtime_ns = 0;
+	sample->class_ns = calloc(nr_cpus * MAX_SCHED_CLASS, sizeof(uint64_t));
+	sample->rq_ns = rq ? calloc(nr_cpus * MAX_SCHED_CLASS,
+				    sizeof(uint64_t)) : NULL;
+	if (!sample->class_ns || (rq && !sample->rq_ns))
+		handle_error("calloc");
+}
+
 static volatile bool exiting;
 
+static void run_daemon(struct schedclasstop_bpf *obj, int interval,
+		       const char *path, bool binary, bool rq)
+{
+	unsigned int nr_cpus = libbpf_num_possible_cpus();
+	struct sample samples[2], *prev = &samples[0], *cur = &samples[1];
+	struct cpu_curr *currs;
+	uint64_t *delta;
+	FILE *bin = NULL;
+
+	init_sample(prev, nr_cpus, rq);
+	init_sample(cur, nr_cpus, rq);
+	currs = calloc(nr_cpus, sizeof(struct cpu_curr));
+	delta = calloc(nr_cpus * MAX_SCHED_CLASS, sizeof(uint64_t));
+	if (!currs || !delta)
+		handle_error("calloc");
+	if (binary)
+		bin = open_bin(path, nr_cpus, rq);
+
+	while (!exiting) {
+		struct sample *tmp;
+
+		/* Cut short by a signal, for one last, partial, interval. */
+		sleep(interval);
+		take_sample(obj, nr_cpus, currs, prev, cur);
+		if (binary)
+			write_bin(bin, nr_cpus, delta, prev, cur);
+		else
+			write_prom(path, nr_cpus, prev, cur);
+
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+	}
+
+	if (bin)
+		fclose(bin);
+}
+
 static void sig_hand(int signr)
 {
 	exiting = true;
@@ -154,23 +456,74 @@ static void sig_hand(int signr)
 
 static struct sigaction sigact = {.sa_handler = sig_hand};
 
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-r] [-i SECS -o FILE [-b]]\n"
+		"  -r       also track the time tasks wait runnable\n"
+		"  -i SECS  run as a daemon, writing FILE every SECS seconds\n"
+		"  -o FILE  Prometheus text, replaced on every write\n"
+		"  -b       append binary records to FILE instead\n",
+		prog);
+}
+
 int main(int argc, char **argv)
 {
 	struct schedclasstop_bpf *obj;
-	int err;
+	const char *path = NULL;
+	bool binary = false, rq = false;
+	int interval = 0;
+	int opt, err;
+
+	while ((opt = getopt(argc, argv, "bi:o:r")) != -1) {
+		switch (opt) {
+		case 'b':
+			binary = true;
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			if (interval <= 0) {
+				fprintf(stderr, "Invalid interval: %s\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'o':
+			path = optarg;
+			break;
+		case 'r':
+			rq = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (!interval != !path || (binary && !interval)) {
+		usage(argv[0]);
+		return 1;
+	}
 
 	sigaction(SIGINT, &sigact, 0);
+	sigaction(SIGTERM, &sigact, 0);
 	err = bump_memlock_rlimit();
 	if (err) {
 		fprintf(stderr, "failed to increase rlimit: %d\n", err);
 		return -1;
 	}
 
-	obj = schedclasstop_bpf__open_and_load();
+	obj = schedclasstop_bpf__open();
 	if (!obj) {
 		fprintf(stderr, "failed to open BPF object\n");
 		return -1;
 	}
+	obj->rodata->track_rq_time = rq;
+
+	err = schedclasstop_bpf__load(obj);
+	if (err) {
+		fprintf(stderr, "failed to load BPF object\n");
+		goto cleanup;
+	}
 
 	err = schedclasstop_bpf__attach(obj);
 	if (err) {
@@ -180,12 +533,19 @@ int main(int argc, char **argv)
 
 	start_time_ns = get_ktime_ns();
 
+	if (interval) {
+		run_daemon(obj, interval, path, binary, rq);
+		goto cleanup;
+	}
+
 	printf("Ctrl-c to exit\n");
 
 	while (!exiting)
 		sleep(9999999);
 
 	print_class_times(bpf_map__fd(obj->maps.class_times));
+	if (rq)
+		print_rq_times(bpf_map__fd(obj->maps.rq_times));
 
 cleanup:
 	schedclasstop_bpf__destroy(obj);
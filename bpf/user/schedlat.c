@@ -15,11 +15,13 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/param.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "third_party/bpf/schedlat.h"
@@ -37,37 +39,297 @@ static const char *titles[] = {
 	[RUNNABLE_TO_RUN] = "Latency from Runnable to Run",
 };
 
-static void print_hists(int fd)
+/* Names of the histograms in interval dumps. */
+static const char *names[] = {
+	[RUNNABLE_TO_LATCHED] = "runnable_to_latched",
+	[LATCHED_TO_RUN] = "latched_to_run",
+	[RUNNABLE_TO_RUN] = "runnable_to_run",
+};
+
+#define NR_PERCENTILES 4
+
+static const struct {
+	double pct;
+	const char *name;
+} percentiles[NR_PERCENTILES] = {
+	{50, "p50"}, {90, "p90"}, {99, "p99"}, {99.9, "p99.9"},
+};
+
+/* The histograms of one cgroup or process, as read from the map. */
+struct lat_entry {
+	uint64_t key;
+	struct lat_hists lh;
+};
+
+/*
+ * A per-cgroup or per-process map.  `prev` is what it held at the last dump:
+ * the kernel's counters only ever grow, and each dump reports the difference.
+ */
+struct breakdown {
+	const char *scope;
+	int fd;
+	size_t max;
+	struct lat_entry *cur, *prev;
+	size_t nr_cur, nr_prev;
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-c] [-t] [-i SECS]\n"
+		"  -c       per-cgroup histograms, for up to %d cgroups\n"
+		"  -t       per-process histograms, for up to %d processes\n"
+		"  -i SECS  every SECS seconds, print that interval's histograms\n"
+		"           as JSON lines instead of a report on Ctrl-c.  id %d\n"
+		"           holds the cgroups or processes that did not fit.\n",
+		prog, MAX_CGROUPS - 1, MAX_TGIDS - 1, LAT_KEY_OTHER);
+}
+
+static uint64_t hist_count(const struct hist *hist)
+{
+	uint64_t count = 0;
+
+	for (int s = 0; s < NR_HIST_SLOTS; s++)
+		count += hist->slots[s];
+	return count;
+}
+
+/* The highest value of the slot holding the `pct` percentile. */
+static uint64_t hist_percentile(const struct hist *hist, uint64_t count,
+				double pct)
+{
+	uint64_t rank = (uint64_t)(pct / 100 * count + 0.5);
+	uint64_t seen = 0;
+
+	for (int s = 0; s < NR_HIST_SLOTS; s++) {
+		seen += hist->slots[s];
+		if (seen && seen >= rank)
+			return hist_slot_upper(s) - 1;
+	}
+	return hist_slot_upper(NR_HIST_SLOTS - 1) - 1;
+}
+
+/*
+ * The counters are 32 bits and wrap, but an interval's delta fits unless a
+ * single slot sees 2^32 samples in it.
+ */
+static void lat_hists_sub(struct lat_hists *to, const struct lat_hists *from)
+{
+	for (int i = 0; i < NR_HISTS; i++) {
+		for (int s = 0; s < NR_HIST_SLOTS; s++)
+			to->hists[i].slots[s] -= from->hists[i].slots[s];
+	}
+}
+
+static bool lat_hists_empty(const struct lat_hists *lh)
+{
+	for (int i = 0; i < NR_HISTS; i++) {
+		if (hist_count(&lh->hists[i]))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * There are NR_HISTS members of the PERCPU_ARRAY.  Each one we read is an
+ * *array[nr_cpus]* of the struct hist, one for each cpu.  This differs from a
+ * accessing an element from within a BPF program, where we only get the percpu
+ * element.
+ */
+static void read_global_hists(int fd, struct lat_hists *total)
 {
 	unsigned int nr_cpus = libbpf_num_possible_cpus();
 	struct hist *hist;
-	uint32_t total[MAX_NR_HIST_SLOTS];
 
-	/*
-	 * There are NR_HISTS members of the PERCPU_ARRAY.  Each one we read is
-	 * an *array[nr_cpus]* of the struct hist, one for each cpu.  This
-	 * differs from a accessing an element from within a BPF program, where
-	 * we only get the percpu element.
-	 */
 	hist = calloc(nr_cpus, sizeof(struct hist));
 	if (!hist)
 		handle_error("calloc");
 
+	memset(total, 0, sizeof(*total));
 	for (int i = 0; i < NR_HISTS; i++) {
 		if (bpf_map_lookup_elem(fd, &i, hist))
 			handle_error("lookup");
-		memset(total, 0, sizeof(total));
 		for (int c = 0; c < nr_cpus; c++) {
-			for (int s = 0; s < MAX_NR_HIST_SLOTS; s++)
-				total[s] += hist[c].slots[s];
+			for (int s = 0; s < NR_HIST_SLOTS; s++)
+				total->hists[i].slots[s] += hist[c].slots[s];
 		}
-		printf("\n%s:\n----------\n", titles[i]);
-		print_log2_hist(total, MAX_NR_HIST_SLOTS, "usec");
 	}
 
 	free(hist);
 }
 
+static int lat_entry_cmp(const void *a, const void *b)
+{
+	uint64_t ka = ((const struct lat_entry *)a)->key;
+	uint64_t kb = ((const struct lat_entry *)b)->key;
+
+	return ka < kb ? -1 : ka > kb;
+}
+
+/* Reads the map into bd->cur, sorted by key. */
+static void read_breakdown(struct breakdown *bd)
+{
+	uint64_t key, prev_key;
+	bool first = true;
+
+	bd->nr_cur = 0;
+	while (bd->nr_cur < bd->max &&
+	       !bpf_map_get_next_key(bd->fd, first ? NULL : &prev_key, &key)) {
+		first = false;
+		prev_key = key;
+		/* The key may have been deleted since. */
+		if (bpf_map_lookup_elem(bd->fd, &key, &bd->cur[bd->nr_cur].lh))
+			continue;
+		bd->cur[bd->nr_cur++].key = key;
+	}
+	qsort(bd->cur, bd->nr_cur, sizeof(struct lat_entry), lat_entry_cmp);
+}
+
+static void print_log2_hists(const struct lat_hists *lh)
+{
+	uint32_t total[MAX_LAT_LOG2 + 1];
+
+	for (int i = 0; i < NR_HISTS; i++) {
+		memset(total, 0, sizeof(total));
+		for (int s = 0; s < NR_HIST_SLOTS; s++) {
+			uint64_t lower = hist_slot_lower(s);
+
+			total[lower ? 63 - __builtin_clzll(lower) : 0] +=
+				lh->hists[i].slots[s];
+		}
+		printf("\n%s:\n----------\n", titles[i]);
+		print_log2_hist(total, MAX_LAT_LOG2 + 1, "usec");
+	}
+}
+
+static void print_breakdown(struct breakdown *bd)
+{
+	read_breakdown(bd);
+	printf("\nPer-%s latencies (usec), %s %d is everyone else:\n",
+	       bd->scope, bd->scope, LAT_KEY_OTHER);
+	for (size_t e = 0; e < bd->nr_cur; e++) {
+		const struct lat_entry *entry = &bd->cur[e];
+
+		for (int i = 0; i < NR_HISTS; i++) {
+			const struct hist *hist = &entry->lh.hists[i];
+			uint64_t count = hist_count(hist);
+
+			if (!count)
+				continue;
+			printf("%s %-12" PRIu64 " %-20s count %-10" PRIu64,
+			       bd->scope, entry->key, names[i], count);
+			for (int p = 0; p < NR_PERCENTILES; p++) {
+				printf(" %s %" PRIu64, percentiles[p].name,
+				       hist_percentile(hist, count,
+						       percentiles[p].pct));
+			}
+			printf("\n");
+		}
+	}
+}
+
+/* Prints one JSON line per non-empty histogram in `lh`. */
+static void dump_lat_hists(double now, double secs, const char *scope,
+			   uint64_t key, const struct lat_hists *lh)
+{
+	for (int i = 0; i < NR_HISTS; i++) {
+		const struct hist *hist = &lh->hists[i];
+		uint64_t count = hist_count(hist);
+		bool first = true;
+
+		if (!count)
+			continue;
+		printf("{\"time\":%.3f,\"interval_s\":%.3f,\"scope\":\"%s\","
+		       "\"id\":%" PRIu64 ",\"hist\":\"%s\",\"count\":%" PRIu64,
+		       now, secs, scope, key, names[i], count);
+		for (int p = 0; p < NR_PERCENTILES; p++) {
+			printf(",\"%s_us\":%" PRIu64, percentiles[p].name,
+			       hist_percentile(hist, count,
+					       percentiles[p].pct));
+		}
+		/* [lowest value in usec, count] of each non-empty slot. */
+		printf(",\"slots\":[");
+		for (int s = 0; s < NR_HIST_SLOTS; s++) {
+			if (!hist->slots[s])
+				continue;
+			printf("%s[%" PRIu64 ",%u]", first ? "" : ",",
+			       hist_slot_lower(s), hist->slots[s]);
+			first = false;
+		}
+		printf("]}\n");
+	}
+}
+
+static void dump_breakdown(struct breakdown *bd, double now, double secs)
+{
+	struct lat_entry *tmp;
+	size_t p = 0, kept = 0;
+	bool gc;
+
+	read_breakdown(bd);
+	/*
+	 * Once the map is mostly full, make room by deleting the entries that
+	 * were idle for the whole interval.  A sample that lands between our
+	 * read and the delete is lost.
+	 */
+	gc = bd->nr_cur >= bd->max * 3 / 4;
+
+	for (size_t e = 0; e < bd->nr_cur; e++) {
+		struct lat_entry *entry = &bd->cur[e];
+		struct lat_hists delta = entry->lh;
+
+		while (p < bd->nr_prev && bd->prev[p].key < entry->key)
+			p++;
+		if (p < bd->nr_prev && bd->prev[p].key == entry->key)
+			lat_hists_sub(&delta, &bd->prev[p].lh);
+
+		if (lat_hists_empty(&delta)) {
+			if (gc && entry->key != LAT_KEY_OTHER &&
+			    !bpf_map_delete_elem(bd->fd, &entry->key))
+				continue;
+		} else {
+			dump_lat_hists(now, secs, bd->scope, entry->key,
+				       &delta);
+		}
+		if (kept != e)
+			bd->cur[kept] = *entry;
+		kept++;
+	}
+	bd->nr_cur = kept;
+
+	tmp = bd->prev;
+	bd->prev = bd->cur;
+	bd->nr_prev = bd->nr_cur;
+	bd->cur = tmp;
+}
+
+static void init_breakdown(struct breakdown *bd, const char *scope,
+			   struct bpf_map *map, size_t max)
+{
+	struct lat_hists zero = {0};
+	uint64_t other = LAT_KEY_OTHER;
+
+	bd->scope = scope;
+	bd->fd = bpf_map__fd(map);
+	bd->max = max;
+	bd->cur = calloc(max, sizeof(struct lat_entry));
+	bd->prev = calloc(max, sizeof(struct lat_entry));
+	if (!bd->cur || !bd->prev)
+		handle_error("calloc");
+	bd->nr_cur = bd->nr_prev = 0;
+
+	if (bpf_map_update_elem(bd->fd, &other, &zero, BPF_NOEXIST))
+		handle_error("bpf_map_update_elem");
+}
+
+static double now_secs(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 static volatile bool exiting;
 
 static void sig_hand(int signr)
@@ -80,7 +342,33 @@ static struct sigaction sigact = {.sa_handler = sig_hand};
 int main(int argc, char **argv)
 {
 	struct schedlat_bpf *obj;
-	int err;
+	struct breakdown breakdowns[2];
+	int nr_breakdowns = 0;
+	bool by_cgroup = false, by_tgid = false;
+	int interval = 0;
+	int opt, err;
+
+	while ((opt = getopt(argc, argv, "cti:")) != -1) {
+		switch (opt) {
+		case 'c':
+			by_cgroup = true;
+			break;
+		case 't':
+			by_tgid = true;
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			if (interval <= 0) {
+				fprintf(stderr, "Invalid interval: %s\n",
+					optarg);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
 
 	sigaction(SIGINT, &sigact, 0);
 	err = bump_memlock_rlimit();
@@ -89,28 +377,85 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
-	obj = schedlat_bpf__open_and_load();
+	obj = schedlat_bpf__open();
 	if (!obj) {
 		fprintf(stderr, "failed to open BPF object\n");
 		return -1;
 	}
 
+	obj->rodata->by_cgroup = by_cgroup;
+	obj->rodata->by_tgid = by_tgid;
+	/* Disabled maps keep a single, unused, element. */
+	if (by_cgroup)
+		bpf_map__resize(obj->maps.cgroup_hists, MAX_CGROUPS);
+	if (by_tgid)
+		bpf_map__resize(obj->maps.tgid_hists, MAX_TGIDS);
+
+	err = schedlat_bpf__load(obj);
+	if (err) {
+		fprintf(stderr, "failed to load BPF object\n");
+		goto cleanup;
+	}
+
+	if (by_cgroup) {
+		init_breakdown(&breakdowns[nr_breakdowns++], "cgroup",
+			       obj->maps.cgroup_hists, MAX_CGROUPS);
+	}
+	if (by_tgid) {
+		init_breakdown(&breakdowns[nr_breakdowns++], "tgid",
+			       obj->maps.tgid_hists, MAX_TGIDS);
+	}
+
 	err = schedlat_bpf__attach(obj);
 	if (err) {
 		fprintf(stderr, "failed to attach BPF programs\n");
 		goto cleanup;
 	}
 
-	printf("Ctrl-c to exit\n");
-	while (!exiting)
-		sleep(9999999);
+	if (!interval) {
+		struct lat_hists total;
+
+		printf("Ctrl-c to exit\n");
+		while (!exiting)
+			sleep(9999999);
+
+		read_global_hists(bpf_map__fd(obj->maps.hists), &total);
+		print_log2_hists(&total);
+		for (int b = 0; b < nr_breakdowns; b++)
+			print_breakdown(&breakdowns[b]);
+	} else {
+		struct lat_hists total, prev_total = {0};
+		double last = now_secs(CLOCK_MONOTONIC);
+
+		/* stdout is for the dumps. */
+		fprintf(stderr, "Ctrl-c to exit\n");
+		while (!exiting) {
+			struct lat_hists delta;
+			double mono, secs, now;
 
-	print_hists(bpf_map__fd(obj->maps.hists));
+			/* Cut short by Ctrl-c, for one last, partial, dump. */
+			sleep(interval);
+			mono = now_secs(CLOCK_MONOTONIC);
+			secs = mono - last;
+			last = mono;
+			now = now_secs(CLOCK_REALTIME);
+
+			read_global_hists(bpf_map__fd(obj->maps.hists), &total);
+			delta = total;
+			lat_hists_sub(&delta, &prev_total);
+			prev_total = total;
+			dump_lat_hists(now, secs, "all", 0, &delta);
+			for (int b = 0; b < nr_breakdowns; b++)
+				dump_breakdown(&breakdowns[b], now, secs);
+			fflush(stdout);
+		}
+	}
 
-	printf("Exiting\n");
+	if (!interval)
+		printf("Exiting\n");
 
 cleanup:
 	schedlat_bpf__destroy(obj);
 
-	return 0;
+	return err != 0;
 }
@@ -0,0 +1,79 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks Biff's bpf programs, compiled as userspace C on top of the bpf
+// shim, under the synthetic workload of BpfSchedDriver.  Every iteration is one
+// driver round: each cpu's task blocks, yields, is preempted or ticks, and idle
+// cpus run bpf-pnt.  No ghOSt kernel is needed.
+
+#include <cstring>
+
+#include "benchmark/benchmark.h"
+#include "bpf/shim/bpf_driver.h"
+#include "experiments/microbenchmarks/bpf_sched_benchmark.h"
+#include "third_party/bpf/biff_bpf.h"
+
+extern "C" {
+extern bool initialized;
+extern uint32_t cpu_to_llc[BIFF_MAX_CPUS];
+extern uint32_t nr_llcs;
+
+int biff_pnt(struct bpf_ghost_sched* ctx);
+int biff_msg_send(struct bpf_ghost_msg* msg);
+}
+
+namespace ghost {
+namespace {
+
+// Args are the number of cpus, tasks and LLCs.
+void BM_biff(benchmark::State& state) {
+  BpfDriverOptions options;
+  options.nr_cpus = state.range(0);
+  options.nr_tasks = state.range(1);
+  const int llcs = state.range(2);
+
+  // Consecutive cpus share an LLC, as BiffScheduler would set it up.
+  memset(cpu_to_llc, 0, sizeof(cpu_to_llc));
+  for (int cpu = 0; cpu < options.nr_cpus; cpu++) {
+    cpu_to_llc[cpu] = cpu * llcs / options.nr_cpus;
+  }
+  nr_llcs = llcs;
+
+  BpfSchedDriver driver({.name = "biff",
+                         .pnt = biff_pnt,
+                         .msg_send = biff_msg_send,
+                         .initialized = &initialized},
+                        options);
+  driver.ResetStats();
+  for (auto _ : state) {
+    driver.Round();
+  }
+  SetBpfSchedCounters(state, driver);
+}
+
+BENCHMARK(BM_biff)
+    ->ArgNames({"cpus", "tasks", "llcs"})
+    ->Args({8, 4, 1})
+    ->Args({8, 64, 1})
+    ->Args({64, 512, 1})
+    ->Args({64, 512, 4})
+    ->Args({64, 32, 4});
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  ::benchmark::RunSpecifiedBenchmarks();
+}
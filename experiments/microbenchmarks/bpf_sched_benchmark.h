@@ -0,0 +1,54 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GHOST_EXPERIMENTS_MICROBENCHMARKS_BPF_SCHED_BENCHMARK_H_
+#define GHOST_EXPERIMENTS_MICROBENCHMARKS_BPF_SCHED_BENCHMARK_H_
+
+#include <string>
+
+#include "benchmark/benchmark.h"
+#include "bpf/shim/bpf_driver.h"
+
+namespace ghost {
+
+// Reports a BpfSchedDriver's stats as benchmark counters: decisions per
+// iteration and per second of bpf-pnt time, and the average cost of bpf-pnt and
+// of each message handler that ran.  Each bpf benchmark is its own binary,
+// since the bpf programs' globals (e.g. cpu_data) would collide.
+inline void SetBpfSchedCounters(benchmark::State& state,
+                                const BpfSchedDriver& driver) {
+  const BpfSchedDriver::Stats& stats = driver.stats();
+
+  auto avg_ns = [](const BpfSchedDriver::HandlerStats& hs) {
+    return hs.calls ? 1.0 * hs.ns / hs.calls : 0.0;
+  };
+
+  state.counters["decisions"] =
+      benchmark::Counter(stats.decisions, benchmark::Counter::kAvgIterations);
+  state.counters["rejected"] =
+      benchmark::Counter(stats.rejected, benchmark::Counter::kAvgIterations);
+  if (stats.pnt.ns) {
+    state.counters["decisions/pnt_s"] = 1e9 * stats.decisions / stats.pnt.ns;
+  }
+  state.counters["pnt_ns"] = avg_ns(stats.pnt);
+  for (int type = 0; type <= _MSG_CPU_LAST; type++) {
+    if (!stats.msg[type].calls) continue;
+    state.counters[std::string(BpfSchedDriver::MsgName(type)) + "_ns"] =
+        avg_ns(stats.msg[type]);
+  }
+}
+
+}  // namespace ghost
+
+#endif  // GHOST_EXPERIMENTS_MICROBENCHMARKS_BPF_SCHED_BENCHMARK_H_
@@ -0,0 +1,106 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks EDF's bpf programs, compiled as userspace C on top of the bpf
+// shim, under the synthetic workload of BpfSchedDriver.  EDF's bpf-pnt only
+// runs the next-up tasks that the agent publishes.  BM_edf has no agent, so no
+// task ever gets a cpu and it measures the cost of bpf-pnt declining to pick.
+// BM_edf_next_up stands in for the agent, publishing a runnable task in each
+// idle cpu's next-up slot, and measures the latching fast path.
+
+#include "benchmark/benchmark.h"
+#include "bpf/shim/bpf_driver.h"
+#include "experiments/microbenchmarks/bpf_sched_benchmark.h"
+#include "third_party/bpf/edf.h"
+
+extern "C" {
+// The shim keys maps by address, so the symbol is all userspace needs to reach
+// the per-cpu data that EdfScheduler would mmap.
+extern char cpu_data;
+
+int edf_pnt(struct bpf_ghost_sched* ctx);
+int edf_msg_send(struct bpf_ghost_msg* msg);
+}
+
+namespace ghost {
+namespace {
+
+struct edf_bpf_per_cpu_data* CpuData(uint32_t cpu) {
+  return static_cast<struct edf_bpf_per_cpu_data*>(bpf_shim_map_lookup(
+      &cpu_data, BPF_MAP_TYPE_ARRAY, /*max_entries=*/1024, sizeof(cpu),
+      sizeof(struct edf_bpf_per_cpu_data), &cpu));
+}
+
+// What EdfScheduler does for an idle cpu: reap the slot's last result, then
+// publish the task it wants the cpu to run.
+void PublishNextUp(int cpu, uint64_t gtid, uint32_t barrier) {
+  struct edf_bpf_per_cpu_data* data = CpuData(cpu);
+  edf_next_up_revoke(data);
+  edf_next_up_publish(data, gtid, barrier);
+}
+
+// Args are the number of cpus and tasks.
+void BM_edf(benchmark::State& state) {
+  BpfDriverOptions options;
+  options.nr_cpus = state.range(0);
+  options.nr_tasks = state.range(1);
+
+  BpfSchedDriver driver({.name = "edf",
+                         .pnt = edf_pnt,
+                         .msg_send = edf_msg_send},
+                        options);
+  driver.ResetStats();
+  for (auto _ : state) {
+    driver.Round();
+  }
+  SetBpfSchedCounters(state, driver);
+}
+
+BENCHMARK(BM_edf)->ArgNames({"cpus", "tasks"})->Args({8, 64})->Args({64, 512});
+
+// Args are the number of cpus and tasks.
+void BM_edf_next_up(benchmark::State& state) {
+  BpfDriverOptions options;
+  options.nr_cpus = state.range(0);
+  options.nr_tasks = state.range(1);
+
+  BpfSchedDriver driver({.name = "edf",
+                         .pnt = edf_pnt,
+                         .msg_send = edf_msg_send,
+                         .publish_next = PublishNextUp},
+                        options);
+  // Like EdfScheduler, empty the slots before publishing: a zeroed state would
+  // read as claimed by cpu 0.
+  for (int cpu = 0; cpu < options.nr_cpus; cpu++) {
+    CpuData(cpu)->next_up_state = EDF_NEXT_UP_EMPTY;
+  }
+  driver.ResetStats();
+  for (auto _ : state) {
+    driver.Round();
+  }
+  SetBpfSchedCounters(state, driver);
+}
+
+BENCHMARK(BM_edf_next_up)
+    ->ArgNames({"cpus", "tasks"})
+    ->Args({8, 64})
+    ->Args({64, 512});
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  ::benchmark::RunSpecifiedBenchmarks();
+}
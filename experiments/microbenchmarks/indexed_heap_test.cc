@@ -0,0 +1,135 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks the EDF runqueue operations on an IndexedHeap holding many queued
+// tasks, for a binary and a 4-ary heap. The items are keyed like
+// EdfTask::SchedDeadlineGreater: prio_boost, then QoS, then sched_deadline.
+
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "absl/random/random.h"
+#include "absl/time/time.h"
+#include "lib/indexed_heap.h"
+
+namespace ghost {
+
+struct Item {
+  struct SchedDeadlineGreater {
+    bool operator()(const Item* a, const Item* b) const {
+      if (a->prio_boost != b->prio_boost) {
+        return b->prio_boost;
+      } else if (a->qos != b->qos) {
+        return a->qos < b->qos;
+      } else {
+        return a->sched_deadline > b->sched_deadline;
+      }
+    }
+  };
+
+  bool prio_boost = false;
+  uint32_t qos = 0;
+  absl::Time sched_deadline;
+  int rq_pos = -1;
+};
+
+template <size_t D>
+using Heap = IndexedHeap<Item, Item::SchedDeadlineGreater, &Item::rq_pos, D>;
+
+absl::Time RandomDeadline(absl::BitGen& gen) {
+  return absl::UnixEpoch() + absl::Microseconds(absl::Uniform(gen, 0, 1000000));
+}
+
+std::vector<Item> MakeItems(int n, absl::BitGen& gen) {
+  std::vector<Item> items(n);
+  for (Item& item : items) {
+    item.qos = absl::Uniform(gen, 0, 4);
+    item.sched_deadline = RandomDeadline(gen);
+  }
+  return items;
+}
+
+// Dequeue the earliest deadline and enqueue it again with a later deadline, as
+// a task that ran and was queued again does.
+template <size_t D>
+void BM_dequeue_enqueue(benchmark::State& state) {
+  absl::BitGen gen;
+  std::vector<Item> items = MakeItems(state.range(0), gen);
+  Heap<D> heap;
+  for (Item& item : items) heap.Push(&item);
+
+  for (auto _ : state) {
+    Item* item = heap.Pop();
+    item->sched_deadline += absl::Microseconds(absl::Uniform(gen, 1, 1000));
+    heap.Push(item);
+  }
+}
+BENCHMARK_TEMPLATE(BM_dequeue_enqueue, 2)->Arg(10000)->Arg(100000);
+BENCHMARK_TEMPLATE(BM_dequeue_enqueue, 4)->Arg(10000)->Arg(100000);
+
+// Change the deadline of an arbitrary queued task, as UpdateSchedParams does.
+template <size_t D>
+void BM_update(benchmark::State& state) {
+  absl::BitGen gen;
+  std::vector<Item> items = MakeItems(state.range(0), gen);
+  Heap<D> heap;
+  for (Item& item : items) heap.Push(&item);
+
+  for (auto _ : state) {
+    Item* item = &items[absl::Uniform<size_t>(gen, 0, items.size())];
+    item->sched_deadline = RandomDeadline(gen);
+    heap.Update(item);
+  }
+}
+BENCHMARK_TEMPLATE(BM_update, 2)->Arg(10000)->Arg(100000);
+BENCHMARK_TEMPLATE(BM_update, 4)->Arg(10000)->Arg(100000);
+
+// Remove an arbitrary queued task and queue it again, as a task whose work is
+// paused and later resumed is.
+template <size_t D>
+void BM_erase_push(benchmark::State& state) {
+  absl::BitGen gen;
+  std::vector<Item> items = MakeItems(state.range(0), gen);
+  Heap<D> heap;
+  for (Item& item : items) heap.Push(&item);
+
+  for (auto _ : state) {
+    Item* item = &items[absl::Uniform<size_t>(gen, 0, items.size())];
+    heap.Erase(item);
+    heap.Push(item);
+  }
+}
+BENCHMARK_TEMPLATE(BM_erase_push, 2)->Arg(10000)->Arg(100000);
+BENCHMARK_TEMPLATE(BM_erase_push, 4)->Arg(10000)->Arg(100000);
+
+// The cost of validating the whole runqueue, which EdfScheduler used to do
+// after every operation and now only does with --check_runqueue.
+void BM_check_invariants(benchmark::State& state) {
+  absl::BitGen gen;
+  std::vector<Item> items = MakeItems(state.range(0), gen);
+  Heap<4> heap;
+  for (Item& item : items) heap.Push(&item);
+
+  for (auto _ : state) {
+    heap.CheckInvariants();
+  }
+}
+BENCHMARK(BM_check_invariants)->Arg(10000)->Arg(100000);
+
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  ::benchmark::RunSpecifiedBenchmarks();
+}
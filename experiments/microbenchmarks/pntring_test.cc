@@ -0,0 +1,222 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks the PNT ring protocol (third_party/bpf/pntring.bpf.h) without a
+// ghost kernel.  The agent's side is the userspace half of pntring_funcs.bpf.h
+// and the bpf side is compiled as userspace C on top of the bpf shim, with
+// bpf_ghost_run_gtid() always succeeding.  Each consumer is a thread playing
+// bpf-pnt on its own cpu.
+
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "bpf/shim/bpf_shim.h"
+#include "third_party/bpf/pntring_funcs.bpf.h"
+
+extern "C" {
+struct pnt_ring* pntring_bench_ring(int which_ring);
+bool pntring_bench_latch(int which_ring, int cpu);
+bool pntring_bench_latch_cpu(int cpu);
+}
+
+namespace ghost {
+namespace {
+
+constexpr int kMaxBatch = NR_PNT_RING_SLOTS;
+
+// Where the agent produces and who consumes.
+enum RingMode {
+  kShared = 0,  // One ring, pulled by every consumer.
+  kPerCpu = 1,  // One ring per consumer, pulled only by it.
+};
+
+// The agent's view of a ring: the next slot to reap.
+struct Ring {
+  struct pnt_ring* ring;
+  uint64_t reap_idx = 0;
+};
+
+// Reaps the ring's latched txns, in order, as TaskLatched() would.  Returns how
+// many it reaped.
+int Reap(Ring& r) {
+  int n = 0;
+  while (r.reap_idx != READ_ONCE(r.ring->prod_idx)) {
+    struct pnt_ring_slot* slot = pnt_ring_get_slot(r.ring, r.reap_idx);
+    if (__atomic_load_n(&slot->txn_state, __ATOMIC_ACQUIRE) !=
+        GHOST_TXN_COMPLETE) {
+      break;
+    }
+    pnt_ring_reap_slot(slot);
+    r.reap_idx++;
+    n++;
+  }
+  return n;
+}
+
+// Produces up to `batch` txns into `r`, one claim per batch, or one claim per
+// txn if `!batched`.  Returns how many it produced.
+int Produce(Ring& r, int batch, bool batched, uint64_t& next_gtid) {
+  uint64_t gtids[kMaxBatch];
+  uint64_t barriers[kMaxBatch] = {};
+  struct pnt_ring_slot* slots[kMaxBatch];
+
+  for (int i = 0; i < batch; i++) gtids[i] = next_gtid + i;
+  int n = 0;
+  if (batched) {
+    n = pnt_schedule_batch_onto_ring(r.ring, batch, gtids, barriers,
+                                     /*task_ptrs=*/nullptr, slots);
+  } else {
+    while (n < batch && pnt_schedule_onto_ring(r.ring, gtids[n], barriers[n],
+                                               /*task_ptr=*/nullptr)) {
+      n++;
+    }
+  }
+  next_gtid += n;
+  return n;
+}
+
+std::vector<Ring> InitRings(int nr_rings) {
+  bpf_shim_reset();
+  std::vector<Ring> rings(nr_rings);
+  for (int i = 0; i < nr_rings; i++) {
+    rings[i].ring = pntring_bench_ring(i);
+    for (int s = 0; s < NR_PNT_RING_SLOTS; s++) {
+      rings[i].ring->slots[s].txn_state = GHOST_TXN_REAPED;
+    }
+  }
+  return rings;
+}
+
+// Cost of the agent's side of the protocol: fill the ring `batch` txns at a
+// time, one claim per batch (or per txn with batched = 0), then drain it from a
+// single consumer and reap.  Args are the batch size and whether to batch.
+void BM_pntring_produce(benchmark::State& state) {
+  const int batch = state.range(0);
+  const bool batched = state.range(1);
+  std::vector<Ring> rings = InitRings(1);
+  Ring& r = rings[0];
+  uint64_t next_gtid = 1;
+
+  for (auto _ : state) {
+    int produced = 0;
+    while (produced < NR_PNT_RING_SLOTS) {
+      const int n = Produce(r, batch, batched, next_gtid);
+      if (!n) break;
+      produced += n;
+    }
+    while (pntring_bench_latch(0, /*cpu=*/0)) {
+    }
+    benchmark::DoNotOptimize(Reap(r));
+  }
+  state.counters["txns"] = benchmark::Counter(
+      NR_PNT_RING_SLOTS, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+BENCHMARK(BM_pntring_produce)
+    ->ArgNames({"batch", "batched"})
+    ->Args({1, 0})
+    ->Args({8, 0})
+    ->Args({8, 1})
+    ->Args({32, 1});
+
+// Throughput of one producer feeding `consumers` cpus, each in a tight bpf-pnt
+// loop.  Every iteration produces, latches and reaps kTxns txns.  Args are the
+// RingMode, the number of consumers and the producer's batch size.
+void BM_pntring_consume(benchmark::State& state) {
+  constexpr int kTxns = 4096;
+  const RingMode mode = static_cast<RingMode>(state.range(0));
+  const int consumers = state.range(1);
+  const int batch = state.range(2);
+  std::vector<Ring> rings = InitRings(mode == kPerCpu ? consumers : 1);
+
+  std::atomic<bool> done{false};
+  std::atomic<uint64_t> empty_polls{0};
+  std::vector<std::thread> threads;
+  for (int cpu = 0; cpu < consumers; cpu++) {
+    threads.emplace_back([mode, cpu, &done, &empty_polls] {
+      bpf_shim_set_cpu(cpu);
+      uint64_t empty = 0;
+      while (!done.load(std::memory_order_relaxed)) {
+        const bool latched = mode == kPerCpu
+                                 ? pntring_bench_latch_cpu(cpu)
+                                 : pntring_bench_latch(0, cpu);
+        if (!latched) {
+          // An idle cpu runs PNT again once the idle task yields.
+          empty++;
+          sched_yield();
+        }
+      }
+      empty_polls += empty;
+    });
+  }
+
+  uint64_t next_gtid = 1;
+  int next_ring = 0;
+  for (auto _ : state) {
+    int produced = 0;
+    int reaped = 0;
+    while (reaped < kTxns) {
+      int progress = 0;
+      for (Ring& r : rings) progress += Reap(r);
+      reaped += progress;
+      if (produced < kTxns) {
+        // In per-cpu mode, the agent spreads txns over the cpus' rings.
+        Ring& r = rings[next_ring];
+        next_ring = (next_ring + 1) % rings.size();
+        const int n = Produce(r, std::min(batch, kTxns - produced),
+                              /*batched=*/true, next_gtid);
+        produced += n;
+        progress += n;
+      }
+      // Rings are full or latching is in flight: let the consumers run, as
+      // the agent would while waiting for messages.
+      if (!progress) sched_yield();
+    }
+  }
+
+  done = true;
+  for (std::thread& t : threads) t.join();
+
+  state.counters["txns"] =
+      benchmark::Counter(kTxns, benchmark::Counter::kIsIterationInvariantRate);
+  state.counters["empty_polls"] = benchmark::Counter(
+      empty_polls.load(), benchmark::Counter::kAvgIterations);
+}
+
+void ConsumeArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"mode", "consumers", "batch"});
+  for (int mode : {kShared, kPerCpu}) {
+    for (int consumers : {1, 2, 4, 8}) {
+      for (int batch : {1, 8}) {
+        b->Args({mode, consumers, batch});
+      }
+    }
+  }
+}
+
+BENCHMARK(BM_pntring_consume)->Apply(ConsumeArgs)->UseRealTime();
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  ::benchmark::RunSpecifiedBenchmarks();
+}
@@ -0,0 +1,122 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks the part of the EDF and Shinjuku agent loops that picks up
+// PrioTable updates, i.e. Orchestrator::RefreshSchedParams(), against the
+// number of sched items in the table. Every iteration, the "application"
+// updates `updates` sched items and the orchestrator drains the stream.
+//
+// Both orchestrators attach to a table created by this process, so no ghOSt
+// kernel is needed.
+
+#include <unistd.h>
+
+#include <memory>
+
+#include "benchmark/benchmark.h"
+#include "schedulers/edf/admission.h"
+#include "schedulers/edf/orchestrator.h"
+#include "schedulers/shinjuku/shinjuku_orchestrator.h"
+#include "shared/prio_table.h"
+
+namespace ghost {
+namespace {
+
+constexpr PrioTable::StreamCapacity kStreamCapacity =
+    PrioTable::StreamCapacity::kStreamCapacity97;
+
+std::unique_ptr<PrioTable> MakeTable(int num_items) {
+  auto table = std::make_unique<PrioTable>(num_items, /*num_classes=*/1,
+                                           kStreamCapacity);
+  struct work_class* wc = table->work_class(0);
+  wc->id = 0;
+  wc->flags = WORK_CLASS_ONESHOT;
+  wc->exectime = 1000;
+  for (int i = 0; i < num_items; i++) {
+    struct sched_item* si = table->sched_item(i);
+    si->sid = i;
+    si->wcid = 0;
+  }
+  return table;
+}
+
+// Updates `updates` consecutive sched items starting at `*next`, the way an
+// application does.
+void UpdateItems(PrioTable* table, int updates, int* next) {
+  for (int i = 0; i < updates; i++) {
+    struct sched_item* si = table->sched_item(*next);
+    uint32_t seq = si->seqcount.write_begin();
+    si->flags ^= SCHED_ITEM_RUNNABLE;
+    si->seqcount.write_end(seq);
+    table->MarkUpdatedIndex(*next, /*num_retries=*/3);
+    *next = (*next + 1) % table->NumSchedItems();
+  }
+}
+
+template <typename Orch>
+bool InitOrchestrator(Orch& orch);
+
+template <>
+bool InitOrchestrator(Orchestrator& orch) {
+  static AdmissionControl admission(AdmissionControl::Policy::kNone, 1.0, 1);
+  return orch.Init(getpid(), admission);
+}
+
+template <>
+bool InitOrchestrator(ShinjukuOrchestrator& orch) {
+  return orch.Init(getpid());
+}
+
+// Args are the number of sched items and the number of updates per iteration.
+template <typename Orch>
+void BM_refresh(benchmark::State& state) {
+  const int num_items = state.range(0);
+  const int updates = state.range(1);
+  std::unique_ptr<PrioTable> table = MakeTable(num_items);
+  Orch orch;
+  CHECK(InitOrchestrator(orch));
+
+  int64_t refreshed = 0;
+  const typename Orch::SchedCallbackFunc callback =
+      [&refreshed](auto&, auto*, Gtid) { refreshed++; };
+
+  int next = 0;
+  for (auto _ : state) {
+    UpdateItems(table.get(), updates, &next);
+    orch.RefreshSchedParams(callback);
+  }
+  state.counters["refreshed/iter"] = benchmark::Counter(
+      refreshed, benchmark::Counter::kAvgIterations);
+}
+
+// Updates fit in the stream, so the cost should only depend on `updates`.
+BENCHMARK_TEMPLATE(BM_refresh, Orchestrator)
+    ->ArgsProduct({{100, 1000, 10000}, {1, 16, 64}});
+BENCHMARK_TEMPLATE(BM_refresh, ShinjukuOrchestrator)
+    ->ArgsProduct({{100, 1000, 10000}, {1, 16, 64}});
+
+// Overflows the stream every iteration, so the orchestrator falls back to
+// rescanning every sched item.
+BENCHMARK_TEMPLATE(BM_refresh, Orchestrator)
+    ->ArgsProduct({{100, 1000, 10000}, {128}});
+BENCHMARK_TEMPLATE(BM_refresh, ShinjukuOrchestrator)
+    ->ArgsProduct({{100, 1000, 10000}, {128}});
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  ::benchmark::RunSpecifiedBenchmarks();
+}
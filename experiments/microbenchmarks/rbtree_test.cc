@@ -0,0 +1,115 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the intrusive RbTree used by the CFS run queue against the
+// `std::set` it replaced. Each iteration does what CfsRq does on a context
+// switch: pop the entity with the smallest vruntime, charge it a slice of
+// runtime and put it back.
+
+#include <set>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "absl/random/random.h"
+#include "lib/rbtree.h"
+
+namespace ghost {
+
+struct Entity : public RbTreeNode {
+  static bool Less(const Entity* a, const Entity* b) {
+    if (a->vruntime == b->vruntime) return a < b;
+    return a->vruntime < b->vruntime;
+  }
+
+  uint64_t vruntime = 0;
+  uint64_t slice = 0;
+};
+
+std::vector<Entity> MakeEntities(int n) {
+  std::vector<Entity> entities(n);
+  absl::BitGen gen;
+  for (Entity& e : entities) {
+    e.vruntime = absl::Uniform<uint64_t>(gen, 0, 1'000'000);
+    // Spread the slices so that requeued entities land all over the tree.
+    e.slice = absl::Uniform<uint64_t>(gen, 100, 10'000);
+  }
+  return entities;
+}
+
+void BM_rbtree_pick_requeue(benchmark::State& state) {
+  std::vector<Entity> entities = MakeEntities(state.range(0));
+  RbTree<Entity, &Entity::Less> rq;
+  for (Entity& e : entities) rq.Insert(&e);
+
+  for (auto _ : state) {
+    Entity* e = rq.First();
+    rq.Erase(e);
+    e->vruntime += e->slice;
+    rq.Insert(e);
+  }
+}
+BENCHMARK(BM_rbtree_pick_requeue)->Arg(10)->Arg(1000)->Arg(100000);
+
+void BM_set_pick_requeue(benchmark::State& state) {
+  std::vector<Entity> entities = MakeEntities(state.range(0));
+  std::set<Entity*, decltype(&Entity::Less)> rq(&Entity::Less);
+  for (Entity& e : entities) rq.insert(&e);
+
+  for (auto _ : state) {
+    Entity* e = *rq.begin();
+    rq.erase(rq.begin());
+    e->vruntime += e->slice;
+    rq.insert(e);
+  }
+}
+BENCHMARK(BM_set_pick_requeue)->Arg(10)->Arg(1000)->Arg(100000);
+
+// Erasing an arbitrary entity (e.g. a task that departs while runnable) is a
+// tree lookup for `std::set` but not for the intrusive tree.
+void BM_rbtree_erase_insert(benchmark::State& state) {
+  std::vector<Entity> entities = MakeEntities(state.range(0));
+  RbTree<Entity, &Entity::Less> rq;
+  for (Entity& e : entities) rq.Insert(&e);
+
+  size_t i = 0;
+  for (auto _ : state) {
+    Entity* e = &entities[i];
+    rq.Erase(e);
+    rq.Insert(e);
+    if (++i == entities.size()) i = 0;
+  }
+}
+BENCHMARK(BM_rbtree_erase_insert)->Arg(10)->Arg(1000)->Arg(100000);
+
+void BM_set_erase_insert(benchmark::State& state) {
+  std::vector<Entity> entities = MakeEntities(state.range(0));
+  std::set<Entity*, decltype(&Entity::Less)> rq(&Entity::Less);
+  for (Entity& e : entities) rq.insert(&e);
+
+  size_t i = 0;
+  for (auto _ : state) {
+    Entity* e = &entities[i];
+    rq.erase(e);
+    rq.insert(e);
+    if (++i == entities.size()) i = 0;
+  }
+}
+BENCHMARK(BM_set_erase_insert)->Arg(10)->Arg(1000)->Arg(100000);
+
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  ::benchmark::RunSpecifiedBenchmarks();
+}
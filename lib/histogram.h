@@ -0,0 +1,92 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GHOST_LIB_HISTOGRAM_H_
+#define GHOST_LIB_HISTOGRAM_H_
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+#include "absl/time/time.h"
+
+namespace ghost {
+
+// Power of 2 histogram of durations: <=1 us, 2us, 4us, etc., with the last slot
+// counting everything larger.
+//
+// Recording a sample is a relaxed atomic increment, so a thread may record
+// samples while other threads read the histogram without any locking. Readers
+// see each slot's count atomically, but not a consistent snapshot across
+// slots.
+class DurationHistogram {
+ public:
+  static constexpr int kNumSlots = 25;
+  using Slots = std::array<uint64_t, kNumSlots>;
+
+  // Returns the slot that `d` is counted in.
+  static int Slot(absl::Duration d) {
+    int64_t ns = absl::ToInt64Nanoseconds(d);
+    if (ns <= 1000) return 0;
+    uint64_t us = (ns + 999) / 1000;  // Round up.
+    int slot = 64 - __builtin_clzll(us - 1);
+    return slot < kNumSlots ? slot : kNumSlots - 1;
+  }
+
+  // Returns the largest duration counted in `slot`.
+  static absl::Duration SlotUpperBound(int slot) {
+    if (slot >= kNumSlots - 1) return absl::InfiniteDuration();
+    return absl::Microseconds(uint64_t{1} << slot);
+  }
+
+  // Returns the upper bound of the slot that contains the `p`th percentile
+  // (0 < p <= 100) of the samples counted in `slots`, or zero if there are no
+  // samples.
+  static absl::Duration Percentile(const Slots& slots, double p) {
+    uint64_t total = 0;
+    for (uint64_t count : slots) total += count;
+    if (total == 0) return absl::ZeroDuration();
+
+    uint64_t rank = std::ceil(total * p / 100.0);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < kNumSlots; i++) {
+      seen += slots[i];
+      if (seen >= rank) return SlotUpperBound(i);
+    }
+    return SlotUpperBound(kNumSlots - 1);
+  }
+
+  void Record(absl::Duration d) {
+    slots_[Slot(d)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Adds the counts of this histogram to `slots`, e.g. to merge per-cpu
+  // histograms.
+  void AddTo(Slots& slots) const {
+    for (int i = 0; i < kNumSlots; i++) {
+      slots[i] += slots_[i].load(std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  std::array<std::atomic<uint64_t>, kNumSlots> slots_ = {};
+};
+
+}  // namespace ghost
+
+#endif  // GHOST_LIB_HISTOGRAM_H_
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// An intrusive, indexed d-ary heap of pointers.
+#ifndef GHOST_LIB_INDEXED_HEAP_H_
+#define GHOST_LIB_INDEXED_HEAP_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "lib/base.h"
+
+namespace ghost {
+
+// A heap of T* in which every element records its own position in the heap in
+// `T::*Pos`, which must be -1 while the element is not in any heap. Knowing the
+// position makes it possible to erase an element or to restore the heap
+// property after its key changed in O(log n), without searching for it.
+//
+// As with std::priority_queue, `Compare(a, b)` returns true if `a` is ordered
+// after `b`, so Top() is an element that no other element is ordered before.
+// E.g. with a "greater than" comparator, Top() is the smallest element.
+//
+// Each node has `D` children. A 4-ary heap is half as deep as a binary heap,
+// which makes Push() and key updates cheaper, at the cost of comparing up to
+// `D` children at every level when sifting down in Pop(). See
+// experiments/microbenchmarks/indexed_heap_test.cc.
+//
+// Example:
+// struct Foo {
+//   struct Greater {
+//     bool operator()(const Foo* a, const Foo* b) const { return a->k > b->k; }
+//   };
+//   int k;
+//   int heap_pos = -1;
+// };
+// IndexedHeap<Foo, Foo::Greater, &Foo::heap_pos> heap;
+// heap.Push(&foo);
+// foo.k = -1;
+// heap.Update(&foo);
+// Foo* smallest = heap.Pop();
+template <typename T, typename Compare, int T::*Pos, size_t D = 4>
+class IndexedHeap {
+  static_assert(D >= 2, "A heap node must have at least two children");
+
+ public:
+  IndexedHeap() = default;
+  IndexedHeap(const IndexedHeap&) = delete;
+  IndexedHeap& operator=(const IndexedHeap&) = delete;
+
+  bool empty() const { return heap_.empty(); }
+  size_t size() const { return heap_.size(); }
+
+  // Returns the element at position `i`, in no particular order.
+  T* operator[](size_t i) const { return heap_[i]; }
+
+  // Returns true if `t` is in a heap. Elements can only tell whether they are
+  // in *some* heap, so this is only meaningful if `t` can be in just one.
+  static bool Contains(const T* t) { return t->*Pos >= 0; }
+
+  // Returns the element at the top of the heap, or nullptr if it is empty.
+  T* Top() const { return heap_.empty() ? nullptr : heap_.front(); }
+
+  // REQUIRES: `t` is not in any heap.
+  void Push(T* t) {
+    CHECK_LT(t->*Pos, 0);
+    heap_.push_back(t);
+    t->*Pos = heap_.size() - 1;
+    SiftUp(heap_.size() - 1);
+  }
+
+  // Removes and returns the element at the top of the heap, or nullptr if it
+  // is empty.
+  T* Pop() {
+    if (heap_.empty()) return nullptr;
+    T* t = heap_.front();
+    Erase(t);
+    return t;
+  }
+
+  // REQUIRES: `t` is in *this.
+  void Erase(T* t) {
+    size_t pos = Position(t);
+    T* last = heap_.back();
+    heap_.pop_back();
+    t->*Pos = -1;
+    if (last != t) {
+      Place(last, pos);
+      Update(last);
+    }
+  }
+
+  // Restores the heap property after the key of `t` changed in either
+  // direction.
+  // REQUIRES: `t` is in *this.
+  void Update(T* t) {
+    size_t pos = Position(t);
+    if (pos > 0 && Compare()(heap_[Parent(pos)], t)) {
+      SiftUp(pos);
+    } else {
+      SiftDown(pos);
+    }
+  }
+
+  // CHECK-fails unless the heap property holds and every element's position is
+  // correct. This is O(n), so it is only meant for debugging and tests.
+  void CheckInvariants() const {
+    for (size_t i = 0; i < heap_.size(); i++) {
+      CHECK_EQ(heap_[i]->*Pos, i);
+      if (i > 0) CHECK(!Compare()(heap_[Parent(i)], heap_[i]));
+    }
+  }
+
+ private:
+  static size_t Parent(size_t pos) { return (pos - 1) / D; }
+  static size_t FirstChild(size_t pos) { return pos * D + 1; }
+
+  size_t Position(const T* t) const {
+    int pos = t->*Pos;
+    DCHECK_GE(pos, 0);
+    DCHECK_LT(pos, heap_.size());
+    DCHECK_EQ(heap_[pos], t);
+    return pos;
+  }
+
+  void Place(T* t, size_t pos) {
+    heap_[pos] = t;
+    t->*Pos = pos;
+  }
+
+  // Moves the element at `pos` up, shifting the parents it passes down, rather
+  // than swapping at every level.
+  void SiftUp(size_t pos) {
+    T* t = heap_[pos];
+    while (pos > 0) {
+      size_t parent = Parent(pos);
+      if (!Compare()(heap_[parent], t)) break;
+      Place(heap_[parent], pos);
+      pos = parent;
+    }
+    Place(t, pos);
+  }
+
+  void SiftDown(size_t pos) {
+    T* t = heap_[pos];
+    const size_t n = heap_.size();
+    while (true) {
+      size_t first = FirstChild(pos);
+      if (first >= n) break;
+      size_t last = first + D < n ? first + D : n;
+      size_t best = first;
+      for (size_t c = first + 1; c < last; c++) {
+        if (Compare()(heap_[best], heap_[c])) best = c;
+      }
+      if (!Compare()(t, heap_[best])) break;
+      Place(heap_[best], pos);
+      pos = best;
+    }
+    Place(t, pos);
+  }
+
+  std::vector<T*> heap_;
+};
+
+}  // namespace ghost
+
+#endif  // GHOST_LIB_INDEXED_HEAP_H_
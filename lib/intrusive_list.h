@@ -0,0 +1,132 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// An intrusive doubly-linked list.
+#ifndef GHOST_LIB_INTRUSIVE_LIST_H_
+#define GHOST_LIB_INTRUSIVE_LIST_H_
+
+#include <cstddef>
+
+#include "lib/base.h"
+
+namespace ghost {
+
+// The links of an element of an IntrusiveList<T>, embedded in T.
+template <typename T>
+struct ListLink {
+  T* prev = nullptr;
+  T* next = nullptr;
+  bool linked = false;
+};
+
+// A list of T* linked through `T::*Link`. Since the links live in the elements,
+// inserting and erasing never allocate, and erasing an element is O(1) without
+// searching for it. An element can be on one list per ListLink member.
+//
+// Example:
+// struct Foo {
+//   ListLink<Foo> link;
+// };
+// IntrusiveList<Foo, &Foo::link> list;
+// list.PushBack(&foo);
+// list.Erase(&foo);
+template <typename T, ListLink<T> T::*Link>
+class IntrusiveList {
+ public:
+  IntrusiveList() = default;
+  IntrusiveList(const IntrusiveList&) = delete;
+  IntrusiveList& operator=(const IntrusiveList&) = delete;
+
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+
+  // Returns true if `t` is on a list linked through `Link`.
+  static bool Linked(const T* t) { return (t->*Link).linked; }
+
+  // Returns the first element, or nullptr if the list is empty.
+  T* Front() const { return head_; }
+  // Returns the element after `t`, or nullptr if `t` is the last one.
+  static T* Next(const T* t) { return (t->*Link).next; }
+
+  // REQUIRES: `t` is not on a list linked through `Link`.
+  void PushBack(T* t) {
+    ListLink<T>& link = Prepare(t);
+    link.prev = tail_;
+    if (tail_) {
+      (tail_->*Link).next = t;
+    } else {
+      head_ = t;
+    }
+    tail_ = t;
+  }
+
+  // REQUIRES: `t` is not on a list linked through `Link`.
+  void PushFront(T* t) {
+    ListLink<T>& link = Prepare(t);
+    link.next = head_;
+    if (head_) {
+      (head_->*Link).prev = t;
+    } else {
+      tail_ = t;
+    }
+    head_ = t;
+  }
+
+  // Removes and returns the first element, or nullptr if the list is empty.
+  T* PopFront() {
+    T* t = head_;
+    if (t) Erase(t);
+    return t;
+  }
+
+  // REQUIRES: `t` is on *this.
+  void Erase(T* t) {
+    ListLink<T>& link = t->*Link;
+    CHECK(link.linked);
+    if (link.prev) {
+      (link.prev->*Link).next = link.next;
+    } else {
+      DCHECK_EQ(head_, t);
+      head_ = link.next;
+    }
+    if (link.next) {
+      (link.next->*Link).prev = link.prev;
+    } else {
+      DCHECK_EQ(tail_, t);
+      tail_ = link.prev;
+    }
+    link = ListLink<T>();
+    size_--;
+  }
+
+ private:
+  ListLink<T>& Prepare(T* t) {
+    ListLink<T>& link = t->*Link;
+    CHECK(!link.linked);
+    link = ListLink<T>();
+    link.linked = true;
+    size_++;
+    return link;
+  }
+
+  T* head_ = nullptr;
+  T* tail_ = nullptr;
+  size_t size_ = 0;
+};
+
+}  // namespace ghost
+
+#endif  // GHOST_LIB_INTRUSIVE_LIST_H_
@@ -0,0 +1,347 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// An intrusive red-black tree, similar to the kernel's `rb_root_cached`.
+#ifndef GHOST_LIB_RBTREE_H_
+#define GHOST_LIB_RBTREE_H_
+
+#include <cstddef>
+
+#include "lib/base.h"
+
+namespace ghost {
+
+// The node embedded in elements of an RbTree. Element types derive from
+// RbTreeNode, so an element can be in at most one RbTree at a time. Linking and
+// unlinking an element never allocates memory.
+class RbTreeNode {
+ public:
+  RbTreeNode() = default;
+  RbTreeNode(const RbTreeNode&) = delete;
+  RbTreeNode& operator=(const RbTreeNode&) = delete;
+
+  // Returns true if this node is currently in a tree.
+  bool rb_linked() const { return rb_linked_; }
+
+ private:
+  template <typename T, bool (*Less)(const T*, const T*)>
+  friend class RbTree;
+
+  RbTreeNode* rb_parent_ = nullptr;
+  RbTreeNode* rb_left_ = nullptr;
+  RbTreeNode* rb_right_ = nullptr;
+  bool rb_red_ = false;
+  bool rb_linked_ = false;
+};
+
+// An ordered collection of T, sorted by `Less`, which must be a strict weak
+// ordering that does not change for an element while it is in the tree. T
+// must derive from RbTreeNode. The leftmost (smallest) element is cached, so
+// First() is O(1). Insert() and Erase() are O(log n) and do not allocate.
+//
+// Example:
+// struct Foo : public RbTreeNode {
+//   static bool Less(const Foo* a, const Foo* b) { return a->key < b->key; }
+//   int key;
+// };
+// RbTree<Foo, &Foo::Less> tree;
+// tree.Insert(&foo);
+// Foo* smallest = tree.First();
+// tree.Erase(smallest);
+template <typename T, bool (*Less)(const T*, const T*)>
+class RbTree {
+ public:
+  RbTree() = default;
+  RbTree(const RbTree&) = delete;
+  RbTree& operator=(const RbTree&) = delete;
+
+  bool empty() const { return root_ == nullptr; }
+  size_t size() const { return size_; }
+
+  // Returns the smallest element, or nullptr if the tree is empty.
+  T* First() const { return static_cast<T*>(leftmost_); }
+
+  // Returns the element following `t` in order, or nullptr if `t` is the last.
+  // REQUIRES: `t` is in *this.
+  T* Next(const T* t) const {
+    return static_cast<T*>(Successor(static_cast<const RbTreeNode*>(t)));
+  }
+
+  // REQUIRES: `t` is not in any tree.
+  void Insert(T* t) {
+    RbTreeNode* n = t;
+    DCHECK(!n->rb_linked_);
+
+    RbTreeNode* parent = nullptr;
+    RbTreeNode** link = &root_;
+    bool leftmost = true;
+    while (*link) {
+      parent = *link;
+      if (Less(t, static_cast<T*>(parent))) {
+        link = &parent->rb_left_;
+      } else {
+        link = &parent->rb_right_;
+        leftmost = false;
+      }
+    }
+
+    n->rb_parent_ = parent;
+    n->rb_left_ = n->rb_right_ = nullptr;
+    n->rb_red_ = true;
+    n->rb_linked_ = true;
+    *link = n;
+    if (leftmost) leftmost_ = n;
+    size_++;
+
+    InsertFixup(n);
+  }
+
+  // REQUIRES: `t` is in *this.
+  void Erase(T* t) {
+    RbTreeNode* z = t;
+    DCHECK(z->rb_linked_);
+
+    if (leftmost_ == z) leftmost_ = Successor(z);
+
+    RbTreeNode* y = z;
+    bool removed_red = y->rb_red_;
+    RbTreeNode* x;
+    RbTreeNode* x_parent;
+    if (!z->rb_left_) {
+      x = z->rb_right_;
+      x_parent = z->rb_parent_;
+      Transplant(z, z->rb_right_);
+    } else if (!z->rb_right_) {
+      x = z->rb_left_;
+      x_parent = z->rb_parent_;
+      Transplant(z, z->rb_left_);
+    } else {
+      // `z` has two children: splice out its successor `y` and put `y` in
+      // `z`'s place.
+      y = Minimum(z->rb_right_);
+      removed_red = y->rb_red_;
+      x = y->rb_right_;
+      if (y->rb_parent_ == z) {
+        x_parent = y;
+      } else {
+        x_parent = y->rb_parent_;
+        Transplant(y, y->rb_right_);
+        y->rb_right_ = z->rb_right_;
+        y->rb_right_->rb_parent_ = y;
+      }
+      Transplant(z, y);
+      y->rb_left_ = z->rb_left_;
+      y->rb_left_->rb_parent_ = y;
+      y->rb_red_ = z->rb_red_;
+    }
+    if (!removed_red) EraseFixup(x, x_parent);
+
+    z->rb_parent_ = z->rb_left_ = z->rb_right_ = nullptr;
+    z->rb_linked_ = false;
+    size_--;
+  }
+
+  // CHECK-fails unless the tree is a valid red-black tree: the root is black,
+  // no red node has a red child, and every path from a node down to a leaf has
+  // the same number of black nodes. Also checks the order, the parent links,
+  // the cached leftmost element and the size. This is O(n), so it is only
+  // meant for debugging and tests.
+  void CheckInvariants() const {
+    CHECK(!IsRed(root_));
+    if (root_) CHECK_EQ(root_->rb_parent_, nullptr);
+    size_t count = 0;
+    CheckSubtree(root_, &count);
+    CHECK_EQ(count, size_);
+    CHECK_EQ(leftmost_, root_ ? Minimum(root_) : nullptr);
+    for (const T* t = First(); t; t = Next(t)) {
+      const T* next = Next(t);
+      if (next) CHECK(!Less(next, t));
+    }
+  }
+
+ private:
+  static bool IsRed(const RbTreeNode* n) { return n && n->rb_red_; }
+
+  // Checks the subtree rooted at `n`, adding its size to `count`. Returns its
+  // black height.
+  static int CheckSubtree(const RbTreeNode* n, size_t* count) {
+    if (!n) return 0;
+    CHECK(n->rb_linked_);
+    (*count)++;
+    const RbTreeNode* children[] = {n->rb_left_, n->rb_right_};
+    for (const RbTreeNode* c : children) {
+      if (!c) continue;
+      CHECK_EQ(c->rb_parent_, n);
+      CHECK(!(n->rb_red_ && c->rb_red_));
+    }
+    const int left = CheckSubtree(n->rb_left_, count);
+    CHECK_EQ(left, CheckSubtree(n->rb_right_, count));
+    return left + !n->rb_red_;
+  }
+
+  static RbTreeNode* Minimum(RbTreeNode* n) {
+    while (n->rb_left_) n = n->rb_left_;
+    return n;
+  }
+
+  static RbTreeNode* Successor(const RbTreeNode* n) {
+    if (n->rb_right_) return Minimum(n->rb_right_);
+    RbTreeNode* p = n->rb_parent_;
+    while (p && n == p->rb_right_) {
+      n = p;
+      p = p->rb_parent_;
+    }
+    return p;
+  }
+
+  // Replaces the subtree rooted at `u` with the subtree rooted at `v`.
+  void Transplant(RbTreeNode* u, RbTreeNode* v) {
+    if (!u->rb_parent_) {
+      root_ = v;
+    } else if (u == u->rb_parent_->rb_left_) {
+      u->rb_parent_->rb_left_ = v;
+    } else {
+      u->rb_parent_->rb_right_ = v;
+    }
+    if (v) v->rb_parent_ = u->rb_parent_;
+  }
+
+  void RotateLeft(RbTreeNode* x) {
+    RbTreeNode* y = x->rb_right_;
+    x->rb_right_ = y->rb_left_;
+    if (y->rb_left_) y->rb_left_->rb_parent_ = x;
+    Transplant(x, y);
+    y->rb_left_ = x;
+    x->rb_parent_ = y;
+  }
+
+  void RotateRight(RbTreeNode* x) {
+    RbTreeNode* y = x->rb_left_;
+    x->rb_left_ = y->rb_right_;
+    if (y->rb_right_) y->rb_right_->rb_parent_ = x;
+    Transplant(x, y);
+    y->rb_right_ = x;
+    x->rb_parent_ = y;
+  }
+
+  void InsertFixup(RbTreeNode* z) {
+    while (IsRed(z->rb_parent_)) {
+      RbTreeNode* p = z->rb_parent_;
+      // `p` is red, so it is not the root and `g` exists.
+      RbTreeNode* g = p->rb_parent_;
+      if (p == g->rb_left_) {
+        RbTreeNode* u = g->rb_right_;
+        if (IsRed(u)) {
+          p->rb_red_ = u->rb_red_ = false;
+          g->rb_red_ = true;
+          z = g;
+          continue;
+        }
+        if (z == p->rb_right_) {
+          RotateLeft(p);
+          z = p;
+          p = z->rb_parent_;
+        }
+        p->rb_red_ = false;
+        g->rb_red_ = true;
+        RotateRight(g);
+      } else {
+        RbTreeNode* u = g->rb_left_;
+        if (IsRed(u)) {
+          p->rb_red_ = u->rb_red_ = false;
+          g->rb_red_ = true;
+          z = g;
+          continue;
+        }
+        if (z == p->rb_left_) {
+          RotateRight(p);
+          z = p;
+          p = z->rb_parent_;
+        }
+        p->rb_red_ = false;
+        g->rb_red_ = true;
+        RotateLeft(g);
+      }
+    }
+    root_->rb_red_ = false;
+  }
+
+  // `x` (possibly nullptr) carries an extra black; `parent` is its parent.
+  void EraseFixup(RbTreeNode* x, RbTreeNode* parent) {
+    while (x != root_ && !IsRed(x)) {
+      if (x == parent->rb_left_) {
+        RbTreeNode* w = parent->rb_right_;
+        if (IsRed(w)) {
+          w->rb_red_ = false;
+          parent->rb_red_ = true;
+          RotateLeft(parent);
+          w = parent->rb_right_;
+        }
+        if (!IsRed(w->rb_left_) && !IsRed(w->rb_right_)) {
+          w->rb_red_ = true;
+          x = parent;
+          parent = x->rb_parent_;
+          continue;
+        }
+        if (!IsRed(w->rb_right_)) {
+          w->rb_left_->rb_red_ = false;
+          w->rb_red_ = true;
+          RotateRight(w);
+          w = parent->rb_right_;
+        }
+        w->rb_red_ = parent->rb_red_;
+        parent->rb_red_ = false;
+        w->rb_right_->rb_red_ = false;
+        RotateLeft(parent);
+      } else {
+        RbTreeNode* w = parent->rb_left_;
+        if (IsRed(w)) {
+          w->rb_red_ = false;
+          parent->rb_red_ = true;
+          RotateRight(parent);
+          w = parent->rb_left_;
+        }
+        if (!IsRed(w->rb_left_) && !IsRed(w->rb_right_)) {
+          w->rb_red_ = true;
+          x = parent;
+          parent = x->rb_parent_;
+          continue;
+        }
+        if (!IsRed(w->rb_left_)) {
+          w->rb_right_->rb_red_ = false;
+          w->rb_red_ = true;
+          RotateLeft(w);
+          w = parent->rb_left_;
+        }
+        w->rb_red_ = parent->rb_red_;
+        parent->rb_red_ = false;
+        w->rb_left_->rb_red_ = false;
+        RotateRight(parent);
+      }
+      x = root_;
+      break;
+    }
+    if (x) x->rb_red_ = false;
+  }
+
+  RbTreeNode* root_ = nullptr;
+  RbTreeNode* leftmost_ = nullptr;
+  size_t size_ = 0;
+};
+
+}  // namespace ghost
+
+#endif  // GHOST_LIB_RBTREE_H_
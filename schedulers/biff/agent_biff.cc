@@ -25,13 +25,21 @@
 #include "schedulers/biff/biff_scheduler.h"
 
 ABSL_FLAG(std::string, enclave, "", "Connect to preexisting enclave directory");
+ABSL_FLAG(absl::Duration, time_slice, absl::Milliseconds(50),
+          "How long a task may run while others of its priority wait (0 for "
+          "no limit)");
+ABSL_FLAG(absl::Duration, placement_interval, absl::ZeroDuration(),
+          "How often the agent rebalances tasks across LLCs (0 to leave "
+          "placement to bpf)");
 
 int main(int argc, char* argv[]) {
   absl::InitializeSymbolizer(argv[0]);
   absl::ParseCommandLine(argc, argv);
 
   ghost::Topology* t = ghost::MachineTopology();
-  ghost::AgentConfig config(t, t->all_cpus());
+  ghost::BiffConfig config(t, t->all_cpus());
+  config.time_slice_ = absl::GetFlag(FLAGS_time_slice);
+  config.placement_interval_ = absl::GetFlag(FLAGS_placement_interval);
   std::string enclave = absl::GetFlag(FLAGS_enclave);
   if (!enclave.empty()) {
     int fd = open(enclave.c_str(), O_PATH);
@@ -40,7 +48,7 @@ int main(int argc, char* argv[]) {
   }
 
   auto uap = new ghost::AgentProcess<ghost::FullBiffAgent<ghost::LocalEnclave>,
-                                     ghost::AgentConfig>(config);
+                                     ghost::BiffConfig>(config);
 
   ghost::GhostHelper()->InitCore();
 
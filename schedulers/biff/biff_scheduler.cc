@@ -14,15 +14,21 @@
 
 #include "schedulers/biff/biff_scheduler.h"
 
+#include <algorithm>
+#include <numeric>
+
+#include "absl/container/flat_hash_map.h"
 #include "absl/strings/str_format.h"
 #include "bpf/user/agent.h"
 
 namespace ghost {
 
 BiffScheduler::BiffScheduler(Enclave* enclave, CpuList cpulist,
-                             const AgentConfig& config)
+                             const BiffConfig& config)
     : Scheduler(enclave, std::move(cpulist)),
-      unused_channel_(GHOST_MAX_QUEUE_ELEMS, /*node=*/0) {
+      unused_channel_(GHOST_MAX_QUEUE_ELEMS, /*node=*/0),
+      time_slice_(config.time_slice_),
+      placement_interval_(config.placement_interval_) {
 
   bpf_obj_ = biff_bpf__open();
   CHECK_NE(bpf_obj_, nullptr);
@@ -36,6 +42,9 @@ BiffScheduler::BiffScheduler(Enclave* enclave, CpuList cpulist,
 
   CHECK_EQ(biff_bpf__load(bpf_obj_), 0);
 
+  SetLlcMap();
+  bpf_obj_->bss->slice_us = absl::ToInt64Microseconds(config.time_slice_);
+
   CHECK_EQ(agent_bpf_register(bpf_obj_->progs.biff_pnt, BPF_GHOST_SCHED_PNT),
            0);
   CHECK_EQ(agent_bpf_register(bpf_obj_->progs.biff_msg_send,
@@ -51,16 +60,192 @@ BiffScheduler::BiffScheduler(Enclave* enclave, CpuList cpulist,
 }
 
 BiffScheduler::~BiffScheduler() {
+  if (placement_thread_.joinable()) {
+    placement_done_.Notify();
+    placement_thread_.join();
+  }
   bpf_map__munmap(bpf_obj_->maps.cpu_data, bpf_cpu_data_);
   bpf_map__munmap(bpf_obj_->maps.sw_data, bpf_sw_data_);
   biff_bpf__destroy(bpf_obj_);
 }
 
+// Numbers the machine's LLCs densely and tells bpf which one each cpu is in,
+// so that bpf can keep one run queue per LLC.  Cpus without L3 information are
+// grouped by NUMA node.  bpf must not run until this is done, which is
+// guaranteed since `initialized` is still false.
+void BiffScheduler::SetLlcMap() {
+  absl::flat_hash_map<int, uint32_t> llc_ids;
+
+  for (const Cpu& cpu : topology()->all_cpus()) {
+    CHECK_LT(cpu.id(), BIFF_MAX_CPUS);
+    const CpuList& l3 = cpu.l3_siblings();
+    // Negative keys can't collide with the (non-negative) first L3 sibling.
+    const int key = l3.Empty() ? -1 - cpu.numa_node() : l3.Front().id();
+    const uint32_t llc = llc_ids.try_emplace(key, llc_ids.size()).first->second;
+    bpf_obj_->bss->cpu_to_llc[cpu.id()] = llc % BIFF_MAX_LLCS;
+  }
+  if (llc_ids.size() > BIFF_MAX_LLCS) {
+    absl::FPrintF(stderr, "Biff: %d LLCs share %d run queues\n",
+                  llc_ids.size(), BIFF_MAX_LLCS);
+  }
+  bpf_obj_->bss->nr_llcs =
+      std::min<uint32_t>(llc_ids.size(), BIFF_MAX_LLCS);
+
+  llc_cpus_.assign(bpf_obj_->bss->nr_llcs, 0);
+  for (const Cpu& cpu : cpus()) {
+    llc_cpus_[bpf_obj_->bss->cpu_to_llc[cpu.id()]]++;
+  }
+}
+
 void BiffScheduler::EnclaveReady() {
-  // Biff has no cpu locality, so the remote wakeup is never worth it.
+  // Tasks are queued on the LLC they last ran in and any cpu in that LLC can
+  // run them, so the remote wakeup is never worth it.
   enclave()->SetWakeOnWakerCpu(true);
+  // bpf-msg enforces priorities and time slices on cpu ticks.
+  enclave()->SetDeliverTicks(true);
 
   WRITE_ONCE(bpf_obj_->bss->initialized, true);
+
+  if (placement_interval_ > absl::ZeroDuration()) {
+    placement_thread_ = std::thread([this] {
+      while (!placement_done_.WaitForNotificationWithTimeout(
+          placement_interval_)) {
+        UpdatePlacement();
+      }
+    });
+  }
+}
+
+struct biff_bpf_sw_data* BiffScheduler::SwData(Gtid gtid) {
+  uint64_t key = gtid.id();
+  struct task_sw_info swi;
+
+  if (bpf_map_lookup_elem(bpf_map__fd(bpf_obj_->maps.sw_lookup), &key,
+                          &swi)) {
+    return nullptr;
+  }
+  CHECK_LT(swi.index, BIFF_MAX_GTIDS);
+  return &bpf_sw_data_[swi.index];
+}
+
+bool BiffScheduler::SetPriority(Gtid gtid, uint32_t prio) {
+  if (prio >= BIFF_NR_PRIOS) return false;
+  struct biff_bpf_sw_data* swd = SwData(gtid);
+  if (!swd) return false;
+  WRITE_ONCE(swd->prio, prio);
+  return true;
+}
+
+bool BiffScheduler::SetSlice(Gtid gtid, absl::Duration slice) {
+  if (slice < absl::ZeroDuration()) return false;
+  struct biff_bpf_sw_data* swd = SwData(gtid);
+  if (!swd) return false;
+  WRITE_ONCE(swd->slice_us,
+             static_cast<uint64_t>(absl::ToInt64Microseconds(slice)));
+  return true;
+}
+
+bool BiffScheduler::SetWeight(Gtid gtid, uint32_t weight) {
+  if (!weight) return false;
+  if (time_slice_ == absl::ZeroDuration()) return SwData(gtid) != nullptr;
+  return SetSlice(gtid, WeightedSlice(time_slice_, weight));
+}
+
+absl::Duration WeightedSlice(absl::Duration slice, uint32_t weight) {
+  return std::max(slice * weight / BiffScheduler::kDefaultWeight,
+                  absl::Microseconds(1));
+}
+
+void BiffScheduler::UpdatePlacement() {
+  const int fd = bpf_map__fd(bpf_obj_->maps.sw_lookup);
+  absl::flat_hash_map<uint64_t, uint64_t> runtimes;
+  std::vector<BiffTaskDemand> tasks;
+  std::vector<uint32_t> indexes;
+  uint64_t gtid;
+  bool first = true;
+
+  // bpf adds and removes tasks as we go, so we may miss a few.  They'll get a
+  // home next time.
+  while (!bpf_map_get_next_key(fd, first ? nullptr : &gtid, &gtid)) {
+    struct task_sw_info swi;
+
+    first = false;
+    if (bpf_map_lookup_elem(fd, &gtid, &swi)) continue;
+    CHECK_LT(swi.index, BIFF_MAX_GTIDS);
+
+    struct biff_bpf_sw_data* swd = &bpf_sw_data_[swi.index];
+    const uint64_t runtime = READ_ONCE(swd->runtime);
+    auto iter = last_runtime_.find(gtid);
+    const uint64_t last = iter == last_runtime_.end() ? 0 : iter->second;
+    // If the runtime went backwards, the sw slot was recycled by a new task.
+    tasks.push_back({.demand = runtime >= last ? runtime - last : runtime,
+                     .home = READ_ONCE(swd->home_llc)});
+    indexes.push_back(swi.index);
+    runtimes[gtid] = runtime;
+  }
+  last_runtime_ = std::move(runtimes);
+
+  const std::vector<uint32_t> homes = AssignHomeLlcs(tasks, llc_cpus_);
+  for (size_t i = 0; i < tasks.size(); i++) {
+    if (homes[i] != tasks[i].home) {
+      WRITE_ONCE(bpf_sw_data_[indexes[i]].home_llc, homes[i]);
+    }
+  }
+}
+
+std::vector<uint32_t> AssignHomeLlcs(const std::vector<BiffTaskDemand>& tasks,
+                                     const std::vector<int>& llc_cpus) {
+  // How much busier per cpu a task's home may be than the best LLC before the
+  // task moves.
+  constexpr double kStickiness = 1.25;
+
+  std::vector<uint32_t> homes(tasks.size());
+  std::vector<double> load(llc_cpus.size());
+
+  // Only LLCs with enclave cpus can be homes. The others would look empty, but
+  // their tasks could only run when another LLC steals them.
+  auto usable = [&](uint32_t llc) {
+    return llc < llc_cpus.size() && llc_cpus[llc] > 0;
+  };
+  auto load_per_cpu = [&](uint32_t llc, uint64_t demand) {
+    return (load[llc] + demand) / llc_cpus[llc];
+  };
+  uint32_t first_usable = 0;
+  while (first_usable < llc_cpus.size() && !usable(first_usable)) {
+    first_usable++;
+  }
+
+  // Place the biggest tasks first, each where it adds the least load per cpu.
+  std::vector<size_t> order(tasks.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&tasks](size_t a, size_t b) {
+    return tasks[a].demand > tasks[b].demand;
+  });
+
+  for (size_t i : order) {
+    const BiffTaskDemand& task = tasks[i];
+    if (!task.demand || first_usable == llc_cpus.size()) {
+      homes[i] = task.home;
+      continue;
+    }
+
+    uint32_t best = first_usable;
+    for (uint32_t llc = best + 1; llc < llc_cpus.size(); llc++) {
+      if (usable(llc) &&
+          load_per_cpu(llc, task.demand) < load_per_cpu(best, task.demand)) {
+        best = llc;
+      }
+    }
+    uint32_t home = best;
+    if (usable(task.home) &&
+        load_per_cpu(task.home, task.demand) <=
+            kStickiness * load_per_cpu(best, task.demand)) {
+      home = task.home;
+    }
+    load[home] += task.demand;
+    homes[i] = home;
+  }
+  return homes;
 }
 
 void BiffScheduler::DiscoverTasks() {
@@ -18,7 +18,12 @@
 #define GHOST_SCHEDULERS_BIFF_BIFF_SCHEDULER_H_
 
 #include <cstdint>
+#include <thread>
+#include <vector>
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
 #include "third_party/bpf/biff_bpf.h"
 #include "lib/agent.h"
 #include "lib/scheduler.h"
@@ -26,21 +31,103 @@
 
 namespace ghost {
 
+class BiffConfig : public AgentConfig {
+ public:
+  BiffConfig() {}
+  BiffConfig(Topology* topology, CpuList cpulist)
+      : AgentConfig(topology, std::move(cpulist)) {}
+
+  // How long a task may run while other tasks of its priority wait.  Zero
+  // means until it blocks or yields.
+  absl::Duration time_slice_ = absl::Milliseconds(50);
+  // How often the agent rebalances tasks' home LLCs.  Zero leaves placement to
+  // bpf, which queues a task in the LLC it last ran in.
+  absl::Duration placement_interval_ = absl::ZeroDuration();
+};
+
+// A task's input to AssignHomeLlcs().
+struct BiffTaskDemand {
+  // Time the task spent on cpu recently.
+  uint64_t demand;
+  // The task's home LLC, or BIFF_LLC_NONE.
+  uint32_t home;
+};
+
+// Returns a home LLC for each of `tasks`, spreading their demand over the LLCs
+// in proportion to the LLCs' number of cpus, `llc_cpus`.  A task stays in its
+// home unless that is a lot busier than the best LLC, since moving costs it its
+// cache footprint.  LLCs without cpus get no tasks, and tasks without demand
+// keep their home.
+std::vector<uint32_t> AssignHomeLlcs(const std::vector<BiffTaskDemand>& tasks,
+                                     const std::vector<int>& llc_cpus);
+
+// Returns the time slice of a task of `weight`, given the `slice` of a task of
+// BiffScheduler::kDefaultWeight.  Never less than 1us, since a zero slice_us
+// would mean the global slice.
+absl::Duration WeightedSlice(absl::Duration slice, uint32_t weight);
+
 class BiffScheduler : public Scheduler {
  public:
+  // RPC: arg0 is a gtid, arg1 its new priority.  See SetPriority().
+  static constexpr int kSetPriority = 1;
+  // RPC: arg0 is a gtid, arg1 its time slice in usec.  See SetSlice().
+  static constexpr int kSetSlice = 2;
+  // RPC: arg0 is a gtid, arg1 its weight.  See SetWeight().
+  static constexpr int kSetWeight = 3;
+
+  // The weight of a task that gets BiffConfig::time_slice_.
+  static constexpr uint32_t kDefaultWeight = 100;
+
   explicit BiffScheduler(Enclave* enclave, CpuList cpulist,
-                         const AgentConfig& config);
+                         const BiffConfig& config);
   ~BiffScheduler() final;
 
   void EnclaveReady() final;
   void DiscoverTasks() final;
   Channel& GetDefaultChannel() final { return unused_channel_; };
 
+  // Sets the priority level of `gtid`, from 0 (best) to BIFF_NR_PRIOS - 1.
+  // It takes effect the next time the task is queued.  Returns false if bpf
+  // doesn't know the task (yet) or `prio` is out of range.
+  bool SetPriority(Gtid gtid, uint32_t prio);
+
+  // Sets the time slice of `gtid`, overriding BiffConfig::time_slice_.  Zero
+  // goes back to the config's slice.  It takes effect on the next cpu tick.
+  // Returns false if bpf doesn't know the task (yet) or `slice` is negative.
+  bool SetSlice(Gtid gtid, absl::Duration slice);
+
+  // Sets the weight of `gtid` by scaling its time slice, see WeightedSlice().
+  // A task runs that much longer per turn than a task of kDefaultWeight, so
+  // while both use up their slices, they share the cpus of their priority in
+  // proportion to their weights.  This replaces SetSlice() and vice versa, and
+  // does nothing without a BiffConfig::time_slice_.  Returns false if bpf
+  // doesn't know the task (yet) or `weight` is zero.
+  bool SetWeight(Gtid gtid, uint32_t weight);
+
+  // Gives every task a home LLC with AssignHomeLlcs(), based on its runtime
+  // since the last call, and publishes them to bpf.  Runs every
+  // BiffConfig::placement_interval_ once the enclave is ready.
+  void UpdatePlacement();
+
  private:
+  void SetLlcMap();
+  // Returns the sw_data of `gtid`, or nullptr if bpf doesn't know the task.
+  struct biff_bpf_sw_data* SwData(Gtid gtid);
+
   LocalChannel unused_channel_;
   struct biff_bpf* bpf_obj_;
   struct biff_bpf_cpu_data* bpf_cpu_data_;
   struct biff_bpf_sw_data* bpf_sw_data_;
+
+  // Number of enclave cpus in each LLC.
+  std::vector<int> llc_cpus_;
+  // Each task's sw_data runtime as of the last UpdatePlacement(), by gtid.
+  absl::flat_hash_map<uint64_t, uint64_t> last_runtime_;
+
+  const absl::Duration time_slice_;
+  const absl::Duration placement_interval_;
+  std::thread placement_thread_;
+  absl::Notification placement_done_;
 };
 
 class BiffAgentTask : public LocalAgent {
@@ -58,7 +145,7 @@ class BiffAgentTask : public LocalAgent {
 template <class EnclaveType>
 class FullBiffAgent : public FullAgent<EnclaveType> {
  public:
-  explicit FullBiffAgent(AgentConfig config)
+  explicit FullBiffAgent(BiffConfig config)
       : FullAgent<EnclaveType>(config) {
     biff_sched_ = absl::make_unique<BiffScheduler>(
         &this->enclave_, *this->enclave_.cpus(), config);
@@ -78,6 +165,21 @@ class FullBiffAgent : public FullAgent<EnclaveType> {
   void RpcHandler(int64_t req, const AgentRpcArgs& args,
                   AgentRpcResponse& response) override {
     switch (req) {
+      case BiffScheduler::kSetPriority:
+        response.response_code =
+            biff_sched_->SetPriority(Gtid(args.arg0), args.arg1) ? 0 : -1;
+        return;
+      case BiffScheduler::kSetSlice:
+        response.response_code =
+            biff_sched_->SetSlice(Gtid(args.arg0),
+                                  absl::Microseconds(args.arg1))
+                ? 0
+                : -1;
+        return;
+      case BiffScheduler::kSetWeight:
+        response.response_code =
+            biff_sched_->SetWeight(Gtid(args.arg0), args.arg1) ? 0 : -1;
+        return;
       default:
         response.response_code = -1;
         return;
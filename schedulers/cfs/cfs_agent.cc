@@ -32,6 +32,15 @@ ABSL_FLAG(
     "The minimum time a task will run before being preempted by another task");
 ABSL_FLAG(absl::Duration, latency, absl::Milliseconds(10),
           "The target time period in which all tasks will run at least once");
+ABSL_FLAG(absl::Duration, wakeup_granularity, absl::Milliseconds(1),
+          "How much less vruntime than the running task a waking task needs "
+          "in order to preempt it");
+ABSL_FLAG(bool, group_scheduling, false,
+          "Schedule tasks hierarchically by cgroup, weighted by cpu.weight "
+          "(cgroup v2) or cpu.shares (cgroup v1)");
+ABSL_FLAG(bool, tickless, false,
+          "Preempt tasks with per-cpu timers armed only while a cpu has more "
+          "than one runnable task, instead of checking on every cpu tick");
 
 namespace ghost {
 
@@ -52,6 +61,11 @@ static void ParseAgentConfig(CfsConfig* config) {
 
   config->min_granularity_ = absl::GetFlag(FLAGS_min_granularity);
   config->latency_ = absl::GetFlag(FLAGS_latency);
+  config->wakeup_granularity_ = absl::GetFlag(FLAGS_wakeup_granularity);
+  config->group_scheduling_ = absl::GetFlag(FLAGS_group_scheduling);
+  config->tickless_ = absl::GetFlag(FLAGS_tickless);
+  config->tick_config_ =
+      config->tickless_ ? CpuTickConfig::kNoTicks : CpuTickConfig::kAllTicks;
 }
 
 }  // namespace ghost
@@ -28,7 +28,9 @@
 #include <utility>
 #include <vector>
 
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
 #include "absl/synchronization/mutex.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
@@ -60,10 +62,15 @@ void PrintDebugTaskMessage(std::string message_name, CpuState* cs,
 CfsScheduler::CfsScheduler(Enclave* enclave, CpuList cpulist,
                            std::shared_ptr<TaskAllocator<CfsTask>> allocator,
                            absl::Duration min_granularity,
-                           absl::Duration latency)
+                           absl::Duration latency,
+                           absl::Duration wakeup_granularity,
+                           bool group_scheduling, bool tickless)
     : BasicDispatchScheduler(enclave, std::move(cpulist), std::move(allocator)),
       min_granularity_(min_granularity),
-      latency_(latency) {
+      latency_(latency),
+      wakeup_granularity_(wakeup_granularity),
+      group_scheduling_(group_scheduling),
+      tickless_(tickless) {
   for (const Cpu& cpu : cpus()) {
     CpuState* cs = cpu_state(cpu);
 
@@ -73,6 +80,7 @@ CfsScheduler::CfsScheduler(Enclave* enclave, CpuList cpulist,
       absl::MutexLock l(&cs->run_queue.mu_);
       cs->run_queue.SetMinGranularity(min_granularity_);
       cs->run_queue.SetLatency(latency_);
+      cs->run_queue.SetWakeupGranularity(wakeup_granularity_);
     }
 
     cs->channel = enclave->MakeChannel(GHOST_MAX_QUEUE_ELEMS, cpu.numa_node(),
@@ -81,6 +89,18 @@ CfsScheduler::CfsScheduler(Enclave* enclave, CpuList cpulist,
     if (!default_channel_) {
       default_channel_ = cs->channel.get();
     }
+
+    if (tickless_) {
+      cs->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+      CHECK_GE(cs->timerfd, 0);
+    }
+  }
+}
+
+CfsScheduler::~CfsScheduler() {
+  for (const Cpu& cpu : cpus()) {
+    CpuState* cs = cpu_state(cpu);
+    if (cs->timerfd >= 0) close(cs->timerfd);
   }
 }
 
@@ -146,8 +166,82 @@ Cpu CfsScheduler::SelectTaskRq(CfsTask* task) {
   return next++;
 }
 
+// Returns the path of the cpu controller cgroup in a /proc/<tid>/cgroup file,
+// or an empty string if it cannot be found. Lines have the form
+// "hierarchy-ID:controller-list:cgroup-path". A cgroup v1 "cpu" hierarchy is
+// preferred over the v2 unified hierarchy ("0::path").
+static std::string ParseCpuCgroupPath(std::istream& is) {
+  std::string line;
+  std::string unified;
+  while (std::getline(is, line)) {
+    std::vector<std::string> fields =
+        absl::StrSplit(line, absl::MaxSplits(':', 2));
+    if (fields.size() != 3) continue;
+    if (fields[0] == "0" && fields[1].empty()) {
+      unified = fields[2];
+      continue;
+    }
+    for (absl::string_view controller : absl::StrSplit(fields[1], ',')) {
+      if (controller == "cpu") return fields[2];
+    }
+  }
+  return unified;
+}
+
+// Returns the CFS load weight of the cgroup at `path`: cpu.weight (cgroup v2,
+// default 100) scaled so that the default maps to kNice0Load, or cpu.shares
+// (cgroup v1, default 1024). Falls back to kNice0Load if neither is readable.
+static uint64_t ReadCgroupWeight(const std::string& path) {
+  uint64_t value;
+  std::ifstream weight(absl::StrCat("/sys/fs/cgroup", path, "/cpu.weight"));
+  if (weight >> value) {
+    return std::max<uint64_t>(value * CfsSchedEntity::kNice0Load / 100, 2);
+  }
+  for (absl::string_view mount : {"/sys/fs/cgroup/cpu", "/dev/cgroup/cpu"}) {
+    std::ifstream shares(absl::StrCat(mount, path, "/cpu.shares"));
+    if (shares >> value) return std::max<uint64_t>(value, 2);
+  }
+  return CfsSchedEntity::kNice0Load;
+}
+
+CfsGroup* CfsScheduler::DiscoverGroup(const Gtid& gtid) {
+  std::ifstream ifs(GetProc(absl::StrCat(gtid.tid(), "/cgroup")));
+  if (!ifs) return nullptr;
+
+  std::string path = ParseCpuCgroupPath(ifs);
+  if (path.empty() || path == "/") return nullptr;
+
+  absl::MutexLock l(&groups_mu_);
+  return GetOrCreateGroup(path);
+}
+
+CfsGroup* CfsScheduler::GetOrCreateGroup(const std::string& path) {
+  auto it = groups_.find(path);
+  if (it != groups_.end()) return it->second.get();
+
+  CfsGroup* parent = nullptr;
+  size_t slash = path.find_last_of('/');
+  if (slash != std::string::npos && slash > 0) {
+    parent = GetOrCreateGroup(path.substr(0, slash));
+  }
+
+  auto group =
+      std::make_unique<CfsGroup>(path, parent, ReadCgroupWeight(path));
+  for (const Cpu& cpu : cpus()) {
+    CfsRq* parent_rq =
+        parent ? parent->cfs_rq(cpu.id()) : &cpu_state(cpu)->run_queue;
+    group->AddCpu(cpu, parent_rq);
+  }
+  DPRINT_CFS(1, absl::StrFormat("New group %s with weight %lu", path,
+                                group->weight()));
+
+  CfsGroup* ret = group.get();
+  groups_[path] = std::move(group);
+  return ret;
+}
+
 void CfsScheduler::Migrate(CfsTask* task, Cpu cpu,
-                           StatusWord::BarrierToken seqnum) {
+                           StatusWord::BarrierToken seqnum, bool wakeup) {
   CHECK_EQ(task->cpu, -1);
 
   CpuState* cs = cpu_state(cpu);
@@ -160,7 +254,10 @@ void CfsScheduler::Migrate(CfsTask* task, Cpu cpu,
 
   {
     absl::MutexLock l(&cs->run_queue.mu_);
-    cs->run_queue.EnqueueTask(task);
+    cs->run_queue.EnqueueTask(task, wakeup);
+    if (cs->run_queue.CheckPreemptWakeup(cs, task)) {
+      cs->preempt_curr = true;
+    }
   }
 
   // Get the agent's attention so it notices the new task.
@@ -179,9 +276,13 @@ void CfsScheduler::TaskNew(CfsTask* task, const Message& msg) {
   // an rq lock to set the state.
   task->run_state.Set(CfsTaskState::kBlocked);
 
+  if (group_scheduling_) {
+    task->group = DiscoverGroup(task->gtid);
+  }
+
   if (payload->runnable) {
     Cpu cpu = SelectTaskRq(task);
-    Migrate(task, cpu, msg.seqnum());
+    Migrate(task, cpu, msg.seqnum(), /*wakeup=*/false);
   } else {
     // Wait until task becomes runnable to avoid race between migration
     // and MSG_TASK_WAKEUP showing up on the default channel.
@@ -195,18 +296,25 @@ void CfsScheduler::TaskRunnable(CfsTask* task, const Message& msg) {
     // migrate.
     Cpu cpu = SelectTaskRq(task);
     PrintDebugTaskMessage("TaskRunnable", cpu_state(cpu), task);
-    Migrate(task, cpu, msg.seqnum());
+    // A task that was not runnable at TaskNew has never been enqueued, so
+    // this is not a wakeup as far as placement is concerned.
+    Migrate(task, cpu, msg.seqnum(), /*wakeup=*/task->cfs_rq != nullptr);
   } else {
     CpuState* cs = cpu_state_of(task);
     PrintDebugTaskMessage("TaskRunnable", cs, task);
+    bool preempt = false;
     {
       absl::MutexLock l(&cs->run_queue.mu_);
       if (cs->current == task) {
         task->run_state.Set(CfsTaskState::kRunnable);
       } else {
-        cs->run_queue.EnqueueTask(task);
+        cs->run_queue.EnqueueTask(task, /*wakeup=*/true);
+        preempt = cs->run_queue.CheckPreemptWakeup(cs, task);
+        if (preempt) cs->preempt_curr = true;
       }
     }
+    // Don't wait for the next tick to notice that current should be preempted.
+    if (preempt) PingCpu(topology()->cpu(task->cpu));
   }
 }
 
@@ -267,6 +375,7 @@ void CfsScheduler::TaskYield(CfsTask* task, const Message& msg) {
   CHECK_EQ(cs->current, task);
   {
     absl::MutexLock l(&cs->run_queue.mu_);
+    cs->run_queue.UpdateCurr(cs, payload->runtime);
     task->run_state.Set(CfsTaskState::kRunnable);  // Setting to runnable will
                                                    // trigger a PutPrevTask.
   }
@@ -288,6 +397,7 @@ void CfsScheduler::TaskBlocked(CfsTask* task, const Message& msg) {
 
   {
     absl::MutexLock l(&cs->run_queue.mu_);
+    cs->run_queue.UpdateCurr(cs, payload->runtime);
     task->run_state.Set(CfsTaskState::kBlocked);
   }
 
@@ -306,7 +416,12 @@ void CfsScheduler::TaskPreempted(CfsTask* task, const Message& msg) {
 
   CHECK_EQ(cs->current, task);
 
-  // no-op. the task doesn't change any state.
+  // The task doesn't change any state, but it stopped running, so charge it
+  // for the time it was on cpu.
+  {
+    absl::MutexLock l(&cs->run_queue.mu_);
+    cs->run_queue.UpdateCurr(cs, payload->runtime);
+  }
 
   if (payload->from_switchto) {
     Cpu cpu = topology()->cpu(payload->cpu);
@@ -315,11 +430,16 @@ void CfsScheduler::TaskPreempted(CfsTask* task, const Message& msg) {
 }
 
 void CfsScheduler::TaskSwitchto(CfsTask* task, const Message& msg) {
+  const ghost_msg_payload_task_switchto* payload =
+      static_cast<const ghost_msg_payload_task_switchto*>(msg.payload());
   PrintDebugTaskMessage("TaskSwitchTo", cpu_state_of(task), task);
   CpuState* cs = cpu_state_of(task);
 
   {
     absl::MutexLock l(&cs->run_queue.mu_);
+    if (cs->current == task) {
+      cs->run_queue.UpdateCurr(cs, payload->runtime);
+    }
     task->run_state.Set(CfsTaskState::kBlocked);
   }
 }
@@ -338,6 +458,10 @@ void CfsScheduler::CheckPreemptTick(const Cpu& cpu) {
   CpuState* cs = cpu_state(cpu);
   if (cs->current) {
     absl::MutexLock l(&cs->run_queue.mu_);
+    // Charge current for the time it has run since the last tick, so that its
+    // vruntime is accurate even if it never blocks or is preempted.
+    cs->run_queue.UpdateCurr(cs, cs->current->status_word.runtime());
+
     // If we were on cpu, check if we have run for longer than
     // Granularity(). If so, force picking another task via setting current
     // to nullptr.
@@ -360,6 +484,55 @@ void CfsScheduler::CpuTick(const Message& msg) {
   CheckPreemptTick(topology()->cpu(payload->cpu));
 }
 
+void CfsScheduler::CpuTimerExpired(const Message& msg) {
+  const ghost_msg_payload_timer* payload =
+      static_cast<const ghost_msg_payload_timer*>(msg.payload());
+  CpuState* cs = cpu_state(topology()->cpu(payload->cpu));
+
+  // The slice this timer was armed for has already ended.
+  if (payload->cookie != cs->timer_seq) return;
+  cs->timer_armed = false;
+
+  // The timer was armed for the exact end of current's slice, so there is no
+  // need to check the granularity like CheckPreemptTick() does, which could
+  // be off by the staleness of the status word's runtime.
+  absl::MutexLock l(&cs->run_queue.mu_);
+  if (cs->current) {
+    cs->run_queue.UpdateCurr(cs, cs->current->status_word.runtime());
+    if (!cs->run_queue.Empty()) cs->preempt_curr = true;
+  }
+}
+
+void CfsScheduler::UpdateSliceTimer(const Cpu& cpu, CfsTask* next) {
+  CpuState* cs = cpu_state(cpu);
+
+  bool contended;
+  absl::Duration slice;
+  {
+    absl::MutexLock l(&cs->run_queue.mu_);
+    contended = next && !cs->run_queue.Empty();
+    if (contended) {
+      slice = cs->run_queue.MinPreemptionGranularity() -
+              absl::Nanoseconds(next->status_word.runtime() -
+                                next->runtime_at_first_pick_ns);
+    }
+  }
+
+  if (contended == cs->timer_armed) return;
+
+  // A zero it_value disarms the timer.
+  itimerspec itimerspec = {};
+  if (contended) {
+    // Don't let an already expired slice turn into a timer that never fires.
+    itimerspec.it_value =
+        absl::ToTimespec(std::max(slice, absl::Microseconds(10)));
+  }
+  cs->timer_armed = contended;
+  CHECK_EQ(GhostHelper()->TimerFdSettime(cs->timerfd, /*flags=*/0, &itimerspec,
+                                         cpu, /*type=*/0, ++cs->timer_seq),
+           0);
+}
+
 void CfsScheduler::CfsSchedule(const Cpu& cpu,
                                StatusWord::BarrierToken agent_barrier,
                                bool prio_boost) {
@@ -378,6 +551,7 @@ void CfsScheduler::CfsSchedule(const Cpu& cpu,
           CHECK(false);
           break;
         case CfsTaskState::kBlocked:
+          cs->run_queue.Erase(prev);
           break;
         case CfsTaskState::kDone:
           cs->run_queue.Erase(prev);
@@ -399,6 +573,7 @@ void CfsScheduler::CfsSchedule(const Cpu& cpu,
       cs->current = nullptr;
       cs->run_queue.UpdateMinVruntime(cs);
     }
+    if (tickless_) UpdateSliceTimer(cpu, nullptr);
     // If we are prio_boost'ed, then we are temporarily running at a higher
     // priority than (kernel) CFS. The purpose of this is so that we can
     // reconcile our state with the fact that any task we wanted to be running
@@ -415,9 +590,19 @@ void CfsScheduler::CfsSchedule(const Cpu& cpu,
   }
 
   cs->run_queue.mu_.Lock();
+  // Mirrors PickNextTask()'s check for whether prev keeps running.
+  bool new_slice = !prev || prev->run_state.Get() != CfsTaskState::kRunning ||
+                   cs->preempt_curr;
   CfsTask* next = cs->run_queue.PickNextTask(prev, allocator(), cs);
   cs->run_queue.mu_.Unlock();
 
+  if (tickless_ && new_slice && cs->timer_armed) {
+    // Whatever the timer was armed for, it wasn't `next`'s slice. Forget about
+    // it, so that it is rearmed below and any expiration in flight is ignored.
+    cs->timer_armed = false;
+    cs->timer_seq++;
+  }
+
   cs->current = next;
 
   if (next) {
@@ -431,12 +616,12 @@ void CfsScheduler::CfsSchedule(const Cpu& cpu,
         .commit_flags = COMMIT_AT_TXN_COMMIT | ALLOW_TASK_ONCPU,
     });
 
-    uint64_t before_runtime = next->status_word.runtime();
+    // next's vruntime is charged as it runs, by UpdateCurr() on every tick
+    // and whenever it stops running.
     if (req->Commit()) {
       GHOST_DPRINT(3, stderr, "Task %s oncpu %d", next->gtid.describe(),
                    cpu.id());
-      next->vruntime +=
-          absl::Nanoseconds(next->status_word.runtime() - before_runtime);
+      if (tickless_) UpdateSliceTimer(cpu, next);
     } else {
       GHOST_DPRINT(3, stderr, "CfsSchedule: commit failed (state=%d)",
                    req->state());
@@ -446,6 +631,7 @@ void CfsScheduler::CfsSchedule(const Cpu& cpu,
       // cs->current as what was picked by PickNextTask.
     }
   } else {
+    if (tickless_) UpdateSliceTimer(cpu, nullptr);
     req->LocalYield(agent_barrier, 0);
   }
 }
@@ -507,27 +693,77 @@ void CfsTaskState::AssertValidTransition(State next) {
 }
 #endif  // !NDEBUG
 
-CfsRq::CfsRq() : min_vruntime_(absl::ZeroDuration()), rq_(&CfsTask::Less) {}
+CfsRq::CfsRq() : min_vruntime_(absl::ZeroDuration()) {}
+
+CfsRq::CfsRq(CfsSchedEntity* se)
+    : se_(se), min_vruntime_(absl::ZeroDuration()) {
+  se_->my_q = this;
+}
 
-void CfsRq::EnqueueTask(CfsTask* task) {
+void CfsRq::EnqueueTask(CfsTask* task, bool wakeup) {
   CHECK_GE(task->cpu, 0);
+  DCHECK(!task->on_rq);
 
   DPRINT_CFS(2, absl::StrFormat("[%s]: Enqueing task", task->gtid.describe()));
 
+  task->cfs_rq = task->group ? task->group->cfs_rq(task->cpu) : this;
+
   // We never want to enqueue a new task with a smaller vruntime that we have
   // currently. We also never want to have a task's vruntime go backwards,
   // so we take the max of our current min vruntime and the tasks current one.
-  // Until load balancing is implented, this should just evaluate to
-  // min_vruntime_.
+  // A waking task is credited up to half of latency_ so that, like in the
+  // kernel's place_entity(), interactive tasks get to run soon after waking.
   // TODO: come up with more logical way of handling new tasks with
   // existing vruntimes (e.g. migration from another rq).
-  task->vruntime = std::max(min_vruntime_, task->vruntime);
+  absl::Duration sleeper_credit =
+      wakeup ? latency_ / 2 : absl::ZeroDuration();
+  PlaceEntity(task, sleeper_credit);
   task->run_state.Set(CfsTaskState::kRunnable);
+  AccountEnqueue(task, sleeper_credit);
   InsertTaskIntoRq(task);
 }
 
+bool CfsRq::CheckPreemptWakeup(CpuState* cs, CfsTask* task) {
+  CfsTask* curr = cs->current;
+  if (!curr || curr == task || cs->preempt_curr ||
+      curr->run_state.Get() != CfsTaskState::kRunning) {
+    return false;
+  }
+
+  // Bring curr's vruntime up to date before comparing against it.
+  UpdateCurr(cs, curr->status_word.runtime());
+
+  // Walk both entities up to the first run queue they share (see
+  // find_matching_se() in the kernel).
+  auto depth = [](const CfsSchedEntity* se) {
+    int d = 0;
+    for (const CfsRq* q = se->cfs_rq; q->se_; q = q->se_->cfs_rq) d++;
+    return d;
+  };
+  CfsSchedEntity* se = curr;
+  CfsSchedEntity* pse = task;
+  int se_depth = depth(se);
+  int pse_depth = depth(pse);
+  while (se_depth > pse_depth) {
+    se = se->cfs_rq->se_;
+    se_depth--;
+  }
+  while (pse_depth > se_depth) {
+    pse = pse->cfs_rq->se_;
+    pse_depth--;
+  }
+  while (se->cfs_rq != pse->cfs_rq) {
+    se = se->cfs_rq->se_;
+    pse = pse->cfs_rq->se_;
+  }
+
+  absl::Duration vdiff = se->vruntime - pse->vruntime;
+  return vdiff > pse->ScaleDelta(wakeup_granularity_);
+}
+
 void CfsRq::PutPrevTask(CfsTask* task) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
   CHECK_GE(task->cpu, 0);
+  CHECK(task->on_rq);
 
   DPRINT_CFS(2,
              absl::StrFormat("[%s]: Putting prev task", task->gtid.describe()));
@@ -558,17 +794,23 @@ CfsTask* CfsRq::PickNextTask(CfsTask* prev,
         CHECK(false);
         break;
       case CfsTaskState::kBlocked:
+        // Stop accounting for prev so that its groups may go idle.
+        Erase(prev);
         break;
       case CfsTaskState::kDone:
         Erase(prev);
         allocator->FreeTask(prev);
+        // Don't leave a dangling pointer for UpdateMinVruntime() below.
+        cs->current = nullptr;
         break;
       case CfsTaskState::kRunnable:
         PutPrevTask(prev);
         break;
       case CfsTaskState::kRunning:
         // We had the preempt curr flag set, so we need to put our current task
-        // back into the rq.
+        // back into the rq. It may have run since the tick that preempted it,
+        // so bring its vruntime up to date first.
+        UpdateCurr(cs, prev->status_word.runtime());
         PutPrevTask(prev);
         prev->run_state.Set(CfsTaskState::kRunnable);
         break;
@@ -576,22 +818,33 @@ CfsTask* CfsRq::PickNextTask(CfsTask* prev,
   }
 
   // First, we reconcile our CpuState with the messaging relating to prev.
-  if (rq_.empty()) {
+  if (Empty()) {
     UpdateMinVruntime(cs);
     return nullptr;
   }
 
-  // Get a pointer to the first task. std::{set, multiset} orders by the ::Less
-  // function, implying that, in our case, the first element has the smallest
-  // vruntime (https://www.cplusplus.com/reference/set/set/).
-  auto start_it = rq_.begin();
-  CfsTask* task = *start_it;
+  // Walk down the hierarchy, taking the first entity at each level. RbTree
+  // orders by the ::Less function, implying that, in our case, the first
+  // element has the smallest vruntime. Every group entity in a timeline has at
+  // least one task queued below it, since prev has been reconciled above.
+  CfsRq* q = this;
+  CfsSchedEntity* se;
+  for (;;) {
+    se = q->rq_.First();
+    CHECK_NE(se, nullptr);
+    if (!se->is_group()) break;
+    q = se->my_q;
+  }
+  CfsTask* task = static_cast<CfsTask*>(se);
 
   task->run_state.Set(CfsTaskState::kRunning);
   task->runtime_at_first_pick_ns = task->status_word.runtime();
+  cs->exec_start = task->runtime_at_first_pick_ns;
 
-  // Remove the task from the timeline.
-  rq_.erase(start_it);
+  // Remove the task from the timeline. The task (and therefore its groups)
+  // remain accounted for while it is on cpu.
+  q->rq_.Erase(task);
+  nr_queued_--;
 
   // min_vruntime is used for Enqueing new tasks. We want to place them at
   // at least the current moment in time. Placing them before min_vruntime,
@@ -604,17 +857,35 @@ CfsTask* CfsRq::PickNextTask(CfsTask* prev,
 
 void CfsRq::Erase(CfsTask* task) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
   DPRINT_CFS(2, absl::StrFormat("[%s]: Erasing task", task->gtid.describe()));
-  if (rq_.erase(task) == 0) {
-    // TODO: Figure out the case where we call Erase, but the task is not
-    // actually in the rq. This seems to sporadically happen when processing a
-    // TaskDeparted message. In reality, this is harmless as adding a check for
-    // is my task in the rq currently would be equivalent.
-    // DPRINT_CFS(
-    //     1, absl::StrFormat(
-    //            "[%s] Attempted to remove task with state %d while not in rq",
-    //            task->gtid.describe(), task->run_state.Get()));
-    // CHECK(false);
+  // It is harmless to call Erase on a task that is not in the rq, e.g. a task
+  // that is on cpu or that is blocked and then departs.
+  if (task->cfs_rq && task->cfs_rq->RemoveEntity(task)) {
+    nr_queued_--;
   }
+  if (task->on_rq) {
+    AccountDequeue(task);
+  }
+}
+
+void CfsRq::UpdateVruntime(CfsTask* task, absl::Duration delta) {
+  for (CfsSchedEntity* se = task; se; se = se->cfs_rq->se_) {
+    // The timeline is ordered by vruntime, so an entity that is in it must be
+    // taken out while we change its key.
+    CfsRq* q = se->cfs_rq;
+    bool queued = q->RemoveEntity(se);
+    se->vruntime += se->ScaleDelta(delta);
+    if (queued) q->InsertEntity(se);
+  }
+}
+
+void CfsRq::UpdateCurr(CpuState* cs, uint64_t runtime) {
+  CfsTask* curr = cs->current;
+  if (!curr || runtime <= cs->exec_start) return;
+
+  absl::Duration delta = absl::Nanoseconds(runtime - cs->exec_start);
+  cs->exec_start = runtime;
+  UpdateVruntime(curr, delta);
+  UpdateMinVruntime(cs);
 }
 
 void CfsRq::UpdateMinVruntime(CpuState* cs) {
@@ -625,19 +896,27 @@ void CfsRq::UpdateMinVruntime(CpuState* cs) {
   // - if a new task is inserted into the rq, it doesn't get treated unfairly
   // wrt to curr
   CfsTask* curr = cs->current;
-  CfsTask* leftmost = (rq_.empty()) ? nullptr : *rq_.begin();
-
-  absl::Duration vruntime = min_vruntime_;
 
   // If our curr task should/is on the rq then it should be in contention
   // for the min vruntime.
+  if (!curr || (curr->run_state.Get() != CfsTaskState::kRunnable &&
+                curr->run_state.Get() != CfsTaskState::kRunning)) {
+    UpdateLevelMinVruntime(nullptr);
+    return;
+  }
+
+  // Every level between curr and the root has curr (or its group) running.
+  for (CfsSchedEntity* se = curr; se; se = se->cfs_rq->se_) {
+    se->cfs_rq->UpdateLevelMinVruntime(se);
+  }
+}
+
+void CfsRq::UpdateLevelMinVruntime(CfsSchedEntity* curr) {
+  CfsSchedEntity* leftmost = rq_.First();
+
+  absl::Duration vruntime = min_vruntime_;
   if (curr) {
-    if (curr->run_state.Get() == CfsTaskState::kRunnable ||
-        curr->run_state.Get() == CfsTaskState::kRunning) {
-      vruntime = curr->vruntime;
-    } else {
-      curr = nullptr;
-    }
+    vruntime = curr->vruntime;
   }
 
   // non-empty rq
@@ -658,13 +937,15 @@ void CfsRq::SetMinGranularity(absl::Duration t) {
 
 void CfsRq::SetLatency(absl::Duration t) { latency_ = t; }
 
+void CfsRq::SetWakeupGranularity(absl::Duration t) {
+  wakeup_granularity_ = t;
+}
+
 absl::Duration CfsRq::MinPreemptionGranularity() {
   // Get the number of tasks our cpu is handling. As we only call this to check
   // if cs->current should be pulled be preempted, the number of tasks
-  // associated with the cpu is rq_.size() + 1;
-  std::multiset<ghost::CfsTask*,
-                bool (*)(ghost::CfsTask*, ghost::CfsTask*)>::size_type tasks =
-      rq_.size() + 1;
+  // associated with the cpu is Size() + 1;
+  size_t tasks = Size() + 1;
   if (tasks * min_preemption_granularity_ > latency_) {
     // If we target latency_, each task will run for less than min_granularity
     // so we just return min_granularity_.
@@ -678,19 +959,71 @@ absl::Duration CfsRq::MinPreemptionGranularity() {
 }
 
 void CfsRq::InsertTaskIntoRq(CfsTask* task) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
-  rq_.insert(task);
-  min_vruntime_ = (*rq_.begin())->vruntime;
+  task->cfs_rq->InsertEntity(task);
+  nr_queued_++;
   DPRINT_CFS(2, absl::StrFormat("[%s]: Inserted into run queue",
                                 task->gtid.describe()));
 }
 
+void CfsRq::InsertEntity(CfsSchedEntity* se) {
+  rq_.Insert(se);
+  min_vruntime_ = rq_.First()->vruntime;
+}
+
+bool CfsRq::RemoveEntity(CfsSchedEntity* se) {
+  if (!se->rb_linked()) return false;
+  rq_.Erase(se);
+  return true;
+}
+
+void CfsRq::PlaceEntity(CfsSchedEntity* se, absl::Duration sleeper_credit) {
+  se->vruntime =
+      std::max(se->cfs_rq->min_vruntime_ - sleeper_credit, se->vruntime);
+}
+
+void CfsRq::AccountEnqueue(CfsSchedEntity* se, absl::Duration sleeper_credit) {
+  se->on_rq = true;
+  for (CfsRq* q = se->cfs_rq; q; q = q->se_ ? q->se_->cfs_rq : nullptr) {
+    if (q->h_nr_running_++ == 0 && q->se_) {
+      // The group just became runnable on this cpu. As with tasks, we don't
+      // want it to come back with a vruntime smaller than its peers.
+      CfsSchedEntity* gse = q->se_;
+      PlaceEntity(gse, sleeper_credit);
+      gse->on_rq = true;
+      gse->cfs_rq->InsertEntity(gse);
+    }
+  }
+}
+
+void CfsRq::AccountDequeue(CfsSchedEntity* se) {
+  se->on_rq = false;
+  for (CfsRq* q = se->cfs_rq; q; q = q->se_ ? q->se_->cfs_rq : nullptr) {
+    CHECK_GT(q->h_nr_running_, 0);
+    if (--q->h_nr_running_ == 0 && q->se_) {
+      CfsSchedEntity* gse = q->se_;
+      CHECK(gse->cfs_rq->RemoveEntity(gse));
+      gse->on_rq = false;
+    }
+  }
+}
+
+CfsGroup::CfsGroup(std::string path, CfsGroup* parent, uint64_t weight)
+    : path_(std::move(path)), parent_(parent), weight_(weight) {}
+
+void CfsGroup::AddCpu(const Cpu& cpu, CfsRq* parent_rq) {
+  CHECK_EQ(per_cpu_[cpu.id()].get(), nullptr);
+  per_cpu_[cpu.id()] = std::make_unique<PerCpu>(weight_);
+  per_cpu_[cpu.id()]->se.cfs_rq = parent_rq;
+}
+
 std::unique_ptr<CfsScheduler> MultiThreadedCfsScheduler(
     Enclave* enclave, CpuList cpulist, absl::Duration min_granularity,
-    absl::Duration latency) {
+    absl::Duration latency, absl::Duration wakeup_granularity,
+    bool group_scheduling, bool tickless) {
   auto allocator = std::make_shared<ThreadSafeMallocTaskAllocator<CfsTask>>();
-  auto scheduler = std::make_unique<CfsScheduler>(enclave, std::move(cpulist),
-                                                  std::move(allocator),
-                                                  min_granularity, latency);
+  auto scheduler = std::make_unique<CfsScheduler>(
+      enclave, std::move(cpulist), std::move(allocator), min_granularity,
+      latency, wakeup_granularity, group_scheduling, tickless);
   return scheduler;
 }
 
@@ -22,15 +22,17 @@
 #include <iostream>
 #include <memory>
 #include <ostream>
-#include <set>
+#include <string>
 #include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/strings/str_format.h"
 #include "absl/synchronization/mutex.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "lib/agent.h"
 #include "lib/base.h"
+#include "lib/rbtree.h"
 #include "lib/scheduler.h"
 
 static const absl::Time start = absl::Now();
@@ -109,29 +111,65 @@ class CfsTaskState {
 };
 
 struct CpuState;
-
-struct CfsTask : public Task<> {
-  explicit CfsTask(Gtid d_task_gtid, ghost_sw_info sw_info)
-      : Task<>(d_task_gtid, sw_info), vruntime(absl::ZeroDuration()) {}
-  ~CfsTask() override {}
-
-  // std::multiset expects one to pass a strict (< not <=) weak ordering
-  // function as a template parameter. Technically, this doesn't have to be
-  // inside of the struct, but it seems logical to keep this here.
-  static bool Less(CfsTask* a, CfsTask* b) {
+class CfsGroup;
+class CfsRq;
+
+// A CfsSchedEntity is anything that a CfsRq orders by vruntime: either a
+// CfsTask or the per-cpu representative of a CfsGroup in its parent's run
+// queue. This mirrors `struct sched_entity` in the kernel. The entity is linked
+// directly into its CfsRq's timeline, so enqueueing it does not allocate.
+struct CfsSchedEntity : public RbTreeNode {
+  // The load weight of a nice 0 task (NICE_0_LOAD in the kernel). A cgroup
+  // with the default cpu.weight of 100 is given this weight as well.
+  static constexpr uint64_t kNice0Load = 1024;
+
+  // RbTree expects one to pass a strict (< not <=) weak ordering function as
+  // a template parameter. Technically, this doesn't have to be inside of the
+  // struct, but it seems logical to keep this here.
+  static bool Less(const CfsSchedEntity* a, const CfsSchedEntity* b) {
     if (a->vruntime == b->vruntime) {
       return (uintptr_t)a < (uintptr_t)b;
     }
     return a->vruntime < b->vruntime;
   }
 
+  // Returns true if this entity represents a group rather than a task.
+  bool is_group() const { return my_q != nullptr; }
+
+  // Converts `delta` of real runtime into vruntime for this entity.
+  absl::Duration ScaleDelta(absl::Duration delta) const {
+    if (weight == kNice0Load) return delta;
+    return delta * kNice0Load / weight;
+  }
+
+  // Cfs sorts entities by vruntime, so we need to keep track of how long an
+  // entity has been running.
+  absl::Duration vruntime = absl::ZeroDuration();
+  uint64_t weight = kNice0Load;
+
+  // The run queue this entity is queued on. For tasks, this is set when the
+  // task is enqueued on a cpu.
+  CfsRq* cfs_rq = nullptr;
+  // For group entities, the run queue "owned" by this entity, i.e. the group's
+  // run queue on the same cpu. nullptr for tasks.
+  CfsRq* my_q = nullptr;
+  // True while the entity is accounted for in cfs_rq, i.e. it is either in
+  // the timeline or is the (ancestor of the) task currently running.
+  bool on_rq = false;
+};
+
+struct CfsTask : public Task<>, public CfsSchedEntity {
+  explicit CfsTask(Gtid d_task_gtid, ghost_sw_info sw_info)
+      : Task<>(d_task_gtid, sw_info) {}
+  ~CfsTask() override {}
+
   CfsTaskState run_state =
       CfsTaskState(CfsTaskState::kBlocked, gtid.describe());
   int cpu = -1;
 
-  // Cfs sorts tasks by vruntime, so we need to keep track of how long a task
-  // has been running.
-  absl::Duration vruntime;
+  // The cgroup this task belongs to, or nullptr if it is in the root group (or
+  // if group scheduling is disabled).
+  CfsGroup* group = nullptr;
 
   // runtime_at_first_pick is how much runtime this task had at its initial
   // picking. This timestamp does not change unless we are put back in the
@@ -141,15 +179,28 @@ struct CfsTask : public Task<> {
   uint64_t runtime_at_first_pick_ns;
 };
 
+// A CfsRq is a vruntime-ordered timeline of scheduling entities. Every cpu has
+// a root CfsRq (CpuState::run_queue) and every CfsGroup has one nested CfsRq
+// per cpu, represented in its parent's CfsRq by a group CfsSchedEntity.
+//
+// Locking: the root CfsRq's mu_ protects the root and every nested CfsRq on
+// the same cpu, as well as the state of any task associated with them. The
+// mu_ of a nested CfsRq is unused. Only the root CfsRq's public methods may be
+// called from outside of this class.
 class CfsRq {
  public:
+  // Constructs a root run queue.
   explicit CfsRq();
+  // Constructs the run queue owned by group entity `se`.
+  explicit CfsRq(CfsSchedEntity* se);
   CfsRq(const CfsRq&) = delete;
   CfsRq& operator=(CfsRq&) = delete;
 
   // See CfsRq::granularity_ for a description of how these parameters work.
   void SetMinGranularity(absl::Duration t) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
   void SetLatency(absl::Duration t) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void SetWakeupGranularity(absl::Duration t)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
   // Returns the length of time that the task should run in real time before it
   // is preempted. This value is equivalent to:
@@ -166,22 +217,52 @@ class CfsRq {
   absl::Duration MinPreemptionGranularity() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
   // PickNextTask checks if prev should run again, and if so, returns prev.
-  // Otherwise, it picks the task with the smallest vruntime.
+  // Otherwise, it walks down the group hierarchy, picking the entity with the
+  // smallest vruntime at each level, until it reaches a task.
   // PickNextTask also is the sync up point for processing state changes to
   // prev. PickNextTask sets the state of its returned task to kOnCpu.
   CfsTask* PickNextTask(CfsTask* prev, TaskAllocator<ghost::CfsTask>* allocator,
                         CpuState* cs) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
-  // Enqueues a new task or a task that is coming from being blocked.
-  void EnqueueTask(CfsTask* task) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  // Enqueues a new task or, if `wakeup`, a task that is coming from being
+  // blocked. The task is placed on its group's run queue for task->cpu, and
+  // any group entity on the path to the root that was idle is enqueued as
+  // well. Waking entities get a sleeper credit of up to half of latency_
+  // relative to min_vruntime, so that they run soon without being able to
+  // bank the time they spent asleep.
+  void EnqueueTask(CfsTask* task, bool wakeup)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Returns true if `task`, which was just enqueued, should preempt
+  // cs->current. This is the case if, at the first level of the hierarchy
+  // where the two share a run queue, current's vruntime is ahead of task's by
+  // more than the wakeup granularity (scaled by task's weight). This mirrors
+  // check_preempt_wakeup() in the kernel.
+  bool CheckPreemptWakeup(CpuState* cs, CfsTask* task)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
   // Enqueue a task that is transitioning from being on the cpu to off the cpu.
   void PutPrevTask(CfsTask* task) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
-  // Erase 'task' from the runqueue. Task must be on rq.
+  // Erase 'task' from the runqueue and stop accounting for it in the group
+  // hierarchy. It is fine to call this on a task that is not on the rq.
   void Erase(CfsTask* task) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
-  size_t Size() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) { return rq_.size(); }
+  // Charges `delta` of runtime to `task` and to every group entity between it
+  // and the root, scaled by each entity's weight.
+  void UpdateVruntime(CfsTask* task, absl::Duration delta)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Charges cs->current for the time it has run since cs->exec_start, given
+  // its cumulative `runtime` in ns (from its status word or from a message
+  // payload), and advances cs->exec_start. This mirrors update_curr() in the
+  // kernel. Stale values of `runtime` are ignored.
+  void UpdateCurr(CpuState* cs, uint64_t runtime)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Returns the number of tasks waiting in the hierarchy rooted at this rq.
+  // The currently running task is not included.
+  size_t Size() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) { return nr_queued_; }
 
   bool Empty() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) { return Size() == 0; }
 
@@ -193,23 +274,103 @@ class CfsRq {
   mutable absl::Mutex mu_;
 
  private:
+  // The helpers below operate on any level of the hierarchy and REQUIRE the
+  // root CfsRq's mu_.
+
   // Inserts a task into the backing runqueue.
   // Preconditons: task->vruntime has been set to a logical value.
-  void InsertTaskIntoRq(CfsTask* task) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void InsertTaskIntoRq(CfsTask* task);
+
+  // Inserts/removes `se` into/from this rq's timeline.
+  void InsertEntity(CfsSchedEntity* se);
+  bool RemoveEntity(CfsSchedEntity* se);
+
+  // Sets se->vruntime to at least its cfs_rq's min_vruntime minus
+  // `sleeper_credit`, so that it neither goes back in time nor starves its
+  // peers.
+  static void PlaceEntity(CfsSchedEntity* se, absl::Duration sleeper_credit);
 
-  absl::Duration min_vruntime_ ABSL_GUARDED_BY(mu_);
+  // Starts accounting for task `se` in its cfs_rq and every ancestor. Group
+  // entities whose subtree was idle are placed, with `sleeper_credit`, and
+  // inserted into their parent's timeline.
+  void AccountEnqueue(CfsSchedEntity* se, absl::Duration sleeper_credit);
+  // Reverse of AccountEnqueue: group entities whose subtree becomes idle are
+  // removed from their parent's timeline.
+  void AccountDequeue(CfsSchedEntity* se);
+
+  // Updates min_vruntime_ given `curr`, the entity of this rq that is
+  // currently running (or nullptr).
+  void UpdateLevelMinVruntime(CfsSchedEntity* curr);
+
+  // The group entity that owns this rq, or nullptr for the root.
+  CfsSchedEntity* const se_ = nullptr;
+
+  // The number of tasks accounted for in this rq's subtree, including the
+  // running task. A group entity is in its parent's timeline iff this is
+  // non-zero for its rq.
+  uint64_t h_nr_running_ = 0;
+
+  // The number of tasks waiting in leaf timelines. Only maintained by the
+  // root.
+  size_t nr_queued_ = 0;
+
+  absl::Duration min_vruntime_;
 
   // Unlike in-kernel CFS, we want to have this properties per run-queue instead
   // of system wide.
   absl::Duration min_preemption_granularity_ ABSL_GUARDED_BY(mu_);
   absl::Duration latency_ ABSL_GUARDED_BY(mu_);
+  // How far ahead in vruntime cs->current must be of a waking task before
+  // the waking task preempts it.
+  absl::Duration wakeup_granularity_ ABSL_GUARDED_BY(mu_);
+
+  // Like CFS in the kernel, the timeline is an intrusive red-black tree that
+  // caches its leftmost entity, so picking the next entity is O(1) and
+  // enqueueing/erasing is O(log n) without allocating.
+  RbTree<CfsSchedEntity, &CfsSchedEntity::Less> rq_;
+};
+
+// A CfsGroup mirrors a cgroup (cpu controller) that contains ghOSt tasks. Each
+// group has a run queue and a group entity on every enclave cpu; the group
+// entity is queued in the parent group's run queue on the same cpu (or in the
+// cpu's root run queue for top-level groups) with a weight derived from the
+// cgroup's cpu.weight.
+//
+// Note that, unlike the kernel, a group's weight is not divided among cpus in
+// proportion to the group's load on each cpu: a group competes with its full
+// weight on every cpu where it has runnable tasks.
+class CfsGroup {
+ public:
+  CfsGroup(std::string path, CfsGroup* parent, uint64_t weight);
+  CfsGroup(const CfsGroup&) = delete;
+  CfsGroup& operator=(const CfsGroup&) = delete;
+
+  // Creates the group's run queue and group entity for `cpu`. `parent_rq` is
+  // the run queue that the group entity is queued on.
+  void AddCpu(const Cpu& cpu, CfsRq* parent_rq);
+
+  // Returns the group's run queue on `cpu`.
+  CfsRq* cfs_rq(int cpu) const {
+    DCHECK_NE(per_cpu_[cpu].get(), nullptr);
+    return &per_cpu_[cpu]->rq;
+  }
+
+  const std::string& path() const { return path_; }
+  CfsGroup* parent() const { return parent_; }
+  uint64_t weight() const { return weight_; }
+
+ private:
+  struct PerCpu {
+    explicit PerCpu(uint64_t weight) : rq(&se) { se.weight = weight; }
 
-  // We use a set as the backing data structure as, according to the
-  // C++ standard, it is backed by a red-black tree, which is the backing
-  // data structure in CFS in the the kernel. While opaque, using an std::
-  // container is easiest way to use a red-black tree short of writing or
-  // importing our own.
-  std::set<CfsTask*, decltype(&CfsTask::Less)> rq_ ABSL_GUARDED_BY(mu_);
+    CfsSchedEntity se;
+    CfsRq rq;
+  };
+
+  const std::string path_;
+  CfsGroup* const parent_;
+  const uint64_t weight_;
+  std::unique_ptr<PerCpu> per_cpu_[MAX_CPUS];
 };
 
 struct CpuState {
@@ -223,14 +384,30 @@ struct CpuState {
   CfsRq run_queue;
   // Should we keep running the current task.
   bool preempt_curr = false;
+  // The cumulative runtime of `current`, in ns, up to which its vruntime has
+  // been charged. Protected by run_queue.mu_.
+  uint64_t exec_start = 0;
+
+  // Tickless mode only: a timerfd that ends current's slice by producing a
+  // MSG_CPU_TIMER_EXPIRED for this cpu's agent. These are only accessed by
+  // this cpu's agent.
+  int timerfd = -1;
+  // Whether timerfd is armed for the current slice.
+  bool timer_armed = false;
+  // Bumped whenever a new slice starts or timerfd is (re)armed or disarmed.
+  // It is used as the timer's cookie, so that expirations that were already
+  // in flight can be recognized as stale.
+  uint64_t timer_seq = 0;
 } ABSL_CACHELINE_ALIGNED;
 
 class CfsScheduler : public BasicDispatchScheduler<CfsTask> {
  public:
   explicit CfsScheduler(Enclave* enclave, CpuList cpulist,
                         std::shared_ptr<TaskAllocator<CfsTask>> allocator,
-                        absl::Duration min_granularity, absl::Duration latency);
-  ~CfsScheduler() final {}
+                        absl::Duration min_granularity, absl::Duration latency,
+                        absl::Duration wakeup_granularity,
+                        bool group_scheduling, bool tickless);
+  ~CfsScheduler() final;
 
   void Schedule(const Cpu& cpu, const StatusWord& sw);
 
@@ -271,6 +448,7 @@ class CfsScheduler : public BasicDispatchScheduler<CfsTask> {
   void TaskPreempted(CfsTask* task, const Message& msg) final;
   void TaskSwitchto(CfsTask* task, const Message& msg) final;
   void CpuTick(const Message& msg) final;
+  void CpuTimerExpired(const Message& msg) final;
 
  private:
   // Checks if we should preempt the current task. If so, sets preempt_curr_.
@@ -287,13 +465,27 @@ class CfsScheduler : public BasicDispatchScheduler<CfsTask> {
   // freeing to PickNextTask.
   void HandleTaskDone(CfsTask* task, bool from_switchto);
 
-  // Migrate takes task and places it on cpu's run queue.
-  void Migrate(CfsTask* task, Cpu cpu, StatusWord::BarrierToken seqnum);
+  // Migrate takes task and places it on cpu's run queue. `wakeup` is true if
+  // the task is coming from being blocked rather than being new.
+  void Migrate(CfsTask* task, Cpu cpu, StatusWord::BarrierToken seqnum,
+               bool wakeup);
   Cpu SelectTaskRq(CfsTask* task);
   void DumpAllTasks();
 
+  // Returns the CfsGroup of the cgroup that `gtid` belongs to, creating it
+  // and its ancestors if needed. Returns nullptr for the root cgroup or if the
+  // cgroup cannot be determined (e.g. the task already exited).
+  CfsGroup* DiscoverGroup(const Gtid& gtid);
+  CfsGroup* GetOrCreateGroup(const std::string& path)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(groups_mu_);
+
   void PingCpu(const Cpu& cpu);
 
+  // Tickless mode: arms cpu's timerfd for the end of `next`'s slice if other
+  // tasks are waiting for the cpu, and disarms it otherwise. `next` may be
+  // nullptr if the cpu is going idle.
+  void UpdateSliceTimer(const Cpu& cpu, CfsTask* next);
+
   CpuState* cpu_state(const Cpu& cpu) { return &cpu_states_[cpu.id()]; }
 
   CpuState* cpu_state_of(const CfsTask* task) {
@@ -307,13 +499,29 @@ class CfsScheduler : public BasicDispatchScheduler<CfsTask> {
 
   absl::Duration min_granularity_;
   absl::Duration latency_;
+  absl::Duration wakeup_granularity_;
+
+  // If true, tasks are placed in the CfsGroup of their cgroup. Otherwise all
+  // tasks are in the root group.
+  const bool group_scheduling_;
+  absl::Mutex groups_mu_;
+  // Groups are never freed: a cgroup that has ever contained a ghOSt task
+  // stays in the hierarchy for the lifetime of the scheduler.
+  absl::flat_hash_map<std::string, std::unique_ptr<CfsGroup>> groups_
+      ABSL_GUARDED_BY(groups_mu_);
+
+  // If true, slices are ended by per-cpu timers that are only armed while a
+  // cpu is contended, rather than by checking the granularity on every
+  // MSG_CPU_TICK.
+  const bool tickless_;
 
   friend class CfsRq;
 };
 
 std::unique_ptr<CfsScheduler> MultiThreadedCfsScheduler(
     Enclave* enclave, CpuList cpulist, absl::Duration min_granularity,
-    absl::Duration latency);
+    absl::Duration latency, absl::Duration wakeup_granularity,
+    bool group_scheduling, bool tickless);
 class CfsAgent : public LocalAgent {
  public:
   CfsAgent(Enclave* enclave, Cpu cpu, CfsScheduler* scheduler)
@@ -339,6 +547,12 @@ class CfsConfig : public AgentConfig {
 
   absl::Duration min_granularity_;
   absl::Duration latency_;
+  absl::Duration wakeup_granularity_ = absl::Milliseconds(1);
+  // Enables cgroup-based group scheduling. See CfsGroup.
+  bool group_scheduling_ = false;
+  // Ends slices with per-cpu timers instead of ticks. Set tick_config_ to
+  // CpuTickConfig::kNoTicks along with this.
+  bool tickless_ = false;
 };
 
 // TODO: Pull these classes out into different files.
@@ -348,7 +562,9 @@ class FullCfsAgent : public FullAgent<EnclaveType> {
   explicit FullCfsAgent(CfsConfig config) : FullAgent<EnclaveType>(config) {
     scheduler_ =
         MultiThreadedCfsScheduler(&this->enclave_, *this->enclave_.cpus(),
-                                  config.min_granularity_, config.latency_);
+                                  config.min_granularity_, config.latency_,
+                                  config.wakeup_granularity_,
+                                  config.group_scheduling_, config.tickless_);
     this->StartAgentTasks();
     this->enclave_.Ready();
   }
@@ -0,0 +1,83 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "schedulers/edf/admission.h"
+
+#include <algorithm>
+
+#include "lib/base.h"
+#include "shared/prio_table.h"
+
+namespace ghost {
+
+bool AdmissionControl::ParsePolicy(absl::string_view name, Policy* policy) {
+  if (name == "none") {
+    *policy = Policy::kNone;
+  } else if (name == "reject") {
+    *policy = Policy::kReject;
+  } else if (name == "degrade") {
+    *policy = Policy::kDegrade;
+  } else if (name == "best_effort") {
+    *policy = Policy::kBestEffort;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+AdmissionControl::AdmissionControl(Policy policy, double bound, int num_cpus)
+    : policy_(policy), capacity_(bound * num_cpus) {
+  CHECK_GT(bound, 0.0);
+  CHECK_GT(num_cpus, 0);
+}
+
+AdmissionControl::Decision AdmissionControl::Admit(absl::Duration runtime,
+                                                   absl::Duration period) {
+  if (policy_ == Policy::kNone || period <= absl::ZeroDuration()) {
+    return {WORK_CLASS_ADMITTED, period, runtime};
+  }
+
+  const double utilization = absl::FDivDuration(runtime, period);
+  if (reserved_ + utilization <= capacity_) {
+    reserved_ += utilization;
+    return {WORK_CLASS_ADMITTED, period, runtime};
+  }
+
+  switch (policy_) {
+    case Policy::kReject:
+      return {WORK_CLASS_REJECTED, period, runtime};
+    case Policy::kDegrade: {
+      // Give the work class whatever capacity is left, unless that is so
+      // little that its period would be absurdly long.
+      const double remaining = capacity_ - reserved_;
+      if (remaining < utilization / 1000) break;
+      reserved_ = capacity_;
+      return {WORK_CLASS_DEGRADED, runtime / remaining, runtime};
+    }
+    default:
+      break;
+  }
+  return {WORK_CLASS_BEST_EFFORT, period, runtime};
+}
+
+void AdmissionControl::Release(absl::Duration runtime, absl::Duration period) {
+  // Admit() reserved nothing for these.
+  if (policy_ == Policy::kNone || period <= absl::ZeroDuration()) return;
+
+  // A degraded work class reserved runtime / (its degraded period). Clamp so
+  // that rounding never leaves a negative reservation behind.
+  reserved_ = std::max(reserved_ - absl::FDivDuration(runtime, period), 0.0);
+}
+
+}  // namespace ghost
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GHOST_SCHEDULERS_EDF_ADMISSION_H_
+#define GHOST_SCHEDULERS_EDF_ADMISSION_H_
+
+#include <cstdint>
+
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+
+namespace ghost {
+
+// Utilization-based admission control for repeating work classes.
+//
+// A work class that runs for `runtime` every `period` uses runtime / period of
+// a cpu. Work classes are admitted in the order they are registered for as
+// long as the total stays within `bound` times the number of cpus that run
+// them, which keeps an overloaded enclave from missing every deadline instead
+// of just those of the work that does not fit. A work class that does not fit
+// is handled according to the Policy.
+//
+// One-shot work classes have no period, so their utilization is unknown and
+// they are always admitted.
+class AdmissionControl {
+ public:
+  enum class Policy {
+    // Admit everything. This is the behavior without admission control.
+    kNone,
+    // Never run the sched items of a work class that does not fit.
+    kReject,
+    // Stretch the period of a work class that does not fit until it does, or
+    // run it as best-effort if there is no capacity left at all.
+    kDegrade,
+    // Run a work class that does not fit after all admitted work.
+    kBestEffort,
+  };
+
+  // Parses "none", "reject", "degrade" or "best_effort" into `policy`.
+  // Returns false if `name` is not one of those.
+  static bool ParsePolicy(absl::string_view name, Policy* policy);
+
+  struct Decision {
+    // One of the WORK_CLASS_ADMISSION values in shared/prio_table.h.
+    uint32_t admission;
+    // The period to schedule the work class with. Longer than the requested
+    // period if the work class was degraded.
+    absl::Duration period;
+    // The runtime the work class was admitted with, to pass to Release().
+    absl::Duration runtime;
+  };
+
+  AdmissionControl(Policy policy, double bound, int num_cpus);
+
+  // Decides how to run a work class that needs `runtime` every `period`, where
+  // a zero `period` means the work class is one-shot. Admitted and degraded
+  // work classes reserve their utilization until it is released.
+  Decision Admit(absl::Duration runtime, absl::Duration period);
+
+  // Releases the utilization reserved by an admitted or degraded work class,
+  // given the `runtime` and `period` of its Decision, once it is gone.
+  void Release(absl::Duration runtime, absl::Duration period);
+
+  // The utilization that work classes may reserve, in cpus.
+  double capacity() const { return capacity_; }
+  // The utilization reserved so far, in cpus.
+  double reserved() const { return reserved_; }
+
+ private:
+  const Policy policy_;
+  const double capacity_;
+  double reserved_ = 0.0;
+};
+
+}  // namespace ghost
+
+#endif  // GHOST_SCHEDULERS_EDF_ADMISSION_H_
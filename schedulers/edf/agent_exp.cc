@@ -29,6 +29,16 @@ ABSL_FLAG(
     int32_t, globalcpu, -1,
     "Global cpu. If -1, then defaults to the lowest CPU in <ghost_cpus>)");
 ABSL_FLAG(bool, ticks, false, "Generate cpu tick messages");
+ABSL_FLAG(bool, check_runqueue, false,
+          "Validate the whole runqueue on every update (slow, for debugging)");
+ABSL_FLAG(std::string, admission, "none",
+          "What to do with repeating work classes that do not fit within "
+          "--utilization_bound: none, reject, degrade or best_effort");
+ABSL_FLAG(double, utilization_bound, 1.0,
+          "Fraction of each cpu that admitted work classes may reserve");
+ABSL_FLAG(bool, bpf_next_up, false,
+          "Let bpf-pnt run the next earliest-deadline task on a cpu that goes "
+          "idle, without waiting for the global agent");
 ABSL_FLAG(std::string, enclave, "", "Connect to preexisting enclave directory");
 
 namespace ghost {
@@ -53,6 +63,12 @@ void ParseGlobalConfig(GlobalConfig* config) {
   config->global_cpu_ = topology->cpu(globalcpu);
   config->edf_ticks_ = absl::GetFlag(FLAGS_ticks) ? CpuTickConfig::kAllTicks
                                                   : CpuTickConfig::kNoTicks;
+  config->check_runqueue_ = absl::GetFlag(FLAGS_check_runqueue);
+  CHECK(AdmissionControl::ParsePolicy(absl::GetFlag(FLAGS_admission),
+                                      &config->admission_policy_));
+  config->utilization_bound_ = absl::GetFlag(FLAGS_utilization_bound);
+  CHECK_GT(config->utilization_bound_, 0.0);
+  config->bpf_next_up_ = absl::GetFlag(FLAGS_bpf_next_up);
 
   std::string enclave = absl::GetFlag(FLAGS_enclave);
   if (!enclave.empty()) {
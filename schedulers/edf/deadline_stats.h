@@ -0,0 +1,134 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GHOST_SCHEDULERS_EDF_DEADLINE_STATS_H_
+#define GHOST_SCHEDULERS_EDF_DEADLINE_STATS_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "absl/time/time.h"
+#include "lib/base.h"
+#include "lib/histogram.h"
+#include "lib/topology.h"
+
+namespace ghost {
+
+// Deadline accounting for one work class, summed over all cpus. This is plain
+// old data so that it can be returned by the kDeadlineStats agent RPC.
+struct DeadlineStatsSnapshot {
+  // Closures that completed.
+  uint64_t completed = 0;
+  // Closures that completed after their deadline.
+  uint64_t missed = 0;
+  // Closures whose runtime exceeded the work class's runtime estimate.
+  uint64_t overran = 0;
+  // How late the missed closures completed.
+  DurationHistogram::Slots tardiness = {};
+  // The absolute difference between the runtime of each closure and the
+  // estimate that its deadline was scheduled with.
+  DurationHistogram::Slots estimate_error = {};
+
+  double miss_ratio() const {
+    return completed ? static_cast<double>(missed) / completed : 0.0;
+  }
+};
+
+// Counts deadline misses, tardiness and runtime estimate errors per work class.
+//
+// Work classes are identified by their wcid alone, so classes with the same id
+// in different orchestrators are accounted together. Ids at or above
+// kMaxWorkClasses share the last slot.
+//
+// Samples are recorded into per-cpu shards of atomic counters, indexed by the
+// cpu that the closure last ran on. Recording never takes a lock or shares a
+// cache line with another cpu's shard, and Snapshot() may run concurrently in
+// another thread, e.g. the agent's RPC handler.
+class DeadlineStats {
+ public:
+  static constexpr uint32_t kMaxWorkClasses = 16;
+
+  explicit DeadlineStats(const CpuList& cpus) {
+    for (const Cpu& cpu : cpus) {
+      shards_[cpu.id()] = std::make_unique<Shard>();
+    }
+  }
+
+  // Records a closure of work class `wcid` that finished at `now`, after
+  // running for `runtime`. `cpu` is the cpu it last ran on, or -1 if it never
+  // ran, in which case it is accounted to an arbitrary cpu.
+  void Record(int cpu, uint32_t wcid, absl::Time deadline, absl::Time now,
+              absl::Duration estimate, absl::Duration runtime) {
+    Shard* shard = cpu >= 0 ? shards_[cpu].get() : nullptr;
+    if (!shard) shard = FirstShard();
+    WorkClass& wc = (*shard)[Index(wcid)];
+
+    wc.completed.fetch_add(1, std::memory_order_relaxed);
+    if (now > deadline) {
+      wc.missed.fetch_add(1, std::memory_order_relaxed);
+      wc.tardiness.Record(now - deadline);
+    }
+    if (runtime > estimate) {
+      wc.overran.fetch_add(1, std::memory_order_relaxed);
+    }
+    wc.estimate_error.Record(absl::AbsDuration(runtime - estimate));
+  }
+
+  DeadlineStatsSnapshot Snapshot(uint32_t wcid) const {
+    DeadlineStatsSnapshot snap;
+    for (const std::unique_ptr<Shard>& shard : shards_) {
+      if (!shard) continue;
+      const WorkClass& wc = (*shard)[Index(wcid)];
+      snap.completed += wc.completed.load(std::memory_order_relaxed);
+      snap.missed += wc.missed.load(std::memory_order_relaxed);
+      snap.overran += wc.overran.load(std::memory_order_relaxed);
+      wc.tardiness.AddTo(snap.tardiness);
+      wc.estimate_error.AddTo(snap.estimate_error);
+    }
+    return snap;
+  }
+
+ private:
+  struct WorkClass {
+    std::atomic<uint64_t> completed{0};
+    std::atomic<uint64_t> missed{0};
+    std::atomic<uint64_t> overran{0};
+    DurationHistogram tardiness;
+    DurationHistogram estimate_error;
+  };
+  struct alignas(ABSL_CACHELINE_SIZE) Shard
+      : public std::array<WorkClass, kMaxWorkClasses> {};
+
+  static uint32_t Index(uint32_t wcid) {
+    return wcid < kMaxWorkClasses ? wcid : kMaxWorkClasses - 1;
+  }
+
+  Shard* FirstShard() const {
+    for (const std::unique_ptr<Shard>& shard : shards_) {
+      if (shard) return shard.get();
+    }
+    GHOST_ERROR("No cpus to account deadline stats to");
+    return nullptr;
+  }
+
+  std::array<std::unique_ptr<Shard>, MAX_CPUS> shards_;
+};
+
+}  // namespace ghost
+
+#endif  // GHOST_SCHEDULERS_EDF_DEADLINE_STATS_H_
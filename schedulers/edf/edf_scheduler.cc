@@ -14,6 +14,9 @@
 
 #include "schedulers/edf/edf_scheduler.h"
 
+#include <algorithm>
+#include <vector>
+
 #include "absl/strings/str_format.h"
 #include "bpf/user/agent.h"
 
@@ -68,7 +71,13 @@ EdfScheduler::EdfScheduler(Enclave* enclave, CpuList cpulist,
                            const GlobalConfig& config)
     : BasicDispatchScheduler(enclave, std::move(cpulist), std::move(allocator)),
       global_cpu_(config.global_cpu_.id()),
-      global_channel_(GHOST_MAX_QUEUE_ELEMS, /*node=*/0) {
+      global_channel_(GHOST_MAX_QUEUE_ELEMS, /*node=*/0),
+      check_runqueue_(config.check_runqueue_),
+      bpf_next_up_(config.bpf_next_up_),
+      deadline_stats_(cpus()),
+      // One of the cpus always runs the global agent.
+      admission_(config.admission_policy_, config.utilization_bound_,
+                 std::max<int>(cpus().Size() - 1, 1)) {
   if (!cpus().IsSet(global_cpu_)) {
     Cpu c = cpus().Front();
     CHECK(c.valid());
@@ -103,6 +112,9 @@ EdfScheduler::EdfScheduler(Enclave* enclave, CpuList cpulist,
   bpf_data_ = static_cast<struct edf_bpf_per_cpu_data*>(
       bpf_map__mmap(bpf_obj_->maps.cpu_data));
   CHECK_NE(bpf_data_, MAP_FAILED);
+  for (int i = 0; i < libbpf_num_possible_cpus(); i++) {
+    bpf_data_[i].next_up_state = EDF_NEXT_UP_EMPTY;
+  }
 }
 
 EdfScheduler::~EdfScheduler() {
@@ -138,6 +150,7 @@ void EdfScheduler::DumpAllTasks() {
 void EdfScheduler::DumpState(const Cpu& agent_cpu, int flags) {
   if (flags & kDumpAllTasks) {
     DumpAllTasks();
+    DumpDeadlineStats();
   }
 
   if (!(flags & kDumpStateEmptyRQ) && run_queue_.empty()) {
@@ -159,6 +172,26 @@ void EdfScheduler::DumpState(const Cpu& agent_cpu, int flags) {
   fprintf(stderr, "\n");
 }
 
+void EdfScheduler::DumpDeadlineStats() {
+  for (uint32_t wcid = 0; wcid < DeadlineStats::kMaxWorkClasses; wcid++) {
+    DeadlineStatsSnapshot s = deadline_stats_.Snapshot(wcid);
+    if (!s.completed) continue;
+    absl::FPrintF(stderr,
+                  "wcid %u: %lu completed, %lu missed (%.2f%%), tardiness "
+                  "p50/p99 %s/%s, %lu overran, estimate error p50/p99 %s/%s\n",
+                  wcid, s.completed, s.missed, 100.0 * s.miss_ratio(),
+                  absl::FormatDuration(
+                      DurationHistogram::Percentile(s.tardiness, 50)),
+                  absl::FormatDuration(
+                      DurationHistogram::Percentile(s.tardiness, 99)),
+                  s.overran,
+                  absl::FormatDuration(
+                      DurationHistogram::Percentile(s.estimate_error, 50)),
+                  absl::FormatDuration(
+                      DurationHistogram::Percentile(s.estimate_error, 99)));
+  }
+}
+
 EdfScheduler::CpuState* EdfScheduler::cpu_state_of(const EdfTask* task) {
   CHECK(task->oncpu());
   CpuState* result = &cpu_states_[task->cpu];
@@ -172,7 +205,7 @@ void EdfScheduler::HandleNewGtid(EdfTask* task, pid_t tgid) {
 
   if (orchs_.find(tgid) == orchs_.end()) {
     auto orch = absl::make_unique<Orchestrator>();
-    if (!orch->Init(tgid)) {
+    if (!orch->Init(tgid, admission_)) {
       // If the task's group leader has already exited and closed the PrioTable
       // fd while we are handling TaskNew, it is possible that we cannot find
       // the PrioTable.
@@ -186,6 +219,26 @@ void EdfScheduler::HandleNewGtid(EdfTask* task, pid_t tgid) {
     auto pair = std::make_pair(tgid, std::move(orch));
     orchs_.insert(std::move(pair));
   }
+  orch_tasks_[tgid]++;
+  task->has_orch = true;
+}
+
+void EdfScheduler::ReleaseGtid(EdfTask* task) {
+  if (!task->has_orch) return;
+  task->has_orch = false;
+
+  const pid_t tgid = task->gtid.tgid();
+  auto iter = orch_tasks_.find(tgid);
+  CHECK(iter != orch_tasks_.end());
+  if (--iter->second > 0) return;
+
+  // No task points into the app's SchedParams anymore. Forget the PrioTable
+  // too, in case the tgid is reused by another app.
+  orch_tasks_.erase(iter);
+  auto orch = orchs_.find(tgid);
+  CHECK(orch != orchs_.end());
+  orch->second->Release(admission_);
+  orchs_.erase(orch);
 }
 
 void EdfScheduler::UpdateTaskRuntime(EdfTask* task, absl::Duration new_runtime,
@@ -258,12 +311,14 @@ void EdfScheduler::TaskDeparted(EdfTask* task, const Message& msg) {
     CHECK(task->blocked());
   }
 
+  ReleaseGtid(task);
   allocator()->FreeTask(task);
   num_tasks_--;
 }
 
 void EdfScheduler::TaskDead(EdfTask* task, const Message& msg) {
   CHECK_EQ(task->run_state, EdfTask::RunState::kBlocked);
+  ReleaseGtid(task);
   allocator()->FreeTask(task);
 
   num_tasks_--;
@@ -344,6 +399,40 @@ void EdfScheduler::TaskYield(EdfTask* task, const Message& msg) {
   }
 }
 
+void EdfScheduler::TaskLatched(EdfTask* task, const Message& msg) {
+  const ghost_msg_payload_task_latched* payload =
+      static_cast<const ghost_msg_payload_task_latched*>(msg.payload());
+
+  // Only bpf-pnt asks for TASK_LATCHED, when it runs a cpu's next-up task.
+  const Cpu cpu = topology()->cpu(payload->cpu);
+  CpuState* cs = cpu_state(cpu);
+  CHECK_EQ(cs->next_up, task);
+  const bool revoked = RevokeNextUp(cpu);
+  CHECK(!revoked);
+  cs->next_up = nullptr;
+  cs->next_up_latched = false;
+  task->next_up_cpu = -1;
+
+  // The task was still queued as far as we were concerned. It may have been
+  // skipped in a scheduling round or lost its work while bpf-pnt latched it.
+  if (task->yielding()) Unyield(task);
+  if (task->queued()) RemoveFromRunqueue(task);
+  CHECK(task->paused());
+
+  // The cpu was idle: whatever ran there before got off cpu, and its message
+  // came before this one.
+  CHECK_EQ(cs->current, nullptr);
+  cs->current = task;
+  task->run_state = EdfTask::RunState::kOnCpu;
+  task->cpu = cpu.id();
+  task->preempted = false;
+  task->prio_boost = false;
+
+  if (!task->has_work) {
+    CHECK(PreemptTask(task, nullptr, 0));  // force offcpu.
+  }
+}
+
 void EdfScheduler::DiscoveryStart() { in_discovery_ = true; }
 
 void EdfScheduler::DiscoveryComplete() {
@@ -426,41 +515,24 @@ void EdfScheduler::Enqueue(EdfTask* task) {
     return;
   }
 
-  // push_heap.
-  CHECK_LT(task->rq_pos, 0);
   task->run_state = EdfTask::RunState::kQueued;
-  run_queue_.emplace_back(task);
-  task->rq_pos = run_queue_.size() - 1;
-  UpdateRunqueuePosition(task->rq_pos);
-}
-
-static void swap(EdfTask*& t1, EdfTask*& t2) {
-  std::swap(t1, t2);
-  std::swap(t1->rq_pos, t2->rq_pos);
+  run_queue_.Push(task);
+  CheckRunQueue();
 }
 
 EdfTask* EdfScheduler::Dequeue() {
-  if (run_queue_.empty()) return nullptr;
+  EdfTask* task = run_queue_.Pop();
+  if (!task) return nullptr;
 
-  // pop_heap.
-  swap(run_queue_.front(), run_queue_.back());
-  struct EdfTask* task = run_queue_.back();
   CHECK(task->has_work);
-  CHECK_EQ(task->rq_pos, run_queue_.size() - 1);
-  task->rq_pos = -1;
-  run_queue_.pop_back();
-
-  if (!run_queue_.empty()) UpdateRunqueuePosition(0);
-
+  CheckRunQueue();
   return task;
 }
 
 EdfTask* EdfScheduler::Peek() {
-  if (run_queue_.empty()) {
-    return nullptr;
-  }
+  EdfTask* task = run_queue_.Top();
+  if (!task) return nullptr;
 
-  EdfTask* task = run_queue_.front();
   CHECK(task->has_work);
   CHECK_EQ(task->rq_pos, 0);
 
@@ -468,89 +540,37 @@ EdfTask* EdfScheduler::Peek() {
 }
 
 void EdfScheduler::CheckRunQueue() {
-#if GHOST_DEBUG
-  // Verify that 'run_queue_' is a proper heap.
-  CHECK(std::is_heap(run_queue_.begin(), run_queue_.end(),
-                     EdfTask::SchedDeadlineGreater()));
-
-  // Verify that all queued tasks have proper 'run_state' and 'rq_pos'.
-  for (auto iter = run_queue_.begin(); iter != run_queue_.end(); iter++) {
-    const EdfTask* task = *iter;
-    CHECK(task->queued());
-    CHECK_EQ(task->rq_pos, iter - run_queue_.begin());
-  }
-#endif
-}
-
-void EdfScheduler::UpdateRunqueuePosition(uint32_t pos) {
-  // Sift up.
-  if (pos) {
-    uint32_t parent = (pos - 1) / 2;
-
-    if (EdfTask::SchedDeadlineGreater()(run_queue_[parent], run_queue_[pos])) {
-      do {
-        swap(run_queue_[pos], run_queue_[parent]);
-        pos = parent;
-        parent = (pos - 1) / 2;
-      } while (pos && EdfTask::SchedDeadlineGreater()(run_queue_[parent],
-                                                      run_queue_[pos]));
-      CheckRunQueue();
-      return;
-    }
-  }
-
-  // Sift down.
-  while (true) {
-    uint32_t left = (pos * 2) + 1;
-    uint32_t right = (pos * 2) + 2;
+  if (!check_runqueue_) return;
 
-    if (right < run_queue_.size() &&
-        EdfTask::SchedDeadlineGreater()(run_queue_[left], run_queue_[right])) {
-      left = right;
-    }
+  // Verify that 'run_queue_' is a proper heap.
+  run_queue_.CheckInvariants();
 
-    if (left < run_queue_.size() &&
-        EdfTask::SchedDeadlineGreater()(run_queue_[pos], run_queue_[left])) {
-      swap(run_queue_[pos], run_queue_[left]);
-      pos = left;
-    } else {
-      CheckRunQueue();
-      return;
-    }
+  // Verify that all queued tasks have proper 'run_state'.
+  for (size_t i = 0; i < run_queue_.size(); i++) {
+    CHECK(run_queue_[i]->queued());
   }
 }
 
 void EdfScheduler::RemoveFromRunqueue(EdfTask* task) {
   CHECK(task->queued());
-  CHECK_GE(task->rq_pos, 0);
-  CHECK_LT(task->rq_pos, run_queue_.size());
+  CHECK(run_queue_.Contains(task));
 
-  bool need_update;
-  int pos = task->rq_pos;
-  if (pos == run_queue_.size() - 1) {
-    need_update = false;  // heap property unchanged by pop_back().
-  } else {
-    swap(run_queue_[pos], run_queue_.back());
-    need_update = true;  // needs update to maintain heap property.
+  if (task->next_up_cpu >= 0) {
+    // If bpf-pnt latched the task anyway, TaskLatched() sorts it out.
+    RevokeNextUp(topology()->cpu(task->next_up_cpu));
   }
 
-  CHECK_EQ(task->rq_pos, run_queue_.size() - 1);
-  task->rq_pos = -1;
-  run_queue_.pop_back();
-
-  if (need_update) {
-    UpdateRunqueuePosition(pos);
-  } else {
-    CheckRunQueue();
-  }
+  run_queue_.Erase(task);
+  CheckRunQueue();
   task->run_state = EdfTask::RunState::kPaused;
 }
 
 void EdfScheduler::UpdateRunqueue(EdfTask* task) {
   CHECK(task->queued());
-  CHECK_GE(task->rq_pos, 0);
-  CHECK_LT(task->rq_pos, run_queue_.size());
-  UpdateRunqueuePosition(task->rq_pos);
+  CHECK(run_queue_.Contains(task));
+
+  run_queue_.Update(task);
+  CheckRunQueue();
 }
 
 void EdfScheduler::SchedParamsCallback(Orchestrator& orch,
@@ -597,8 +617,10 @@ void EdfScheduler::SchedParamsCallback(Orchestrator& orch,
   const bool had_work = task->has_work;
   const uint32_t old_wcid = task->wcid;
   task->sp = sp;
-  task->has_work = sp->HasWork();
   task->wcid = sp->GetWorkClass();
+  const uint32_t admission = orch.GetWorkClassAdmission(task->wcid);
+  // The sched items of a rejected work class are never scheduled.
+  task->has_work = sp->HasWork() && admission != WORK_CLASS_REJECTED;
 
   if (had_work) {
     task->UpdateRuntime();
@@ -607,6 +629,8 @@ void EdfScheduler::SchedParamsCallback(Orchestrator& orch,
     // for CPU time that was consumed by the old closure.
     CHECK_LT(task->wcid, orch.NumWorkClasses());
     orch.UpdateWorkClassStats(old_wcid, task->elapsed_runtime, task->deadline);
+    deadline_stats_.Record(task->cpu, old_wcid, task->deadline, MonotonicNow(),
+                           task->estimated_runtime, task->elapsed_runtime);
     task->elapsed_runtime = absl::ZeroDuration();
   }
 
@@ -617,6 +641,11 @@ void EdfScheduler::SchedParamsCallback(Orchestrator& orch,
   } else {
     task->deadline = sp->GetDeadline();
   }
+  // A best-effort work class only runs when no admitted work with the same QoS
+  // is runnable.
+  if (admission == WORK_CLASS_BEST_EFFORT) {
+    task->deadline = absl::InfiniteFuture();
+  }
   task->CalculateSchedDeadline();
 
   // A kBlocked task is not affected by any changes to SchedParams.
@@ -681,89 +710,217 @@ void EdfScheduler::UpdateSchedParams() {
   }
 }
 
-void EdfScheduler::GlobalSchedule(const StatusWord& agent_sw,
-                                  StatusWord::BarrierToken agent_sw_last) {
-  CpuList updated_cpus = MachineTopology()->EmptyCpuList();
+bool EdfScheduler::RevokeNextUp(const Cpu& cpu) {
+  CpuState* cs = cpu_state(cpu);
+  if (!cs->next_up) return true;
+  if (cs->next_up_latched) return false;
 
+  if (!edf_next_up_revoke(&bpf_data_[cpu.id()])) {
+    cs->next_up_latched = true;
+    return false;
+  }
+  cs->next_up->next_up_cpu = -1;
+  cs->next_up = nullptr;
+  return true;
+}
+
+void EdfScheduler::ReapNextUp() {
   for (const Cpu& cpu : cpus()) {
     CpuState* cs = cpu_state(cpu);
+    if (!cs->next_up || cs->next_up_latched) continue;
+
+    // bpf-pnt is done with a slot once it leaves READY. The global cpu never
+    // idles, so bpf-pnt would never pick up its slot.
+    const int64_t state = __atomic_load_n(
+        &bpf_data_[cpu.id()].next_up_state, __ATOMIC_ACQUIRE);
+    if (state != GHOST_TXN_READY || cpu.id() == GetGlobalCPUId()) {
+      RevokeNextUp(cpu);
+    }
+  }
+}
 
+void EdfScheduler::PublishNextUp() {
+  std::vector<const Cpu*> targets;
+  for (const Cpu& cpu : cpus()) {
     if (!Available(cpu) || cpu.id() == GetGlobalCPUId()) continue;
 
-  again:
-    if (cs->current) {
-      EdfTask* peek = Peek();
-      // Only preempt the current task if there is a queued task in a higher
-      // QoS class
-      if (peek && peek->sp->GetQoS() <= cs->current->sp->GetQoS()) {
+    CpuState* cs = cpu_state(cpu);
+    if (cs->current && !cs->next_up_latched) targets.push_back(&cpu);
+  }
+  if (targets.empty()) return;
+
+  // Walk the runqueue in deadline order, skipping the tasks published to other
+  // cpus. Popping and pushing the tasks back leaves the runqueue as it was.
+  std::vector<EdfTask*> popped;
+  auto next_unpublished = [this, &popped]() -> EdfTask* {
+    while (EdfTask* task = run_queue_.Pop()) {
+      popped.push_back(task);
+      if (task->next_up_cpu < 0 && !task->status_word.on_cpu()) return task;
+    }
+    return nullptr;
+  };
+
+  EdfTask* best = next_unpublished();
+  for (const Cpu* cpu : targets) {
+    if (!best) break;
+
+    CpuState* cs = cpu_state(*cpu);
+    if (cs->next_up) {
+      // Keep the cpu's candidate unless a task queued since beats it.
+      if (!EdfTask::SchedDeadlineGreater()(cs->next_up, best) ||
+          !RevokeNextUp(*cpu)) {
         continue;
       }
     }
-    EdfTask* to_run = Dequeue();
-    if (!to_run)  // No tasks left to schedule.
+    edf_next_up_publish(&bpf_data_[cpu->id()], best->gtid.id(), best->seqnum);
+    cs->next_up = best;
+    best->next_up_cpu = cpu->id();
+    best = next_unpublished();
+  }
+
+  for (EdfTask* task : popped) run_queue_.Push(task);
+  CheckRunQueue();
+}
+
+void EdfScheduler::GlobalSchedule(const StatusWord& agent_sw,
+                                  StatusWord::BarrierToken agent_sw_last) {
+  // Global EDF: the tasks that should be on cpu are the earliest-deadline ones
+  // among those running and those queued. CPUs are handed out to queued tasks
+  // in deadline order, idle CPUs first and then the CPUs running the
+  // latest-deadline tasks, until the earliest queued task no longer beats the
+  // latest running one. Boosted tasks that beat no running task are set aside
+  // for the round instead of holding up the tasks queued behind them.
+  if (bpf_next_up_) ReapNextUp();
+
+  std::vector<const Cpu*> idle_cpus;
+  std::vector<const Cpu*> busy_cpus;
+  for (const Cpu& cpu : cpus()) {
+    if (!Available(cpu) || cpu.id() == GetGlobalCPUId()) continue;
+    // bpf-pnt ran the cpu's next-up task; we'll know what runs there once its
+    // TASK_LATCHED arrives.
+    if (cpu_state(cpu)->next_up_latched) continue;
+
+    if (cpu_state(cpu)->current) {
+      busy_cpus.push_back(&cpu);
+    } else {
+      idle_cpus.push_back(&cpu);
+    }
+  }
+  // Order the busy CPUs so that the one running the task that is most
+  // preemptible comes first. Preemption ignores prio_boost (see
+  // EdfTask::PreemptionGreater).
+  std::sort(busy_cpus.begin(), busy_cpus.end(),
+            [this](const Cpu* a, const Cpu* b) {
+              return EdfTask::PreemptionGreater()(cpu_state(*a)->current,
+                                                  cpu_state(*b)->current);
+            });
+
+  CpuList open_cpus = MachineTopology()->EmptyCpuList();
+  auto idle = idle_cpus.begin();
+  auto busy = busy_cpus.begin();
+  auto next_cpu = [&]() {
+    if (idle != idle_cpus.end()) {
+      idle++;
+    } else {
+      busy++;
+    }
+  };
+  // Boosted tasks that can't preempt anything this round.
+  std::vector<EdfTask*> set_aside;
+  while (EdfTask* peek = Peek()) {
+    const Cpu* cpu;
+    if (idle != idle_cpus.end()) {
+      cpu = *idle;
+    } else if (busy != busy_cpus.end() &&
+               (peek = EdfTask::NextPreemptor(
+                    run_queue_, cpu_state(**busy)->current, &set_aside))) {
+      cpu = *busy;
+    } else {
+      // No queued task beats any task still running.
       break;
+    }
+
+    // Take back the cpu's next-up slot before opening a txn on it, so that
+    // bpf-pnt can't latch another task there. If bpf-pnt already did, the cpu
+    // is no longer ours to hand out this round.
+    if (!RevokeNextUp(*cpu)) {
+      next_cpu();
+      continue;
+    }
+
+    EdfTask* to_run = Dequeue();
+    CHECK_EQ(to_run, peek);
 
     // The chosen task was preempted earlier but hasn't gotten off the
-    // CPU. Make it ineligible for selection in this scheduling round.
-    if (to_run->status_word.on_cpu()) {
+    // CPU, or bpf-pnt latched it on another cpu. Make it ineligible for
+    // selection in this scheduling round.
+    if (to_run->status_word.on_cpu() ||
+        (to_run->next_up_cpu >= 0 &&
+         !RevokeNextUp(topology()->cpu(to_run->next_up_cpu)))) {
       Yield(to_run);
-      goto again;
+      continue;
     }
+    next_cpu();
 
+    CpuState* cs = cpu_state(*cpu);
     cs->next = to_run;
 
-    updated_cpus.Set(cpu.id());
+    RunRequest* req = enclave()->GetRunRequest(*cpu);
+    req->Open({
+        .target = to_run->gtid,
+        .target_barrier = to_run->seqnum,
+        .commit_flags = COMMIT_AT_TXN_COMMIT,
+    });
+    open_cpus.Set(cpu->id());
+  }
+  for (EdfTask* task : set_aside) run_queue_.Push(task);
+  CheckRunQueue();
+
+  // Commit all of the assignments together so that the kernel sees the whole
+  // round of decisions in one batch.
+  if (!open_cpus.Empty()) {
+    enclave()->CommitRunRequests(open_cpus);
   }
 
-  bool in_sync = true;
-  for (const Cpu& cpu : updated_cpus) {
+  for (const Cpu& cpu : open_cpus) {
     CpuState* cs = cpu_state(cpu);
-
     EdfTask* next = cs->next;
     cs->next = nullptr;
 
-    if (cs->current == next) continue;
-
-    if (in_sync) {  // In the !in_sync case, we'll just reschedule.
-      RunRequest* req = enclave()->GetRunRequest(cpu);
-      if (next) {
-        if (cs->current) {
-          // We are preempting a lower-priority task
-          EdfTask* prev = cs->current;
-          in_sync = PreemptTask(cs->current, next, agent_sw_last);
-          if (in_sync) {
-            // The preemption succeeded, so we need to enqueue the preempted
-            // task
-            Enqueue(prev);
-          }
-        } else {
-          req->Open({.target = next->gtid, .target_barrier = next->seqnum});
-          in_sync = req->Commit();
-        }
-      } else {
-        req->OpenUnschedule();
-        in_sync = req->Commit();
-      }
+    RunRequest* req = enclave()->GetRunRequest(cpu);
+    DCHECK(req->committed());
+    if (req->state() != GHOST_TXN_COMPLETE) {
+      // Need to requeue in the stale case.
+      Enqueue(next);
+      continue;
     }
 
-    if (next) {
-      if (!in_sync) {
-        // Need to requeue in the stale case.
-        Enqueue(next);
-      } else {
-        // EdfTask latched successfully; clear state from an earlier run.
-        //
-        // Note that 'preempted' influences a task's run_queue position
-        // so we clear it only after SyncCpu() is successful.
-        cs->current = next;
-        next->run_state = EdfTask::RunState::kOnCpu;
-        next->cpu = cpu.id();
-        next->preempted = false;
-        next->prio_boost = false;
-      }
+    if (cs->current) {
+      // We preempted a later-deadline task, so it must be queued again.
+      EdfTask* prev = cs->current;
+      CHECK(prev->oncpu());
+      prev->run_state = EdfTask::RunState::kPaused;
+      // Normally, each task's runtime is updated when a message about that
+      // task is received or when the task's sched item is updated by the
+      // orchestrator. Neither of those events occurs for an agent-initiated
+      // preemption, so update the runtime of 'prev' here.
+      prev->UpdateRuntime();
+      Enqueue(prev);
     }
+
+    // EdfTask latched successfully; clear state from an earlier run.
+    //
+    // Note that 'preempted' influences a task's run_queue position
+    // so we clear it only after the commit is successful.
+    cs->current = next;
+    next->run_state = EdfTask::RunState::kOnCpu;
+    next->cpu = cpu.id();
+    next->preempted = false;
+    next->prio_boost = false;
   }
 
+  if (bpf_next_up_) PublishNextUp();
+
   // Yielding tasks are moved back to the runqueue having skipped one round
   // of scheduling decisions.
   if (!yielding_tasks_.empty()) {
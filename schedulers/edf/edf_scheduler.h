@@ -18,12 +18,16 @@
 #define GHOST_SCHEDULERS_EDF_EDF_SCHEDULER_H_
 
 #include <cstdint>
+#include <vector>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/functional/bind_front.h"
 #include "third_party/bpf/edf.h"
 #include "lib/agent.h"
+#include "lib/indexed_heap.h"
 #include "lib/scheduler.h"
+#include "schedulers/edf/admission.h"
+#include "schedulers/edf/deadline_stats.h"
 #include "schedulers/edf/edf_bpf.skel.h"
 #include "schedulers/edf/orchestrator.h"
 #include "shared/prio_table.h"
@@ -82,9 +86,16 @@ struct EdfTask : public Task<> {
   RunState run_state = RunState::kBlocked;
   int cpu = -1;
 
-  // Position in runqueue.
+  // Position in runqueue (see IndexedHeap).
   int rq_pos = -1;
 
+  // Whether the task is counted in its app's EdfScheduler::orch_tasks_.
+  bool has_orch = false;
+
+  // The cpu whose bpf next-up slot holds this task, or -1. A published task
+  // stays in the runqueue until it is revoked or latched.
+  int next_up_cpu = -1;
+
   // Priority boosting for jumping past regular edf ordering in the runqueue.
   //
   // A task's priority is boosted on a kernel preemption or a !deferrable
@@ -101,6 +112,9 @@ struct EdfTask : public Task<> {
   bool preempted = false;
   void CalculateSchedDeadline();
 
+  // The comparators below are templates so that tests can order stand-ins
+  // for EdfTask, which needs a ghost kernel for its status word.
+
   // Comparator for min-heap runqueue.
   struct SchedDeadlineGreater {
     // Returns true if 'a' should be ordered after 'b' in the min-heap
@@ -108,18 +122,50 @@ struct EdfTask : public Task<> {
     //
     // A task with boosted priority takes precedence over other usual
     // discriminating factors like QoS or sched_deadline.
-    bool operator()(EdfTask* a, EdfTask* b) const {
+    template <typename T>
+    bool operator()(const T* a, const T* b) const {
       if (a->prio_boost != b->prio_boost) {
         return b->prio_boost;
-      } else if (a->sp->GetQoS() != b->sp->GetQoS()) {
+      }
+      return PreemptionGreater()(a, b);
+    }
+  };
+
+  // Comparator for preempting a running task: returns true if 'a' should give
+  // its cpu to 'b'.
+  //
+  // Unlike SchedDeadlineGreater, prio_boost is ignored. A boost lets a task
+  // that may hold a lock jump the queue, but it must not take the cpu of a
+  // task of higher QoS; boosted tasks still get idle cpus first.
+  struct PreemptionGreater {
+    template <typename T>
+    bool operator()(const T* a, const T* b) const {
+      if (a->sp->GetQoS() != b->sp->GetQoS()) {
         // A task in a higher QoS class has preference
         return a->sp->GetQoS() < b->sp->GetQoS();
-      } else {
-        return a->sched_deadline > b->sched_deadline;
       }
+      return a->sched_deadline > b->sched_deadline;
     }
   };
 
+  // Returns the first task in `queue`, a run queue ordered by
+  // SchedDeadlineGreater, that should take the cpu of `running`, or nullptr if
+  // there is none. Boosted tasks are queued first whatever their QoS, so the
+  // ones that can't take the cpu are popped into `set_aside` for the caller to
+  // push back after the round, rather than hold up the tasks behind them. The
+  // unboosted tasks are in PreemptionGreater order, so the first one that
+  // can't take the cpu ends the scan.
+  template <typename Queue, typename T>
+  static T* NextPreemptor(Queue& queue, const T* running,
+                          std::vector<T*>* set_aside) {
+    while (T* head = queue.Top()) {
+      if (PreemptionGreater()(running, head)) return head;
+      if (!head->prio_boost) return nullptr;
+      set_aside->push_back(queue.Pop());
+    }
+    return nullptr;
+  }
+
   // Estimated runtime in ns.
   // This value is first set to the estimate in the corresponding sched item's
   // work class, but is later set to a weighted average of observed runtimes
@@ -150,6 +196,17 @@ class GlobalConfig : public AgentConfig {
 
   Cpu global_cpu_{Cpu::UninitializedType::kUninitialized};
   CpuTickConfig edf_ticks_ = CpuTickConfig::kNoTicks;
+  // Validates the whole runqueue after every operation on it. This is O(n) per
+  // operation, so it is only meant for debugging.
+  bool check_runqueue_ = false;
+  // What to do with repeating work classes that would push the utilization of
+  // the enclave's cpus past `utilization_bound_`. See AdmissionControl.
+  AdmissionControl::Policy admission_policy_ = AdmissionControl::Policy::kNone;
+  double utilization_bound_ = 1.0;
+  // Publishes the earliest-deadline queued tasks to busy cpus' next-up slots
+  // (see edf.h), so that bpf-pnt can run them as soon as the cpus go idle
+  // instead of waiting for the next scheduling round.
+  bool bpf_next_up_ = false;
 };
 
 class EdfScheduler : public BasicDispatchScheduler<EdfTask> {
@@ -169,6 +226,7 @@ class EdfScheduler : public BasicDispatchScheduler<EdfTask> {
   void TaskYield(EdfTask* task, const Message& msg) final;
   void TaskBlocked(EdfTask* task, const Message& msg) final;
   void TaskPreempted(EdfTask* task, const Message& msg) final;
+  void TaskLatched(EdfTask* task, const Message& msg) final;
 
   void DiscoveryStart() final;
   void DiscoveryComplete() final;
@@ -179,7 +237,6 @@ class EdfScheduler : public BasicDispatchScheduler<EdfTask> {
 
   void UpdateRunqueue(EdfTask* task);
   void RemoveFromRunqueue(EdfTask* task);
-  void UpdateRunqueuePosition(uint32_t pos);
   void CheckRunQueue();
 
   void GlobalSchedule(const StatusWord& agent_sw,
@@ -196,7 +253,13 @@ class EdfScheduler : public BasicDispatchScheduler<EdfTask> {
   void DumpState(const Cpu& cpu, int flags) final;
   std::atomic<bool> debug_runqueue_ = false;
 
+  // Safe to call from any thread.
+  const DeadlineStats& deadline_stats() const { return deadline_stats_; }
+
   static const int kDebugRunqueue = 1;
+  // Returns the DeadlineStatsSnapshot of work class `arg0` in the response
+  // buffer.
+  static const int kDeadlineStats = 2;
 
  private:
   bool PreemptTask(EdfTask* prev, EdfTask* next,
@@ -207,6 +270,7 @@ class EdfScheduler : public BasicDispatchScheduler<EdfTask> {
   EdfTask* Dequeue();
   EdfTask* Peek();
   void DumpAllTasks();
+  void DumpDeadlineStats();
 
   void UpdateTaskRuntime(EdfTask* task, absl::Duration new_runtime,
                          bool update_elapsed_runtime);
@@ -214,13 +278,28 @@ class EdfScheduler : public BasicDispatchScheduler<EdfTask> {
                            Gtid oldgtid);
 
   void HandleNewGtid(EdfTask* task, pid_t tgid);
+  // Drops `task`'s reference on its app's Orchestrator. The last task of an
+  // app to leave releases its admission and forgets its PrioTable.
+  void ReleaseGtid(EdfTask* task);
 
   bool Available(const Cpu& cpu);
 
+  // Empties `cpu`'s next-up slot. Returns false if bpf-pnt latched the slot's
+  // task, in which case the cpu is not ours until its TASK_LATCHED arrives.
+  bool RevokeNextUp(const Cpu& cpu);
+  // Reaps the slots that bpf-pnt is done with.
+  void ReapNextUp();
+  // Refills the busy cpus' next-up slots from the runqueue.
+  void PublishNextUp();
+
   struct CpuState {
     EdfTask* current = nullptr;
     EdfTask* next = nullptr;
     const Agent* agent = nullptr;
+    // The task published in this cpu's next-up slot.
+    EdfTask* next_up = nullptr;
+    // bpf-pnt latched `next_up`; waiting for its TASK_LATCHED.
+    bool next_up_latched = false;
   } ABSL_CACHELINE_ALIGNED;
   CpuState* cpu_state_of(const EdfTask* task);
   inline CpuState* cpu_state(const Cpu& cpu) { return &cpu_states_[cpu.id()]; }
@@ -230,10 +309,17 @@ class EdfScheduler : public BasicDispatchScheduler<EdfTask> {
   LocalChannel global_channel_;
   int num_tasks_ = 0;
   bool in_discovery_ = false;
-  // Heapified runqueue
-  std::vector<EdfTask*> run_queue_;
+  const bool check_runqueue_;
+  const bool bpf_next_up_;
+  // Min-heap runqueue, ordered by SchedDeadlineGreater.
+  IndexedHeap<EdfTask, EdfTask::SchedDeadlineGreater, &EdfTask::rq_pos>
+      run_queue_;
   std::vector<EdfTask*> yielding_tasks_;
+  DeadlineStats deadline_stats_;
+  AdmissionControl admission_;
   absl::flat_hash_map<pid_t, std::unique_ptr<Orchestrator>> orchs_;
+  // The number of tasks of each app in orchs_.
+  absl::flat_hash_map<pid_t, int> orch_tasks_;
 
   const Orchestrator::SchedCallbackFunc kSchedCallbackFunc =
       absl::bind_front(&EdfScheduler::SchedParamsCallback, this);
@@ -307,6 +393,15 @@ class GlobalEdfAgent : public FullAgent<EnclaveType> {
         global_scheduler_->debug_runqueue_ = true;
         response.response_code = 0;
         return;
+      case EdfScheduler::kDeadlineStats:
+        if (args.arg0 < 0) {
+          response.response_code = -1;
+          return;
+        }
+        response.buffer.Serialize(
+            global_scheduler_->deadline_stats().Snapshot(args.arg0));
+        response.response_code = 0;
+        return;
       default:
         response.response_code = -1;
         return;
@@ -14,8 +14,54 @@
 
 #include "schedulers/edf/orchestrator.h"
 
+#include <cstddef>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 namespace ghost {
 
+namespace {
+
+#if defined(__x86_64__)
+// Sched items and cached SchedParams are both arrays of structs, so their
+// seqcounts are strided in memory. These are the strides in 32-bit words.
+constexpr int kItemStride = sizeof(struct sched_item) / sizeof(uint32_t);
+static_assert(sizeof(struct sched_item) % sizeof(uint32_t) == 0);
+
+// Returns a bitmask of which of the 8 consecutive sched items whose seqcounts
+// start at `item_seq` have a seqcount different from the 8 cached ones that
+// start at `cached_seq`, `cached_stride` words apart.
+__attribute__((target("avx2"))) uint32_t ChangedSeqCounts8(
+    const uint32_t* item_seq, const uint32_t* cached_seq, int cached_stride) {
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i item_idx =
+      _mm256_mullo_epi32(lanes, _mm256_set1_epi32(kItemStride));
+  const __m256i cached_idx =
+      _mm256_mullo_epi32(lanes, _mm256_set1_epi32(cached_stride));
+  const __m256i items = _mm256_i32gather_epi32(
+      reinterpret_cast<const int*>(item_seq), item_idx, sizeof(uint32_t));
+  const __m256i cached = _mm256_i32gather_epi32(
+      reinterpret_cast<const int*>(cached_seq), cached_idx, sizeof(uint32_t));
+  const __m256i same = _mm256_cmpeq_epi32(items, cached);
+  return ~_mm256_movemask_ps(_mm256_castsi256_ps(same)) & 0xff;
+}
+
+bool HaveAvx2() {
+  static const bool have_avx2 = __builtin_cpu_supports("avx2");
+  return have_avx2;
+}
+#endif
+
+}  // namespace
+
+bool Orchestrator::SeqCountChanged(uint32_t sid) const {
+  const struct sched_item* si = table_.sched_item(sid);
+  return si->seqcount.seqnum.load(std::memory_order_relaxed) !=
+         cachedsids_[sid].GetSeqCount();
+}
+
 void Orchestrator::RefreshSchedParam(uint32_t sid,
                                      const SchedCallbackFunc& SchedCallback) {
   struct sched_item* si = table_.sched_item(sid);
@@ -38,10 +84,41 @@ void Orchestrator::RefreshSchedParam(uint32_t sid,
 
 // This is the slowpath. The fastpath will only iterate over sched_items that
 // have changed.
+//
+// The stream overflows when the application is busiest, so rather than run
+// RefreshSchedParam() on every sched item, we first compare the seqcounts of
+// the sched items with the ones we cached and only refresh those that differ.
+// Where AVX2 is available, we compare 8 at a time.
+//
+// The seqcounts are read without ordering here. That is fine, since the
+// producers' updates are ordered before their increment of scrape_all, which
+// we acquired, and RefreshSchedParam() rereads the seqcount properly.
 void Orchestrator::RefreshAllSchedParams(
-    const SchedCallbackFunc& SchedCallback) {
-  for (uint32_t sid = 0; sid < num_sched_items_; sid++) {
-    RefreshSchedParam(sid, SchedCallback);
+    const SchedCallbackFunc& SchedCallback, bool simd) {
+  uint32_t sid = 0;
+
+#if defined(__x86_64__)
+  if (simd && HaveAvx2()) {
+    constexpr size_t kCachedStride = sizeof(SchedParams) / sizeof(uint32_t);
+    static_assert(sizeof(SchedParams) % sizeof(uint32_t) == 0);
+    static_assert(offsetof(SchedParams, seqcount_) % sizeof(uint32_t) == 0);
+
+    for (; sid + 8 <= num_sched_items_; sid += 8) {
+      const uint32_t* item_seq = reinterpret_cast<const uint32_t*>(
+          &table_.sched_item(sid)->seqcount.seqnum);
+      uint32_t changed = ChangedSeqCounts8(
+          item_seq, &cachedsids_[sid].seqcount_, kCachedStride);
+      while (changed) {
+        int i = __builtin_ctz(changed);
+        changed &= changed - 1;
+        RefreshSchedParam(sid + i, SchedCallback);
+      }
+    }
+  }
+#endif
+
+  for (; sid < num_sched_items_; sid++) {
+    if (SeqCountChanged(sid)) RefreshSchedParam(sid, SchedCallback);
   }
 }
 
@@ -107,6 +184,7 @@ void Orchestrator::DumpSchedParams() const {
 void Orchestrator::UpdateWorkClassStats(uint32_t wcid,
                                         absl::Duration elapsed_runtime,
                                         absl::Time deadline) {
+  CHECK_LT(wcid, wc_stats_.size());
   WorkClassStats& stats = wc_stats_[wcid];
 
   stats.runtimes += elapsed_runtime;
@@ -117,6 +195,7 @@ void Orchestrator::UpdateWorkClassStats(uint32_t wcid,
 }
 
 absl::Duration Orchestrator::EstimateRuntime(uint32_t wcid) const {
+  CHECK_LT(wcid, wc_stats_.size());
   const WorkClassStats& stats = wc_stats_[wcid];
 
   CHECK_GE(stats.samples, 1);
@@ -139,7 +218,7 @@ void Orchestrator::MakeEngineRunnable(const SchedParams* sp) {
   item->flags |= SCHED_ITEM_RUNNABLE;
 }
 
-bool Orchestrator::Init(pid_t remote) {
+bool Orchestrator::Init(pid_t remote, AdmissionControl& admission) {
   bool ret = table_.Attach(remote);
   if (ret) {
     num_sched_items_ = table_.NumSchedItems();
@@ -147,12 +226,35 @@ bool Orchestrator::Init(pid_t remote) {
     cachedsids_ = absl::make_unique<SchedParams[]>(num_sched_items_);
 
     for (uint32_t wcid = 0; wcid < num_work_classes_; wcid++) {
-      const struct work_class* wc = table_.work_class(wcid);
+      struct work_class* wc = table_.work_class(wcid);
       WorkClassStats stats = {absl::Nanoseconds(wc->exectime), 1, 0};
       wc_stats_.push_back(stats);
+
+      absl::Duration period = (wc->flags & WORK_CLASS_REPEATING)
+                                  ? absl::Nanoseconds(wc->period)
+                                  : absl::ZeroDuration();
+      AdmissionControl::Decision decision =
+          admission.Admit(EstimateRuntime(wcid), period);
+      wc_admission_.push_back(decision);
+      WRITE_ONCE(wc->admission, decision.admission);
+      GHOST_DPRINT(1, stderr,
+                   "pid %d wcid %u: admission %u period %s (%.2f/%.2f cpus)",
+                   remote, wcid, decision.admission,
+                   absl::FormatDuration(decision.period).c_str(),
+                   admission.reserved(), admission.capacity());
     }
   }
   return ret;
 }
 
+void Orchestrator::Release(AdmissionControl& admission) {
+  for (const AdmissionControl::Decision& decision : wc_admission_) {
+    if (decision.admission == WORK_CLASS_ADMITTED ||
+        decision.admission == WORK_CLASS_DEGRADED) {
+      admission.Release(decision.runtime, decision.period);
+    }
+  }
+  wc_admission_.clear();
+}
+
 }  // namespace ghost
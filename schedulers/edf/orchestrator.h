@@ -21,6 +21,7 @@
 #include <vector>
 
 #include "lib/ghost.h"
+#include "schedulers/edf/admission.h"
 #include "shared/prio_table.h"
 
 namespace ghost {
@@ -29,9 +30,9 @@ class SchedParams {
  public:
   inline void SetRunnable() { flags_ |= SCHED_ITEM_RUNNABLE; }
   inline bool HasWork() const { return flags_ & SCHED_ITEM_RUNNABLE; }
-  inline uint32_t GetFlags() { return flags_; }
-  inline uint32_t GetSeqCount() { return seqcount_; }
-  inline uint32_t GetSID() { return sid_; }
+  inline uint32_t GetFlags() const { return flags_; }
+  inline uint32_t GetSeqCount() const { return seqcount_; }
+  inline uint32_t GetSID() const { return sid_; }
 
   inline uint32_t GetWorkClass() const { return wcid_; }
   inline Gtid GetGtid() const { return Gtid(gpid_); }
@@ -94,6 +95,9 @@ class SchedParams {
   }
 
  private:
+  // Orchestrator compares the cached seqcounts of many sched items at once.
+  friend class Orchestrator;
+
   uint32_t sid_;
   uint32_t wcid_;   // unique identifier for work class
   uint64_t gpid_;   // unique identifier for thread
@@ -108,7 +112,11 @@ class Orchestrator {
  public:
   Orchestrator() : table_() {}
 
-  bool Init(pid_t remote);
+  // Attaches to the PrioTable of `remote` and decides the admission of each
+  // of its work classes, which is published in the work class's 'admission'.
+  bool Init(pid_t remote, AdmissionControl& admission);
+  // Releases what Init() reserved in `admission`, once the app is gone.
+  void Release(AdmissionControl& admission);
 
   typedef std::function<void(Orchestrator& orch, const SchedParams* sp,
                              Gtid oldGtid)>
@@ -119,7 +127,11 @@ class Orchestrator {
   void DumpSchedParams() const;
   void GetSchedParams(Gtid gtid, const SchedCallbackFunc& callback);
   void RefreshSchedParams(const SchedCallbackFunc& SchedCallback);
-  void RefreshAllSchedParams(const SchedCallbackFunc& SchedCallback);
+  // Refreshes every sched item whose seqcount changed. Where AVX2 is
+  // available, 8 seqcounts are compared at a time unless `simd` is false,
+  // which tests use to compare the two.
+  void RefreshAllSchedParams(const SchedCallbackFunc& SchedCallback,
+                             bool simd = true);
 
   inline bool Repeating(const SchedParams* sp) {
     const struct work_class* wc = table_.work_class(sp->GetWorkClass());
@@ -129,9 +141,17 @@ class Orchestrator {
   void UpdateWorkClassStats(uint32_t wcid, absl::Duration elapsed_runtime,
                             absl::Time deadline);
   absl::Duration EstimateRuntime(uint32_t wcid) const;
+  // Returns the period that the work class was admitted with, which is longer
+  // than the period in its 'work_class' if it was degraded.
   absl::Duration GetWorkClassPeriod(uint32_t wcid) const {
-    const struct work_class* wc = table_.work_class(wcid);
-    return absl::Nanoseconds(wc->period);
+    // `wcid` comes from the sched item in shared memory.
+    CHECK_LT(wcid, wc_admission_.size());
+    return wc_admission_[wcid].period;
+  }
+  // Returns one of the WORK_CLASS_ADMISSION values.
+  uint32_t GetWorkClassAdmission(uint32_t wcid) const {
+    CHECK_LT(wcid, wc_admission_.size());
+    return wc_admission_[wcid].admission;
   }
 
   void MakeEngineRunnable(const SchedParams* sp);
@@ -143,6 +163,9 @@ class Orchestrator {
 
  private:
   void RefreshSchedParam(uint32_t sid, const SchedCallbackFunc& SchedCallback);
+  // Returns true if the seqcount of sched item `sid` differs from the one we
+  // last copied, i.e. RefreshSchedParam() may have something to do.
+  bool SeqCountChanged(uint32_t sid) const;
 
   struct WorkClassStats {
     absl::Duration runtimes;
@@ -151,6 +174,7 @@ class Orchestrator {
   };
 
   std::vector<WorkClassStats> wc_stats_;
+  std::vector<AdmissionControl::Decision> wc_admission_;
 
   PrioTable table_;
   uint32_t num_sched_items_ = 0;
@@ -18,6 +18,8 @@
 
 #include "absl/debugging/symbolize.h"
 #include "absl/flags/parse.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
 #include "lib/agent.h"
 #include "lib/channel.h"
 #include "lib/enclave.h"
@@ -31,6 +33,14 @@ ABSL_FLAG(int32_t, ncpus, 5, "Schedule on <ncpus> starting from <firstcpu>");
 ABSL_FLAG(std::string, enclave, "", "Connect to preexisting enclave directory");
 ABSL_FLAG(absl::Duration, preemption_time_slice, absl::Microseconds(50),
           "Shinjuku preemption time slice");
+ABSL_FLAG(bool, slice_timers, false,
+          "End time slices with per-CPU timers rather than by polling each "
+          "running task's elapsed runtime. The global agent still spins, but "
+          "only runs a scheduling pass when a message or PrioTable update "
+          "arrives");
+ABSL_FLAG(std::string, app_weights, "",
+          "Comma-separated tgid:weight pairs. Applications at the same QoS "
+          "level share the CPUs in proportion to their weights (default 1)");
 
 namespace ghost {
 
@@ -63,6 +73,19 @@ void ParseShinjukuConfig(ShinjukuConfig* config) {
   config->cpus_ = topology->ToCpuList(std::move(all_cpus_v));
   config->global_cpu_ = topology->cpu(globalcpu);
   config->preemption_time_slice_ = absl::GetFlag(FLAGS_preemption_time_slice);
+  config->slice_timers_ = absl::GetFlag(FLAGS_slice_timers);
+
+  for (absl::string_view entry :
+       absl::StrSplit(absl::GetFlag(FLAGS_app_weights), ',', absl::SkipEmpty())) {
+    std::vector<absl::string_view> fields = absl::StrSplit(entry, ':');
+    pid_t tgid;
+    uint32_t weight;
+    CHECK_EQ(fields.size(), 2);
+    CHECK(absl::SimpleAtoi(fields[0], &tgid));
+    CHECK(absl::SimpleAtoi(fields[1], &weight));
+    CHECK_GT(weight, 0);
+    config->app_weights_[tgid] = weight;
+  }
 
   std::string enclave = absl::GetFlag(FLAGS_enclave);
   if (!enclave.empty()) {
@@ -45,9 +45,10 @@ void ShinjukuOrchestrator::RefreshAllSchedParams(
   }
 }
 
-void ShinjukuOrchestrator::RefreshSchedParams(
+bool ShinjukuOrchestrator::RefreshSchedParams(
     const SchedCallbackFunc& SchedCallback) {
   int updatedIndex;
+  bool refreshed = false;
 
   // Limit the number of iterations that we do before exiting this function. If
   // we were to replace this for loop with a while true loop, a malicious or
@@ -61,8 +62,10 @@ void ShinjukuOrchestrator::RefreshSchedParams(
     updatedIndex = table_.NextUpdatedIndex();
     if (updatedIndex >= 0 && updatedIndex < num_sched_items_) {
       RefreshSchedParam(updatedIndex, SchedCallback);
+      refreshed = true;
     } else if (updatedIndex == PrioTable::kStreamOverflow) {
       RefreshAllSchedParams(SchedCallback);
+      refreshed = true;
       break;
     } else if (updatedIndex == PrioTable::kStreamNoEntries) {
       break;
@@ -70,6 +73,7 @@ void ShinjukuOrchestrator::RefreshSchedParams(
       GHOST_ERROR("Dequeued unknown value from the stream");
     }
   }
+  return refreshed;
 }
 
 void ShinjukuOrchestrator::GetSchedParams(Gtid gtid,
@@ -143,8 +143,9 @@ class ShinjukuOrchestrator {
   // this function uses the PrioTable stream to efficiently detect which sched
   // items have been updated, but if the stream has overflown, then the entire
   // PrioTable is scraped and all sched items are refreshed and passed to the
-  // callback regardless of whether they have been updated or not.
-  void RefreshSchedParams(const SchedCallbackFunc& SchedCallback);
+  // callback regardless of whether they have been updated or not. Returns
+  // 'true' if any sched item was refreshed.
+  bool RefreshSchedParams(const SchedCallbackFunc& SchedCallback);
 
   // Calls 'RefreshSchedParam' with 'SchedCallback' on all sched items in the
   // PrioTable.
@@ -14,6 +14,8 @@
 
 #include "schedulers/shinjuku/shinjuku_scheduler.h"
 
+#include <sys/timerfd.h>
+
 #include "absl/strings/str_format.h"
 
 namespace ghost {
@@ -43,19 +45,42 @@ void ShinjukuTask::UpdateRuntime() {
 ShinjukuScheduler::ShinjukuScheduler(
     Enclave* enclave, CpuList cpulist,
     std::shared_ptr<TaskAllocator<ShinjukuTask>> allocator, int32_t global_cpu,
-    absl::Duration preemption_time_slice)
+    absl::Duration preemption_time_slice, bool slice_timers,
+    absl::flat_hash_map<pid_t, uint32_t> app_weights)
     : BasicDispatchScheduler(enclave, std::move(cpulist), std::move(allocator)),
       global_cpu_(global_cpu),
       global_channel_(GHOST_MAX_QUEUE_ELEMS, /*node=*/0),
-      preemption_time_slice_(preemption_time_slice) {
+      app_weights_(std::move(app_weights)),
+      preemption_time_slice_(preemption_time_slice),
+      slice_timers_(slice_timers),
+      // Without a time slice, use Shinjuku's default one as the quantum.
+      quantum_ns_(absl::ToInt64Nanoseconds(
+          preemption_time_slice == absl::InfiniteDuration()
+              ? absl::Microseconds(50)
+              : preemption_time_slice)) {
+  for (const auto& [tgid, weight] : app_weights_) CHECK_GT(weight, 0);
+
   if (!cpus().IsSet(global_cpu_)) {
     Cpu c = cpus().Front();
     CHECK(c.valid());
     global_cpu_ = c.id();
   }
+
+  if (slice_timers_) {
+    for (const Cpu& cpu : cpus()) {
+      CpuState* cs = cpu_state(cpu);
+      cs->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+      CHECK_GE(cs->timerfd, 0);
+    }
+  }
 }
 
-ShinjukuScheduler::~ShinjukuScheduler() {}
+ShinjukuScheduler::~ShinjukuScheduler() {
+  for (const Cpu& cpu : cpus()) {
+    CpuState* cs = cpu_state(cpu);
+    if (cs->timerfd >= 0) close(cs->timerfd);
+  }
+}
 
 void ShinjukuScheduler::EnclaveReady() {
   for (const Cpu& cpu : cpus()) {
@@ -165,6 +190,7 @@ void ShinjukuScheduler::TaskNew(ShinjukuTask* task, const Message& msg) {
   const Gtid gtid(payload->gtid);
   const pid_t tgid = gtid.tgid();
   HandleNewGtid(task, tgid);
+  app_tasks_[tgid]++;
   if (payload->runnable) Enqueue(task);
 
   num_tasks_++;
@@ -204,18 +230,21 @@ void ShinjukuScheduler::TaskDeparted(ShinjukuTask* task, const Message& msg) {
     CpuState* cs = cpu_state_of(task);
     CHECK_EQ(cs->current, task);
     cs->current = nullptr;
+    if (slice_timers_) StopSliceTimer(topology()->cpu(task->cpu));
   } else if (task->queued()) {
     RemoveFromRunqueue(task);
   } else {
     CHECK(task->blocked());
   }
 
+  ReleaseApp(task);
   allocator()->FreeTask(task);
   num_tasks_--;
 }
 
 void ShinjukuScheduler::TaskDead(ShinjukuTask* task, const Message& msg) {
   CHECK_EQ(task->run_state, ShinjukuTask::RunState::kBlocked);
+  ReleaseApp(task);
   allocator()->FreeTask(task);
 
   num_tasks_--;
@@ -237,6 +266,7 @@ void ShinjukuScheduler::TaskBlocked(ShinjukuTask* task, const Message& msg) {
     CpuState* cs = cpu_state_of(task);
     CHECK_EQ(cs->current, task);
     cs->current = nullptr;
+    if (slice_timers_) StopSliceTimer(topology()->cpu(task->cpu));
   } else if (task->queued()) {
     RemoveFromRunqueue(task);
   } else {
@@ -265,6 +295,7 @@ void ShinjukuScheduler::TaskPreempted(ShinjukuTask* task, const Message& msg) {
     CpuState* cs = cpu_state_of(task);
     CHECK_EQ(cs->current, task);
     cs->current = nullptr;
+    if (slice_timers_) StopSliceTimer(topology()->cpu(task->cpu));
     Enqueue(task);
   } else if (task->queued()) {
     // The task was preempted, so add it to the front of run queue. We do this
@@ -297,12 +328,59 @@ void ShinjukuScheduler::TaskYield(ShinjukuTask* task, const Message& msg) {
     CpuState* cs = cpu_state_of(task);
     CHECK_EQ(cs->current, task);
     cs->current = nullptr;
+    if (slice_timers_) StopSliceTimer(topology()->cpu(task->cpu));
     Yield(task);
   } else {
     CHECK(task->queued() || task->paused());
   }
 }
 
+void ShinjukuScheduler::CpuTimerExpired(const Message& msg) {
+  const ghost_msg_payload_timer* payload =
+      static_cast<const ghost_msg_payload_timer*>(msg.payload());
+  CpuState* cs = cpu_state(topology()->cpu(payload->cpu));
+
+  // The slice this timer was armed for has already ended.
+  if (payload->cookie != cs->timer_seq) return;
+  cs->timer_armed = false;
+  cs->slice_expired = true;
+}
+
+void ShinjukuScheduler::StartSliceTimer(const Cpu& cpu, ShinjukuTask* next) {
+  CpuState* cs = cpu_state(cpu);
+  cs->slice_expired = false;
+  cs->timer_seq++;
+
+  // Whether `next` may actually be preempted when its slice ends (e.g., it is
+  // not a repeatable) is decided by GlobalSchedule() at that point, since it
+  // can change while `next` runs.
+  const bool arm = preemption_time_slice_ != absl::InfiniteDuration();
+  if (!arm && !cs->timer_armed) return;
+
+  // A zero it_value disarms the timer.
+  itimerspec itimerspec = {};
+  if (arm) itimerspec.it_value = absl::ToTimespec(preemption_time_slice_);
+  cs->timer_armed = arm;
+  CHECK_EQ(GhostHelper()->TimerFdSettime(cs->timerfd, /*flags=*/0, &itimerspec,
+                                         cpu, /*type=*/0, cs->timer_seq),
+           0);
+}
+
+void ShinjukuScheduler::StopSliceTimer(const Cpu& cpu) {
+  CpuState* cs = cpu_state(cpu);
+  cs->slice_expired = false;
+  // Makes an expiration that is already in flight stale.
+  cs->timer_seq++;
+  if (!cs->timer_armed) return;
+
+  // A zero it_value disarms the timer.
+  itimerspec itimerspec = {};
+  cs->timer_armed = false;
+  CHECK_EQ(GhostHelper()->TimerFdSettime(cs->timerfd, /*flags=*/0, &itimerspec,
+                                         cpu, /*type=*/0, cs->timer_seq),
+           0);
+}
+
 void ShinjukuScheduler::DiscoveryStart() { in_discovery_ = true; }
 
 void ShinjukuScheduler::DiscoveryComplete() {
@@ -332,9 +410,50 @@ void ShinjukuScheduler::Unyield(ShinjukuTask* task) {
   Enqueue(task);
 }
 
+ShinjukuAppQueue* ShinjukuScheduler::AppQueue(const ShinjukuTask* task,
+                                              uint32_t level) {
+  const pid_t tgid = task->gtid.tgid();
+  auto it = apps_.find(tgid);
+  if (it == apps_.end()) {
+    auto queues = std::make_unique<ShinjukuAppQueue[]>(kNumQoS);
+    auto weight = app_weights_.find(tgid);
+    if (weight != app_weights_.end()) {
+      for (uint32_t i = 0; i < kNumQoS; i++) queues[i].weight = weight->second;
+    }
+    it = apps_.emplace(tgid, std::move(queues)).first;
+  }
+  return &it->second[level];
+}
+
+void ShinjukuScheduler::ReleaseApp(ShinjukuTask* task) {
+  const pid_t tgid = task->gtid.tgid();
+  auto iter = app_tasks_.find(tgid);
+  CHECK(iter != app_tasks_.end());
+  if (--iter->second > 0) return;
+
+  app_tasks_.erase(iter);
+  auto app = apps_.find(tgid);
+  // The application may never have been queued.
+  if (app == apps_.end()) return;
+  // The departing task is off the runqueue, so nothing points into the queues.
+  for (uint32_t i = 0; i < kNumQoS; i++) {
+    CHECK(app->second[i].tasks.empty());
+  }
+  apps_.erase(app);
+}
+
+void ShinjukuScheduler::SettleCharge(ShinjukuTask* task) {
+  if (!task->charged_app) return;
+  const int64_t used = task->status_word.runtime() - task->charged_from;
+  task->charged_app->deficit_ns -= used - quantum_ns_;
+  task->charged_app = nullptr;
+}
+
 void ShinjukuScheduler::Enqueue(ShinjukuTask* task, bool back) {
   CHECK_EQ(task->unschedule_level,
            ShinjukuTask::UnscheduleLevel::kNoUnschedule);
+  // The task is off cpu (or never got on it), so its last run is over.
+  SettleCharge(task);
   if (!task->has_work) {
     // We'll re-enqueue when this ShinjukuTask has work to do during periodic
     // scraping of PrioTable.
@@ -343,57 +462,130 @@ void ShinjukuScheduler::Enqueue(ShinjukuTask* task, bool back) {
   }
 
   task->run_state = ShinjukuTask::RunState::kQueued;
-  if (back && !task->prio_boost) {
-    run_queue_[task->sp->GetQoS()].emplace_back(task);
+  task->rq_qos = RunqueueLevel(task->sp->GetQoS());
+  ShinjukuRunqueue& rq = run_queue_[task->rq_qos];
+  if (task->prio_boost) {
+    task->rq_app = nullptr;
+    rq.boosted.PushFront(task);
   } else {
-    run_queue_[task->sp->GetQoS()].emplace_front(task);
+    ShinjukuAppQueue* app = AppQueue(task, task->rq_qos);
+    task->rq_app = app;
+    if (back) {
+      app->tasks.PushBack(task);
+    } else {
+      app->tasks.PushFront(task);
+    }
+    // An application that had nothing queued joins the end of the round.
+    if (!decltype(rq.apps)::Linked(app)) rq.apps.PushBack(app);
   }
+  rq_bitmap_ |= uint64_t{1} << task->rq_qos;
+  rq_size_++;
 }
 
 ShinjukuTask* ShinjukuScheduler::Dequeue() {
+  ShinjukuTask* task = Peek();
+  if (!task) return nullptr;
+
+  if (task->rq_app) {
+    run_queue_[task->rq_qos].StartRounds(task->rq_app, quantum_ns_);
+  }
+  EraseFromRunqueue(task);
+  // We don't know yet how long the task will run, so charge its application a
+  // quantum now and settle the difference when it is enqueued again.
+  ShinjukuAppQueue* app = AppQueue(task, task->rq_qos);
+  app->deficit_ns -= quantum_ns_;
+  task->charged_app = app;
+  task->charged_from = task->status_word.runtime();
+  return task;
+}
+
+ShinjukuTask* ShinjukuScheduler::Peek() {
   if (RunqueueEmpty()) {
     return nullptr;
   }
 
-  std::deque<ShinjukuTask*>& rq = run_queue_[FirstFilledRunqueue()];
-  struct ShinjukuTask* task = rq.front();
+  const ShinjukuRunqueue& rq = run_queue_[FirstFilledRunqueue()];
+  ShinjukuTask* task = rq.boosted.Front();
+  if (!task) {
+    // Dequeue() runs the rounds it takes for this application to get a
+    // positive deficit.
+    task = rq.NextApp(quantum_ns_)->tasks.Front();
+  }
   CHECK_NE(task, nullptr);
   CHECK(task->has_work);
   CHECK_EQ(task->unschedule_level,
            ShinjukuTask::UnscheduleLevel::kNoUnschedule);
-  rq.pop_front();
 
   return task;
 }
 
-ShinjukuTask* ShinjukuScheduler::Peek() {
-  if (RunqueueEmpty()) {
-    return nullptr;
+// The number of rounds after which `app` has a positive deficit.
+static int64_t RoundsUntilPositive(const ShinjukuAppQueue* app,
+                                   int64_t quantum_ns) {
+  if (app->deficit_ns > 0) return 0;
+  return -app->deficit_ns / (app->weight * quantum_ns) + 1;
+}
+
+ShinjukuAppQueue* ShinjukuRunqueue::NextApp(int64_t quantum_ns) const {
+  ShinjukuAppQueue* next = apps.Front();
+  if (!next || next->deficit_ns > 0) return next;
+
+  // Each round goes over the applications in order, and the first one with a
+  // positive deficit wins. So the fewest rounds win, and ties go to the
+  // application that comes first.
+  int64_t rounds = RoundsUntilPositive(next, quantum_ns);
+  for (ShinjukuAppQueue* app = apps.Next(next); app; app = apps.Next(app)) {
+    const int64_t app_rounds = RoundsUntilPositive(app, quantum_ns);
+    if (app_rounds < rounds) {
+      next = app;
+      rounds = app_rounds;
+    }
   }
+  return next;
+}
 
-  ShinjukuTask* task = run_queue_[FirstFilledRunqueue()].front();
-  CHECK(task->has_work);
-  CHECK_EQ(task->unschedule_level,
-           ShinjukuTask::UnscheduleLevel::kNoUnschedule);
+void ShinjukuRunqueue::StartRounds(ShinjukuAppQueue* next,
+                                   int64_t quantum_ns) {
+  const int64_t rounds = RoundsUntilPositive(next, quantum_ns);
 
-  return task;
+  if (rounds) {
+    for (ShinjukuAppQueue* app = apps.Front(); app; app = apps.Next(app)) {
+      app->deficit_ns += rounds * app->weight * quantum_ns;
+    }
+  }
+  // The applications ahead of `next` are visited once more, in the round that
+  // it wins, and go to the back.
+  while (apps.Front() != next) {
+    ShinjukuAppQueue* app = apps.PopFront();
+    CHECK_NE(app, nullptr);
+    app->deficit_ns += app->weight * quantum_ns;
+    apps.PushBack(app);
+  }
+}
+
+void ShinjukuScheduler::EraseFromRunqueue(ShinjukuTask* task) {
+  ShinjukuRunqueue& rq = run_queue_[task->rq_qos];
+  if (ShinjukuAppQueue* app = task->rq_app) {
+    app->tasks.Erase(task);
+    if (app->tasks.empty()) {
+      rq.apps.Erase(app);
+      // As in deficit round robin, an application does not bank its unused
+      // share while it has nothing to run. It does keep its debt, though.
+      app->deficit_ns = std::min<int64_t>(app->deficit_ns, 0);
+    }
+    task->rq_app = nullptr;
+  } else {
+    rq.boosted.Erase(task);
+  }
+  if (rq.empty()) rq_bitmap_ &= ~(uint64_t{1} << task->rq_qos);
+  rq_size_--;
 }
 
 void ShinjukuScheduler::RemoveFromRunqueue(ShinjukuTask* task) {
   CHECK(task->queued());
 
-  for (auto& [qos, rq] : run_queue_) {
-    for (int pos = rq.size() - 1; pos >= 0; pos--) {
-      // The [] operator for 'std::deque' is constant time
-      if (rq[pos] == task) {
-        task->run_state = ShinjukuTask::RunState::kPaused;
-        rq.erase(rq.cbegin() + pos);
-        return;
-      }
-    }
-  }
-  // This state is unreachable because the task is queued
-  CHECK(false);
+  EraseFromRunqueue(task);
+  task->run_state = ShinjukuTask::RunState::kPaused;
 }
 
 void ShinjukuScheduler::UnscheduleTask(ShinjukuTask* task) {
@@ -412,6 +604,7 @@ void ShinjukuScheduler::UnscheduleTask(ShinjukuTask* task) {
 
   CpuState* cs = cpu_state(cpu);
   cs->current = nullptr;
+  if (slice_timers_) StopSliceTimer(cpu);
   task->run_state = ShinjukuTask::RunState::kPaused;
   task->unschedule_level = ShinjukuTask::UnscheduleLevel::kNoUnschedule;
 }
@@ -580,181 +773,208 @@ void ShinjukuScheduler::SchedParamsCallback(ShinjukuOrchestrator& orch,
   }
 }
 
-void ShinjukuScheduler::UpdateSchedParams() {
+bool ShinjukuScheduler::UpdateSchedParams() {
+  bool refreshed = false;
   for (auto& scraper : orchs_) {
-    scraper.second->RefreshSchedParams(kSchedCallbackFunc);
+    refreshed |= scraper.second->RefreshSchedParams(kSchedCallbackFunc);
   }
+  return refreshed;
 }
 
-bool ShinjukuScheduler::SkipForSchedule(int iteration, const Cpu& cpu) {
-  CpuState* cs = cpu_state(cpu);
-  // The logic is complex, so we break it into multiple if statements rather
-  // than compress it into a single boolean expression that we return
-  if (!Available(cpu) || cpu.id() == GetGlobalCPUId()) {
-    // Cannot schedule on this CPU.
-    return true;
-  }
-  if (iteration == 0 && cs->current &&
-      cs->current->unschedule_level <
-          ShinjukuTask::UnscheduleLevel::kMustUnschedule) {
-    // Don't preempt the task on this CPU in the first iteration. We first
-    // try to see if there is an idle CPU we can run the next task on. The only
-    // exception is if the currently running task must be unscheduled... it is
-    // fine to preempt the task in the first iteration in that case (especially
-    // since we would prefer to preempt a task with a level of `kMustUnschedule`
-    // rather than a task on a different CPU with a level of `kCouldUnschedule`.
-    return true;
+bool ShinjukuScheduler::PreemptionVictim::operator<(
+    const PreemptionVictim& other) const {
+  // `*this` is a worse victim than `other`.
+  if (qos != other.qos) return qos > other.qos;
+  if (unschedule_level != other.unschedule_level) {
+    return unschedule_level < other.unschedule_level;
   }
-  if (iteration == 1 && cs->next) {
-    // We already assigned a task to this CPU in the first iteration.
-    return true;
-  }
-  return false;
+  if (slice_expired != other.slice_expired) return !slice_expired;
+  return last_ran > other.last_ran;
+}
+
+bool ShinjukuScheduler::ShouldPreempt(const PreemptionVictim& victim,
+                                      const ShinjukuTask* next) const {
+  // Preempt the current task if either:
+  // 1. A higher-priority task wants to run.
+  // 2. The next task to run has the same priority as the current task,
+  // the current task has used up its time slice, and the current task is
+  // not a repeatable.
+  // 3. The task's unschedule level is at least `kCouldUnschedule`, making
+  // the task eligible for preemption.
+  const uint32_t next_qos = next->sp->GetQoS();
+  if (victim.qos < next_qos) return true;
+  if (victim.qos > next_qos) return false;
+  return victim.slice_expired ||
+         victim.unschedule_level >=
+             ShinjukuTask::UnscheduleLevel::kCouldUnschedule;
 }
 
 void ShinjukuScheduler::GlobalSchedule(const StatusWord& agent_sw,
                                        StatusWord::BarrierToken agent_sw_last) {
   // List of CPUs with open transactions.
   CpuList open_cpus = MachineTopology()->EmptyCpuList();
+  CpuList updated_cpus = MachineTopology()->EmptyCpuList();
   const absl::Time now = absl::Now();
-  // TODO: Refactor this loop
-  for (int i = 0; i < 2; i++) {
-    CpuList updated_cpus = MachineTopology()->EmptyCpuList();
-    for (const Cpu& cpu : cpus()) {
-      CpuState* cs = cpu_state(cpu);
-      if (SkipForSchedule(i, cpu)) {
-        continue;
-      }
 
-    again:
-      if (cs->current) {
-        // Approximate the elapsed runtime rather than update the runtime with
-        // 'cs->current->UpdateRuntime()' to get the true elapsed runtime from
-        // 'cs->current->elapsed_runtime'. Calls to 'UpdateRuntime()' grab the
-        // runqueue lock, so calling this for tasks on many CPUs harms tail
-        // latency.
-        absl::Duration elapsed_runtime = now - cs->current->last_ran;
-
-        // Preempt the current task if either:
-        // 1. A higher-priority task wants to run.
-        // 2. The next task to run has the same priority as the current task,
-        // the current task has used up its time slice, and the current task is
-        // not a repeatable.
-        // 3. The task's unschedule level is at least `kCouldUnschedule`, making
-        // the task eligible for preemption.
-        ShinjukuTask* peek = Peek();
-        bool should_preempt = false;
-        if (peek) {
-          uint32_t current_qos = cs->current->sp->GetQoS();
-          uint32_t peek_qos = peek->sp->GetQoS();
-
-          if (current_qos < peek_qos) {
-            should_preempt = true;
-          } else if (current_qos == peek_qos) {
-            if (elapsed_runtime >= preemption_time_slice_ &&
-                cs->current->orch &&
-                !cs->current->orch->Repeating(cs->current->sp)) {
-              should_preempt = true;
-            } else if (cs->current->unschedule_level >=
-                       ShinjukuTask::UnscheduleLevel::kCouldUnschedule) {
-              should_preempt = true;
-            }
-          }
-        }
-        if (!should_preempt) {
-          continue;
-        }
-      }
-      ShinjukuTask* to_run = Dequeue();
-      if (!to_run) {
-        // No tasks left to schedule.
-        break;
-      }
+  // CPUs that we can run a task on without preempting anything: first those
+  // whose task must be unscheduled anyway, so that the unschedule is combined
+  // with the new schedule, then idle ones. The remaining CPUs are potential
+  // preemption victims, kept as a heap ordered by ShouldPreempt() so that the
+  // best one is found in O(log n).
+  free_cpus_.clear();
+  victims_.clear();
+  size_t num_must_unschedule = 0;
+  bool all_available = true;
+  for (const Cpu& cpu : cpus()) {
+    if (cpu.id() == GetGlobalCPUId()) continue;
+    if (!Available(cpu)) {
+      // Cannot schedule on this CPU.
+      all_available = false;
+      continue;
+    }
+    CpuState* cs = cpu_state(cpu);
+    ShinjukuTask* current = cs->current;
+    if (!current) {
+      free_cpus_.push_back(cpu);
+      continue;
+    }
+    if (current->unschedule_level ==
+        ShinjukuTask::UnscheduleLevel::kMustUnschedule) {
+      free_cpus_.push_back(cpu);
+      std::swap(free_cpus_[num_must_unschedule++], free_cpus_.back());
+      continue;
+    }
 
-      // The chosen task was preempted earlier but hasn't gotten off the
-      // CPU. Make it ineligible for selection in this scheduling round.
-      if (to_run->status_word.on_cpu()) {
-        Yield(to_run);
-        goto again;
+    // Approximate the elapsed runtime rather than update the runtime with
+    // 'current->UpdateRuntime()' to get the true elapsed runtime from
+    // 'current->elapsed_runtime'. Calls to 'UpdateRuntime()' grab the runqueue
+    // lock, so calling this for tasks on many CPUs harms tail latency.
+    //
+    // With slice timers, the CPU's timer has already told us whether the
+    // slice has ended.
+    const bool slice_expired =
+        slice_timers_ ? cs->slice_expired
+                      : now - current->last_ran >= preemption_time_slice_;
+    victims_.push_back({
+        .cpu = cpu,
+        .qos = current->sp->GetQoS(),
+        .unschedule_level = current->unschedule_level,
+        .slice_expired = slice_expired && current->orch &&
+                         !current->orch->Repeating(current->sp),
+        .last_ran = current->last_ran,
+    });
+  }
+  // Only pay for the heap if we run out of free CPUs.
+  bool victims_heap = false;
+
+  size_t next_free = 0;
+  while (ShinjukuTask* peek = Peek()) {
+    Cpu cpu(Cpu::UninitializedType::kUninitialized);
+    if (next_free < free_cpus_.size()) {
+      cpu = free_cpus_[next_free];
+    } else {
+      if (!victims_heap) {
+        std::make_heap(victims_.begin(), victims_.end());
+        victims_heap = true;
       }
+      // The best victim is the only one worth checking: if it should not be
+      // preempted for `peek`, no other CPU should be either.
+      if (victims_.empty() || !ShouldPreempt(victims_.front(), peek)) break;
+      cpu = victims_.front().cpu;
+    }
 
-      cs->next = to_run;
+    ShinjukuTask* to_run = Dequeue();
+    CHECK_EQ(to_run, peek);
 
-      updated_cpus.Set(cpu.id());
+    // The chosen task was preempted earlier but hasn't gotten off the
+    // CPU. Make it ineligible for selection in this scheduling round, and
+    // reconsider `cpu` for the next task.
+    if (to_run->status_word.on_cpu()) {
+      Yield(to_run);
+      continue;
     }
 
-    for (const Cpu& cpu : cpus()) {
-      CpuState* cs = cpu_state(cpu);
-      // Make a copy of the `cs->current` pointer since we need to access the
-      // task after it is unscheduled. `UnscheduleTask` sets `cs->current` to
-      // `nullptr`.
-      ShinjukuTask* task = cs->current;
-      if (task) {
-        if (!cs->next) {
-          if (task->unschedule_level ==
-              ShinjukuTask::UnscheduleLevel::kCouldUnschedule) {
-            // We set the level to `kNoUnschedule` since no task is being
-            // scheduled in place of `task` on `cpu`. We cannot set the level to
-            // `kNoUnschedule` when trying to schedule another task on this
-            // `cpu` because that schedule may fail, so `task` needs to be
-            // directly unscheduled in that case so that `task` does not get
-            // preference over tasks waiting in the runqueue.
-            //
-            // Note that an unschedule is optional for a level of
-            // `kCouldUnschedule`, so we do not initiate an unschedule unlike
-            // below for `kMustUnschedule`.
-            task->unschedule_level =
-                ShinjukuTask::UnscheduleLevel::kNoUnschedule;
-          } else if (task->unschedule_level ==
-                     ShinjukuTask::UnscheduleLevel::kMustUnschedule) {
-            // `task` must be unscheduled and we have no new task schedule to
-            // pair the unschedule with, so initiate the unschedule directly.
-            UnscheduleTask(task);
-          }
-        }
+    if (next_free < free_cpus_.size()) {
+      next_free++;
+    } else {
+      std::pop_heap(victims_.begin(), victims_.end());
+      victims_.pop_back();
+    }
+    cpu_state(cpu)->next = to_run;
+    updated_cpus.Set(cpu.id());
+  }
 
-        // Four cases:
-        //
-        // If there is a new task `cs->next` to run next (i.e., `cs->next` !=
-        // `nullptr`):
-        //   Case 1: If the level is `kCouldUnschedule`, we will attempt the
-        //   schedule below and directly initiate an unschedule of `task` if
-        //   that schedule fails.
-        //
-        //   Case 2: If the level is `kMustUnschedule`, we will attempt the
-        //   schedule below and directly initiate an unschedule of `task` if
-        //   that schedule fails.
-        //
-        // If there is no new task `cs->current` to run next (i.e., `cs->next`
-        // == `nullptr`):
-        //   Case 3: If the level of `task` was `kCouldUnschedule`, we set it to
-        //   `kNoUnschedule` above.
-        //
-        //   Case 4: If the level of `task` was `kMustUnschedule`, we directly
-        //   initiated an unschedule of `task` above. `UnscheduleTask(task)`
-        //   sets the level of `task` to `kNoUnschedule`.
-        CHECK(cs->next || task->unschedule_level ==
-                              ShinjukuTask::UnscheduleLevel::kNoUnschedule);
+  for (const Cpu& cpu : cpus()) {
+    CpuState* cs = cpu_state(cpu);
+    // Make a copy of the `cs->current` pointer since we need to access the
+    // task after it is unscheduled. `UnscheduleTask` sets `cs->current` to
+    // `nullptr`.
+    ShinjukuTask* task = cs->current;
+    if (task) {
+      if (!cs->next) {
+        if (task->unschedule_level ==
+            ShinjukuTask::UnscheduleLevel::kCouldUnschedule) {
+          // We set the level to `kNoUnschedule` since no task is being
+          // scheduled in place of `task` on `cpu`. We cannot set the level to
+          // `kNoUnschedule` when trying to schedule another task on this
+          // `cpu` because that schedule may fail, so `task` needs to be
+          // directly unscheduled in that case so that `task` does not get
+          // preference over tasks waiting in the runqueue.
+          //
+          // Note that an unschedule is optional for a level of
+          // `kCouldUnschedule`, so we do not initiate an unschedule unlike
+          // below for `kMustUnschedule`.
+          task->unschedule_level =
+              ShinjukuTask::UnscheduleLevel::kNoUnschedule;
+        } else if (task->unschedule_level ==
+                   ShinjukuTask::UnscheduleLevel::kMustUnschedule) {
+          // `task` must be unscheduled and we have no new task schedule to
+          // pair the unschedule with, so initiate the unschedule directly.
+          UnscheduleTask(task);
+        }
       }
+
+      // Four cases:
+      //
+      // If there is a new task `cs->next` to run next (i.e., `cs->next` !=
+      // `nullptr`):
+      //   Case 1: If the level is `kCouldUnschedule`, we will attempt the
+      //   schedule below and directly initiate an unschedule of `task` if
+      //   that schedule fails.
+      //
+      //   Case 2: If the level is `kMustUnschedule`, we will attempt the
+      //   schedule below and directly initiate an unschedule of `task` if
+      //   that schedule fails.
+      //
+      // If there is no new task `cs->current` to run next (i.e., `cs->next`
+      // == `nullptr`):
+      //   Case 3: If the level of `task` was `kCouldUnschedule`, we set it to
+      //   `kNoUnschedule` above.
+      //
+      //   Case 4: If the level of `task` was `kMustUnschedule`, we directly
+      //   initiated an unschedule of `task` above. `UnscheduleTask(task)`
+      //   sets the level of `task` to `kNoUnschedule`.
+      CHECK(cs->next || task->unschedule_level ==
+                            ShinjukuTask::UnscheduleLevel::kNoUnschedule);
     }
+  }
 
-    for (const Cpu& cpu : updated_cpus) {
-      CpuState* cs = cpu_state(cpu);
+  for (const Cpu& cpu : updated_cpus) {
+    CpuState* cs = cpu_state(cpu);
 
-      ShinjukuTask* next = cs->next;
-      CHECK_NE(next, nullptr);
+    ShinjukuTask* next = cs->next;
+    CHECK_NE(next, nullptr);
 
-      if (cs->current == next) continue;
+    if (cs->current == next) continue;
 
-      RunRequest* req = enclave()->GetRunRequest(cpu);
-      req->Open({
-          .target = next->gtid,
-          .target_barrier = next->seqnum,
-          .commit_flags = COMMIT_AT_TXN_COMMIT,
-      });
+    RunRequest* req = enclave()->GetRunRequest(cpu);
+    req->Open({
+        .target = next->gtid,
+        .target_barrier = next->seqnum,
+        .commit_flags = COMMIT_AT_TXN_COMMIT,
+    });
 
-      open_cpus.Set(cpu.id());
-    }
+    open_cpus.Set(cpu.id());
   }
   if (!open_cpus.Empty()) {
     enclave()->CommitRunRequests(open_cpus);
@@ -795,6 +1015,7 @@ void ShinjukuScheduler::GlobalSchedule(const StatusWord& agent_sw,
       // this task
       next->elapsed_runtime = absl::ZeroDuration();
       next->last_ran = absl::Now();
+      if (slice_timers_) StartSliceTimer(cpu, next);
     } else {
       // Need to requeue in the stale case.
       Enqueue(next, /* back = */ false);
@@ -810,6 +1031,12 @@ void ShinjukuScheduler::GlobalSchedule(const StatusWord& agent_sw,
     }
   }
 
+  // Whether a repeatable becomes eligible depends only on the time, so paused
+  // repeatables keep the next pass coming.
+  settled_ = updated_cpus.Empty() && yielding_tasks_.empty() &&
+             paused_repeatables_.empty() &&
+             (RunqueueEmpty() || all_available);
+
   // Yielding tasks are moved back to the runqueue having skipped one round
   // of scheduling decisions.
   if (!yielding_tasks_.empty()) {
@@ -908,9 +1135,11 @@ void ShinjukuAgent::AgentThread() {
       }
 
       Message msg;
+      bool consumed = false;
       while (!(msg = global_channel.Peek()).empty()) {
         global_scheduler_->DispatchMessage(msg);
         global_channel.Consume(msg);
+        consumed = true;
       }
 
       // Order matters here: when a worker is PAUSED we defer the
@@ -919,9 +1148,16 @@ void ShinjukuAgent::AgentThread() {
       //
       // To restrict the visibility of this awkward state (PAUSED
       // but on_cpu) we do this immediately before GlobalSchedule().
-      global_scheduler_->UpdateSchedParams();
+      const bool refreshed = global_scheduler_->UpdateSchedParams();
 
-      global_scheduler_->GlobalSchedule(status_word(), agent_barrier);
+      // With slice timers, the end of a slice arrives as a message too, so a
+      // settled scheduler has nothing to do until a message or a PrioTable
+      // update arrives. Only poll the channel and the PrioTable stream then.
+      if (!consumed && !refreshed && global_scheduler_->Settled()) {
+        Pause();
+      } else {
+        global_scheduler_->GlobalSchedule(status_word(), agent_barrier);
+      }
 
       if (verbose() && debug_out.Edge()) {
         static const int flags =
@@ -17,19 +17,23 @@
 #ifndef GHOST_SCHEDULERS_SHINJUKU_SHINJUKU_SCHEDULER_H
 #define GHOST_SCHEDULERS_SHINJUKU_SHINJUKU_SCHEDULER_H
 
+#include <array>
 #include <cstdint>
-#include <map>
+#include <memory>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/functional/bind_front.h"
 #include "absl/time/time.h"
 #include "lib/agent.h"
+#include "lib/intrusive_list.h"
 #include "lib/scheduler.h"
 #include "schedulers/shinjuku/shinjuku_orchestrator.h"
 #include "shared/prio_table.h"
 
 namespace ghost {
 
+struct ShinjukuAppQueue;
+
 // Store information about a scheduled task.
 struct ShinjukuTask : public Task<> {
   enum class RunState {
@@ -145,6 +149,53 @@ struct ShinjukuTask : public Task<> {
   // Indicates whether there is a pending deferred unschedule for this task, and
   // if so, whether the unschedule could optionally happen or must happen.
   UnscheduleLevel unschedule_level = UnscheduleLevel::kNoUnschedule;
+
+  // Links in the runqueue of QoS level `rq_qos` while queued. The level is
+  // remembered because the task's QoS may change while it is queued. The task
+  // is on `rq_app`'s queue, or on the level's boosted queue if `rq_app` is
+  // nullptr.
+  ListLink<ShinjukuTask> rq_link;
+  uint32_t rq_qos = 0;
+  ShinjukuAppQueue* rq_app = nullptr;
+
+  // The application queue charged for this task's last run, if the charge has
+  // not been settled against the runtime the task actually used yet, and the
+  // task's cumulative runtime in ns when that run started.
+  ShinjukuAppQueue* charged_app = nullptr;
+  uint64_t charged_from = 0;
+};
+
+// The tasks of one application (tgid) at one QoS level. Within a level, the
+// runnable applications take turns by deficit round robin: an application may
+// dispatch tasks while its deficit is positive, each dispatch is charged the
+// runtime the task uses, and every round adds `weight` quanta to the deficit.
+struct ShinjukuAppQueue {
+  IntrusiveList<ShinjukuTask, &ShinjukuTask::rq_link> tasks;
+  // Links in the level's round robin while `tasks` is non-empty.
+  ListLink<ShinjukuAppQueue> link;
+  int64_t deficit_ns = 0;
+  uint32_t weight = 1;
+};
+
+// The runqueue of one QoS level: boosted tasks first, then the applications'
+// tasks by deficit round robin.
+struct ShinjukuRunqueue {
+  IntrusiveList<ShinjukuTask, &ShinjukuTask::rq_link> boosted;
+  // The applications with queued tasks, in round robin order.
+  IntrusiveList<ShinjukuAppQueue, &ShinjukuAppQueue::link> apps;
+
+  bool empty() const { return boosted.empty() && apps.empty(); }
+
+  // Returns the application that dispatches next, or nullptr if `apps` is
+  // empty: the first one in round robin order to have a positive deficit, if
+  // every round adds `quantum_ns` times its weight to each application. Rounds
+  // are counted rather than run, so this is O(1) when the front application
+  // can dispatch and O(apps) otherwise, however long the last run was.
+  ShinjukuAppQueue* NextApp(int64_t quantum_ns) const;
+
+  // Runs the rounds that NextApp() counted, leaving `next` (what NextApp()
+  // returned) at the front of `apps` with a positive deficit.
+  void StartRounds(ShinjukuAppQueue* next, int64_t quantum_ns);
 };
 
 // Implements the global agent policy layer and the Shinjuku scheduling
@@ -158,7 +209,9 @@ class ShinjukuScheduler : public BasicDispatchScheduler<ShinjukuTask> {
   explicit ShinjukuScheduler(
       Enclave* enclave, CpuList cpulist,
       std::shared_ptr<TaskAllocator<ShinjukuTask>> allocator,
-      int32_t global_cpu, absl::Duration preemption_time_slice);
+      int32_t global_cpu, absl::Duration preemption_time_slice,
+      bool slice_timers = false,
+      absl::flat_hash_map<pid_t, uint32_t> app_weights = {});
   ~ShinjukuScheduler() final;
 
   void EnclaveReady() final;
@@ -173,6 +226,9 @@ class ShinjukuScheduler : public BasicDispatchScheduler<ShinjukuTask> {
   void TaskBlocked(ShinjukuTask* task, const Message& msg) final;
   void TaskPreempted(ShinjukuTask* task, const Message& msg) final;
 
+  // Slice timers only: ends the slice of the task running on the timer's CPU.
+  void CpuTimerExpired(const Message& msg) final;
+
   void DiscoveryStart() final;
   void DiscoveryComplete() final;
 
@@ -180,17 +236,20 @@ class ShinjukuScheduler : public BasicDispatchScheduler<ShinjukuTask> {
 
   // Refreshes updated sched items. Note that all sched items may be refreshed,
   // regardless of whether they have been updated or not, if the stream has
-  // overflown.
-  void UpdateSchedParams();
+  // overflown. Returns 'true' if any sched item was refreshed.
+  bool UpdateSchedParams();
+
+  // Whether the last GlobalSchedule() pass left nothing for another pass to do
+  // until a message arrives or a sched item is updated. Always 'false' without
+  // slice timers, since slices then end by polling. A settled pass made no
+  // scheduling decisions, left no yielding tasks or paused repeatables waiting,
+  // and either the runqueue is empty or every CPU was available (a CPU
+  // becoming available again produces no message).
+  bool Settled() const { return slice_timers_ && settled_; }
 
   // Removes 'task' from the runqueue.
   void RemoveFromRunqueue(ShinjukuTask* task);
 
-  // Helper function to 'GlobalSchedule' that determines whether it should skip
-  // scheduling a CPU right now (returns 'true') or if it can schedule a CPU
-  // right now (returns 'false').
-  bool SkipForSchedule(int iteration, const Cpu& cpu);
-
   // Main scheduling function for the global agent.
   void GlobalSchedule(const StatusWord& agent_sw,
                       StatusWord::BarrierToken agent_sw_last);
@@ -200,6 +259,8 @@ class ShinjukuScheduler : public BasicDispatchScheduler<ShinjukuTask> {
   }
 
   void SetGlobalCPU(const Cpu& cpu) {
+    // The old global CPU is now schedulable.
+    settled_ = false;
     global_cpu_.store(cpu.id(), std::memory_order_release);
   }
 
@@ -221,8 +282,40 @@ class ShinjukuScheduler : public BasicDispatchScheduler<ShinjukuTask> {
     ShinjukuTask* current = nullptr;
     ShinjukuTask* next = nullptr;
     const Agent* agent = nullptr;
+
+    // Slice timers only: a timerfd that produces a MSG_CPU_TIMER_EXPIRED when
+    // current's time slice ends. These are only accessed by the global agent.
+    int timerfd = -1;
+    // Whether timerfd is armed for current's slice.
+    bool timer_armed = false;
+    // Set when current's slice has ended, cleared when a new task is latched.
+    bool slice_expired = false;
+    // Bumped whenever a new task is latched. It is used as the timer's cookie,
+    // so that expirations of earlier slices can be recognized as stale.
+    uint64_t timer_seq = 0;
   } ABSL_CACHELINE_ALIGNED;
 
+  // A CPU whose current task GlobalSchedule() may preempt, with a snapshot of
+  // what decides whether it should be.
+  struct PreemptionVictim {
+    Cpu cpu;
+    uint32_t qos;
+    ShinjukuTask::UnscheduleLevel unschedule_level;
+    // Whether current's slice has ended and it is not a repeatable.
+    bool slice_expired;
+    absl::Time last_ran;
+
+    // Orders victims from worst to best: the best victim runs the lowest QoS,
+    // then has the highest unschedule level, then has used up its slice, and
+    // then has been running the longest. If the best victim should not be
+    // preempted for some task, no other victim should be either.
+    bool operator<(const PreemptionVictim& other) const;
+  };
+
+  // Returns true if the task on `victim`'s CPU should make way for `next`.
+  bool ShouldPreempt(const PreemptionVictim& victim,
+                     const ShinjukuTask* next) const;
+
   // Stop 'task' from running and schedule nothing in its place. 'task' must be
   // currently running on a CPU.
   void UnscheduleTask(ShinjukuTask* task);
@@ -233,20 +326,44 @@ class ShinjukuScheduler : public BasicDispatchScheduler<ShinjukuTask> {
   // Unmarks a task as yielded.
   void Unyield(ShinjukuTask* task);
 
-  // Adds a task to the FIFO runqueue. By default, the task is added to the back
-  // of the FIFO ('back' == true), but will be added to the front of the FIFO if
-  // 'back' == false or if 'task->prio_boost' == true. When 'task->prio_boost'
+  // Adds a task to its application's FIFO at the task's QoS level. By default,
+  // the task is added to the back of the FIFO ('back' == true), but will be
+  // added to the front of the FIFO if 'back' == false. When 'task->prio_boost'
   // == true, the task was unexpectedly preempted (e.g., by CFS) and could be
   // holding a critical lock, so we want to schedule it again as soon as
-  // possible so it can release the lock. This could improve performance.
+  // possible so it can release the lock. It then goes to the front of the
+  // level's boosted queue, which runs ahead of every application's FIFO.
   void Enqueue(ShinjukuTask* task, bool back = true);
 
-  // Removes and returns the task at the front of the runqueue.
+  // Removes and returns the task at the front of the runqueue, charging its
+  // application for the run.
   ShinjukuTask* Dequeue();
 
-  // Returns (but does not remove) the task at the front of the runqueue.
+  // Returns (but does not remove) the task at the front of the runqueue. This
+  // may advance the round robin of the highest filled QoS level.
   ShinjukuTask* Peek();
 
+  // Charges `task`'s application for the runtime `task` used since it was last
+  // dequeued, correcting the estimate Dequeue() charged up front.
+  void SettleCharge(ShinjukuTask* task);
+
+  // Returns the queue of the application that `task` belongs to at `level`.
+  ShinjukuAppQueue* AppQueue(const ShinjukuTask* task, uint32_t level);
+  // Uncounts `task`, which is leaving, from its application and frees the
+  // application's queues if it was the last task.
+  void ReleaseApp(ShinjukuTask* task);
+
+  // Slice timers only: starts `next`'s time slice on `cpu`, arming cpu's
+  // timerfd for the end of the slice unless the slice is infinite. Whether
+  // `next` may be preempted when it ends is left to GlobalSchedule().
+  void StartSliceTimer(const Cpu& cpu, ShinjukuTask* next);
+  // Slice timers only: ends the slice on `cpu` early, because its current task
+  // left the cpu, and disarms cpu's timerfd if it is armed.
+  void StopSliceTimer(const Cpu& cpu);
+
+  // Unlinks 'task' from its runqueue without changing its run state.
+  void EraseFromRunqueue(ShinjukuTask* task);
+
   // Prints all tasks (includin tasks not running or on the runqueue) managed by
   // the global agent.
   void DumpAllTasks();
@@ -272,30 +389,20 @@ class ShinjukuScheduler : public BasicDispatchScheduler<ShinjukuTask> {
 
   CpuState* cpu_state(const Cpu& cpu) { return &cpu_states_[cpu.id()]; }
 
-  size_t RunqueueSize() const {
-    size_t size = 0;
-    for (const auto& [qos, rq] : run_queue_) {
-      size += rq.size();
-    }
-    return size;
-  }
+  size_t RunqueueSize() const { return rq_size_; }
 
-  bool RunqueueEmpty() const { return RunqueueSize() == 0; }
+  bool RunqueueEmpty() const { return rq_size_ == 0; }
 
   // Returns the highest-QoS runqueue that has at least one task enqueued.
   // Must call this on a non-empty runqueue.
   uint32_t FirstFilledRunqueue() const {
-    for (auto it = run_queue_.rbegin(); it != run_queue_.rend(); it++) {
-      if (!it->second.empty()) {
-        return it->first;
-      }
-    }
-    // A precondition for this method is that the runqueue must be non-empty, so
-    // if we get down here, that precondition was not upheld.
-    CHECK(false);
-    // Return something so that the compiler doesn't complain, but we will never
-    // execute this return statement due to the 'CHECK(false)' above.
-    return std::numeric_limits<uint32_t>::max();
+    CHECK_NE(rq_bitmap_, 0);
+    return 63 - __builtin_clzll(rq_bitmap_);
+  }
+
+  // QoS levels at or above kNumQoS share the highest runqueue.
+  static uint32_t RunqueueLevel(uint32_t qos) {
+    return qos < kNumQoS ? qos : kNumQoS - 1;
   }
 
   CpuState cpu_states_[MAX_CPUS];
@@ -305,22 +412,46 @@ class ShinjukuScheduler : public BasicDispatchScheduler<ShinjukuTask> {
   int num_tasks_ = 0;
   bool in_discovery_ = false;
 
-  // Map from QoS level to runqueue
-  // We use an 'std::map' rather than 'absl::flat_hash_map' because we need to
-  // iterate on the map in order of QoS level.
-  std::map<uint32_t, std::deque<ShinjukuTask*>> run_queue_;
+  // One runqueue per QoS level. Bit i of 'rq_bitmap_' is set iff
+  // 'run_queue_[i]' is non-empty, so the highest filled level is found with a
+  // single find-last-set, and 'rq_size_' is the total number of queued tasks.
+  static constexpr uint32_t kNumQoS = 64;
+  std::array<ShinjukuRunqueue, kNumQoS> run_queue_;
+  uint64_t rq_bitmap_ = 0;
+  size_t rq_size_ = 0;
+  // Scratch space for GlobalSchedule(), kept to avoid allocating every time.
+  std::vector<Cpu> free_cpus_;
+  std::vector<PreemptionVictim> victims_;
   std::vector<ShinjukuTask*> paused_repeatables_;
   std::vector<ShinjukuTask*> yielding_tasks_;
   absl::flat_hash_map<pid_t, std::shared_ptr<ShinjukuOrchestrator>> orchs_;
+  // Per-application queues, one per QoS level, indexed by tgid. Tasks point
+  // into these, so they are freed with the application's last task, as counted
+  // by 'app_tasks_'. A reused tgid then starts over with no deficit.
+  absl::flat_hash_map<pid_t, std::unique_ptr<ShinjukuAppQueue[]>> apps_;
+  absl::flat_hash_map<pid_t, int> app_tasks_;
+  // Round robin weights of applications, indexed by tgid. Applications that
+  // are not listed have weight 1.
+  const absl::flat_hash_map<pid_t, uint32_t> app_weights_;
   const ShinjukuOrchestrator::SchedCallbackFunc kSchedCallbackFunc =
       absl::bind_front(&ShinjukuScheduler::SchedParamsCallback, this);
   const absl::Duration preemption_time_slice_;
+  // Whether time slices are ended by per-CPU timers rather than by comparing
+  // each running task's elapsed runtime in every GlobalSchedule() pass.
+  const bool slice_timers_;
+  // See Settled().
+  bool settled_ = false;
+  // The deficit that a weight 1 application gains per round. It is also what
+  // Dequeue() charges up front, so that one GlobalSchedule() pass cannot hand
+  // every idle CPU to the same application before its runs are settled.
+  const int64_t quantum_ns_;
 };
 
 // Initializes the task allocator and the Shinjuku scheduler.
 std::unique_ptr<ShinjukuScheduler> SingleThreadShinjukuScheduler(
     Enclave* enclave, CpuList cpulist, int32_t global_cpu,
-    absl::Duration preemption_time_slice);
+    absl::Duration preemption_time_slice, bool slice_timers = false,
+    absl::flat_hash_map<pid_t, uint32_t> app_weights = {});
 
 // Operates as the Global or Satellite agent depending on input from the
 // global_scheduler->GetGlobalCPU callback.
@@ -344,6 +475,8 @@ class ShinjukuConfig : public AgentConfig {
 
   Cpu global_cpu_{Cpu::UninitializedType::kUninitialized};
   absl::Duration preemption_time_slice_;
+  bool slice_timers_ = false;
+  absl::flat_hash_map<pid_t, uint32_t> app_weights_;
 };
 
 // An global agent scheduler.  It runs a single-threaded Shinjuku scheduler on
@@ -355,7 +488,8 @@ class FullShinjukuAgent : public FullAgent<EnclaveType> {
       : FullAgent<EnclaveType>(config) {
     global_scheduler_ = SingleThreadShinjukuScheduler(
         &this->enclave_, *this->enclave_.cpus(), config.global_cpu_.id(),
-        config.preemption_time_slice_);
+        config.preemption_time_slice_, config.slice_timers_,
+        config.app_weights_);
     this->StartAgentTasks();
     this->enclave_.Ready();
   }
@@ -27,7 +27,10 @@ SolScheduler::SolScheduler(Enclave* enclave, CpuList cpulist,
                            int32_t global_cpu)
     : BasicDispatchScheduler(enclave, std::move(cpulist), std::move(allocator)),
       global_cpu_(global_cpu),
-      global_channel_(GHOST_MAX_QUEUE_ELEMS, /*node=*/0) {
+      global_channel_(GHOST_MAX_QUEUE_ELEMS, /*node=*/0),
+      idle_cpus_(cpus()),
+      pending_cpus_(topology()->EmptyCpuList()),
+      warm_cpus_(topology()->EmptyCpuList()) {
   if (!cpus().IsSet(global_cpu_)) {
     Cpu c = cpus().Front();
     CHECK(c.valid());
@@ -140,21 +143,21 @@ void SolScheduler::TaskDeparted(SolTask* task, const Message& msg) {
   }
 
   if (task->oncpu()) {
-    CpuState* cs = cpu_state_of(task);
-    CHECK_EQ(cs->current, task);
-    cs->current = nullptr;
+    ClearCurrent(task);
   } else if (task->queued()) {
     RemoveFromRunqueue(task);
   } else {
     CHECK(task->blocked());
   }
 
+  ForgetLastTask(task);
   allocator()->FreeTask(task);
   num_tasks_--;
 }
 
 void SolScheduler::TaskDead(SolTask* task, const Message& msg) {
   CHECK_EQ(task->run_state, SolTask::RunState::kBlocked);
+  ForgetLastTask(task);
   allocator()->FreeTask(task);
   num_tasks_--;
 }
@@ -171,10 +174,21 @@ bool SolScheduler::SyncCpuState(const Cpu& cpu) {
   RunRequest* req = enclave()->GetRunRequest(cpu);
   CHECK(req->committed());
   cs->next = nullptr;
+  pending_cpus_.Clear(cpu);
 
   CHECK(!next->preempted);
 
   if (req->succeeded()) {
+    // The cpu's caches are no longer warm for whichever task ran there before.
+    if (cs->last_task) {
+      cs->last_task->last_cpu = Cpu(Cpu::UninitializedType::kUninitialized);
+    }
+    if (next->last_cpu.valid() && next->last_cpu != cpu) {
+      cpu_state(next->last_cpu)->last_task = nullptr;
+    }
+    cs->last_task = next;
+    next->last_cpu = cpu;
+    warm_cpus_.Clear(cpu);
     cs->current = next;
     next->run_state = SolTask::RunState::kOnCpu;
     next->prio_boost = false;
@@ -183,9 +197,64 @@ bool SolScheduler::SyncCpuState(const Cpu& cpu) {
 
   next->run_state = SolTask::RunState::kRunnable;
   Enqueue(next);
+  idle_cpus_.Set(cpu);
   return false;
 }
 
+void SolScheduler::UpdateWarmCpu(const SolTask* task, bool waiting) {
+  if (!task->last_cpu.valid()) return;
+  DCHECK_EQ(cpu_state(task->last_cpu)->last_task, task);
+  if (waiting) {
+    warm_cpus_.Set(task->last_cpu);
+  } else {
+    warm_cpus_.Clear(task->last_cpu);
+  }
+}
+
+void SolScheduler::ForgetLastTask(const SolTask* task) {
+  if (!task->last_cpu.valid()) return;
+  CpuState* cs = cpu_state(task->last_cpu);
+  DCHECK_EQ(cs->last_task, task);
+  cs->last_task = nullptr;
+  warm_cpus_.Clear(task->last_cpu);
+}
+
+Cpu SolScheduler::PickFromDomain(const CpuList& domain,
+                                 const CpuList& available) const {
+  CpuList candidates = available;
+  candidates.Intersection(domain);
+  if (candidates.Empty()) return Cpu(Cpu::UninitializedType::kUninitialized);
+
+  const CpuList cold = candidates - warm_cpus_;
+  return cold.Empty() ? candidates.Front() : cold.Front();
+}
+
+Cpu SolScheduler::PickCpu(const SolTask* task,
+                          const CpuList& available) const {
+  const Cpu& prev = task->cpu;
+  if (prev.valid()) {
+    if (available.IsSet(prev)) return prev;
+
+    Cpu cpu = PickFromDomain(prev.siblings(), available);
+    if (cpu.valid()) return cpu;
+    cpu = PickFromDomain(prev.l3_siblings(), available);
+    if (cpu.valid()) return cpu;
+    if (prev.numa_node() >= 0) {
+      cpu = PickFromDomain(topology()->CpusOnNode(prev.numa_node()), available);
+      if (cpu.valid()) return cpu;
+    }
+  }
+  return PickFromDomain(available, available);
+}
+
+void SolScheduler::ClearCurrent(SolTask* task) {
+  CpuState* cs = cpu_state_of(task);
+  CHECK_EQ(cs->current, task);
+  CHECK_EQ(cs->next, nullptr);
+  cs->current = nullptr;
+  idle_cpus_.Set(task->cpu);
+}
+
 void SolScheduler::SyncTaskState(SolTask* task) {
   CHECK(task->pending());
   CpuState* cs = cpu_state_of(task);
@@ -200,10 +269,7 @@ void SolScheduler::TaskBlocked(SolTask* task, const Message& msg) {
   }
 
   if (task->oncpu()) {
-    CpuState* cs = cpu_state_of(task);
-    CHECK_EQ(cs->current, task);
-    CHECK_EQ(cs->next, nullptr);
-    cs->current = nullptr;
+    ClearCurrent(task);
   } else {
     CHECK(task->queued());
     RemoveFromRunqueue(task);
@@ -220,10 +286,7 @@ void SolScheduler::TaskPreempted(SolTask* task, const Message& msg) {
   task->preempted = true;
 
   if (task->oncpu()) {
-    CpuState* cs = cpu_state_of(task);
-    CHECK_EQ(cs->current, task);
-    CHECK_EQ(cs->next, nullptr);
-    cs->current = nullptr;
+    ClearCurrent(task);
     task->run_state = SolTask::RunState::kRunnable;
     Enqueue(task);
   } else {
@@ -237,10 +300,7 @@ void SolScheduler::TaskYield(SolTask* task, const Message& msg) {
   }
 
   if (task->oncpu()) {
-    CpuState* cs = cpu_state_of(task);
-    CHECK_EQ(cs->current, task);
-    CHECK_EQ(cs->next, nullptr);
-    cs->current = nullptr;
+    ClearCurrent(task);
     Yield(task);
   } else {
     CHECK(task->queued());
@@ -259,6 +319,7 @@ void SolScheduler::Yield(SolTask* task) {
 void SolScheduler::Enqueue(SolTask* task) {
   CHECK_EQ(task->run_state, SolTask::RunState::kRunnable);
   task->run_state = SolTask::RunState::kQueued;
+  UpdateWarmCpu(task, /*waiting=*/true);
   if (task->prio_boost || task->preempted)
     run_queue_.push_front(task);
   else
@@ -274,6 +335,7 @@ SolTask* SolScheduler::Dequeue() {
   CHECK_EQ(task->run_state, SolTask::RunState::kQueued);
   task->run_state = SolTask::RunState::kRunnable;
   run_queue_.pop_front();
+  UpdateWarmCpu(task, /*waiting=*/false);
 
   return task;
 }
@@ -288,6 +350,7 @@ void SolScheduler::RemoveFromRunqueue(SolTask* task) {
       // no longer runnable.
       task->run_state = SolTask::RunState::kRunnable;
       run_queue_.erase(run_queue_.cbegin() + pos);
+      UpdateWarmCpu(task, /*waiting=*/false);
       return;
     }
   }
@@ -299,39 +362,31 @@ void SolScheduler::RemoveFromRunqueue(SolTask* task) {
 void SolScheduler::GlobalSchedule(const StatusWord& agent_sw,
                                   StatusWord::BarrierToken agent_sw_last) {
   const int global_cpu_id = GetGlobalCPUId();
-  CpuList available = topology()->EmptyCpuList();
-  CpuList assigned = topology()->EmptyCpuList();
-
-  for (const Cpu& cpu : cpus()) {
-    CpuState* cs = cpu_state(cpu);
-    RunRequest* req = enclave()->GetRunRequest(cpu);
-
-    if (cpu.id() == global_cpu_id) {
-      CHECK_EQ(cs->current, nullptr);
-      CHECK_EQ(cs->next, nullptr);
-      CHECK(req->committed());
-      continue;
-    }
-
-    if (cs->current) {
-      CHECK_EQ(cs->next, nullptr);
-      continue;
-    }
+  {
+    const Cpu global_cpu = topology()->cpu(global_cpu_id);
+    CpuState* cs = cpu_state(global_cpu);
+    CHECK_EQ(cs->current, nullptr);
+    CHECK_EQ(cs->next, nullptr);
+    CHECK(enclave()->GetRunRequest(global_cpu)->committed());
+  }
 
-    if (cs->next) {
-      if (req->committed()) {
-        // Note that txn could have failed to commit in which case the
-        // 'cs->next' will go back into the run queue.
-        SyncCpuState(cpu);
-      }
+  // Reap the transactions submitted by earlier passes that the kernel has
+  // committed by now. The ones still in flight are left for a later pass
+  // rather than waited for. Iterate over a copy since SyncCpuState() updates
+  // `pending_cpus_`.
+  const CpuList pending = pending_cpus_;
+  for (const Cpu& cpu : pending) {
+    if (enclave()->GetRunRequest(cpu)->committed()) {
+      // Note that txn could have failed to commit in which case the
+      // 'cs->next' will go back into the run queue.
+      SyncCpuState(cpu);
     }
-
-    // CPU has a pending txn that we haven't reaped yet.
-    if (cs->next) continue;
-
-    if (!cs->current) available.Set(cpu);
   }
 
+  CpuList available = idle_cpus_;
+  available.Clear(global_cpu_id);
+  CpuList assigned = topology()->EmptyCpuList();
+
   while (!available.Empty()) {
     SolTask* next = Dequeue();
     if (!next) break;
@@ -342,25 +397,12 @@ void SolScheduler::GlobalSchedule(const StatusWord& agent_sw,
       continue;
     }
 
-    if (!next->cpu.valid()) {
-      next->cpu = available.Front();
-    } else if (!available.IsSet(next->cpu)) {
-      bool found = false;
-      for (const Cpu& sibling : next->cpu.siblings()) {
-        if (available.IsSet(sibling)) {
-          found = true;
-          next->cpu = sibling;
-          break;
-        }
-      }
-      if (!found) next->cpu = available.Front();
-    } else {
-      // previous cpu is available.
-    }
+    next->cpu = PickCpu(next, available);
 
     CHECK(next->cpu.valid());
     CHECK(available.IsSet(next->cpu));
     available.Clear(next->cpu);
+    idle_cpus_.Clear(next->cpu);
     assigned.Set(next->cpu);
 
     CpuState* cs = cpu_state(next->cpu);
@@ -381,8 +423,12 @@ void SolScheduler::GlobalSchedule(const StatusWord& agent_sw,
     }
   }
 
-  // Commit on all cpus with open transactions.
-  if (!assigned.Empty()) enclave()->SubmitRunRequests(assigned);
+  // Commit on all cpus with open transactions, without waiting for the commits
+  // to complete.
+  if (!assigned.Empty()) {
+    enclave()->SubmitRunRequests(assigned);
+    pending_cpus_ += assigned;
+  }
 
   // Yielding tasks are moved back to the runqueue having skipped one round
   // of scheduling decisions.
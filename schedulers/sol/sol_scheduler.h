@@ -78,6 +78,9 @@ struct SolTask : public Task<> {
 
   RunState run_state = RunState::kBlocked;
   Cpu cpu{Cpu::UninitializedType::kUninitialized};
+  // The cpu whose `last_task` this task is, if any. Unlike `cpu`, this does not
+  // move to a cpu the task was assigned to but failed to get on.
+  Cpu last_cpu{Cpu::UninitializedType::kUninitialized};
 
   // Whether the last execution was preempted or not.
   bool preempted = false;
@@ -170,11 +173,35 @@ class SolScheduler : public BasicDispatchScheduler<SolTask> {
     SolTask* current = nullptr;
     SolTask* next = nullptr;
     const Agent* agent = nullptr;
+    // The task that last got on this cpu, whose working set is most likely
+    // still in its caches.
+    SolTask* last_task = nullptr;
   } ABSL_CACHELINE_ALIGNED;
 
   bool SyncCpuState(const Cpu& cpu);
   void SyncTaskState(SolTask* task);
 
+  // Clears the current task of `task`'s cpu, which makes the cpu idle.
+  void ClearCurrent(SolTask* task);
+
+  // Picks the cpu in `available` to run `task` on. The task's previous cpu is
+  // preferred, then the closest cpu to it: an SMT sibling, then a cpu sharing
+  // its L3, then one on its NUMA node. Within each level, cpus whose caches
+  // are warm for another waiting task are used last.
+  Cpu PickCpu(const SolTask* task, const CpuList& available) const;
+
+  // Returns a cpu in both `domain` and `available`, preferring one that is not
+  // in `warm_cpus_`, or an invalid cpu if there is none.
+  Cpu PickFromDomain(const CpuList& domain, const CpuList& available) const;
+
+  // Marks the cpu that `task` last ran on as warm for it if `task` was the last
+  // task to run there, or clears that mark.
+  void UpdateWarmCpu(const SolTask* task, bool waiting);
+
+  // Forgets `task` as the last task of the cpu it last ran on, before it is
+  // freed.
+  void ForgetLastTask(const SolTask* task);
+
   // Marks a task as yielded.
   void Yield(SolTask* task);
 
@@ -208,6 +235,17 @@ class SolScheduler : public BasicDispatchScheduler<SolTask> {
   LocalChannel global_channel_;
   int num_tasks_ = 0;
 
+  // GlobalSchedule() is a pipeline: transactions are submitted without waiting
+  // for them and reaped on a later pass, once committed. These track the CPUs
+  // in each stage so that no pass has to look at every CPU.
+  //
+  // CPUs with neither a current task nor a transaction in flight.
+  CpuList idle_cpus_;
+  // CPUs with a submitted transaction that has not been reaped yet.
+  CpuList pending_cpus_;
+  // CPUs whose last task is waiting in the runqueue to run again.
+  CpuList warm_cpus_;
+
   std::deque<SolTask*> run_queue_;
   std::vector<SolTask*> yielding_tasks_;
 
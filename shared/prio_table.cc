@@ -20,7 +20,18 @@ namespace ghost {
 
 // Warning insanity requires "constexpr const" here.
 static constexpr const char* kPrioTableShmemName = "priotable";
-static constexpr int64_t kPrioTableVersion = 0;
+// Version 1 replaced the hashed stream with a ring. Version 2 packed each
+// ring entry into one word and added the "queued" bits.
+static constexpr int64_t kPrioTableVersion = 2;
+
+// Entries pack the low 32 bits of their position with an index or kEntryFree.
+static uint64_t EntryWord(uint64_t pos, uint32_t low) {
+  return (pos << 32) | low;
+}
+
+static size_t queued_words(uint32_t sched_items) {
+  return (sched_items + 63) / 64;
+}
 
 static size_t shmem_size(uint32_t sched_items, uint32_t work_classes,
                          uint32_t stream_capacity) {
@@ -35,7 +46,8 @@ static size_t shmem_size(uint32_t sched_items, uint32_t work_classes,
   // should succeed
   CHECK_ZERO(sz % ABSL_CACHELINE_SIZE);
   sz += sizeof(struct ghost::PrioTable::stream) +
-        sizeof(std::atomic<int>) * stream_capacity;
+        sizeof(struct ghost::PrioTable::stream_entry) * stream_capacity;
+  sz += sizeof(std::atomic<uint64_t>) * queued_words(sched_items);
 
   return sz;
 }
@@ -63,9 +75,15 @@ PrioTable::PrioTable(uint32_t num_items, uint32_t num_classes,
   // so this check should succeed
   CHECK_ZERO(hdr()->st_off % ABSL_CACHELINE_SIZE);
 
-  std::atomic<int>* entries = stream()->entries;
+  struct stream* s = stream();
+  s->head.store(0, std::memory_order_relaxed);
+  s->tail.store(0, std::memory_order_relaxed);
   for (uint32_t i = 0; i < hdr()->st_cap; i++) {
-    entries[i].store(kStreamFreeEntry, std::memory_order_relaxed);
+    s->entries[i].word.store(EntryWord(i, kEntryFree),
+                             std::memory_order_relaxed);
+  }
+  for (size_t i = 0; i < queued_words(num_items); i++) {
+    queued()[i].store(0, std::memory_order_relaxed);
   }
 
   shmem_->MarkReady();  // Ready for ghOSt agent to connect/start polling.
@@ -91,10 +109,15 @@ struct ghost::PrioTable::stream* PrioTable::stream() {
                                                             hdr()->st_off);
 }
 
+std::atomic<uint64_t>* PrioTable::queued() {
+  return reinterpret_cast<std::atomic<uint64_t>*>(
+      &stream()->entries[hdr()->st_cap]);
+}
+
 void PrioTable::MarkUpdatedIndex(int idx, int num_retries) {
   struct stream* s = stream();
   std::atomic<int>* scrape_all = &s->scrape_all;
-  std::atomic<int>* entries = s->entries;
+  const uint32_t cap = hdr()->st_cap;
 
   // Already in overflow? Ensure we are covered by a scrape_all pass.
   if (scrape_all->load(std::memory_order_relaxed) > 0) {
@@ -102,16 +125,52 @@ void PrioTable::MarkUpdatedIndex(int idx, int num_retries) {
     return;
   }
 
-  for (int i = 0; i < num_retries + 1; i++) {
-    std::atomic<int>* cell = &entries[(idx + i) % hdr()->st_cap];
-    int expected = kStreamFreeEntry;
-    if (cell->load(std::memory_order_relaxed) == kStreamFreeEntry &&
-        cell->compare_exchange_weak(expected, idx, std::memory_order_release,
-                                    std::memory_order_relaxed)) {
+  // If `idx` is already queued, the agent will see this update when it
+  // consumes that entry: it clears the bit, which is ordered after our
+  // fetch_or, before reading the sched item. Indices outside the table are
+  // never deduplicated.
+  std::atomic<uint64_t>* queued_word = nullptr;
+  uint64_t queued_bit = 0;
+  if (idx >= 0 && idx < hdr()->si_num) {
+    queued_word = &queued()[idx / 64];
+    queued_bit = 1ULL << (idx % 64);
+    if (queued_word->fetch_or(queued_bit, std::memory_order_acq_rel) &
+        queued_bit) {
       return;
     }
   }
 
+  uint64_t pos = s->tail.load(std::memory_order_relaxed);
+  for (int i = 0; i < num_retries + 1; i++) {
+    struct stream_entry* e = &s->entries[pos % cap];
+    uint64_t word = e->word.load(std::memory_order_acquire);
+    int32_t lap = static_cast<int32_t>((word >> 32) - pos);
+    if (lap < 0) {
+      // The agent has not consumed the entry from the previous lap yet, so the
+      // ring is full.
+      break;
+    }
+    if (lap > 0 || static_cast<uint32_t>(word) != kEntryFree) {
+      // Another producer claimed `pos` since we read `tail`.
+      pos = s->tail.load(std::memory_order_relaxed);
+      continue;
+    }
+    // A strong cmpxchg, so that we only retry if another producer got in.
+    if (s->tail.compare_exchange_strong(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+      // Fails if the agent gave up waiting for us and took the entry back.
+      if (e->word.compare_exchange_strong(word, EntryWord(pos, idx),
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed)) {
+        return;
+      }
+      break;
+    }
+  }
+
+  if (queued_word) {
+    queued_word->fetch_and(~queued_bit, std::memory_order_release);
+  }
   scrape_all->fetch_add(1, std::memory_order_release);
 }
 
@@ -122,27 +181,63 @@ void PrioTable::MarkUpdatedIndex(int idx, int num_retries) {
 int PrioTable::NextUpdatedIndex() {
   struct stream* s = stream();
   std::atomic<int>* scrape_all = &s->scrape_all;
-  std::atomic<int>* entries = s->entries;
-  bool full_scan = false;
+  const uint32_t cap = hdr()->st_cap;
+  uint64_t head = s->head.load(std::memory_order_relaxed);
 
+  bool full_scan = false;
+  auto start_full_scan = [&]() {
+    full_scan = true;
+    // The scan covers every sched item, so nothing needs to stay queued. This
+    // also clears the bits of indices lost with entries we took back.
+    for (size_t i = 0; i < queued_words(hdr()->si_num); i++) {
+      queued()[i].exchange(0, std::memory_order_acquire);
+    }
+  };
   if (scrape_all->load(std::memory_order_relaxed) > 0) {
     scrape_all->exchange(0, std::memory_order_acquire);
-    full_scan = true;
+    start_full_scan();
   }
 
-  for (uint32_t i = 0; i < hdr()->st_cap; i++) {
-    // We always need to also acquire versus our advertised indices below as
-    // they may represent writes (prior to capacity) not paired with
-    // scrape_all.
-    int idx = entries[i].load(std::memory_order_acquire);
-    if (idx != kStreamFreeEntry) {
-      // This is slightly subtle, a non-atomic RMW (versus exchange) is safe as
-      // we are guaranteed that only a single writer can proceed (due to
-      // cmpxchg). In the case we race on not observing an ongoing writer, we
-      // must see them (and their updates) in a future NextUpdatedIndex() call.
-      entries[i].store(kStreamFreeEntry, std::memory_order_relaxed);
-      if (!full_scan) return idx;
+  // Bounded, since producers can refill the ring while we drain it.
+  for (uint32_t i = 0; i < cap; i++) {
+    struct stream_entry* e = &s->entries[head % cap];
+    // Acquire versus the producer's release so that we see its update of the
+    // sched item, which may not be paired with scrape_all.
+    uint64_t word = e->word.load(std::memory_order_acquire);
+    if (static_cast<uint32_t>(word >> 32) != static_cast<uint32_t>(head)) {
+      // Empty: still free from the previous lap.
+      break;
+    }
+    if (static_cast<uint32_t>(word) == kEntryFree) {
+      // Empty, or claimed by a producer that has not published yet.
+      if (s->tail.load(std::memory_order_relaxed) == head) break;
+      const absl::Time now = MonotonicNow();
+      if (stalled_head_ != head) {
+        stalled_head_ = head;
+        stalled_since_ = now;
+      }
+      if (now - stalled_since_ < kStalledProducerTimeout) break;
+      // Take the entry back. If the producer publishes after all, we see its
+      // index next time around the loop.
+      if (!e->word.compare_exchange_strong(
+              word, EntryWord(head + cap, kEntryFree),
+              std::memory_order_acq_rel)) {
+        continue;
+      }
+      s->head.store(++head, std::memory_order_relaxed);
+      if (!full_scan) start_full_scan();
+      continue;
+    }
+
+    int idx = static_cast<int32_t>(word);
+    e->word.store(EntryWord(head + cap, kEntryFree), std::memory_order_release);
+    s->head.store(++head, std::memory_order_relaxed);
+    if (idx >= 0 && idx < hdr()->si_num) {
+      queued()[idx / 64].fetch_and(~(1ULL << (idx % 64)),
+                                   std::memory_order_acq_rel);
     }
+    // A full scan covers every published index, so discard them all.
+    if (!full_scan) return idx;
   }
 
   return full_scan ? kStreamOverflow : kStreamNoEntries;
@@ -21,6 +21,7 @@
 
 #include <atomic>
 
+#include "absl/time/time.h"
 #include "shared/shmem.h"
 
 namespace ghost {
@@ -70,22 +71,33 @@ struct sched_item {
 
 /*
  * work_class is readonly-after-init so does not include a 'seqcount'
- * for synchronization.
+ * for synchronization. The exception is 'admission', which only the agent
+ * writes, once, after it attaches to the table.
  */
 struct work_class {
-  uint32_t id;       /* unique identifier for this work_class */
-  uint32_t flags;    /* attributes of the work_class */
-  uint32_t qos;      /* quality of service for this work class */
-  uint64_t exectime; /* execution time in nsecs */
-  uint64_t period;   /* period in nsecs for repeating work */
+  uint32_t id;        /* unique identifier for this work_class */
+  uint32_t flags;     /* attributes of the work_class */
+  uint32_t qos;       /* quality of service for this work class */
+  uint32_t admission; /* agent's admission decision, see below */
+  uint64_t exectime;  /* execution time in nsecs */
+  uint64_t period;    /* period in nsecs for repeating work */
 } ABSL_CACHELINE_ALIGNED;
 #define WORK_CLASS_ONESHOT (1U << 0)
 #define WORK_CLASS_REPEATING (1U << 1)
 
+/* work_class.admission */
+#define WORK_CLASS_ADMISSION_PENDING 0 /* agent has not decided yet */
+#define WORK_CLASS_ADMITTED 1          /* deadlines are scheduled as given */
+#define WORK_CLASS_DEGRADED 2    /* admitted with a longer period */
+#define WORK_CLASS_BEST_EFFORT 3 /* runs after all admitted work */
+#define WORK_CLASS_REJECTED 4    /* sched items never run */
+
 class PrioTable {
  public:
-  // We use an enum to enforce that the client can only use primes as the stream
-  // capacity to reduce hash collisions.
+  // The stream capacities were chosen to be primes to reduce hash collisions
+  // when the stream was a hash table of updated indices. The stream is now a
+  // ring, for which any capacity works, but the values are kept for existing
+  // clients.
   enum class StreamCapacity : uint32_t {
     kStreamCapacity11 = 11,
     kStreamCapacity19 = 19,
@@ -114,10 +126,45 @@ class PrioTable {
   inline int NumSchedItems() { return hdr()->si_num; }
   inline int NumWorkClasses() { return hdr()->wc_num; }
 
+  // The stream of updated sched item indices is a bounded multi-producer,
+  // single-consumer ring. A producer claims the position `tail` by advancing
+  // it and then publishes the index in the entry at that position. The agent
+  // consumes entries in order from `head`, so draining k updates reads O(k)
+  // entries regardless of the capacity.
+  //
+  // Each entry's `word` holds the low 32 bits of the position it is at in its
+  // upper half and, in its lower half, either kEntryFree or the index published
+  // at that position. Consuming the entry at position p makes it free for
+  // p + capacity. Since the index and the position change together, the agent
+  // can take back an entry that was claimed but never published, e.g. because
+  // its producer stalled or died, with a single cmpxchg. It does so once the
+  // entry has blocked the ring for kStalledProducerTimeout, and rescans every
+  // sched item in case the lost index was one of them. A producer that loses
+  // its entry this way falls back to `scrape_all`.
+  //
+  // A sched item that is already queued is not queued again: the agent reads
+  // its latest state when it consumes the first entry. The ring is followed by
+  // one "queued" bit per sched item, which producers set before claiming an
+  // entry and the agent clears before returning the index.
+  //
+  // When the ring is full, or a producer loses the race for `tail` more than
+  // `num_retries` times, the producer increments `scrape_all` instead, which
+  // tells the agent to rescan every sched item. `head` lives in the shared
+  // memory, rather than in the agent, so that a new agent that attaches to the
+  // table resumes where the previous one stopped.
+  struct stream_entry {
+    std::atomic<uint64_t> word;
+  };
   struct stream {
     std::atomic<int> scrape_all;
-    std::atomic<int> entries[];
+    // Only written by the agent.
+    std::atomic<uint64_t> head ABSL_CACHELINE_ALIGNED;
+    std::atomic<uint64_t> tail ABSL_CACHELINE_ALIGNED;
+    struct stream_entry entries[];
   };
+  static constexpr uint32_t kEntryFree = ~0U;
+  static constexpr absl::Duration kStalledProducerTimeout =
+      absl::Milliseconds(50);
   static constexpr int kStreamNoEntries = -1;
   static constexpr int kStreamOverflow = -2;
   void MarkUpdatedIndex(int idx, int num_retries);
@@ -132,8 +179,13 @@ class PrioTable {
   std::unique_ptr<GhostShmem> shmem_;
   struct ghost_shmem_hdr* hdr_ = nullptr;
 
-  static constexpr int kStreamFreeEntry = std::numeric_limits<uint32_t>::max();
   struct stream* stream();
+  // The "queued" bits, one per sched item, that follow the ring.
+  std::atomic<uint64_t>* queued();
+
+  // The agent's view of an entry at `head` that is claimed but unpublished.
+  uint64_t stalled_head_ = ~0ULL;
+  absl::Time stalled_since_;
 };
 
 //------------------------------------------------------------------------------
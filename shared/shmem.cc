@@ -138,6 +138,7 @@ void GhostShmem::CreateShmem(int64_t client_version, const char* suffix,
   // We can safely initialize InternalHeader data fields after this point, as
   // MarkReady() cannot yet proceed.
   hdr_->header_version = kHeaderVersion;
+  hdr_->client_version = client_version;
   hdr_->mapping_size = map_size_;
   hdr_->client_size = map_size_ - kHeaderReservedBytes;
   hdr_->header_size = kHeaderReservedBytes;
@@ -0,0 +1,380 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Runs Biff's bpf programs in userspace, on top of the bpf shim, to test its
+// per-LLC, per-priority run queues, time slices and the placement published by
+// userspace without a ghost kernel.
+
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "bpf/shim/bpf_shim.h"
+#include "third_party/bpf/biff_bpf.h"
+
+extern "C" {
+extern bool initialized;
+extern uint32_t cpu_to_llc[BIFF_MAX_CPUS];
+extern uint32_t nr_llcs;
+extern uint64_t slice_us;
+extern struct biff_bpf_llc_queued nr_queued[BIFF_MAX_LLCS];
+// The shim keys maps by address, so the symbol is all userspace needs to reach
+// the status words that BiffScheduler would mmap.
+extern char sw_data;
+
+int biff_pnt(struct bpf_ghost_sched* ctx);
+int biff_msg_send(struct bpf_ghost_msg* msg);
+}
+
+namespace ghost {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Pair;
+
+class BiffBpfTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    bpf_shim_reset();
+    ran_.clear();
+    run_errors_.clear();
+    rescheds_.clear();
+    bpf_shim_set_run_gtid_hook(RunGtid);
+    bpf_shim_set_resched_cpu_hook(ReschedCpu);
+
+    // Two LLCs: cpus 0 and 1 share one, cpus 2 and 3 share the other.
+    memset(cpu_to_llc, 0, sizeof(cpu_to_llc));
+    cpu_to_llc[2] = 1;
+    cpu_to_llc[3] = 1;
+    nr_llcs = 2;
+    slice_us = 0;
+    memset(nr_queued, 0, sizeof(nr_queued));
+    initialized = true;
+  }
+
+  void TearDown() override {
+    initialized = false;
+    bpf_shim_reset();
+  }
+
+  // Sends a message to bpf-msg as if it ran on `cpu`.
+  static void Send(int cpu, struct bpf_ghost_msg& msg) {
+    bpf_shim_set_cpu(cpu);
+    msg.seqnum = ++seqnum_;
+    biff_msg_send(&msg);
+  }
+
+  static void TaskNew(int cpu, uint64_t gtid, bool runnable) {
+    struct bpf_ghost_msg msg = {};
+    msg.type = MSG_TASK_NEW;
+    msg.newt.gtid = gtid;
+    msg.newt.runnable = runnable;
+    msg.newt.sw_info.index = gtid;
+    Send(cpu, msg);
+  }
+
+  static void TaskWakeup(uint64_t gtid, int last_ran_cpu, int wake_up_cpu) {
+    struct bpf_ghost_msg msg = {};
+    msg.type = MSG_TASK_WAKEUP;
+    msg.wakeup.gtid = gtid;
+    msg.wakeup.last_ran_cpu = last_ran_cpu;
+    msg.wakeup.wake_up_cpu = wake_up_cpu;
+    Send(wake_up_cpu, msg);
+  }
+
+  static void TaskLatched(int cpu, uint64_t gtid) {
+    struct bpf_ghost_msg msg = {};
+    msg.type = MSG_TASK_LATCHED;
+    msg.latched.gtid = gtid;
+    msg.latched.cpu = cpu;
+    msg.latched.cpu_seqnum = ++cpu_seqnum_;
+    Send(cpu, msg);
+  }
+
+  static void CpuTick(int cpu) {
+    struct bpf_ghost_msg msg = {};
+    msg.type = MSG_CPU_TICK;
+    msg.cpu_tick.cpu = cpu;
+    Send(cpu, msg);
+  }
+
+  // Returns the sw_data through which BiffScheduler publishes a task's policy.
+  static struct biff_bpf_sw_data* SwData(uint64_t gtid) {
+    uint32_t index = gtid;  // TaskNew() uses the gtid as the sw_info index.
+    return static_cast<struct biff_bpf_sw_data*>(bpf_shim_map_lookup(
+        &sw_data, BPF_MAP_TYPE_ARRAY, BIFF_MAX_GTIDS, sizeof(index),
+        sizeof(struct biff_bpf_sw_data), &index));
+  }
+
+  // Runs bpf-pnt on `cpu`.
+  static void Pnt(int cpu) {
+    struct bpf_ghost_sched ctx = {};
+    bpf_shim_set_cpu(cpu);
+    biff_pnt(&ctx);
+    EXPECT_TRUE(ctx.dont_idle);
+  }
+
+  static long RunGtid(u32 cpu, s64 gtid, u32 task_barrier, s32 run_flags) {
+    if (!run_errors_.empty()) {
+      long err = run_errors_.front();
+      run_errors_.erase(run_errors_.begin());
+      if (err) return err;
+    }
+    ran_.emplace_back(cpu, gtid);
+    return 0;
+  }
+
+  static long ReschedCpu(u32 cpu, u64 cpu_seqnum) {
+    rescheds_.push_back(cpu);
+    return 0;
+  }
+
+  // (cpu, gtid) for each successful bpf_ghost_run_gtid().
+  static std::vector<std::pair<uint32_t, int64_t>> ran_;
+  // Errors to return from the next calls to bpf_ghost_run_gtid().
+  static std::vector<long> run_errors_;
+  // Cpus that bpf asked to reschedule.
+  static std::vector<uint32_t> rescheds_;
+  static uint64_t seqnum_;
+  static uint64_t cpu_seqnum_;
+};
+
+std::vector<std::pair<uint32_t, int64_t>> BiffBpfTest::ran_;
+std::vector<long> BiffBpfTest::run_errors_;
+std::vector<uint32_t> BiffBpfTest::rescheds_;
+uint64_t BiffBpfTest::seqnum_;
+uint64_t BiffBpfTest::cpu_seqnum_;
+
+TEST_F(BiffBpfTest, NothingBeforeInitialized) {
+  initialized = false;
+  TaskNew(/*cpu=*/0, /*gtid=*/1, /*runnable=*/true);
+  Pnt(0);
+  EXPECT_TRUE(ran_.empty());
+
+  initialized = true;
+  Pnt(0);
+  EXPECT_THAT(ran_, ElementsAre(Pair(0, 1)));
+}
+
+TEST_F(BiffBpfTest, LocalLlcFirst) {
+  TaskNew(/*cpu=*/2, /*gtid=*/1, /*runnable=*/true);
+  TaskNew(/*cpu=*/0, /*gtid=*/2, /*runnable=*/true);
+  TaskNew(/*cpu=*/3, /*gtid=*/3, /*runnable=*/true);
+
+  // Task 1 was queued first, but it is in the other LLC.
+  Pnt(1);
+  Pnt(2);
+  Pnt(3);
+  EXPECT_THAT(ran_, ElementsAre(Pair(1, 2), Pair(2, 1), Pair(3, 3)));
+}
+
+TEST_F(BiffBpfTest, StealWhenLocalLlcIsEmpty) {
+  TaskNew(/*cpu=*/2, /*gtid=*/1, /*runnable=*/true);
+  TaskNew(/*cpu=*/3, /*gtid=*/2, /*runnable=*/true);
+
+  Pnt(0);
+  Pnt(1);
+  Pnt(0);
+  EXPECT_THAT(ran_, ElementsAre(Pair(0, 1), Pair(1, 2)));
+}
+
+TEST_F(BiffBpfTest, WakeupQueuesOnLastRanLlc) {
+  TaskNew(/*cpu=*/0, /*gtid=*/1, /*runnable=*/false);
+  TaskNew(/*cpu=*/0, /*gtid=*/2, /*runnable=*/true);
+  TaskNew(/*cpu=*/0, /*gtid=*/3, /*runnable=*/false);
+
+  // Task 1 last ran in LLC 1.  Task 3 never ran, so it goes where it woke up.
+  TaskWakeup(/*gtid=*/1, /*last_ran_cpu=*/3, /*wake_up_cpu=*/0);
+  TaskWakeup(/*gtid=*/3, /*last_ran_cpu=*/-1, /*wake_up_cpu=*/2);
+
+  Pnt(2);
+  Pnt(2);
+  Pnt(0);
+  EXPECT_THAT(ran_, ElementsAre(Pair(2, 1), Pair(2, 3), Pair(0, 2)));
+}
+
+TEST_F(BiffBpfTest, BusyTaskStaysOnPickingLlc) {
+  TaskNew(/*cpu=*/0, /*gtid=*/1, /*runnable=*/true);
+
+  // Cpu 2 steals task 1, which is still on its old cpu.  Biff requeues it in
+  // cpu 2's LLC, so cpu 3 finds it there ahead of newer work in LLC 0.
+  run_errors_ = {-EBUSY};
+  Pnt(2);
+  EXPECT_TRUE(ran_.empty());
+
+  TaskNew(/*cpu=*/0, /*gtid=*/2, /*runnable=*/true);
+  Pnt(3);
+  Pnt(3);
+  EXPECT_THAT(ran_, ElementsAre(Pair(3, 1), Pair(3, 2)));
+}
+
+TEST_F(BiffBpfTest, DepartedTaskIsDropped) {
+  TaskNew(/*cpu=*/0, /*gtid=*/1, /*runnable=*/true);
+  TaskNew(/*cpu=*/0, /*gtid=*/2, /*runnable=*/true);
+
+  // The kernel rejects the departed task; Biff forgets about it.
+  run_errors_ = {-ENOENT};
+  Pnt(0);
+  Pnt(0);
+  Pnt(0);
+  EXPECT_THAT(ran_, ElementsAre(Pair(0, 2)));
+}
+
+TEST_F(BiffBpfTest, BetterPriorityFirst) {
+  TaskNew(/*cpu=*/0, /*gtid=*/1, /*runnable=*/true);
+  TaskNew(/*cpu=*/0, /*gtid=*/2, /*runnable=*/false);
+  TaskNew(/*cpu=*/0, /*gtid=*/3, /*runnable=*/false);
+
+  // Lower is better.  Out-of-range priorities are clamped to the worst one.
+  SwData(/*gtid=*/2)->prio = BIFF_NR_PRIOS + 5;
+  SwData(/*gtid=*/3)->prio = 0;
+  TaskWakeup(/*gtid=*/2, /*last_ran_cpu=*/-1, /*wake_up_cpu=*/0);
+  TaskWakeup(/*gtid=*/3, /*last_ran_cpu=*/-1, /*wake_up_cpu=*/2);
+
+  // Task 3 is in the other LLC, but a better priority beats locality.
+  Pnt(0);
+  Pnt(0);
+  Pnt(0);
+  EXPECT_THAT(ran_, ElementsAre(Pair(0, 3), Pair(0, 1), Pair(0, 2)));
+  for (const struct biff_bpf_llc_queued& q : nr_queued) {
+    EXPECT_THAT(q.nr, ElementsAre(0, 0, 0));
+  }
+}
+
+TEST_F(BiffBpfTest, FullQueueSpillsToNextLlc) {
+  // One LLC's queue of a priority is full, yet its cpus still run all tasks.
+  const int nr_tasks = BIFF_RQ_ENTRIES + 2;
+  for (int gtid = 1; gtid <= nr_tasks; gtid++) {
+    TaskNew(/*cpu=*/0, gtid, /*runnable=*/true);
+  }
+  EXPECT_EQ(nr_queued[0].nr[BIFF_PRIO_DEFAULT], BIFF_RQ_ENTRIES);
+  EXPECT_EQ(nr_queued[1].nr[BIFF_PRIO_DEFAULT], 2);
+
+  for (int i = 0; i < nr_tasks; i++) Pnt(0);
+  ASSERT_EQ(ran_.size(), nr_tasks);
+  EXPECT_THAT(ran_.back(), Pair(0, nr_tasks));
+}
+
+TEST_F(BiffBpfTest, TickPreemptsForBetterPriority) {
+  TaskNew(/*cpu=*/0, /*gtid=*/1, /*runnable=*/true);
+  Pnt(0);
+  TaskLatched(/*cpu=*/0, /*gtid=*/1);
+
+  // Same priority, no time slice: task 1 keeps the cpu.
+  TaskNew(/*cpu=*/0, /*gtid=*/2, /*runnable=*/true);
+  CpuTick(0);
+  EXPECT_TRUE(rescheds_.empty());
+
+  TaskNew(/*cpu=*/0, /*gtid=*/3, /*runnable=*/false);
+  SwData(/*gtid=*/3)->prio = 0;
+  TaskWakeup(/*gtid=*/3, /*last_ran_cpu=*/-1, /*wake_up_cpu=*/0);
+  CpuTick(0);
+  EXPECT_THAT(rescheds_, ElementsAre(0));
+}
+
+TEST_F(BiffBpfTest, TickIgnoresOtherLlcs) {
+  slice_us = 1000;
+  bpf_shim_set_time_ns(0);
+  TaskNew(/*cpu=*/0, /*gtid=*/1, /*runnable=*/true);
+  Pnt(0);
+  TaskLatched(/*cpu=*/0, /*gtid=*/1);
+
+  // Cpu 0 would pop its own LLC first and run task 1 again, so neither a
+  // better priority nor a peer in LLC 1 ends task 1's slice.
+  TaskNew(/*cpu=*/2, /*gtid=*/2, /*runnable=*/true);
+  TaskNew(/*cpu=*/0, /*gtid=*/3, /*runnable=*/false);
+  SwData(/*gtid=*/3)->prio = 0;
+  TaskWakeup(/*gtid=*/3, /*last_ran_cpu=*/-1, /*wake_up_cpu=*/2);
+  bpf_shim_set_time_ns(2'000'000);
+  CpuTick(0);
+  EXPECT_TRUE(rescheds_.empty());
+}
+
+TEST_F(BiffBpfTest, SliceExpiresOnlyWhenOthersWait) {
+  slice_us = 1000;
+  bpf_shim_set_time_ns(0);
+  TaskNew(/*cpu=*/0, /*gtid=*/1, /*runnable=*/true);
+  Pnt(0);
+  TaskLatched(/*cpu=*/0, /*gtid=*/1);
+
+  // Past the slice, but no one else wants the cpu.
+  bpf_shim_set_time_ns(2'000'000);
+  CpuTick(0);
+  EXPECT_TRUE(rescheds_.empty());
+
+  // A worse priority does not end the slice either.
+  TaskNew(/*cpu=*/0, /*gtid=*/2, /*runnable=*/false);
+  SwData(/*gtid=*/2)->prio = BIFF_NR_PRIOS - 1;
+  TaskWakeup(/*gtid=*/2, /*last_ran_cpu=*/-1, /*wake_up_cpu=*/0);
+  CpuTick(0);
+  EXPECT_TRUE(rescheds_.empty());
+
+  // A peer does, but only once the slice is used up.
+  TaskNew(/*cpu=*/0, /*gtid=*/3, /*runnable=*/true);
+  bpf_shim_set_time_ns(2'500'000);
+  TaskLatched(/*cpu=*/0, /*gtid=*/1);
+  bpf_shim_set_time_ns(3'000'000);
+  CpuTick(0);
+  EXPECT_TRUE(rescheds_.empty());
+  bpf_shim_set_time_ns(3'500'000);
+  CpuTick(0);
+  EXPECT_THAT(rescheds_, ElementsAre(0));
+}
+
+TEST_F(BiffBpfTest, HomeLlcOverridesLastRan) {
+  TaskNew(/*cpu=*/0, /*gtid=*/1, /*runnable=*/false);
+  TaskNew(/*cpu=*/0, /*gtid=*/2, /*runnable=*/false);
+  EXPECT_EQ(SwData(/*gtid=*/1)->home_llc, BIFF_LLC_NONE);
+
+  // Task 1 last ran in LLC 0, but userspace moved it to LLC 1.  A bogus home
+  // is ignored.
+  SwData(/*gtid=*/1)->home_llc = 1;
+  SwData(/*gtid=*/2)->home_llc = BIFF_MAX_LLCS;
+  TaskWakeup(/*gtid=*/1, /*last_ran_cpu=*/0, /*wake_up_cpu=*/0);
+  TaskWakeup(/*gtid=*/2, /*last_ran_cpu=*/3, /*wake_up_cpu=*/0);
+
+  Pnt(2);
+  Pnt(2);
+  EXPECT_THAT(ran_, ElementsAre(Pair(2, 1), Pair(2, 2)));
+}
+
+TEST_F(BiffBpfTest, RuntimeAndTaskSlice) {
+  slice_us = 1000;
+  bpf_shim_set_time_ns(0);
+  TaskNew(/*cpu=*/0, /*gtid=*/1, /*runnable=*/true);
+  TaskNew(/*cpu=*/0, /*gtid=*/2, /*runnable=*/true);
+  SwData(/*gtid=*/1)->slice_us = 5000;
+  Pnt(0);
+  TaskLatched(/*cpu=*/0, /*gtid=*/1);
+
+  // Task 1's own slice replaces the global one.
+  bpf_shim_set_time_ns(2'000'000);
+  CpuTick(0);
+  EXPECT_TRUE(rescheds_.empty());
+  bpf_shim_set_time_ns(5'000'000);
+  CpuTick(0);
+  EXPECT_THAT(rescheds_, ElementsAre(0));
+
+  struct bpf_ghost_msg msg = {};
+  msg.type = MSG_TASK_PREEMPT;
+  msg.preempt.gtid = 1;
+  msg.preempt.cpu = 0;
+  Send(0, msg);
+  EXPECT_EQ(SwData(/*gtid=*/1)->runtime, 5000);
+}
+
+}  // namespace
+}  // namespace ghost
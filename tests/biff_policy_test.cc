@@ -0,0 +1,90 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests the policy that Biff's agent computes for bpf.  Unlike biff_test, this
+// needs no ghost kernel.
+
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "schedulers/biff/biff_scheduler.h"
+
+namespace ghost {
+namespace {
+
+TEST(AssignHomeLlcsTest, SpreadsByCpus) {
+  std::vector<BiffTaskDemand> tasks(5, {.demand = 100, .home = BIFF_LLC_NONE});
+
+  // LLC 0 has four times the cpus, so it takes four times the work.
+  EXPECT_THAT(AssignHomeLlcs(tasks, /*llc_cpus=*/{4, 1}),
+              testing::ElementsAre(0, 0, 0, 0, 1));
+}
+
+TEST(AssignHomeLlcsTest, TasksStayHomeUnlessImbalanced) {
+  // LLC 1 ends up a little busier, but not enough to move task 2.
+  EXPECT_THAT(AssignHomeLlcs({{.demand = 100, .home = 0},
+                              {.demand = 100, .home = 1},
+                              {.demand = 90, .home = 1}},
+                             /*llc_cpus=*/{1, 1}),
+              testing::ElementsAre(0, 1, 1));
+
+  // Everyone in LLC 0 would leave LLC 1 idle.
+  EXPECT_THAT(AssignHomeLlcs({{.demand = 100, .home = 0},
+                              {.demand = 100, .home = 0},
+                              {.demand = 100, .home = 0},
+                              {.demand = 100, .home = 0}},
+                             /*llc_cpus=*/{1, 1}),
+              testing::ElementsAre(0, 1, 0, 1));
+}
+
+TEST(AssignHomeLlcsTest, IdleTasksKeepTheirHome) {
+  EXPECT_THAT(AssignHomeLlcs({{.demand = 0, .home = 1},
+                              {.demand = 0, .home = BIFF_LLC_NONE},
+                              {.demand = 100, .home = 7}},
+                             /*llc_cpus=*/{1, 1}),
+              testing::ElementsAre(1, BIFF_LLC_NONE, 0));
+}
+
+TEST(AssignHomeLlcsTest, SkipsLlcsWithoutCpus) {
+  // LLCs 0 and 2 are outside the enclave. Task 1's home there doesn't stick.
+  EXPECT_THAT(AssignHomeLlcs({{.demand = 100, .home = BIFF_LLC_NONE},
+                              {.demand = 100, .home = 2},
+                              {.demand = 100, .home = 1}},
+                             /*llc_cpus=*/{0, 2, 0}),
+              testing::ElementsAre(1, 1, 1));
+
+  // With no cpus anywhere, nothing moves.
+  EXPECT_THAT(AssignHomeLlcs({{.demand = 100, .home = 1}},
+                             /*llc_cpus=*/{0, 0}),
+              testing::ElementsAre(1));
+}
+
+TEST(WeightedSliceTest, ScalesWithWeight) {
+  const absl::Duration slice = absl::Milliseconds(10);
+
+  EXPECT_EQ(WeightedSlice(slice, BiffScheduler::kDefaultWeight), slice);
+  EXPECT_EQ(WeightedSlice(slice, 2 * BiffScheduler::kDefaultWeight),
+            absl::Milliseconds(20));
+  EXPECT_EQ(WeightedSlice(slice, BiffScheduler::kDefaultWeight / 4),
+            absl::Microseconds(2500));
+}
+
+TEST(WeightedSliceTest, NeverZero) {
+  // A zero slice_us would give the task the global slice instead.
+  EXPECT_EQ(WeightedSlice(absl::Microseconds(10), 1), absl::Microseconds(1));
+}
+
+}  // namespace
+}  // namespace ghost
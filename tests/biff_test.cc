@@ -23,9 +23,9 @@ class BiffTest : public testing::Test {
  protected:
   static void SetUpTestSuite() {
     Topology* t = MachineTopology();
-    AgentConfig cfg(t, t->all_cpus());
+    BiffConfig cfg(t, t->all_cpus());
 
-    uap_ = new AgentProcess<FullBiffAgent<LocalEnclave>, AgentConfig>(cfg);
+    uap_ = new AgentProcess<FullBiffAgent<LocalEnclave>, BiffConfig>(cfg);
   }
 
   static void TearDownTestSuite() {
@@ -33,10 +33,10 @@ class BiffTest : public testing::Test {
     uap_ = nullptr;
   }
 
-  static AgentProcess<FullBiffAgent<LocalEnclave>, AgentConfig>* uap_;
+  static AgentProcess<FullBiffAgent<LocalEnclave>, BiffConfig>* uap_;
 };
 
-AgentProcess<FullBiffAgent<LocalEnclave>, AgentConfig>* BiffTest::uap_;
+AgentProcess<FullBiffAgent<LocalEnclave>, BiffConfig>* BiffTest::uap_;
 
 TEST_F(BiffTest, Simple) {
   ForkedProcess fp([]() {
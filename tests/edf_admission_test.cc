@@ -0,0 +1,141 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "schedulers/edf/admission.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "shared/prio_table.h"
+
+namespace ghost {
+namespace {
+
+using ::testing::DoubleEq;
+using ::testing::Eq;
+
+using Policy = AdmissionControl::Policy;
+
+TEST(AdmissionControlTest, ParsePolicy) {
+  Policy policy;
+  EXPECT_TRUE(AdmissionControl::ParsePolicy("degrade", &policy));
+  EXPECT_THAT(policy, Eq(Policy::kDegrade));
+  EXPECT_TRUE(AdmissionControl::ParsePolicy("best_effort", &policy));
+  EXPECT_THAT(policy, Eq(Policy::kBestEffort));
+  EXPECT_FALSE(AdmissionControl::ParsePolicy("bogus", &policy));
+}
+
+TEST(AdmissionControlTest, NoneAdmitsEverything) {
+  AdmissionControl admission(Policy::kNone, 1.0, 1);
+  for (int i = 0; i < 10; i++) {
+    AdmissionControl::Decision d =
+        admission.Admit(absl::Milliseconds(10), absl::Milliseconds(10));
+    EXPECT_THAT(d.admission, Eq(WORK_CLASS_ADMITTED));
+  }
+}
+
+TEST(AdmissionControlTest, OneShotIsAlwaysAdmitted) {
+  AdmissionControl admission(Policy::kReject, 0.5, 1);
+  AdmissionControl::Decision d =
+      admission.Admit(absl::Seconds(1), absl::ZeroDuration());
+  EXPECT_THAT(d.admission, Eq(WORK_CLASS_ADMITTED));
+  EXPECT_THAT(admission.reserved(), DoubleEq(0.0));
+}
+
+TEST(AdmissionControlTest, Reject) {
+  // Two cpus at 75% leaves 1.5 cpus.
+  AdmissionControl admission(Policy::kReject, 0.75, 2);
+  EXPECT_THAT(admission.capacity(), DoubleEq(1.5));
+
+  const absl::Duration period = absl::Milliseconds(100);
+  EXPECT_THAT(admission.Admit(absl::Milliseconds(100), period).admission,
+              Eq(WORK_CLASS_ADMITTED));
+  EXPECT_THAT(admission.Admit(absl::Milliseconds(60), period).admission,
+              Eq(WORK_CLASS_REJECTED));
+  // A rejected work class does not reserve anything, so a smaller one fits.
+  EXPECT_THAT(admission.Admit(absl::Milliseconds(50), period).admission,
+              Eq(WORK_CLASS_ADMITTED));
+  EXPECT_THAT(admission.reserved(), DoubleEq(1.5));
+}
+
+TEST(AdmissionControlTest, Degrade) {
+  AdmissionControl admission(Policy::kDegrade, 1.0, 1);
+
+  const absl::Duration period = absl::Milliseconds(100);
+  EXPECT_THAT(admission.Admit(absl::Milliseconds(80), period).admission,
+              Eq(WORK_CLASS_ADMITTED));
+
+  // Only 20% is left, so a 40% work class gets twice its period.
+  AdmissionControl::Decision d = admission.Admit(absl::Milliseconds(40), period);
+  EXPECT_THAT(d.admission, Eq(WORK_CLASS_DEGRADED));
+  EXPECT_THAT(d.period, Eq(absl::Milliseconds(200)));
+  EXPECT_THAT(admission.reserved(), DoubleEq(1.0));
+
+  // Nothing is left at all.
+  d = admission.Admit(absl::Milliseconds(1), period);
+  EXPECT_THAT(d.admission, Eq(WORK_CLASS_BEST_EFFORT));
+  EXPECT_THAT(d.period, Eq(period));
+}
+
+TEST(AdmissionControlTest, BestEffort) {
+  AdmissionControl admission(Policy::kBestEffort, 1.0, 1);
+
+  const absl::Duration period = absl::Milliseconds(10);
+  EXPECT_THAT(admission.Admit(absl::Milliseconds(6), period).admission,
+              Eq(WORK_CLASS_ADMITTED));
+  EXPECT_THAT(admission.Admit(absl::Milliseconds(6), period).admission,
+              Eq(WORK_CLASS_BEST_EFFORT));
+  EXPECT_THAT(admission.reserved(), DoubleEq(0.6));
+}
+
+TEST(AdmissionControlTest, ReleaseMakesRoom) {
+  AdmissionControl admission(Policy::kReject, 1.0, 1);
+
+  const absl::Duration period = absl::Milliseconds(10);
+  AdmissionControl::Decision d = admission.Admit(absl::Milliseconds(8), period);
+  EXPECT_THAT(d.admission, Eq(WORK_CLASS_ADMITTED));
+  EXPECT_THAT(admission.Admit(absl::Milliseconds(8), period).admission,
+              Eq(WORK_CLASS_REJECTED));
+
+  // Once the first work class is gone, the same work class fits again, as
+  // often as it is released.
+  for (int i = 0; i < 100; i++) {
+    admission.Release(d.runtime, d.period);
+    EXPECT_THAT(admission.reserved(), DoubleEq(0.0));
+    d = admission.Admit(absl::Milliseconds(8), period);
+    EXPECT_THAT(d.admission, Eq(WORK_CLASS_ADMITTED));
+  }
+  EXPECT_THAT(admission.reserved(), DoubleEq(0.8));
+}
+
+TEST(AdmissionControlTest, ReleaseDegraded) {
+  AdmissionControl admission(Policy::kDegrade, 1.0, 1);
+
+  const absl::Duration period = absl::Milliseconds(100);
+  AdmissionControl::Decision admitted =
+      admission.Admit(absl::Milliseconds(80), period);
+  AdmissionControl::Decision degraded =
+      admission.Admit(absl::Milliseconds(40), period);
+  EXPECT_THAT(degraded.admission, Eq(WORK_CLASS_DEGRADED));
+
+  // A degraded work class only gives back what it got.
+  admission.Release(degraded.runtime, degraded.period);
+  EXPECT_THAT(admission.reserved(), DoubleEq(0.8));
+  admission.Release(admitted.runtime, admitted.period);
+  EXPECT_THAT(admission.reserved(), DoubleEq(0.0));
+  EXPECT_THAT(admission.Admit(absl::Milliseconds(40), period).admission,
+              Eq(WORK_CLASS_ADMITTED));
+}
+
+}  // namespace
+}  // namespace ghost
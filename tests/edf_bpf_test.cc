@@ -0,0 +1,146 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Runs EDF's bpf-pnt in userspace, on top of the bpf shim, to test the next-up
+// slots that EdfScheduler publishes without a ghost kernel.
+
+#include <cstdint>
+#include <tuple>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "bpf/shim/bpf_shim.h"
+#include "third_party/bpf/edf.h"
+
+extern "C" {
+// The shim keys maps by address, so the symbol is all userspace needs to reach
+// the per-cpu data that EdfScheduler would mmap.
+extern char cpu_data;
+
+int edf_pnt(struct bpf_ghost_sched* ctx);
+}
+
+namespace ghost {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::FieldsAre;
+using ::testing::IsEmpty;
+
+class EdfBpfTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    bpf_shim_reset();
+    ran_.clear();
+    run_error_ = 0;
+    bpf_shim_set_run_gtid_hook(RunGtid);
+    for (uint32_t cpu = 0; cpu < kNumCpus; cpu++) {
+      CpuData(cpu)->next_up_state = EDF_NEXT_UP_EMPTY;
+    }
+  }
+
+  void TearDown() override { bpf_shim_reset(); }
+
+  static struct edf_bpf_per_cpu_data* CpuData(uint32_t cpu) {
+    return static_cast<struct edf_bpf_per_cpu_data*>(bpf_shim_map_lookup(
+        &cpu_data, BPF_MAP_TYPE_ARRAY, /*max_entries=*/1024, sizeof(cpu),
+        sizeof(struct edf_bpf_per_cpu_data), &cpu));
+  }
+
+  // Runs bpf-pnt on `cpu`.
+  static void Pnt(int cpu, struct bpf_ghost_sched ctx = {}) {
+    bpf_shim_set_cpu(cpu);
+    edf_pnt(&ctx);
+  }
+
+  static long RunGtid(u32 cpu, s64 gtid, u32 task_barrier, s32 run_flags) {
+    if (run_error_) return run_error_;
+    ran_.emplace_back(cpu, gtid, task_barrier);
+    return 0;
+  }
+
+  static constexpr uint32_t kNumCpus = 4;
+
+  // (cpu, gtid, barrier) for each successful bpf_ghost_run_gtid().
+  static std::vector<std::tuple<uint32_t, int64_t, uint32_t>> ran_;
+  // Error to return from bpf_ghost_run_gtid().
+  static long run_error_;
+};
+
+std::vector<std::tuple<uint32_t, int64_t, uint32_t>> EdfBpfTest::ran_;
+long EdfBpfTest::run_error_;
+
+TEST_F(EdfBpfTest, LatchesNextUpOnItsCpu) {
+  edf_next_up_publish(CpuData(1), /*gtid=*/7, /*barrier=*/3);
+
+  Pnt(0);
+  EXPECT_THAT(ran_, IsEmpty());
+
+  Pnt(1);
+  EXPECT_THAT(ran_, ElementsAre(FieldsAre(1, 7, 3)));
+  EXPECT_EQ(CpuData(1)->next_up_state, GHOST_TXN_COMPLETE);
+
+  // The agent learns that bpf-pnt latched the task, and the slot is empty.
+  EXPECT_FALSE(edf_next_up_revoke(CpuData(1)));
+  EXPECT_EQ(CpuData(1)->next_up_state, EDF_NEXT_UP_EMPTY);
+
+  Pnt(1);
+  EXPECT_EQ(ran_.size(), 1);
+}
+
+TEST_F(EdfBpfTest, AgentComesFirst) {
+  edf_next_up_publish(CpuData(1), /*gtid=*/7, /*barrier=*/3);
+
+  Pnt(1, {.agent_runnable = 1});
+  Pnt(1, {.might_yield = 1});
+  Pnt(1, {.next_gtid = 9});
+  EXPECT_THAT(ran_, IsEmpty());
+  EXPECT_EQ(CpuData(1)->next_up_state, GHOST_TXN_READY);
+
+  EXPECT_TRUE(edf_next_up_revoke(CpuData(1)));
+}
+
+TEST_F(EdfBpfTest, RevokedBeforeIdle) {
+  edf_next_up_publish(CpuData(2), /*gtid=*/7, /*barrier=*/3);
+
+  EXPECT_TRUE(edf_next_up_revoke(CpuData(2)));
+  Pnt(2);
+  EXPECT_THAT(ran_, IsEmpty());
+  EXPECT_EQ(CpuData(2)->next_up_state, EDF_NEXT_UP_EMPTY);
+}
+
+TEST_F(EdfBpfTest, FailedLatchGoesBackToAgent) {
+  edf_next_up_publish(CpuData(1), /*gtid=*/7, /*barrier=*/3);
+
+  run_error_ = -ESTALE;
+  Pnt(1);
+  EXPECT_EQ(CpuData(1)->next_up_state, GHOST_TXN_TARGET_STALE);
+  EXPECT_TRUE(edf_next_up_revoke(CpuData(1)));
+  EXPECT_EQ(CpuData(1)->next_up_state, EDF_NEXT_UP_EMPTY);
+
+  run_error_ = -EBUSY;
+  edf_next_up_publish(CpuData(1), /*gtid=*/7, /*barrier=*/4);
+  Pnt(1);
+  EXPECT_EQ(CpuData(1)->next_up_state, GHOST_TXN_TARGET_NOT_RUNNABLE);
+  EXPECT_TRUE(edf_next_up_revoke(CpuData(1)));
+
+  run_error_ = 0;
+  edf_next_up_publish(CpuData(1), /*gtid=*/7, /*barrier=*/5);
+  Pnt(1);
+  EXPECT_THAT(ran_, ElementsAre(FieldsAre(1, 7, 5)));
+}
+
+}  // namespace
+}  // namespace ghost
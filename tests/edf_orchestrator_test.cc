@@ -0,0 +1,101 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests Orchestrator's scan for updated sched items against a PrioTable created
+// by this process, so that no ghost kernel is needed.
+
+#include "schedulers/edf/orchestrator.h"
+
+#include <unistd.h>
+
+#include <memory>
+#include <set>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/random/random.h"
+#include "schedulers/edf/admission.h"
+#include "shared/prio_table.h"
+
+namespace ghost {
+namespace {
+
+using ::testing::ContainerEq;
+using ::testing::IsEmpty;
+
+std::unique_ptr<PrioTable> MakeTable(int num_items) {
+  auto table = std::make_unique<PrioTable>(
+      num_items, /*num_classes=*/1,
+      PrioTable::StreamCapacity::kStreamCapacity19);
+  struct work_class* wc = table->work_class(0);
+  wc->id = 0;
+  wc->flags = WORK_CLASS_ONESHOT;
+  wc->exectime = 1000;
+  for (int i = 0; i < num_items; i++) {
+    struct sched_item* si = table->sched_item(i);
+    si->sid = i;
+    si->wcid = 0;
+  }
+  return table;
+}
+
+// Returns the sids that RefreshAllSchedParams() refreshes.
+std::set<uint32_t> RefreshAll(Orchestrator& orch, bool simd) {
+  std::set<uint32_t> refreshed;
+  orch.RefreshAllSchedParams(
+      [&refreshed](Orchestrator&, const SchedParams* sp, Gtid) {
+        refreshed.insert(sp->GetSID());
+      },
+      simd);
+  return refreshed;
+}
+
+// Item counts that are not multiples of 8 leave a tail for the scalar loop.
+class RefreshAllTest : public testing::TestWithParam<int> {};
+
+TEST_P(RefreshAllTest, SimdMatchesScalar) {
+  const int num_items = GetParam();
+  std::unique_ptr<PrioTable> table = MakeTable(num_items);
+  AdmissionControl admission(AdmissionControl::Policy::kNone, 1.0, 1);
+  Orchestrator simd, scalar;
+  ASSERT_TRUE(simd.Init(getpid(), admission));
+  ASSERT_TRUE(scalar.Init(getpid(), admission));
+
+  // Nothing changed since the orchestrators attached.
+  EXPECT_THAT(RefreshAll(simd, /*simd=*/true), IsEmpty());
+  EXPECT_THAT(RefreshAll(scalar, /*simd=*/false), IsEmpty());
+
+  absl::BitGen gen;
+  for (int round = 0; round < 20; round++) {
+    // Update a random subset, without telling the stream.
+    std::set<uint32_t> updated;
+    for (int i = 0; i < num_items; i++) {
+      if (!absl::Bernoulli(gen, 0.3)) continue;
+      struct sched_item* si = table->sched_item(i);
+      uint32_t seq = si->seqcount.write_begin();
+      si->flags ^= SCHED_ITEM_RUNNABLE;
+      si->seqcount.write_end(seq);
+      updated.insert(i);
+    }
+
+    EXPECT_THAT(RefreshAll(simd, /*simd=*/true), ContainerEq(updated));
+    EXPECT_THAT(RefreshAll(scalar, /*simd=*/false), ContainerEq(updated));
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(ItemCounts, RefreshAllTest,
+                         testing::Values(1, 7, 8, 13, 64, 101));
+
+}  // namespace
+}  // namespace ghost
@@ -0,0 +1,166 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests EdfTask's ordering on stand-ins for EdfTask, so that no ghost kernel is
+// needed.
+
+#include <cstdint>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/time/time.h"
+#include "schedulers/edf/edf_scheduler.h"
+
+namespace ghost {
+namespace {
+
+struct FakeParams {
+  uint32_t GetQoS() const { return qos; }
+
+  uint32_t qos;
+};
+
+struct FakeTask {
+  bool prio_boost;
+  const FakeParams* sp;
+  absl::Time sched_deadline;
+  int rq_pos = -1;
+};
+
+using FakeRunQueue =
+    IndexedHeap<FakeTask, EdfTask::SchedDeadlineGreater, &FakeTask::rq_pos>;
+
+using ::testing::ElementsAre;
+using ::testing::Eq;
+using ::testing::IsEmpty;
+using ::testing::IsNull;
+
+const FakeParams kLowQoS = {.qos = 1};
+const FakeParams kMidQoS = {.qos = 2};
+const FakeParams kHighQoS = {.qos = 3};
+
+TEST(EdfTaskTest, BoostedTaskIsQueuedFirst) {
+  const absl::Time now = absl::Now();
+  FakeTask boosted = {.prio_boost = true,
+                      .sp = &kLowQoS,
+                      .sched_deadline = now + absl::Seconds(1)};
+  FakeTask high = {
+      .prio_boost = false, .sp = &kHighQoS, .sched_deadline = now};
+
+  EXPECT_TRUE(EdfTask::SchedDeadlineGreater()(&high, &boosted));
+  EXPECT_FALSE(EdfTask::SchedDeadlineGreater()(&boosted, &high));
+}
+
+TEST(EdfTaskTest, BoostedTaskDoesNotPreemptHigherQoS) {
+  const absl::Time now = absl::Now();
+  FakeTask running = {.prio_boost = false,
+                      .sp = &kHighQoS,
+                      .sched_deadline = now + absl::Seconds(1)};
+
+  // Whatever its deadline, a boosted low-QoS task never takes the cpu.
+  for (absl::Duration d : {-absl::Seconds(1), absl::ZeroDuration()}) {
+    FakeTask boosted = {
+        .prio_boost = true, .sp = &kLowQoS, .sched_deadline = now + d};
+    EXPECT_FALSE(EdfTask::PreemptionGreater()(&running, &boosted));
+    EXPECT_TRUE(EdfTask::PreemptionGreater()(&boosted, &running));
+  }
+}
+
+TEST(EdfTaskTest, PreemptsOnQoSThenDeadline) {
+  const absl::Time now = absl::Now();
+  FakeTask running = {
+      .prio_boost = true, .sp = &kLowQoS, .sched_deadline = now};
+  FakeTask later = {.prio_boost = false,
+                    .sp = &kLowQoS,
+                    .sched_deadline = now + absl::Seconds(1)};
+  FakeTask earlier = {.prio_boost = false,
+                      .sp = &kLowQoS,
+                      .sched_deadline = now - absl::Seconds(1)};
+  FakeTask high = {.prio_boost = false,
+                   .sp = &kHighQoS,
+                   .sched_deadline = now + absl::Seconds(1)};
+
+  // The running task's own boost doesn't protect it either.
+  EXPECT_FALSE(EdfTask::PreemptionGreater()(&running, &later));
+  EXPECT_TRUE(EdfTask::PreemptionGreater()(&running, &earlier));
+  EXPECT_TRUE(EdfTask::PreemptionGreater()(&running, &high));
+}
+
+// All cpus are busy. A boosted low-QoS task is queued ahead of a high-QoS task,
+// and must not keep it from preempting.
+TEST(EdfTaskTest, BoostedTaskDoesNotBlockPreemption) {
+  const absl::Time now = absl::Now();
+  FakeTask running = {
+      .prio_boost = false, .sp = &kMidQoS, .sched_deadline = now};
+  FakeTask boosted = {
+      .prio_boost = true, .sp = &kLowQoS, .sched_deadline = now};
+  FakeTask high = {.prio_boost = false,
+                   .sp = &kHighQoS,
+                   .sched_deadline = now + absl::Seconds(1)};
+
+  FakeRunQueue queue;
+  queue.Push(&high);
+  queue.Push(&boosted);
+  ASSERT_THAT(queue.Top(), Eq(&boosted));
+
+  std::vector<FakeTask*> set_aside;
+  EXPECT_THAT(EdfTask::NextPreemptor(queue, &running, &set_aside), Eq(&high));
+  EXPECT_THAT(queue.Top(), Eq(&high));
+  EXPECT_THAT(set_aside, ElementsAre(&boosted));
+}
+
+TEST(EdfTaskTest, BoostedTaskStillPreempts) {
+  const absl::Time now = absl::Now();
+  FakeTask running = {
+      .prio_boost = false, .sp = &kLowQoS, .sched_deadline = now};
+  FakeTask boosted = {
+      .prio_boost = true, .sp = &kMidQoS, .sched_deadline = now};
+
+  FakeRunQueue queue;
+  queue.Push(&boosted);
+
+  std::vector<FakeTask*> set_aside;
+  EXPECT_THAT(EdfTask::NextPreemptor(queue, &running, &set_aside),
+              Eq(&boosted));
+  EXPECT_THAT(set_aside, IsEmpty());
+}
+
+// Unboosted tasks are queued in preemption order, so the scan stops at the
+// first one that can't preempt.
+TEST(EdfTaskTest, UnboostedLoserEndsScan) {
+  const absl::Time now = absl::Now();
+  FakeTask running = {
+      .prio_boost = false, .sp = &kMidQoS, .sched_deadline = now};
+  FakeTask boosted = {
+      .prio_boost = true, .sp = &kLowQoS, .sched_deadline = now};
+  FakeTask low = {.prio_boost = false, .sp = &kLowQoS, .sched_deadline = now};
+  FakeTask later = {.prio_boost = false,
+                    .sp = &kLowQoS,
+                    .sched_deadline = now + absl::Seconds(1)};
+
+  FakeRunQueue queue;
+  queue.Push(&later);
+  queue.Push(&low);
+  queue.Push(&boosted);
+
+  std::vector<FakeTask*> set_aside;
+  EXPECT_THAT(EdfTask::NextPreemptor(queue, &running, &set_aside), IsNull());
+  EXPECT_THAT(set_aside, ElementsAre(&boosted));
+  EXPECT_THAT(queue.Top(), Eq(&low));
+  EXPECT_THAT(queue.size(), Eq(2));
+}
+
+}  // namespace
+}  // namespace ghost
@@ -107,6 +107,7 @@ class EdfTest : public testing::Test {
     constexpr int kGlobalCpu = 1;
     Topology* t = MachineTopology();
     GlobalConfig cfg(t, t->all_cpus(), t->cpu(kGlobalCpu));
+    cfg.check_runqueue_ = true;
 
     uap_ = new AgentProcess<GlobalEdfAgent<LocalEnclave>, GlobalConfig>(cfg);
   }
@@ -0,0 +1,76 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "lib/histogram.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace ghost {
+namespace {
+
+using ::testing::Eq;
+
+TEST(DurationHistogramTest, Slots) {
+  EXPECT_THAT(DurationHistogram::Slot(absl::ZeroDuration()), Eq(0));
+  EXPECT_THAT(DurationHistogram::Slot(-absl::Seconds(1)), Eq(0));
+  EXPECT_THAT(DurationHistogram::Slot(absl::Microseconds(1)), Eq(0));
+  EXPECT_THAT(DurationHistogram::Slot(absl::Nanoseconds(1001)), Eq(1));
+  EXPECT_THAT(DurationHistogram::Slot(absl::Microseconds(2)), Eq(1));
+  EXPECT_THAT(DurationHistogram::Slot(absl::Microseconds(3)), Eq(2));
+  EXPECT_THAT(DurationHistogram::Slot(absl::Microseconds(4)), Eq(2));
+  EXPECT_THAT(DurationHistogram::Slot(absl::Microseconds(5)), Eq(3));
+  EXPECT_THAT(DurationHistogram::Slot(absl::Hours(1)),
+              Eq(DurationHistogram::kNumSlots - 1));
+
+  // Every duration is at most its slot's upper bound.
+  for (int us = 1; us < 100000; us += 7) {
+    absl::Duration d = absl::Microseconds(us);
+    int slot = DurationHistogram::Slot(d);
+    EXPECT_LE(d, DurationHistogram::SlotUpperBound(slot));
+    if (slot > 0) {
+      EXPECT_GT(d, DurationHistogram::SlotUpperBound(slot - 1));
+    }
+  }
+}
+
+TEST(DurationHistogramTest, Percentile) {
+  DurationHistogram::Slots slots = {};
+  EXPECT_THAT(DurationHistogram::Percentile(slots, 50),
+              Eq(absl::ZeroDuration()));
+
+  DurationHistogram hist;
+  for (int i = 0; i < 90; i++) hist.Record(absl::Microseconds(3));
+  for (int i = 0; i < 9; i++) hist.Record(absl::Microseconds(100));
+  hist.Record(absl::Hours(1));
+  hist.AddTo(slots);
+
+  EXPECT_THAT(DurationHistogram::Percentile(slots, 50),
+              Eq(absl::Microseconds(4)));
+  EXPECT_THAT(DurationHistogram::Percentile(slots, 90),
+              Eq(absl::Microseconds(4)));
+  EXPECT_THAT(DurationHistogram::Percentile(slots, 99),
+              Eq(absl::Microseconds(128)));
+  EXPECT_THAT(DurationHistogram::Percentile(slots, 100),
+              Eq(absl::InfiniteDuration()));
+
+  // Merging doubles every count but leaves the percentiles unchanged.
+  hist.AddTo(slots);
+  EXPECT_THAT(slots[2], Eq(180));
+  EXPECT_THAT(DurationHistogram::Percentile(slots, 99),
+              Eq(absl::Microseconds(128)));
+}
+
+}  // namespace
+}  // namespace ghost
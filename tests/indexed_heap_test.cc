@@ -0,0 +1,143 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "lib/indexed_heap.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/random/random.h"
+
+namespace ghost {
+namespace {
+
+using ::testing::Eq;
+using ::testing::IsNull;
+
+struct Item {
+  // Orders by key, breaking ties by address so that the order matches
+  // `std::set` below.
+  struct Greater {
+    bool operator()(const Item* a, const Item* b) const {
+      if (a->key == b->key) return a > b;
+      return a->key > b->key;
+    }
+  };
+  struct Less {
+    bool operator()(const Item* a, const Item* b) const {
+      return Greater()(b, a);
+    }
+  };
+
+  int key = 0;
+  int pos = -1;
+};
+
+using Heap = IndexedHeap<Item, Item::Greater, &Item::pos>;
+
+TEST(IndexedHeapTest, Empty) {
+  Heap heap;
+  EXPECT_TRUE(heap.empty());
+  EXPECT_THAT(heap.Top(), IsNull());
+  EXPECT_THAT(heap.Pop(), IsNull());
+}
+
+TEST(IndexedHeapTest, PushPopUpdate) {
+  Heap heap;
+  std::vector<Item> items(3);
+  items[0].key = 2;
+  items[1].key = 1;
+  items[2].key = 3;
+  for (Item& item : items) heap.Push(&item);
+  EXPECT_THAT(heap.size(), Eq(3));
+  EXPECT_THAT(heap.Top(), Eq(&items[1]));
+
+  // Decrease a key.
+  items[2].key = 0;
+  heap.Update(&items[2]);
+  EXPECT_THAT(heap.Top(), Eq(&items[2]));
+
+  // Increase a key.
+  items[2].key = 10;
+  heap.Update(&items[2]);
+  EXPECT_THAT(heap.Top(), Eq(&items[1]));
+
+  heap.Erase(&items[1]);
+  EXPECT_THAT(items[1].pos, Eq(-1));
+  EXPECT_FALSE(Heap::Contains(&items[1]));
+
+  EXPECT_THAT(heap.Pop(), Eq(&items[0]));
+  EXPECT_THAT(heap.Pop(), Eq(&items[2]));
+  EXPECT_TRUE(heap.empty());
+}
+
+// Changes the keys of elements all over the heap, in both directions, and
+// erases elements from its middle, which is how EdfScheduler uses the heap as
+// deadlines and priorities change. Both paths move an element from anywhere in
+// the heap, and Erase() may have to sift the last element up or down in its
+// place. The positions and the heap property are checked after every step, and
+// draining the heap at the end must produce the elements in order.
+template <size_t D>
+void CheckUpdateAndErase() {
+  constexpr int kItems = 500;
+  constexpr int kSteps = 20000;
+  constexpr int kMaxKey = kItems / 4;  // Forces plenty of ties.
+
+  absl::BitGen gen;
+  std::vector<Item> items(kItems);
+  IndexedHeap<Item, Item::Greater, &Item::pos, D> heap;
+  for (Item& item : items) {
+    item.key = absl::Uniform(gen, 0, kMaxKey);
+    heap.Push(&item);
+  }
+
+  int min_key = 0;
+  for (int i = 0; i < kSteps; i++) {
+    Item* item = &items[absl::Uniform(gen, 0, kItems)];
+    if (!decltype(heap)::Contains(item)) {
+      heap.Push(item);
+    } else if (absl::Bernoulli(gen, 0.1)) {
+      // Moves the item from wherever it is to the top.
+      item->key = --min_key;
+      heap.Update(item);
+      ASSERT_THAT(heap.Top(), Eq(item));
+    } else if (absl::Bernoulli(gen, 0.2)) {
+      heap.Erase(heap[absl::Uniform<size_t>(gen, 0, heap.size())]);
+    } else {
+      item->key = absl::Uniform(gen, 0, kMaxKey);
+      heap.Update(item);
+    }
+    heap.CheckInvariants();
+  }
+
+  const size_t size = heap.size();
+  std::vector<Item*> drained;
+  while (Item* item = heap.Pop()) {
+    ASSERT_THAT(item->pos, Eq(-1));
+    drained.push_back(item);
+  }
+  EXPECT_THAT(drained.size(), Eq(size));
+  EXPECT_TRUE(std::is_sorted(drained.begin(), drained.end(), Item::Less()));
+}
+
+TEST(IndexedHeapTest, UpdateAndErase) {
+  CheckUpdateAndErase<2>();
+  CheckUpdateAndErase<3>();
+  CheckUpdateAndErase<4>();
+}
+
+}  // namespace
+}  // namespace ghost
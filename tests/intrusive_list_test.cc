@@ -0,0 +1,130 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "lib/intrusive_list.h"
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/random/random.h"
+
+namespace ghost {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::ElementsAreArray;
+using ::testing::Eq;
+using ::testing::IsNull;
+
+struct Item {
+  ListLink<Item> link;
+  // Links a second, independent list, like ShinjukuTask's runqueue link and
+  // its application's link.
+  ListLink<Item> other_link;
+};
+
+using List = IntrusiveList<Item, &Item::link>;
+using OtherList = IntrusiveList<Item, &Item::other_link>;
+
+template <typename L>
+std::vector<Item*> Elements(const L& list) {
+  std::vector<Item*> items;
+  for (Item* i = list.Front(); i; i = L::Next(i)) items.push_back(i);
+  return items;
+}
+
+TEST(IntrusiveListTest, Empty) {
+  List list;
+  EXPECT_TRUE(list.empty());
+  EXPECT_THAT(list.Front(), IsNull());
+  EXPECT_THAT(list.PopFront(), IsNull());
+}
+
+TEST(IntrusiveListTest, PushErase) {
+  List list;
+  Item a, b, c;
+
+  list.PushBack(&b);
+  list.PushFront(&a);
+  list.PushBack(&c);
+  EXPECT_THAT(list.size(), Eq(3));
+  EXPECT_TRUE(List::Linked(&b));
+  EXPECT_THAT(Elements(list), ElementsAre(&a, &b, &c));
+
+  list.Erase(&b);
+  EXPECT_FALSE(List::Linked(&b));
+  EXPECT_THAT(Elements(list), ElementsAre(&a, &c));
+
+  list.Erase(&c);
+  EXPECT_THAT(Elements(list), ElementsAre(&a));
+
+  EXPECT_THAT(list.PopFront(), Eq(&a));
+  EXPECT_TRUE(list.empty());
+  EXPECT_FALSE(List::Linked(&a));
+}
+
+// Runs a round robin the way ShinjukuRunqueue does: the front element takes
+// its turn and goes to the back, and elements leave from anywhere in the list
+// and rejoin at the back. The order must match a rotated vector after every
+// step, and a second list of the same elements must not be disturbed.
+TEST(IntrusiveListTest, RoundRobin) {
+  constexpr int kItems = 64;
+  constexpr int kSteps = 20000;
+
+  std::deque<Item> items(kItems);
+  List list;
+  OtherList others;
+  std::vector<Item*> ref;
+  for (Item& item : items) {
+    list.PushBack(&item);
+    ref.push_back(&item);
+    others.PushFront(&item);
+  }
+  const std::vector<Item*> reversed(ref.rbegin(), ref.rend());
+
+  absl::BitGen gen;
+  for (int i = 0; i < kSteps; i++) {
+    Item* item = &items[absl::Uniform(gen, 0, kItems)];
+    switch (absl::Uniform(gen, 0, 3)) {
+      case 0:
+        if (Item* front = list.PopFront()) {
+          ASSERT_THAT(front, Eq(ref.front()));
+          list.PushBack(front);
+          std::rotate(ref.begin(), ref.begin() + 1, ref.end());
+        }
+        break;
+      case 1:
+        if (List::Linked(item)) {
+          list.Erase(item);
+          ref.erase(std::find(ref.begin(), ref.end(), item));
+        }
+        break;
+      case 2:
+        if (!List::Linked(item)) {
+          list.PushBack(item);
+          ref.push_back(item);
+        }
+        break;
+    }
+    ASSERT_THAT(list.size(), Eq(ref.size()));
+    ASSERT_THAT(Elements(list), ElementsAreArray(ref));
+  }
+  EXPECT_THAT(Elements(others), ElementsAreArray(reversed));
+}
+
+}  // namespace
+}  // namespace ghost
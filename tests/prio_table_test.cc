@@ -14,6 +14,11 @@
 
 #include "shared/prio_table.h"
 
+#include <numeric>
+#include <thread>
+#include <vector>
+
+#include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
 namespace {
@@ -64,30 +69,102 @@ TEST(PrioTableTest, CapacityOverflow) {
   ASSERT_EQ(table.NextUpdatedIndex(), ghost::PrioTable::kStreamNoEntries);
 }
 
-TEST(PrioTableTest, ContentionOverflow) {
+// The stream used to be a hash table in which indices that are equal modulo
+// the capacity collided. The ring has no collisions.
+TEST(PrioTableTest, NoCollisions) {
   ghost::PrioTable table(10, 4,
                          ghost::PrioTable::StreamCapacity::kStreamCapacity19);
 
   ASSERT_EQ(table.NextUpdatedIndex(), ghost::PrioTable::kStreamNoEntries);
   table.MarkUpdatedIndex(/* idx = */ 0, /* num_retries = */ 0);
-  // 'table.hdr()->st_cap' (i.e., the stream capacity) should be mapped to the
-  // same index in the stream as '0', so since 'numRetries' is set to '0' there
-  // will be overflow
   table.MarkUpdatedIndex(/* idx = */ table.hdr()->st_cap,
                          /* num_retries = */ 0);
+  ASSERT_EQ(table.NextUpdatedIndex(), 0);
+  ASSERT_EQ(table.NextUpdatedIndex(), table.hdr()->st_cap);
+  ASSERT_EQ(table.NextUpdatedIndex(), ghost::PrioTable::kStreamNoEntries);
+}
+
+// Fill the stream to capacity and drain it in order, several times around the
+// ring.
+TEST(PrioTableTest, FifoWraparound) {
+  ghost::PrioTable table(10, 4,
+                         ghost::PrioTable::StreamCapacity::kStreamCapacity19);
+  const int cap = table.hdr()->st_cap;
+
+  for (int lap = 0; lap < 3; lap++) {
+    // Start at a different offset in the ring every lap.
+    table.MarkUpdatedIndex(/* idx = */ lap, /* num_retries = */ 0);
+    ASSERT_EQ(table.NextUpdatedIndex(), lap);
+
+    for (int i = 0; i < cap; i++) {
+      table.MarkUpdatedIndex(/* idx = */ i, /* num_retries = */ 0);
+    }
+    for (int i = 0; i < cap; i++) {
+      ASSERT_EQ(table.NextUpdatedIndex(), i);
+    }
+    ASSERT_EQ(table.NextUpdatedIndex(), ghost::PrioTable::kStreamNoEntries);
+  }
+}
+
+// Marking an index that is already queued does not take another entry.
+TEST(PrioTableTest, QueuedIndexIsNotRequeued) {
+  ghost::PrioTable table(10, 4,
+                         ghost::PrioTable::StreamCapacity::kStreamCapacity19);
+
+  table.MarkUpdatedIndex(/* idx = */ 3, /* num_retries = */ 0);
+  table.MarkUpdatedIndex(/* idx = */ 7, /* num_retries = */ 0);
+  table.MarkUpdatedIndex(/* idx = */ 3, /* num_retries = */ 0);
+  ASSERT_EQ(table.NextUpdatedIndex(), 3);
+  ASSERT_EQ(table.NextUpdatedIndex(), 7);
+  ASSERT_EQ(table.NextUpdatedIndex(), ghost::PrioTable::kStreamNoEntries);
+
+  // Once consumed, the index is queued again by its next update.
+  table.MarkUpdatedIndex(/* idx = */ 3, /* num_retries = */ 0);
+  ASSERT_EQ(table.NextUpdatedIndex(), 3);
+  ASSERT_EQ(table.NextUpdatedIndex(), ghost::PrioTable::kStreamNoEntries);
+
+  // Marking every index many times cannot overflow the ring.
+  for (int j = 0; j < 5; j++) {
+    for (int i = 0; i < table.hdr()->si_num; i++) {
+      table.MarkUpdatedIndex(/* idx = */ i, /* num_retries = */ 0);
+    }
+  }
+  for (int i = 0; i < table.hdr()->si_num; i++) {
+    ASSERT_EQ(table.NextUpdatedIndex(), i);
+  }
+  ASSERT_EQ(table.NextUpdatedIndex(), ghost::PrioTable::kStreamNoEntries);
+}
+
+// A producer that claims an entry and never publishes it, e.g. because it
+// died, must not wedge the ring.
+TEST(PrioTableTest, StalledProducerTimesOut) {
+  ghost::PrioTable table(10, 4,
+                         ghost::PrioTable::StreamCapacity::kStreamCapacity19);
+  auto* s = reinterpret_cast<struct ghost::PrioTable::stream*>(
+      reinterpret_cast<char*>(table.hdr()) + table.hdr()->st_off);
+
+  // Claim the entry at `tail` the way a producer does, without publishing.
+  s->tail.fetch_add(1, std::memory_order_relaxed);
+  table.MarkUpdatedIndex(/* idx = */ 4, /* num_retries = */ 0);
+
+  // The agent waits for the stalled producer for a while...
+  ASSERT_EQ(table.NextUpdatedIndex(), ghost::PrioTable::kStreamNoEntries);
+  absl::SleepFor(ghost::PrioTable::kStalledProducerTimeout);
+  // ...then skips its entry and rescans everything, which covers index 4.
   ASSERT_EQ(table.NextUpdatedIndex(), ghost::PrioTable::kStreamOverflow);
   ASSERT_EQ(table.NextUpdatedIndex(), ghost::PrioTable::kStreamNoEntries);
 
-  // Make sure the stream stops reporting an overflow
-  table.MarkUpdatedIndex(/* idx = */ 0, /* num_retries = */ 0);
-  ASSERT_EQ(table.NextUpdatedIndex(), 0);
+  // The ring works normally afterwards, including for index 4.
+  table.MarkUpdatedIndex(/* idx = */ 4, /* num_retries = */ 0);
+  table.MarkUpdatedIndex(/* idx = */ 5, /* num_retries = */ 0);
+  ASSERT_EQ(table.NextUpdatedIndex(), 4);
+  ASSERT_EQ(table.NextUpdatedIndex(), 5);
   ASSERT_EQ(table.NextUpdatedIndex(), ghost::PrioTable::kStreamNoEntries);
 }
 
 TEST(PrioTableTest, StressThreads) {
   static const int kNumIterations = 1000;
   static const int kNumThreads = 10;
-  static const int kIdx = 0;
   static const int kNumRetries = kNumThreads - 1;
   ghost::PrioTable table(10, 4,
                          ghost::PrioTable::StreamCapacity::kStreamCapacity19);
@@ -98,12 +175,14 @@ TEST(PrioTableTest, StressThreads) {
   // ensure the number of threads is less than or equal to
   // 'table.hdr()->st_cap', which is the stream capacity
   ASSERT_LE(kNumThreads, table.hdr()->st_cap);
+  // Each thread marks its own index, since a queued index is not requeued.
+  ASSERT_LE(kNumThreads, table.hdr()->si_num);
 
   for (int i = 0; i < kNumThreads; i++) {
     threads.emplace_back(std::thread([&table, i, &test]() {
       for (int j = 0; j < kNumIterations; j++) {
         test[i].store(true, std::memory_order_relaxed);
-        table.MarkUpdatedIndex(kIdx, kNumRetries);
+        table.MarkUpdatedIndex(/* idx = */ i, kNumRetries);
         while (test[i].load(std::memory_order_relaxed)) {
         }
       }
@@ -111,13 +190,17 @@ TEST(PrioTableTest, StressThreads) {
   }
 
   for (int j = 0; j < kNumIterations; j++) {
+    std::vector<int> seen;
     for (int i = 0; i < kNumThreads; i++) {
       int next;
       while ((next = table.NextUpdatedIndex()) ==
              ghost::PrioTable::kStreamNoEntries) {
       }
-      ASSERT_EQ(next, kIdx);
+      seen.push_back(next);
     }
+    std::vector<int> expected(kNumThreads);
+    std::iota(expected.begin(), expected.end(), 0);
+    ASSERT_THAT(seen, testing::UnorderedElementsAreArray(expected));
     for (int i = 0; i < kNumThreads; i++) {
       ASSERT_TRUE(test[i].load(std::memory_order_relaxed));
       test[i].store(false, std::memory_order_relaxed);
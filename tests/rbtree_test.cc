@@ -0,0 +1,149 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "lib/rbtree.h"
+
+#include <deque>
+#include <set>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/random/random.h"
+
+namespace ghost {
+namespace {
+
+using ::testing::ElementsAreArray;
+using ::testing::Eq;
+using ::testing::Ge;
+using ::testing::IsNull;
+
+struct Node : public RbTreeNode {
+  explicit Node(int key) : key(key) {}
+
+  // Ties are broken by address so that the order matches `std::set` below.
+  static bool Less(const Node* a, const Node* b) {
+    if (a->key == b->key) return a < b;
+    return a->key < b->key;
+  }
+
+  int key;
+};
+
+using Tree = RbTree<Node, &Node::Less>;
+using RefSet = std::set<Node*, decltype(&Node::Less)>;
+
+std::vector<Node*> InOrder(const Tree& tree) {
+  std::vector<Node*> nodes;
+  for (Node* n = tree.First(); n; n = tree.Next(n)) nodes.push_back(n);
+  return nodes;
+}
+
+TEST(RbTreeTest, Empty) {
+  Tree tree;
+  EXPECT_TRUE(tree.empty());
+  EXPECT_THAT(tree.size(), Eq(0));
+  EXPECT_THAT(tree.First(), IsNull());
+}
+
+TEST(RbTreeTest, InsertErase) {
+  Tree tree;
+  Node a(2), b(1), c(3);
+
+  tree.Insert(&a);
+  tree.Insert(&b);
+  tree.Insert(&c);
+  tree.CheckInvariants();
+  EXPECT_TRUE(a.rb_linked());
+  EXPECT_THAT(tree.size(), Eq(3));
+  EXPECT_THAT(InOrder(tree), ElementsAreArray({&b, &a, &c}));
+
+  tree.Erase(&b);
+  tree.CheckInvariants();
+  EXPECT_FALSE(b.rb_linked());
+  EXPECT_THAT(tree.First(), Eq(&a));
+
+  tree.Erase(&c);
+  tree.Erase(&a);
+  tree.CheckInvariants();
+  EXPECT_TRUE(tree.empty());
+  EXPECT_THAT(tree.First(), IsNull());
+}
+
+// Runs a random mix of inserts, erases and pops of the leftmost node, the same
+// operations CfsRq does, and checks that the tree agrees with `std::set` and
+// stays balanced after every operation. The mix alternates between growing the
+// tree to most of the nodes and draining it, so that deep trees are covered
+// and not just the few dozen nodes an even mix hovers around.
+TEST(RbTreeTest, MatchesStdSet) {
+  constexpr int kNodes = 1000;
+  constexpr int kOps = 100000;
+
+  // RbTreeNode is not movable, so the nodes must never be relocated.
+  std::deque<Node> nodes;
+  absl::BitGen gen;
+  for (int i = 0; i < kNodes; i++) {
+    // A small key range forces plenty of ties.
+    nodes.emplace_back(absl::Uniform(gen, 0, kNodes / 4));
+  }
+
+  Tree tree;
+  RefSet ref(&Node::Less);
+  bool growing = true;
+  int phases = 0;
+  for (int i = 0; i < kOps; i++) {
+    if (growing && tree.size() >= kNodes * 3 / 4) {
+      growing = false;
+      phases++;
+    } else if (!growing && tree.empty()) {
+      growing = true;
+      phases++;
+    }
+    Node* n = &nodes[absl::Uniform(gen, 0, kNodes)];
+    // Mostly inserts while growing, mostly erases and pops while draining.
+    const double insert_odds = growing ? 0.9 : 0.1;
+    switch (absl::Bernoulli(gen, insert_odds) ? 0 : absl::Uniform(gen, 1, 3)) {
+      case 0:
+        if (!n->rb_linked()) {
+          tree.Insert(n);
+          ref.insert(n);
+        }
+        break;
+      case 1:
+        if (n->rb_linked()) {
+          tree.Erase(n);
+          ref.erase(n);
+        }
+        break;
+      case 2:
+        if (!tree.empty()) {
+          Node* first = tree.First();
+          ASSERT_THAT(first, Eq(*ref.begin()));
+          tree.Erase(first);
+          ref.erase(ref.begin());
+        }
+        break;
+    }
+    tree.CheckInvariants();
+    ASSERT_THAT(tree.size(), Eq(ref.size()));
+    ASSERT_THAT(tree.First(), Eq(ref.empty() ? nullptr : *ref.begin()));
+  }
+  EXPECT_THAT(InOrder(tree), ElementsAreArray(ref.begin(), ref.end()));
+  // At least one full grow and drain.
+  EXPECT_THAT(phases, Ge(2));
+}
+
+}  // namespace
+}  // namespace ghost
@@ -0,0 +1,155 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests the deficit round robin between the applications of a Shinjuku
+// runqueue. The application queues stay empty, so no ghost kernel is needed.
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "schedulers/shinjuku/shinjuku_scheduler.h"
+
+namespace ghost {
+namespace {
+
+using ::testing::ElementsAre;
+
+constexpr int64_t kQuantumNs = 50'000;
+
+std::vector<ShinjukuAppQueue*> Order(const ShinjukuRunqueue& rq) {
+  std::vector<ShinjukuAppQueue*> order;
+  for (ShinjukuAppQueue* app = rq.apps.Front(); app; app = rq.apps.Next(app)) {
+    order.push_back(app);
+  }
+  return order;
+}
+
+// Picks the next application one round robin step at a time.
+ShinjukuAppQueue* StepRounds(ShinjukuRunqueue& rq) {
+  ShinjukuAppQueue* app;
+  while ((app = rq.apps.Front())->deficit_ns <= 0) {
+    app->deficit_ns += app->weight * kQuantumNs;
+    rq.apps.Erase(app);
+    rq.apps.PushBack(app);
+  }
+  return app;
+}
+
+TEST(ShinjukuRunqueueTest, Empty) {
+  ShinjukuRunqueue rq;
+  EXPECT_EQ(rq.NextApp(kQuantumNs), nullptr);
+}
+
+TEST(ShinjukuRunqueueTest, FrontWithDeficitGoesFirst) {
+  ShinjukuAppQueue a, b;
+  a.deficit_ns = 1;
+  b.deficit_ns = kQuantumNs;
+  ShinjukuRunqueue rq;
+  rq.apps.PushBack(&a);
+  rq.apps.PushBack(&b);
+
+  EXPECT_EQ(rq.NextApp(kQuantumNs), &a);
+  rq.StartRounds(&a, kQuantumNs);
+  EXPECT_THAT(Order(rq), ElementsAre(&a, &b));
+  EXPECT_EQ(a.deficit_ns, 1);
+  EXPECT_EQ(b.deficit_ns, kQuantumNs);
+}
+
+TEST(ShinjukuRunqueueTest, NextAppChangesNothing) {
+  ShinjukuAppQueue a, b;
+  a.deficit_ns = -3 * kQuantumNs;
+  b.deficit_ns = -kQuantumNs;
+  ShinjukuRunqueue rq;
+  rq.apps.PushBack(&a);
+  rq.apps.PushBack(&b);
+
+  EXPECT_EQ(rq.NextApp(kQuantumNs), &b);
+  EXPECT_THAT(Order(rq), ElementsAre(&a, &b));
+  EXPECT_EQ(a.deficit_ns, -3 * kQuantumNs);
+  EXPECT_EQ(b.deficit_ns, -kQuantumNs);
+
+  // b needs two rounds, and a is visited once more in the second one.
+  rq.StartRounds(&b, kQuantumNs);
+  EXPECT_THAT(Order(rq), ElementsAre(&b, &a));
+  EXPECT_EQ(a.deficit_ns, 0);
+  EXPECT_EQ(b.deficit_ns, kQuantumNs);
+}
+
+TEST(ShinjukuRunqueueTest, LongRunIsOneStep) {
+  // An infinite slice can leave an application hours in debt, which would
+  // take billions of rounds one at a time.
+  ShinjukuAppQueue a;
+  a.deficit_ns = -int64_t{3600} * 1'000'000'000 - 1;
+  ShinjukuRunqueue rq;
+  rq.apps.PushBack(&a);
+
+  EXPECT_EQ(rq.NextApp(kQuantumNs), &a);
+  rq.StartRounds(&a, kQuantumNs);
+  EXPECT_GT(a.deficit_ns, 0);
+  EXPECT_LE(a.deficit_ns, kQuantumNs);
+}
+
+TEST(ShinjukuRunqueueTest, MatchesRoundByRound) {
+  std::mt19937 rng(1);
+  for (int iter = 0; iter < 1000; iter++) {
+    const int n = 1 + rng() % 5;
+    std::vector<ShinjukuAppQueue> fast(n), slow(n);
+    ShinjukuRunqueue fast_rq, slow_rq;
+    for (int i = 0; i < n; i++) {
+      fast[i].weight = slow[i].weight = 1 + rng() % 4;
+      fast[i].deficit_ns = slow[i].deficit_ns =
+          static_cast<int64_t>(rng() % (20 * kQuantumNs)) - 18 * kQuantumNs;
+      fast_rq.apps.PushBack(&fast[i]);
+      slow_rq.apps.PushBack(&slow[i]);
+    }
+
+    ShinjukuAppQueue* next = fast_rq.NextApp(kQuantumNs);
+    fast_rq.StartRounds(next, kQuantumNs);
+    ShinjukuAppQueue* expected = StepRounds(slow_rq);
+
+    ASSERT_EQ(next - fast.data(), expected - slow.data());
+    std::vector<ShinjukuAppQueue*> fast_order = Order(fast_rq);
+    std::vector<ShinjukuAppQueue*> slow_order = Order(slow_rq);
+    for (int i = 0; i < n; i++) {
+      ASSERT_EQ(fast_order[i] - fast.data(), slow_order[i] - slow.data());
+      ASSERT_EQ(fast[i].deficit_ns, slow[i].deficit_ns);
+    }
+  }
+}
+
+TEST(ShinjukuRunqueueTest, SharesFollowWeights) {
+  ShinjukuAppQueue light, heavy;
+  heavy.weight = 3;
+  ShinjukuRunqueue rq;
+  rq.apps.PushBack(&light);
+  rq.apps.PushBack(&heavy);
+
+  // Every dispatch runs for a fifth of a quantum, so a round is 5 runs of the
+  // light application and 15 of the heavy one.
+  int light_runs = 0, heavy_runs = 0;
+  for (int i = 0; i < 100 * 20; i++) {
+    ShinjukuAppQueue* next = rq.NextApp(kQuantumNs);
+    rq.StartRounds(next, kQuantumNs);
+    next->deficit_ns -= kQuantumNs / 5;
+    (next == &light ? light_runs : heavy_runs)++;
+  }
+  EXPECT_EQ(light_runs, 100 * 5);
+  EXPECT_EQ(heavy_runs, 100 * 15);
+}
+
+}  // namespace
+}  // namespace ghost
@@ -15,8 +15,9 @@
  *
  * The world's dumbest scheduler just needs to handle the messages in bpf-msg
  * for new, wakeup, preempt, and yield, and then enqueue those in a global
- * queue.  Pop tasks from the queue in bpf-pnt.  You only need a single map for
- * the global queue.  You can do all of this in probably 100 lines of code.
+ * queue.  (Biff shards that queue per LLC, see "Run queues" below.)  Pop tasks
+ * from the queue in bpf-pnt.  You only need a single map for the global queue.
+ * You can do all of this in probably 100 lines of code.
  * I've commented the policy bits with "POLICY" for easy grepping.
  *
  * But any real scheduler will want more, so Biff has a few extras:
@@ -44,10 +45,10 @@
  *   below by rescheding your cpu).
  *
  * - What happens if any of the bpf operations fail?  You're out of luck.  If
- *   the global_rq overflows (65k tasks) or bpf_ghost_run_gtid() fails with an
- *   esoteric error code, we might lose track of a task.  As far as the kernel
- *   is concerned, the task is sitting on the runqueue, but bpf will never run
- *   it.  There are a few ways out:
+ *   the run queues of a priority overflow (65k tasks) or bpf_ghost_run_gtid()
+ *   fails with an esoteric error code, we might lose track of a task.  As far
+ *   as the kernel is concerned, the task is sitting on the runqueue, but bpf
+ *   will never run it.  There are a few ways out:
  *   - if we detect an error, add infrastructure to pass the task to userspace,
  *   which can try to handle it in a more forgiving environment than bpf.
  *   - userspace can periodically poll the status word table for runnable tasks
@@ -85,18 +86,22 @@
  */
 
 
+#ifdef GHOST_BPF_SHIM
+/* Compiled as userspace C for tests, see bpf/shim/bpf_shim.h. */
+#include "bpf/shim/bpf_shim.h"
+#else
 // vmlinux.h must be included before bpf_helpers.h
 // clang-format off
 #include "kernel/vmlinux_ghost_5_11.h"
 #include "libbpf/bpf_helpers.h"
 #include "libbpf/bpf_tracing.h"
 // clang-format on
+#include <asm-generic/errno.h>
+#endif
 
 #include "third_party/bpf/biff_bpf.h"
 #include "third_party/bpf/common.bpf.h"
 
-#include <asm-generic/errno.h>
-
 /*
  * Part of the ghost UAPI.  vmlinux.h doesn't include #defines, so we need to
  * add it manually.
@@ -105,6 +110,22 @@
 
 bool initialized;
 
+/*
+ * Set by userspace before `initialized`: the LLC (run queue shard) of each
+ * cpu, numbered densely from 0 to nr_llcs - 1.
+ */
+u32 cpu_to_llc[BIFF_MAX_CPUS];
+u32 nr_llcs;
+
+/*
+ * Set by userspace: how long a task may run while others of its priority wait,
+ * unless the task has a slice of its own.  0 means forever.
+ */
+u64 slice_us;
+
+/* Number of tasks in each LLC's queues. */
+struct biff_bpf_llc_queued nr_queued[BIFF_MAX_LLCS];
+
 /* max_entries is patched at runtime to num_possible_cpus */
 struct {
 	__uint(type, BPF_MAP_TYPE_ARRAY);
@@ -129,14 +150,7 @@ struct {
  * Also, we can't use BPF_MAP_TYPE_TASK_STORAGE since we don't have the
  * task_struct pointer.  Ghost BPF doesn't really have access to kernel
  * internals - it's more an extension of userspace.
- *
- * aligned(8) since this is a bpf map value.
  */
-struct task_sw_info {
-	uint32_t id;
-	uint32_t index;
-} __attribute__((aligned(8)));
-
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
 	__uint(max_entries, BIFF_MAX_GTIDS);
@@ -156,6 +170,16 @@ static struct biff_bpf_sw_data *gtid_to_swd(u64 gtid)
 	return bpf_map_lookup_elem(&sw_data, &swi->index);
 }
 
+/* Userspace may write anything into sw_data, so clamp it. */
+static u32 task_prio(struct biff_bpf_sw_data *swd)
+{
+	u32 prio = READ_ONCE(swd->prio);
+
+	if (prio >= BIFF_NR_PRIOS)
+		return BIFF_NR_PRIOS - 1;
+	return prio;
+}
+
 static void task_started(u64 gtid, int cpu, u64 cpu_seqnum)
 {
 	struct biff_bpf_cpu_data *pcpu;
@@ -200,21 +224,130 @@ static int resched_cpu(int cpu)
 	return bpf_ghost_resched_cpu(cpu, pcpu->cpu_seqnum);
 }
 
-/* Biff POLICY: dumb global fifo.  No locality, etc. */
+/*
+ * Run queues.
+ *
+ * Biff POLICY: strict priority between BIFF_NR_PRIOS levels, and within a level
+ * a fifo per LLC.  Tasks are queued in the LLC where they last ran, and cpus
+ * take work from their own LLC before stealing from the others, so tasks tend
+ * to stay cache-warm and cpus in different LLCs don't all fight over one queue.
+ *
+ * We'd like an array of queues.  An array-of-maps would need userspace to
+ * create the inner queues and insert them before we run, so instead we declare
+ * BIFF_NR_PRIOS * BIFF_MAX_LLCS queues statically and switch on the index,
+ * prio * BIFF_MAX_LLCS + llc.  A program may use at most 64 maps, which limits
+ * how many levels we can have.
+ *
+ * Queue maps can't be created with BPF_F_NO_PREALLOC, so each queue only has
+ * BIFF_RQ_ENTRIES entries (see biff_bpf.h for the memory this costs) and a
+ * full queue spills into the next LLC's.
+ */
 
 struct rq_item {
 	u64 gtid;
 	u32 task_barrier;
+	u32 prio;
 };
 
-struct {
-	__uint(type, BPF_MAP_TYPE_QUEUE);
-	__uint(max_entries, BIFF_MAX_GTIDS);
-	__type(value, struct rq_item);
-} global_rq SEC(".maps");
+#define DECLARE_RQ(p, n)					\
+struct {							\
+	__uint(type, BPF_MAP_TYPE_QUEUE);			\
+	__uint(max_entries, BIFF_RQ_ENTRIES);			\
+	__type(value, struct rq_item);				\
+} rq_##p##_##n SEC(".maps")
+
+#define DECLARE_PRIO_RQS(p)					\
+	DECLARE_RQ(p, 0); DECLARE_RQ(p, 1); DECLARE_RQ(p, 2);	\
+	DECLARE_RQ(p, 3); DECLARE_RQ(p, 4); DECLARE_RQ(p, 5);	\
+	DECLARE_RQ(p, 6); DECLARE_RQ(p, 7); DECLARE_RQ(p, 8);	\
+	DECLARE_RQ(p, 9); DECLARE_RQ(p, 10); DECLARE_RQ(p, 11);	\
+	DECLARE_RQ(p, 12); DECLARE_RQ(p, 13); DECLARE_RQ(p, 14);	\
+	DECLARE_RQ(p, 15)
+
+DECLARE_PRIO_RQS(0);
+DECLARE_PRIO_RQS(1);
+DECLARE_PRIO_RQS(2);
+
+#if BIFF_MAX_LLCS != 16 || BIFF_NR_PRIOS != 3
+#error "Update the run queue declarations"
+#endif
+
+#define RQ_CASE(p, n, op, ...)					\
+	case (p) * BIFF_MAX_LLCS + (n):				\
+		return op(&rq_##p##_##n, __VA_ARGS__)
+
+#define PRIO_RQ_CASES(p, op, ...)				\
+	RQ_CASE(p, 0, op, __VA_ARGS__);				\
+	RQ_CASE(p, 1, op, __VA_ARGS__);				\
+	RQ_CASE(p, 2, op, __VA_ARGS__);				\
+	RQ_CASE(p, 3, op, __VA_ARGS__);				\
+	RQ_CASE(p, 4, op, __VA_ARGS__);				\
+	RQ_CASE(p, 5, op, __VA_ARGS__);				\
+	RQ_CASE(p, 6, op, __VA_ARGS__);				\
+	RQ_CASE(p, 7, op, __VA_ARGS__);				\
+	RQ_CASE(p, 8, op, __VA_ARGS__);				\
+	RQ_CASE(p, 9, op, __VA_ARGS__);				\
+	RQ_CASE(p, 10, op, __VA_ARGS__);			\
+	RQ_CASE(p, 11, op, __VA_ARGS__);			\
+	RQ_CASE(p, 12, op, __VA_ARGS__);			\
+	RQ_CASE(p, 13, op, __VA_ARGS__);			\
+	RQ_CASE(p, 14, op, __VA_ARGS__);			\
+	RQ_CASE(p, 15, op, __VA_ARGS__)
+
+#define RQ_SWITCH(prio, llc, op, ...)				\
+	switch ((prio) * BIFF_MAX_LLCS + (llc)) {		\
+	PRIO_RQ_CASES(0, op, __VA_ARGS__);			\
+	PRIO_RQ_CASES(1, op, __VA_ARGS__);			\
+	PRIO_RQ_CASES(2, op, __VA_ARGS__);			\
+	}
+
+static long rq_push(u32 prio, u32 llc, struct rq_item *item)
+{
+	RQ_SWITCH(prio, llc, bpf_map_push_elem, item, 0);
+	return -EINVAL;
+}
+
+static long rq_pop(u32 prio, u32 llc, struct rq_item *item)
+{
+	RQ_SWITCH(prio, llc, bpf_map_pop_elem, item);
+	return -EINVAL;
+}
+
+/* Unknown cpus (e.g. a wakeup with no cpu) share LLC 0. */
+static u32 cpu_llc(int cpu)
+{
+	if (cpu < 0 || cpu >= BIFF_MAX_CPUS)
+		return 0;
+	return cpu_to_llc[cpu];
+}
+
+/*
+ * POLICY: userspace may place a task in an LLC (see biff_bpf_sw_data), e.g. to
+ * balance load across LLCs.  Otherwise the task goes back to where its cache
+ * footprint is: the LLC of `cpu`.
+ */
+static u32 task_llc(struct biff_bpf_sw_data *swd, int cpu)
+{
+	u32 llc = READ_ONCE(swd->home_llc);
+
+	if (llc < nr_llcs && llc < BIFF_MAX_LLCS)
+		return llc;
+	return cpu_llc(cpu);
+}
+
+/* Whether any task of priority `prio` or better is waiting in `llc`. */
+static bool tasks_waiting(u32 llc, u32 prio)
+{
+	llc %= BIFF_MAX_LLCS;
+	for (u32 i = 0; i < BIFF_NR_PRIOS && i <= prio; i++) {
+		if (READ_ONCE(nr_queued[llc].nr[i]))
+			return true;
+	}
+	return false;
+}
 
 /* POLICY */
-static void enqueue_task(u64 gtid, u32 task_barrier)
+static void enqueue_task(u64 gtid, u32 task_barrier, u32 llc, u32 prio)
 {
 	/*
 	 * Need to explicitly zero the entire struct, otherwise you get
@@ -224,11 +357,26 @@ static void enqueue_task(u64 gtid, u32 task_barrier)
 	 * passing uninitialized stack data to some function.
 	 */
 	struct rq_item p[1] = {0};
-	int err;
+	u32 target = 0;
+	int err = -E2BIG;
 
+	if (prio >= BIFF_NR_PRIOS)
+		prio = BIFF_NR_PRIOS - 1;
 	p->gtid = gtid;
 	p->task_barrier = task_barrier;
-        err = bpf_map_push_elem(&global_rq, p, 0);
+	p->prio = prio;
+	/* A full queue spills into the next LLC's, which cpus steal from. */
+	for (u32 i = 0; i < BIFF_MAX_LLCS && err == -E2BIG; i++) {
+		target = (llc + i) % BIFF_MAX_LLCS;
+		/*
+		 * Count the task before a cpu can pop it, so that the pop's
+		 * decrement can't take the count below zero.
+		 */
+		__sync_fetch_and_add(&nr_queued[target].nr[prio], 1);
+		err = rq_push(prio, target, p);
+		if (err)
+			__sync_fetch_and_add(&nr_queued[target].nr[prio], -1);
+	}
 	if (err) {
 		/*
 		 * If we fail, we'll lose the task permanently.  This is where
@@ -240,6 +388,34 @@ static void enqueue_task(u64 gtid, u32 task_barrier)
 	}
 }
 
+/*
+ * POLICY: take the best priority with any work.  Within a priority, pop from
+ * our own LLC, then steal from the others, starting with the next LLC so that
+ * idle LLCs don't all pile on LLC 0.  The counts let us skip empty queues
+ * without touching them.
+ */
+static long pick_next_task(int cpu, struct rq_item *next)
+{
+	u32 llc = cpu_llc(cpu);
+	long err = -ENOENT;
+
+	for (u32 prio = 0; prio < BIFF_NR_PRIOS; prio++) {
+		for (u32 i = 0; i < BIFF_MAX_LLCS; i++) {
+			u32 victim = (llc + i) % BIFF_MAX_LLCS;
+
+			if (!READ_ONCE(nr_queued[victim].nr[prio]))
+				continue;
+			err = rq_pop(prio, victim, next);
+			if (!err) {
+				__sync_fetch_and_add(&nr_queued[victim].nr[prio],
+						     -1);
+				return 0;
+			}
+		}
+	}
+	return err;
+}
+
 /* Avoid the dreaded "dereference of modified ctx ptr R6 off=3 disallowed" */
 static void __attribute__((noinline)) set_dont_idle(struct bpf_ghost_sched *ctx)
 {
@@ -249,6 +425,7 @@ static void __attribute__((noinline)) set_dont_idle(struct bpf_ghost_sched *ctx)
 SEC("ghost_sched/pnt")
 int biff_pnt(struct bpf_ghost_sched *ctx)
 {
+	int cpu = bpf_get_smp_processor_id();
 	struct rq_item next[1];
 	int err;
 
@@ -279,7 +456,7 @@ int biff_pnt(struct bpf_ghost_sched *ctx)
 	}
 
 	/* POLICY */
-	err = bpf_map_pop_elem(&global_rq, next);
+	err = pick_next_task(cpu, next);
 	if (err) {
 		switch (-err) {
 		case ENOENT:
@@ -323,9 +500,11 @@ int biff_pnt(struct bpf_ghost_sched *ctx)
 			 * hasn't actually gotten off cpu yet.  if we reenqueue,
 			 * select the idle task, and then either set dont_idle
 			 * or resched ourselves, we'll rerun bpf-pnt after the
-			 * task got off cpu.
+			 * task got off cpu.  it was on this cpu, so keep it in
+			 * our LLC.
 			 */
-			enqueue_task(next->gtid, next->task_barrier);
+			enqueue_task(next->gtid, next->task_barrier,
+				     cpu_llc(cpu), next->prio);
 			break;
 		case ERANGE:
 		case EXDEV:
@@ -350,7 +529,8 @@ int biff_pnt(struct bpf_ghost_sched *ctx)
 			 *   be reachable from bpf-pnt.
 			 */
 			bpf_printk("failed to run %p, err %d\n", next->gtid, err);
-			enqueue_task(next->gtid, next->task_barrier);
+			enqueue_task(next->gtid, next->task_barrier,
+				     cpu_llc(cpu), next->prio);
 			break;
 		}
 	}
@@ -407,9 +587,17 @@ static void __attribute__((noinline)) handle_new(struct bpf_ghost_msg *msg)
 	if (!swd)
 		return;
 	swd->ran_until = now;
+	/* The sw slot may be recycled: forget the last task's policy. */
+	swd->prio = BIFF_PRIO_DEFAULT;
+	swd->home_llc = BIFF_LLC_NONE;
+	swd->slice_us = 0;
+	swd->runtime = 0;
 	if (new->runnable) {
 		swd->runnable_at = now;
-		enqueue_task(gtid, msg->seqnum);
+		/* We run on the cpu where the task was created. */
+		enqueue_task(gtid, msg->seqnum,
+			     cpu_llc(bpf_get_smp_processor_id()),
+			     BIFF_PRIO_DEFAULT);
 	}
 }
 
@@ -427,6 +615,14 @@ static void __attribute__((noinline)) handle_latched(struct bpf_ghost_msg *msg)
 	task_started(gtid, latched->cpu, latched->cpu_seqnum);
 }
 
+/* The task got off cpu at `now`, after running since ran_at. */
+static void task_ran(struct biff_bpf_sw_data *swd, u64 now)
+{
+	swd->ran_until = now;
+	if (now > swd->ran_at)
+		swd->runtime += now - swd->ran_at;
+}
+
 static void __attribute__((noinline)) handle_blocked(struct bpf_ghost_msg *msg)
 {
 	struct ghost_msg_payload_task_blocked *blocked = &msg->blocked;
@@ -436,7 +632,7 @@ static void __attribute__((noinline)) handle_blocked(struct bpf_ghost_msg *msg)
 	swd = gtid_to_swd(gtid);
 	if (!swd)
 		return;
-	swd->ran_until = bpf_ktime_get_us();
+	task_ran(swd, bpf_ktime_get_us());
 
 	task_stopped(blocked->cpu);
 }
@@ -447,13 +643,17 @@ static void __attribute__((noinline)) handle_wakeup(struct bpf_ghost_msg *msg)
 	struct biff_bpf_sw_data *swd;
 	u64 gtid = wakeup->gtid;
 	u64 now = bpf_ktime_get_us();
+	int cpu;
 
 	swd = gtid_to_swd(gtid);
 	if (!swd)
 		return;
 	swd->runnable_at = now;
 
-	enqueue_task(gtid, msg->seqnum);
+	cpu = wakeup->last_ran_cpu;
+	if (cpu < 0)
+		cpu = wakeup->wake_up_cpu;
+	enqueue_task(gtid, msg->seqnum, task_llc(swd, cpu), task_prio(swd));
 }
 
 static void __attribute__((noinline)) handle_preempt(struct bpf_ghost_msg *msg)
@@ -467,12 +667,12 @@ static void __attribute__((noinline)) handle_preempt(struct bpf_ghost_msg *msg)
 	swd = gtid_to_swd(gtid);
 	if (!swd)
 		return;
-	swd->ran_until = now;
+	task_ran(swd, now);
 	swd->runnable_at = now;
 
 	task_stopped(cpu);
 
-	enqueue_task(gtid, msg->seqnum);
+	enqueue_task(gtid, msg->seqnum, task_llc(swd, cpu), task_prio(swd));
 }
 
 static void __attribute__((noinline)) handle_yield(struct bpf_ghost_msg *msg)
@@ -486,12 +686,12 @@ static void __attribute__((noinline)) handle_yield(struct bpf_ghost_msg *msg)
 	swd = gtid_to_swd(gtid);
 	if (!swd)
 		return;
-	swd->ran_until = now;
+	task_ran(swd, now);
 	swd->runnable_at = now;
 
 	task_stopped(cpu);
 
-	enqueue_task(gtid, msg->seqnum);
+	enqueue_task(gtid, msg->seqnum, task_llc(swd, cpu), task_prio(swd));
 }
 
 static void __attribute__((noinline)) handle_switchto(struct bpf_ghost_msg *msg)
@@ -536,13 +736,34 @@ static void __attribute__((noinline)) handle_cpu_tick(struct bpf_ghost_msg *msg)
 	struct ghost_msg_payload_cpu_tick *cpu_tick = &msg->cpu_tick;
 	struct biff_bpf_sw_data *swd;
 	int cpu = cpu_tick->cpu;
+	u64 slice;
+	u32 prio, llc;
 
 	swd = get_current(cpu);
 	if (!swd)
 		return;
+	prio = task_prio(swd);
+	llc = cpu_llc(cpu);
 
-	/* Arbitrary POLICY: kick anyone off cpu after 50ms */
-	if (bpf_ktime_get_us() - swd->ran_at > 50000)
+	/*
+	 * POLICY: a waiting task of a better priority preempts us right away.
+	 * One of the same priority waits for our slice (the task's own, if
+	 * userspace set one) to expire.  The preempted task goes to the back
+	 * of its queue.
+	 *
+	 * Only waiters in our LLC count: bpf-pnt pops from our LLC first, so
+	 * preempting for a task queued elsewhere would just re-pick the
+	 * preempted task.  The other LLC's cpus preempt for their own waiters.
+	 */
+	if (prio > 0 && tasks_waiting(llc, prio - 1)) {
+		resched_cpu(cpu);
+		return;
+	}
+	slice = READ_ONCE(swd->slice_us);
+	if (!slice)
+		slice = slice_us;
+	if (slice && bpf_ktime_get_us() - swd->ran_at >= slice &&
+	    tasks_waiting(llc, prio))
 		resched_cpu(cpu);
 }
 
@@ -19,6 +19,37 @@
 #endif
 
 #define BIFF_MAX_GTIDS 65536
+#define BIFF_MAX_CPUS 1024
+/* The run queue is sharded per LLC.  Larger LLC ids are folded modulo this. */
+#define BIFF_MAX_LLCS 16
+/*
+ * Entries in each LLC's queue of a priority.  Queue maps are preallocated, so
+ * this costs BIFF_NR_PRIOS * BIFF_MAX_GTIDS * 16 bytes (3MB) of kernel memory
+ * across all queues.  A full queue spills into the next LLC's, so a priority
+ * still holds BIFF_MAX_GTIDS tasks when they all sit in one LLC.
+ */
+#define BIFF_RQ_ENTRIES (BIFF_MAX_GTIDS / BIFF_MAX_LLCS)
+
+/*
+ * Priority levels, 0 is the best.  Each level has its own run queues and a
+ * task is only picked when no task of a better level is waiting.
+ */
+#define BIFF_NR_PRIOS 3
+#define BIFF_PRIO_DEFAULT 1
+
+/* A task's home_llc when userspace hasn't placed it. */
+#define BIFF_LLC_NONE 0xffffffff
+
+/*
+ * The number of tasks in one LLC's queues, per priority.  A task is counted
+ * before it is pushed and uncounted after it is popped, so the count may
+ * briefly exceed the queue's length but never drops below it.  Each LLC's
+ * counts have their own cacheline, so that cpus only write to the cachelines
+ * of the LLCs they push to and pop from.
+ */
+struct biff_bpf_llc_queued {
+	uint64_t nr[BIFF_NR_PRIOS];
+} __attribute__((aligned(64)));
 
 /*
  * The array map of these, called `cpu_data`, can be mmapped by userspace.
@@ -58,6 +89,36 @@ struct biff_bpf_sw_data {
 	uint64_t ran_at;
 	uint64_t ran_until;
 	uint64_t runnable_at;
+	/*
+	 * Set by userspace, e.g. BiffScheduler::SetPriority().  bpf resets it
+	 * to BIFF_PRIO_DEFAULT when the task is new.  Takes effect the next
+	 * time the task is queued.
+	 */
+	uint32_t prio;
+	/*
+	 * Set by userspace, e.g. BiffScheduler::UpdatePlacement(): the LLC
+	 * whose run queue the task joins, or BIFF_LLC_NONE to let bpf queue it
+	 * where it last ran.  Cpus in other LLCs still steal it when idle.
+	 */
+	uint32_t home_llc;
+	/*
+	 * Set by userspace, e.g. BiffScheduler::SetSlice(): the task's time
+	 * slice, or 0 for the global slice_us.
+	 */
+	uint64_t slice_us;
+	/* Maintained by bpf: total time on cpu, in usec. */
+	uint64_t runtime;
+} __attribute__((aligned(8)));
+
+/*
+ * The value of the `sw_lookup` hash map, indexed by gtid.  Userspace can use it
+ * to find a task's sw_data.
+ *
+ * aligned(8) since this is a bpf map value.
+ */
+struct task_sw_info {
+	uint32_t id;
+	uint32_t index;
 } __attribute__((aligned(8)));
 
 
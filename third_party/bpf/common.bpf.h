@@ -12,7 +12,9 @@
 #ifndef GHOST_LIB_BPF_COMMON_BPF_H_
 #define GHOST_LIB_BPF_COMMON_BPF_H_
 
+#ifndef GHOST_BPF_SHIM
 #include "libbpf/bpf_core_read.h"
+#endif
 
 // TODO: Remove the NULL macro definition below once the open source
 // ghOSt kernel has it in libbpf/bpf_helpers.h (5.13 and newer, see
@@ -35,6 +37,13 @@ static long (*bpf_ghost_run_gtid)(__s64 gtid, __u32 task_barrier, __s32 run_flag
 static long (*bpf_ghost_resched_cpu)(__u32 cpu, __u64 cpu_seqnum) = (void *) 3002;
 #endif
 
+#ifndef READ_ONCE
+#define READ_ONCE(x) (*(volatile typeof(x) *)&(x))
+#endif
+#ifndef WRITE_ONCE
+#define WRITE_ONCE(x, val) ((*(volatile typeof(x) *)&(x)) = val)
+#endif
+
 #define MAX_PIDS 102400
 #define SCHED_GHOST 18
 #define TASK_RUNNING 0
@@ -58,6 +67,8 @@ static inline u64 bpf_ktime_get_us() {
   return bpf_ktime_get_ns() / 1000;
 }
 
+/* The userspace shim has no task_struct: see bpf/shim/bpf_shim.h. */
+#ifndef GHOST_BPF_SHIM
 static inline bool task_has_ghost_policy(struct task_struct *p)
 {
   return BPF_CORE_READ(p, policy) == SCHED_GHOST;
@@ -76,5 +87,6 @@ static inline bool is_agent(struct task_struct *p)
 static inline bool is_traced_ghost(struct task_struct *p) {
   return task_has_ghost_policy(p) && !is_agent(p);
 }
+#endif  // !GHOST_BPF_SHIM
 
 #endif  // GHOST_LIB_BPF_COMMON_BPF_H_
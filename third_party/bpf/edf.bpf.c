@@ -9,16 +9,28 @@
 // MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
 // GNU General Public License for more details.
 
+#ifdef GHOST_BPF_SHIM
+// Compiled as userspace C for tests, see bpf/shim/bpf_shim.h.
+#include "bpf/shim/bpf_shim.h"
+#else
 // vmlinux.h must be included before bpf_helpers.h
 // clang-format off
 #include "kernel/vmlinux_ghost_5_11.h"
 #include "libbpf/bpf_helpers.h"
 #include "libbpf/bpf_tracing.h"
 // clang-format on
+#include <asm-generic/errno.h>
+#endif
 
 #include "third_party/bpf/common.bpf.h"
 #include "third_party/bpf/edf.h"
 
+/*
+ * Part of the ghost UAPI.  vmlinux.h doesn't include #defines, so we need to
+ * add it manually.
+ */
+#define SEND_TASK_LATCHED (1 << 10)
+
 bool skip_tick = false;
 
 /* max_entries is patched at runtime to num_possible_cpus */
@@ -33,6 +45,47 @@ struct {
 SEC("ghost_sched/pnt")
 int edf_pnt(struct bpf_ghost_sched *ctx)
 {
+	struct edf_bpf_per_cpu_data *data;
+	u32 cpu = bpf_get_smp_processor_id();
+	s64 state;
+	int ret;
+
+	/* The agent, or a txn it committed to this cpu, comes first. */
+	if (ctx->agent_runnable || ctx->might_yield || ctx->next_gtid)
+		return 0;
+
+	data = bpf_map_lookup_elem(&cpu_data, &cpu);
+	if (!data)
+		return 0;
+	if (READ_ONCE(data->next_up_state) != GHOST_TXN_READY)
+		return 0;
+	/* Claim the candidate, unless the agent is revoking it. */
+	if (!__sync_bool_compare_and_swap(&data->next_up_state,
+					  GHOST_TXN_READY, cpu))
+		return 0;
+
+	ret = bpf_ghost_run_gtid(data->next_up_gtid, data->next_up_barrier,
+				 SEND_TASK_LATCHED);
+	/* The intermediate s32 casts are explained in pntring_funcs.bpf.h. */
+	switch (-ret) {
+	case 0:
+		state = (s32)GHOST_TXN_COMPLETE;
+		break;
+	case ESTALE:
+		state = (s32)GHOST_TXN_TARGET_STALE;
+		break;
+	case EBUSY:
+		state = (s32)GHOST_TXN_TARGET_NOT_RUNNABLE;
+		break;
+	case ENOENT:
+		state = (s32)GHOST_TXN_TARGET_NOT_FOUND;
+		break;
+	default:
+		state = (s32)GHOST_TXN_NOT_PERMITTED;
+		break;
+	}
+	WRITE_ONCE(data->next_up_state, state);
+
 	return 0;
 }
 
@@ -14,11 +14,71 @@
 #define GHOST_LIB_BPF_BPF_EDF_H_
 
 #ifndef __BPF__
+#include <stdbool.h>
 #include <stdint.h>
+
+#include "kernel/ghost_uapi.h"
 #endif
 
+/*
+ * Each cpu has a "next-up" slot: the task the agent wants the cpu to run when
+ * it goes idle, so that bpf-pnt can latch it without waiting for the agent.
+ *
+ * next_up_state follows the txn protocol of a PNT ring slot (pntring.bpf.h),
+ * with a single producer (the agent) and a single consumer (bpf-pnt on the
+ * slot's cpu):
+ *
+ *   EDF_NEXT_UP_EMPTY -> GHOST_TXN_READY         agent publishes a candidate
+ *   GHOST_TXN_READY -> cpu id                    bpf-pnt claims it (CAS)
+ *   cpu id -> GHOST_TXN_COMPLETE or an error     bpf-pnt latched it, or not
+ *   GHOST_TXN_READY -> EDF_NEXT_UP_EMPTY         agent revokes it (CAS)
+ *   COMPLETE or error -> EDF_NEXT_UP_EMPTY       agent reaps the result
+ *
+ * The barrier is the task's, so bpf-pnt's latch fails with ESTALE if the task
+ * changed state since the agent published it.
+ */
+#define EDF_NEXT_UP_EMPTY (GHOST_TXN_READY - 1)
+
 struct edf_bpf_per_cpu_data {
-	uint8_t example_bool;
+	int64_t next_up_state;
+	uint64_t next_up_gtid;
+	uint32_t next_up_barrier;
 } __attribute__((aligned(64)));
 
+#ifndef __BPF__
+
+/* Publishes `gtid` as the cpu's next-up task.  The slot must be empty. */
+static inline void edf_next_up_publish(struct edf_bpf_per_cpu_data *data,
+				       uint64_t gtid, uint32_t barrier)
+{
+	data->next_up_gtid = gtid;
+	data->next_up_barrier = barrier;
+	__atomic_store_n(&data->next_up_state, GHOST_TXN_READY,
+			 __ATOMIC_RELEASE);
+}
+
+/*
+ * Empties the cpu's next-up slot.  Returns true if the agent has the task
+ * back: bpf-pnt either never claimed it or failed to latch it.  Returns false
+ * if bpf-pnt latched it, in which case a MSG_TASK_LATCHED follows.
+ */
+static inline bool edf_next_up_revoke(struct edf_bpf_per_cpu_data *data)
+{
+	int64_t state = GHOST_TXN_READY;
+
+	if (!__atomic_compare_exchange_n(&data->next_up_state, &state,
+					 EDF_NEXT_UP_EMPTY, false,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		/* A claim (cpu id >= 0) is resolved within one bpf-pnt. */
+		while (state >= 0 && state != EDF_NEXT_UP_EMPTY)
+			state = __atomic_load_n(&data->next_up_state,
+						__ATOMIC_ACQUIRE);
+		__atomic_store_n(&data->next_up_state, EDF_NEXT_UP_EMPTY,
+				 __ATOMIC_RELEASE);
+	}
+	return state != GHOST_TXN_COMPLETE;
+}
+
+#endif  /* !__BPF__ */
+
 #endif  // GHOST_LIB_BPF_BPF_EDF_H_
@@ -17,8 +17,10 @@
 
 #ifndef __BPF__
 #include <stdint.h>
+#ifdef __cplusplus
 #include <atomic>
 #endif
+#endif
 
 /*
  * PNT rings are multi-producer, multi-consumer, power-of-two ring buffers.
@@ -165,6 +167,20 @@
 /*
  * In PNT, each cpu will pull tasks from a ring buffer and attempt to latch them
  * on its cpu.
+ *
+ * Which cpus pull from which ring is up to the scheduler:
+ * - Shared: every cpu pulls from the same ring with pnt_latch_task_from_ring().
+ *   Any idle cpu can take any task, but all of them contend on cons_idx.
+ * - Per-LLC: ring i is pulled by the cpus of LLC i, also with
+ *   pnt_latch_task_from_ring().  Contention is limited to an LLC.
+ * - Per-cpu: ring i is only pulled by cpu i, with
+ *   pnt_latch_task_from_cpu_ring(), which claims slots without a CAS.  The
+ *   agent picks the cpu when it produces, so it should only produce into the
+ *   rings of cpus that will run PNT soon, e.g. idle ones.  A task in a busy
+ *   cpu's ring waits (or gets unscheduled).
+ *
+ * The agent is the main producer and can claim several slots of a ring at once
+ * with pnt_schedule_batch_onto_ring().
  */
 
 #define __PNT_RING_SLOT_ORDER 6
@@ -192,23 +208,24 @@ struct pnt_ring {
 	struct pnt_ring_slot slots[NR_PNT_RING_SLOTS];
 };
 
-inline uint64_t pnt_ring_nr_used(uint64_t prod_idx, uint64_t cons_idx)
+static inline uint64_t pnt_ring_nr_used(uint64_t prod_idx, uint64_t cons_idx)
 {
 	return prod_idx - cons_idx;
 }
 
-inline uint64_t pnt_ring_nr_empty(uint64_t prod_idx, uint64_t cons_idx)
+static inline uint64_t pnt_ring_nr_empty(uint64_t prod_idx,
+					 uint64_t cons_idx)
 {
 	return NR_PNT_RING_SLOTS - pnt_ring_nr_used(prod_idx, cons_idx);
 }
 
-inline bool pnt_ring_full(uint64_t prod_idx, uint64_t cons_idx)
+static inline bool pnt_ring_full(uint64_t prod_idx, uint64_t cons_idx)
 {
 	return pnt_ring_nr_empty(prod_idx, cons_idx) == 0;
 }
 
-inline struct pnt_ring_slot *pnt_ring_get_slot(struct pnt_ring *ring,
-                                               uint64_t idx)
+static inline struct pnt_ring_slot *pnt_ring_get_slot(struct pnt_ring *ring,
+						      uint64_t idx)
 {
 	return &ring->slots[idx & (NR_PNT_RING_SLOTS - 1)];
 }
@@ -220,25 +237,25 @@ inline struct pnt_ring_slot *pnt_ring_get_slot(struct pnt_ring *ring,
  * | entry used |              ring id               |      ring index       |
  * +------------+------------------------------------+-----------------------+
  */
-inline uint64_t pnt_ring_to_agent_data(uint32_t ring_id,
-                                       uint32_t ring_index)
+static inline uint64_t pnt_ring_to_agent_data(uint32_t ring_id,
+					      uint32_t ring_index)
 {
 	return (1ULL << 63) | (ring_id << __PNT_RING_SLOT_ORDER) |
 		(ring_index & (NR_PNT_RING_SLOTS - 1));
 }
 
-inline uint64_t pnt_agent_data_to_ring_id(uint64_t agent_data)
+static inline uint64_t pnt_agent_data_to_ring_id(uint64_t agent_data)
 {
 	return (agent_data & ~(1ULL << 63)) >> __PNT_RING_SLOT_ORDER;
 }
 
-inline uint64_t pnt_agent_data_to_ring_index(uint64_t agent_data)
+static inline uint64_t pnt_agent_data_to_ring_index(uint64_t agent_data)
 {
 	return agent_data & (NR_PNT_RING_SLOTS - 1);
 }
 
-inline struct pnt_ring_slot *pnt_agent_data_to_ring_slot(struct pnt_ring *rings,
-                                                         uint64_t agent_data)
+static inline struct pnt_ring_slot *
+pnt_agent_data_to_ring_slot(struct pnt_ring *rings, uint64_t agent_data)
 {
 	uint64_t ring_id = pnt_agent_data_to_ring_id(agent_data);
 	uint64_t ring_index = pnt_agent_data_to_ring_index(agent_data);
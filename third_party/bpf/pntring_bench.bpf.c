@@ -0,0 +1,51 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * The bpf side of PNT rings, for benchmarking the ring protocol in userspace
+ * on top of the bpf shim.  Only built with GHOST_BPF_SHIM.  See
+ * experiments/microbenchmarks/pntring_test.cc.
+ */
+
+#include "bpf/shim/bpf_shim.h"
+#include "third_party/bpf/pntring.bpf.h"
+
+/* One ring per consumer in per-cpu mode. */
+#define PNTRING_BENCH_MAX_RINGS 64
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, PNTRING_BENCH_MAX_RINGS);
+	__type(key, u32);
+	__type(value, struct pnt_ring);
+	__uint(map_flags, BPF_F_MMAPABLE);
+} pnt_rings SEC(".maps");
+
+u64 latch_error;
+
+#include "third_party/bpf/pntring_funcs.bpf.h"
+
+/* What userspace would mmap. */
+struct pnt_ring *pntring_bench_ring(int which_ring)
+{
+	return bpf_map_lookup_elem(&pnt_rings, &which_ring);
+}
+
+/* What bpf-pnt on `cpu` would call, in shared and per-cpu mode. */
+bool pntring_bench_latch(int which_ring, int cpu)
+{
+	return pnt_latch_task_from_ring(which_ring, cpu);
+}
+
+bool pntring_bench_latch_cpu(int cpu)
+{
+	return pnt_latch_task_from_cpu_ring(cpu);
+}
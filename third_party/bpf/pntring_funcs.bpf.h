@@ -29,10 +29,15 @@
  * For userspace, include this like a standard header.
  */
 
-#define READ_ONCE(x) (*(volatile typeof(x) *)&(x))
-#define WRITE_ONCE(x, val) ((*(volatile typeof(x) *)&(x)) = val)
+#ifndef READ_ONCE
+#define READ_ONCE(x) (*(volatile __typeof__(x) *)&(x))
+#endif
+#ifndef WRITE_ONCE
+#define WRITE_ONCE(x, val) ((*(volatile __typeof__(x) *)&(x)) = val)
+#endif
 
-#ifdef __BPF__
+/* The bpf shim runs the bpf side of the rings in userspace. */
+#if defined(__BPF__) || defined(GHOST_BPF_SHIM)
 
 /*
  * Part of the ghost UAPI.  vmlinux.h doesn't include #defines, so we need to
@@ -46,8 +51,12 @@
  * Attempts to latch a task from ring.  Returns true on success.  We pass cpu so
  * that we do not need to call bpf_get_smp_processor_id() for every ring
  * attempt.
+ *
+ * If single_consumer, we are the only cpu that consumes from this ring, and can
+ * claim slots without a CAS.
  */
-static inline bool pnt_latch_task_from_ring(int which_ring, int cpu)
+static inline bool __pnt_latch_task_from_ring(int which_ring, int cpu,
+					      bool single_consumer)
 {
 	struct pnt_ring *ring;
 	u64 cons_idx, prod_idx;
@@ -78,8 +87,16 @@ static inline bool pnt_latch_task_from_ring(int which_ring, int cpu)
 		if (!(state == GHOST_TXN_READY || state == GHOST_TXN_ABORTED))
 			break;
 
-		if (!__sync_bool_compare_and_swap(&ring->cons_idx, cons_idx,
-						  cons_idx + 1)) {
+		if (single_consumer) {
+			/*
+			 * Producers only read cons_idx, and they check
+			 * txn_state before reusing the slot, so a plain store
+			 * is enough.
+			 */
+			WRITE_ONCE(ring->cons_idx, cons_idx + 1);
+		} else if (!__sync_bool_compare_and_swap(&ring->cons_idx,
+							 cons_idx,
+							 cons_idx + 1)) {
 			/* Another consumer grabbed this slot */
 			continue;
 		}
@@ -158,6 +175,18 @@ static inline bool pnt_latch_task_from_ring(int which_ring, int cpu)
 	return false;
 }
 
+/* Latches a task from a ring shared by several cpus, e.g. per-LLC or global. */
+static inline bool pnt_latch_task_from_ring(int which_ring, int cpu)
+{
+	return __pnt_latch_task_from_ring(which_ring, cpu, false);
+}
+
+/* Latches a task from cpu's own ring, which is ring number cpu. */
+static inline bool pnt_latch_task_from_cpu_ring(int cpu)
+{
+	return __pnt_latch_task_from_ring(cpu, cpu, true);
+}
+
 static inline u64 pnt_push_task_to_ring(int which_ring, u64 gtid,
                                         u32 task_barrier, int cpu)
 {
@@ -207,34 +236,56 @@ static inline u64 pnt_push_task_to_ring(int which_ring, u64 gtid,
 	return 0;
 }
 
-#else  // ! __BPF__ (userspace functions)
+#else  // ! __BPF__ && ! GHOST_BPF_SHIM (userspace functions)
 
 #include "kernel/ghost_uapi.h"
 
 /*
- * Schedules gtid onto the ring, returns the slot pointer or NULL on failure.
- * If successful, the 'ball' is in BPF's court (or the kernel's), until the task
- * is Unscheduled or Reaped.
+ * Claims up to nr free slots of ring, starting at *first_idx, with a single CAS
+ * on prod_idx.  Returns how many were claimed, 0 if the ring is full.  The
+ * caller must fill in and publish every claimed slot, with
+ * pnt_ring_publish_slot(), since consumers stop at the first slot that isn't
+ * ready.
  */
-static inline struct pnt_ring_slot *pnt_schedule_onto_ring(
-		struct pnt_ring *ring, uint64_t gtid, uint64_t task_barrier,
-		void *task_ptr)
+static inline int pnt_ring_claim_slots(struct pnt_ring *ring, int nr,
+				       uint64_t *first_idx)
 {
 	uint64_t prod_idx;
 	uint64_t cons_idx;
-	struct pnt_ring_slot *slot;
-	
+	uint64_t avail;
+	int n;
+
 	do {
 		prod_idx = READ_ONCE(ring->prod_idx);
 		cons_idx = READ_ONCE(ring->cons_idx);
-		if (pnt_ring_full(prod_idx, cons_idx))
-			return NULL;
-		slot = pnt_ring_get_slot(ring, prod_idx);
-		if (READ_ONCE(slot->txn_state) != GHOST_TXN_REAPED)
-			return NULL;
+		avail = pnt_ring_nr_empty(prod_idx, cons_idx);
+		/*
+		 * An empty slot may still hold a txn the agent hasn't reaped.
+		 * Only claim up to the first of those.
+		 */
+		for (n = 0; n < nr && n < avail; n++) {
+			struct pnt_ring_slot *slot =
+				pnt_ring_get_slot(ring, prod_idx + n);
+
+			if (READ_ONCE(slot->txn_state) != GHOST_TXN_REAPED)
+				break;
+		}
+		if (!n)
+			return 0;
 	} while (
-		!__sync_bool_compare_and_swap(&ring->prod_idx, prod_idx, prod_idx + 1));
-	
+		!__sync_bool_compare_and_swap(&ring->prod_idx, prod_idx, prod_idx + n));
+
+	*first_idx = prod_idx;
+	return n;
+}
+
+/* Fills in and publishes a slot claimed with pnt_ring_claim_slots(). */
+static inline struct pnt_ring_slot *pnt_ring_publish_slot(
+		struct pnt_ring *ring, uint64_t idx, uint64_t gtid,
+		uint64_t task_barrier, void *task_ptr)
+{
+	struct pnt_ring_slot *slot = pnt_ring_get_slot(ring, idx);
+
 	slot->gtid = gtid;
 	slot->task_barrier = task_barrier;
 	slot->task_ptr = task_ptr;
@@ -243,6 +294,44 @@ static inline struct pnt_ring_slot *pnt_schedule_onto_ring(
 	return slot;
 }
 
+/*
+ * Schedules up to nr tasks onto the ring, in order, claiming their slots all at
+ * once.  Returns how many were scheduled and their slot pointers in slots.  Like
+ * with pnt_schedule_onto_ring(), those tasks are in BPF's court.
+ */
+static inline int pnt_schedule_batch_onto_ring(
+		struct pnt_ring *ring, int nr, const uint64_t *gtids,
+		const uint64_t *task_barriers, void *const *task_ptrs,
+		struct pnt_ring_slot **slots)
+{
+	uint64_t idx;
+	int n = pnt_ring_claim_slots(ring, nr, &idx);
+
+	for (int i = 0; i < n; i++) {
+		slots[i] = pnt_ring_publish_slot(ring, idx + i, gtids[i],
+						 task_barriers[i],
+						 task_ptrs ? task_ptrs[i] : NULL);
+	}
+	return n;
+}
+
+/*
+ * Schedules gtid onto the ring, returns the slot pointer or NULL on failure.
+ * If successful, the 'ball' is in BPF's court (or the kernel's), until the task
+ * is Unscheduled or Reaped.
+ */
+static inline struct pnt_ring_slot *pnt_schedule_onto_ring(
+		struct pnt_ring *ring, uint64_t gtid, uint64_t task_barrier,
+		void *task_ptr)
+{
+	struct pnt_ring_slot *slot;
+
+	if (!pnt_schedule_batch_onto_ring(ring, 1, &gtid, &task_barrier,
+					  &task_ptr, &slot))
+		return NULL;
+	return slot;
+}
+
 /* Reap a slot for a latched task, e.g. from a MSG_TASK_LATCHED handler. */
 static inline void pnt_ring_reap_slot(struct pnt_ring_slot *slot)
 {
@@ -360,7 +449,7 @@ static inline int pnt_ring_reap_errors(struct pnt_ring_slot *slot)
 	return 1;
 }
 
-#endif  // !__BPF__
+#endif  // !__BPF__ && !GHOST_BPF_SHIM
 
 // clang-format on
 // NOLINTEND
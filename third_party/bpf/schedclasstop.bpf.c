@@ -18,18 +18,21 @@
 // clang-format on
 
 #include "third_party/bpf/common.bpf.h"
+#include "third_party/bpf/schedclasstop.h"
 
-#define SCHED_GHOST 18
-#define SCHED_AGENT 19  /* Not a real sched class */
-#define MAX_SCHED_CLASS (SCHED_AGENT + 1)
+#define TASK_RUNNING 0
+#define SCHED_IDLE_TASK 4	/* See task_sched_policy() */
 
-/* Using this map as a per-cpu u64 */
+/* Set by userspace before loading. */
+const volatile bool track_rq_time = false;
+
+/* Using this map as a per-cpu struct cpu_curr */
 struct {
 	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
 	__uint(max_entries, 1);
 	__type(key, u32);
-	__type(value, u64);
-} start_times SEC(".maps");
+	__type(value, struct cpu_curr);
+} cpu_currs SEC(".maps");
 
 struct {
 	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
@@ -38,6 +41,31 @@ struct {
 	__type(value, u64);
 } class_times SEC(".maps");
 
+/* Time that tasks of each class waited runnable for the cpu they ran on. */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, MAX_SCHED_CLASS);
+	__type(key, u32);
+	__type(value, u64);
+} rq_times SEC(".maps");
+
+/*
+ * When a runnable task became runnable, and the class it waits in, which it
+ * may leave before it runs.
+ */
+struct runnable {
+	u64 at;			/* bpf_ktime_get_ns() */
+	u32 policy;
+};
+
+/* The runnable tasks, by pid, if track_rq_time. */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_PIDS);
+	__type(key, u32);
+	__type(value, struct runnable);
+} runnable_at SEC(".maps");
+
 static int task_sched_policy(struct task_struct *p)
 {
 	#define PF_IDLE 0x2	/* linux/sched.h */
@@ -49,7 +77,7 @@ static int task_sched_policy(struct task_struct *p)
 	 * likely value to be used.
 	 */
 	if (flags & PF_IDLE)
-		return 4;
+		return SCHED_IDLE_TASK;
 	if (task_has_ghost_policy(p)) {
 		if (is_agent(p))
 			return SCHED_AGENT;
@@ -60,30 +88,96 @@ static int task_sched_policy(struct task_struct *p)
 	return BPF_CORE_READ(p, policy);
 }
 
+static void task_runnable(struct task_struct *p, u32 policy, u64 now)
+{
+	struct runnable r = {0};
+	u32 pid;
+
+	if (!track_rq_time || policy == SCHED_IDLE_TASK)
+		return;
+	pid = BPF_CORE_READ(p, pid);
+	r.at = now;
+	r.policy = policy;
+	bpf_map_update_elem(&runnable_at, &pid, &r, BPF_ANY);
+}
+
+/* Charges the wait to the class the task waited in, not the one it runs in. */
+static void task_ran(struct task_struct *p, u64 now)
+{
+	struct runnable *r;
+	u64 *rq_time;
+	u32 pid;
+
+	if (!track_rq_time)
+		return;
+	pid = BPF_CORE_READ(p, pid);
+	r = bpf_map_lookup_elem(&runnable_at, &pid);
+	if (!r)
+		return;
+	rq_time = bpf_map_lookup_elem(&rq_times, &r->policy);
+	if (rq_time && now > r->at)
+		*rq_time += now - r->at;
+	bpf_map_delete_elem(&runnable_at, &pid);
+}
+
+SEC("tp_btf/sched_wakeup")
+int BPF_PROG(sched_wakeup, struct task_struct *p)
+{
+	task_runnable(p, task_sched_policy(p), bpf_ktime_get_ns());
+	return 0;
+}
+
+SEC("tp_btf/sched_wakeup_new")
+int BPF_PROG(sched_wakeup_new, struct task_struct *p)
+{
+	task_runnable(p, task_sched_policy(p), bpf_ktime_get_ns());
+	return 0;
+}
+
 SEC("tp_btf/sched_switch")
 int BPF_PROG(sched_switch, bool preempt, struct task_struct *prev,
 	     struct task_struct *next)
 {
-	u64 *start_time, *class_time;
-	u32 prev_policy;
+	struct cpu_curr *curr;
+	u64 *class_time;
+	u32 prev_policy, next_policy;
 	u32 zero = 0;
 	u64 now;
 
 	prev_policy = task_sched_policy(prev);
+	next_policy = task_sched_policy(next);
 
-	start_time = bpf_map_lookup_elem(&start_times, &zero);
+	curr = bpf_map_lookup_elem(&cpu_currs, &zero);
 	/* This lookup always succeeds, but the verifier needs proof. */
-	if (!start_time)
+	if (!curr)
 		return 0;
 
 	now = bpf_ktime_get_ns();
-	if (*start_time) {
+	if (curr->start) {
 		class_time = bpf_map_lookup_elem(&class_times, &prev_policy);
 		if (class_time)
-			*class_time += now - *start_time;
+			*class_time += now - curr->start;
 	}
-	*start_time = now;
+	curr->start = now;
+	curr->policy = next_policy;
+
+	if (preempt || BPF_CORE_READ(prev, state) == TASK_RUNNING)
+		task_runnable(prev, prev_policy, now);
+	task_ran(next, now);
+
+	return 0;
+}
+
+/* A task that exits while runnable would otherwise keep its entry forever. */
+SEC("tp_btf/sched_process_exit")
+int BPF_PROG(sched_process_exit, struct task_struct *p)
+{
+	u32 pid;
 
+	if (!track_rq_time)
+		return 0;
+	pid = BPF_CORE_READ(p, pid);
+	bpf_map_delete_elem(&runnable_at, &pid);
 	return 0;
 }
 
@@ -0,0 +1,37 @@
+/* Copyright 2021 Google LLC
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef GHOST_LIB_BPF_BPF_SCHEDCLASSTOP_H_
+#define GHOST_LIB_BPF_BPF_SCHEDCLASSTOP_H_
+
+#ifndef __BPF__
+#include <stdint.h>
+#endif
+
+#define MAX_PIDS 102400
+
+#ifndef SCHED_GHOST
+#define SCHED_GHOST 18
+#endif
+#define SCHED_AGENT 19  /* Not a real sched class */
+#define MAX_SCHED_CLASS (SCHED_AGENT + 1)
+
+/*
+ * What a cpu has run since its last context switch, so that userspace can
+ * account for the time that class_times doesn't have yet.
+ */
+struct cpu_curr {
+	uint64_t start;		/* bpf_ktime_get_ns() */
+	uint32_t policy;
+} __attribute__((aligned(8)));
+
+#endif  // GHOST_LIB_BPF_BPF_SCHEDCLASSTOP_H_
@@ -29,6 +29,10 @@
 #define SCHED_GHOST 18
 #define TASK_RUNNING 0
 
+/* Set by userspace before loading. */
+const volatile bool by_cgroup = false;
+const volatile bool by_tgid = false;
+
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
 	__uint(max_entries, MAX_PIDS);
@@ -43,6 +47,29 @@ struct {
 	__type(value, struct hist);
 } hists SEC(".maps");
 
+/*
+ * Per-cgroup and per-process histograms.  Userspace sizes these to MAX_CGROUPS
+ * and MAX_TGIDS when enabled and inserts LAT_KEY_OTHER, which takes the
+ * samples of everyone that doesn't fit.  Unlike `hists`, these are shared by
+ * all cpus, so their counters are updated atomically.
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 1);
+	__type(key, u64);
+	__type(value, struct lat_hists);
+} cgroup_hists SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 1);
+	__type(key, u64);
+	__type(value, struct lat_hists);
+} tgid_hists SEC(".maps");
+
+/* Initial value of new cgroup_hists and tgid_hists elements. */
+static const struct lat_hists zero_lat_hists;
+
 static void task_runnable(struct task_struct *p)
 {
 	struct task_stat stat[1] = {0};
@@ -68,23 +95,64 @@ static void task_latched(struct task_struct *p)
 	stat->latched_at = bpf_ktime_get_us();
 }
 
-static void increment_hist(u32 hist_id, u64 value)
+/* See struct hist. */
+static u64 hist_slot(u64 value)
+{
+	u64 log, slot;
+
+	if (value < NR_SUB_SLOTS)
+		return value;
+	log = log2l(value);
+	if (log >= MAX_LAT_LOG2)
+		return NR_HIST_SLOTS - 1;
+	slot = (log - SUB_SLOT_BITS + 1) * NR_SUB_SLOTS +
+		(value >> (log - SUB_SLOT_BITS)) - NR_SUB_SLOTS;
+	/* Can't happen, but the verifier doesn't know that. */
+	if (slot >= NR_HIST_SLOTS)
+		slot = NR_HIST_SLOTS - 1;
+	return slot;
+}
+
+/* Returns `key`'s histograms in `map`, or LAT_KEY_OTHER's if `map` is full. */
+static __always_inline struct lat_hists *lookup_lat_hists(void *map, u64 key)
+{
+	struct lat_hists *lh;
+
+	lh = bpf_map_lookup_elem(map, &key);
+	if (lh)
+		return lh;
+	/* Another cpu may have inserted it first; either way it exists. */
+	bpf_map_update_elem(map, &key, &zero_lat_hists, BPF_NOEXIST);
+	lh = bpf_map_lookup_elem(map, &key);
+	if (lh)
+		return lh;
+	key = LAT_KEY_OTHER;
+	return bpf_map_lookup_elem(map, &key);
+}
+
+static void increment_hist(u32 hist_id, u64 value, struct lat_hists *cgroup,
+			   struct lat_hists *tgid)
 {
 	u64 slot; /* Gotta love BPF.  slot needs to be a u64, not a u32. */
 	struct hist *hist;
 
-	hist = bpf_map_lookup_elem(&hists, &hist_id);
-	if (!hist)
+	if (hist_id >= NR_HISTS)
 		return;
-	slot = log2l(value);
-	if (slot >= MAX_NR_HIST_SLOTS)
-		slot = MAX_NR_HIST_SLOTS - 1;
-	hist->slots[slot]++;
+	slot = hist_slot(value);
+
+	hist = bpf_map_lookup_elem(&hists, &hist_id);
+	if (hist)
+		hist->slots[slot]++;
+	if (cgroup)
+		__sync_fetch_and_add(&cgroup->hists[hist_id].slots[slot], 1);
+	if (tgid)
+		__sync_fetch_and_add(&tgid->hists[hist_id].slots[slot], 1);
 }
 
 static void task_ran(struct task_struct *p)
 {
 	struct task_stat *stat;
+	struct lat_hists *cgroup = NULL, *tgid = NULL;
 	pid_t pid = BPF_CORE_READ(p, pid);
 
 	stat = bpf_map_lookup_elem(&task_stats, &pid);
@@ -92,17 +160,27 @@ static void task_ran(struct task_struct *p)
 		return;
 	stat->ran_at = bpf_ktime_get_us();
 
+	if (by_cgroup) {
+		cgroup = lookup_lat_hists(&cgroup_hists,
+					  BPF_CORE_READ(p, cgroups, dfl_cgrp,
+							kn, id));
+	}
+	if (by_tgid)
+		tgid = lookup_lat_hists(&tgid_hists, BPF_CORE_READ(p, tgid));
+
 	/*
 	 * Not all tasks are latched/committed.  The agent can yield and
 	 * context_switch to a task, bypassing pick_next_task.
 	 */
 	if (stat->latched_at) {
 		increment_hist(RUNNABLE_TO_LATCHED,
-			       stat->latched_at - stat->runnable_at);
+			       stat->latched_at - stat->runnable_at, cgroup,
+			       tgid);
 		increment_hist(LATCHED_TO_RUN,
-			       stat->ran_at - stat->latched_at);
+			       stat->ran_at - stat->latched_at, cgroup, tgid);
 	}
-	increment_hist(RUNNABLE_TO_RUN, stat->ran_at - stat->runnable_at);
+	increment_hist(RUNNABLE_TO_RUN, stat->ran_at - stat->runnable_at,
+		       cgroup, tgid);
 
 	bpf_map_delete_elem(&task_stats, &pid);
 }
@@ -18,7 +18,14 @@
 #endif
 
 #define MAX_PIDS 102400
-#define MAX_NR_HIST_SLOTS 25
+/* Bounds on the number of cgroups and processes with their own histograms. */
+#define MAX_CGROUPS 1024
+#define MAX_TGIDS 4096
+/*
+ * Key of the histograms that cgroups and processes share once their map is
+ * full.  No cgroup has id 0 and no process has tgid 0.
+ */
+#define LAT_KEY_OTHER 0
 
 struct task_stat {
 	uint64_t runnable_at;
@@ -27,16 +34,26 @@ struct task_stat {
 };
 
 /*
- * Power of 2 histogram, <=1 us, 2us, 4us, etc.  This struct must be at least
- * 8-byte aligned, since it is a value for a BPF map.  The kernel will round up
- * the size of any map value to 8 bytes internally.  If we have an array of
- * these objects, the kernel will think each object is 8-byte aligned each.
- * When we read the per-cpu map in schedlat.c, we get an array of struct hist.
- * The compiler needs to agree with the kernel on the size of the objects, or
- * you'll corrupt your stats.
+ * HDR-style histogram of latencies in usec.  Each power of 2 is split into
+ * NR_SUB_SLOTS linear sub-slots, so a slot's width is at most 1/NR_SUB_SLOTS of
+ * its values (6.25%).  Values below NR_SUB_SLOTS have a slot each.  Values of
+ * 2^MAX_LAT_LOG2 usec (~33 sec) and above land in the last slot.
+ */
+#define SUB_SLOT_BITS 4
+#define NR_SUB_SLOTS (1 << SUB_SLOT_BITS)
+#define MAX_LAT_LOG2 25
+#define NR_HIST_SLOTS ((MAX_LAT_LOG2 - SUB_SLOT_BITS + 1) * NR_SUB_SLOTS)
+
+/*
+ * This struct must be at least 8-byte aligned, since it is a value for a BPF
+ * map.  The kernel will round up the size of any map value to 8 bytes
+ * internally.  If we have an array of these objects, the kernel will think
+ * each object is 8-byte aligned each.  When we read the per-cpu map in
+ * schedlat.c, we get an array of struct hist.  The compiler needs to agree
+ * with the kernel on the size of the objects, or you'll corrupt your stats.
  */
 struct hist {
-	uint32_t slots[MAX_NR_HIST_SLOTS];
+	uint32_t slots[NR_HIST_SLOTS];
 } __attribute__((aligned(8)));
 
 enum {
@@ -46,4 +63,26 @@ enum {
 	NR_HISTS,
 };
 
+/* The histograms of one cgroup or process. */
+struct lat_hists {
+	struct hist hists[NR_HISTS];
+};
+
+/* The smallest value in slot `slot`. */
+static inline uint64_t hist_slot_lower(uint32_t slot)
+{
+	uint32_t pow = slot / NR_SUB_SLOTS;
+	uint32_t sub = slot % NR_SUB_SLOTS;
+
+	if (!pow)
+		return sub;
+	return (uint64_t)(NR_SUB_SLOTS + sub) << (pow - 1);
+}
+
+/* One past the largest value in slot `slot`. */
+static inline uint64_t hist_slot_upper(uint32_t slot)
+{
+	return hist_slot_lower(slot + 1);
+}
+
 #endif  // GHOST_LIB_BPF_BPF_SCHEDLAT_H_